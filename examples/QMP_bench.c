@@ -0,0 +1,469 @@
+/*
+ * Point to point benchmark over every message type.
+ *
+ * Each rank exchanges messages with its first k logical neighbors
+ * (+x, -x, +y, -y, ... skipping axes of length one) using contiguous,
+ * strided, strided array, indexed or combined (QMP_declare_multiple)
+ * messages, sweeping the message size and the neighbor count.  The
+ * time of every exchange is recorded; the percentiles reported are the
+ * largest over the ranks.  Results can be written as JSON and CSV, and
+ * compared with a CSV from an earlier run to flag regressions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+#include "QMP_bench_util.h"
+
+enum { T_CONTIG, T_STRIDED, T_STRIDED_ARRAY, T_INDEXED, T_MULTIPLE, NTYPES };
+static const char *type_name[NTYPES] =
+  { "contig", "strided", "strided-array", "indexed", "multiple" };
+
+#define MAXDIM 8
+#define WARMUP 10
+#define MAXRESULTS 4096
+
+struct bench_args {
+  int types;		/* bit mask of the types to run */
+  size_t minsize, maxsize;
+  int fac;
+  size_t block;		/* block size of the non-contiguous types */
+  int maxnbr;
+  int loops;
+  int ndim;
+  int verify;
+  double tolerance;	/* percent */
+  const char *json, *csv, *baseline;
+};
+
+struct result {
+  int type, nbr;
+  size_t bytes;
+  int iters;
+  double min, p50, p90, p99, max, avg;	/* microseconds */
+  double gbps;				/* sent GB/s per rank */
+};
+
+static struct result results[MAXRESULTS];
+/* axis of the neighbor d, in direction +1 for even d, -1 for odd d */
+static int nbr_axis[2*MAXDIM];
+static int nresults = 0;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -types list       comma separated from contig,strided,strided-array,\n");
+  printf("                    indexed,multiple (all)\n");
+  printf("  -min bytes        smallest message (8)\n");
+  printf("  -max bytes        largest message (4194304)\n");
+  printf("  -fac n            message size factor (2)\n");
+  printf("  -block bytes      block size of the non-contiguous types (64)\n");
+  printf("  -neighbors n      largest neighbor count (all)\n");
+  printf("  -loops n          exchanges per point, fewer for large messages (1000)\n");
+  printf("  -ndim n           logical dimensions (4)\n");
+  printf("  -v                verify the received data\n");
+  printf("  -json file        write the results as JSON\n");
+  printf("  -csv file         write the results as CSV\n");
+  printf("  -baseline file    compare with the CSV of an earlier run\n");
+  printf("  -tolerance pct    allowed slowdown against the baseline (10)\n");
+}
+
+static int
+parse_types(const char *s)
+{
+  char buf[256], *tok;
+  int t, mask = 0;
+  strncpy(buf, s, sizeof(buf)-1);
+  buf[sizeof(buf)-1] = 0;
+  for(tok=strtok(buf, ","); tok; tok=strtok(NULL, ",")) {
+    if(strcmp(tok, "all")==0) return (1<<NTYPES)-1;
+    for(t=0; t<NTYPES; t++)
+      if(strcmp(tok, type_name[t])==0) break;
+    if(t==NTYPES) return -1;
+    mask |= 1<<t;
+  }
+  return mask;
+}
+
+static int
+parse_args(int argc, char **argv, struct bench_args *a)
+{
+  int i;
+  a->types = (1<<NTYPES)-1;
+  a->minsize = 8;
+  a->maxsize = 4*1024*1024;
+  a->fac = 2;
+  a->block = 64;
+  a->maxnbr = 0;
+  a->loops = 1000;
+  a->ndim = 4;
+  a->verify = 0;
+  a->tolerance = 10;
+  a->json = a->csv = a->baseline = NULL;
+
+  for(i=1; i<argc; i++) {
+    const char *o = argv[i];
+    const char *v = (i+1<argc) ? argv[i+1] : NULL;
+    if(strcmp(o, "-v")==0) { a->verify = 1; continue; }
+    if(!v) return -1;
+    i++;
+    if(strcmp(o, "-types")==0) {
+      if((a->types = parse_types(v))<=0) return -1;
+    }
+    else if(strcmp(o, "-min")==0) a->minsize = strtoul(v, NULL, 0);
+    else if(strcmp(o, "-max")==0) a->maxsize = strtoul(v, NULL, 0);
+    else if(strcmp(o, "-fac")==0) a->fac = atoi(v);
+    else if(strcmp(o, "-block")==0) a->block = strtoul(v, NULL, 0);
+    else if(strcmp(o, "-neighbors")==0) a->maxnbr = atoi(v);
+    else if(strcmp(o, "-loops")==0) a->loops = atoi(v);
+    else if(strcmp(o, "-ndim")==0) a->ndim = atoi(v);
+    else if(strcmp(o, "-json")==0) a->json = v;
+    else if(strcmp(o, "-csv")==0) a->csv = v;
+    else if(strcmp(o, "-baseline")==0) a->baseline = v;
+    else if(strcmp(o, "-tolerance")==0) a->tolerance = atof(v);
+    else return -1;
+  }
+  if(a->fac<2 || a->block<1 || a->minsize<1 || a->maxsize<a->minsize ||
+     a->loops<1 || a->ndim<1 || a->ndim>MAXDIM) return -1;
+  return 0;
+}
+
+/*
+ * Byte layout of a message of nblk blocks.  The non-contiguous types
+ * leave a gap of one block after every block; the strided array splits
+ * the blocks over two interleaved strided pieces.
+ */
+static size_t
+block_offset(int type, int b, int nblk, size_t blk)
+{
+  switch(type) {
+  case T_CONTIG:
+  case T_MULTIPLE:
+    return b*blk;
+  case T_STRIDED_ARRAY:
+    if(b<(nblk+1)/2) return 2*blk*b;
+    return blk + 2*blk*(b-(nblk+1)/2);
+  default:
+    return 2*blk*b;
+  }
+}
+
+static QMP_msgmem_t
+declare_msgmem(int type, char *buf, int nblk, size_t blk)
+{
+  switch(type) {
+  case T_CONTIG:
+  case T_MULTIPLE:
+    return QMP_declare_msgmem(buf, nblk*blk);
+  case T_STRIDED:
+    return QMP_declare_strided_msgmem(buf, blk, nblk, 2*blk);
+  case T_STRIDED_ARRAY: {
+    void *base[2] = { buf, buf+blk };
+    size_t blksize[2] = { blk, blk };
+    int nblocks[2] = { (nblk+1)/2, nblk/2 };
+    ptrdiff_t stride[2] = { 2*blk, 2*blk };
+    return QMP_declare_strided_array_msgmem(base, blksize, nblocks, stride,
+					    nblocks[1]>0 ? 2 : 1);
+  }
+  case T_INDEXED: {
+    int b, *len = malloc(nblk*sizeof(int)), *index = malloc(nblk*sizeof(int));
+    QMP_msgmem_t mm;
+    for(b=0; b<nblk; b++) {
+      len[b] = 1;
+      index[b] = 2*b;
+    }
+    mm = QMP_declare_indexed_msgmem(buf, len, index, (int)blk, nblk);
+    free(len);
+    free(index);
+    return mm;
+  }
+  }
+  return NULL;
+}
+
+static unsigned char
+pattern(int rank, size_t i)
+{
+  return (unsigned char)(rank*131 + i*7 + (i>>8));
+}
+
+static int
+run_point(struct bench_args *a, int type, int nbr, size_t bytes,
+	  QMP_mem_t *smem[], QMP_mem_t *rmem[], double *t)
+{
+  int nblk, d, i, iters, nerr = 0, nh = 0;
+  size_t blk, span;
+  QMP_msgmem_t mm[4*MAXDIM];
+  QMP_msghandle_t mh[4*MAXDIM], multi = NULL;
+  int rank = QMP_get_node_number();
+
+  blk = (type==T_CONTIG || type==T_MULTIPLE) ? bytes : a->block;
+  if(blk>bytes) blk = bytes;
+  nblk = bytes/blk;
+  bytes = nblk*blk;
+  span = (type==T_CONTIG || type==T_MULTIPLE) ? bytes : 2*bytes;
+
+  iters = a->loops;
+  if((double)iters*bytes*nbr > 256.0*1024*1024) {
+    iters = (int)(256.0*1024*1024/((double)bytes*nbr));
+    if(iters<20) iters = (a->loops<20) ? a->loops : 20;
+  }
+
+  for(d=0; d<nbr; d++) {
+    int mu = nbr_axis[d], sign = (d&1) ? -1 : 1;
+    char *s = QMP_get_memory_pointer(smem[d]);
+    char *r = QMP_get_memory_pointer(rmem[d]);
+    memset(r, 0, span);
+    for(i=0; i<nblk; i++) {
+      size_t k, off = block_offset(type, i, nblk, blk);
+      for(k=0; k<blk; k++) s[off+k] = pattern(rank, i*blk+k);
+    }
+    mm[2*d] = declare_msgmem(type, r, nblk, blk);
+    mm[2*d+1] = declare_msgmem(type, s, nblk, blk);
+    mh[nh++] = QMP_declare_receive_relative(mm[2*d], mu, -sign, 0);
+    mh[nh++] = QMP_declare_send_relative(mm[2*d+1], mu, sign, 0);
+    if(!mm[2*d] || !mm[2*d+1] || !mh[nh-2] || !mh[nh-1]) {
+      QMP_error("cannot declare %s messages of %lu bytes", type_name[type],
+		(unsigned long)bytes);
+      QMP_abort(1);
+    }
+  }
+  if(type==T_MULTIPLE) multi = QMP_declare_multiple(mh, nh);
+
+  for(i=-WARMUP; i<iters; i++) {
+    double t0 = QMP_time();
+    if(multi) {
+      QMP_start(multi);
+      QMP_wait(multi);
+    } else {
+      for(d=0; d<nh; d++) QMP_start(mh[d]);
+      for(d=0; d<nh; d++) QMP_wait(mh[d]);
+    }
+    if(i>=0) t[i] = 1e6*(QMP_time() - t0);
+  }
+
+  if(a->verify) {
+    for(d=0; d<nbr; d++) {
+      int mu = nbr_axis[d], sign = (d&1) ? -1 : 1;
+      int disp[MAXDIM] = {0};
+      const unsigned char *r = QMP_get_memory_pointer(rmem[d]);
+      disp[mu] = -sign;
+      int src = QMP_get_neighbor(disp);
+      for(i=0; i<nblk; i++) {
+	size_t k, off = block_offset(type, i, nblk, blk);
+	for(k=0; k<blk; k++)
+	  if(r[off+k]!=pattern(src, i*blk+k)) { nerr++; break; }
+      }
+    }
+  }
+
+  if(multi) QMP_free_msghandle(multi);
+  else for(d=0; d<nh; d++) QMP_free_msghandle(mh[d]);
+  for(d=0; d<2*nbr; d++) QMP_free_msgmem(mm[d]);
+
+  struct result *res = &results[nresults<MAXRESULTS ? nresults : MAXRESULTS-1];
+  double sum = 0;
+  for(i=0; i<iters; i++) sum += t[i];
+  qsort(t, iters, sizeof(double), compare_double);
+  res->type = type;
+  res->nbr = nbr;
+  res->bytes = bytes;
+  res->iters = iters;
+  res->min = percentile(t, iters, 0);
+  res->p50 = percentile(t, iters, 0.5);
+  res->p90 = percentile(t, iters, 0.9);
+  res->p99 = percentile(t, iters, 0.99);
+  res->max = percentile(t, iters, 1);
+  res->avg = sum/iters;
+  QMP_max_double(&res->avg);
+  res->gbps = 1e-3*(double)bytes*nbr/res->avg;
+  if(nresults<MAXRESULTS) nresults++;
+
+  QMP_sum_int(&nerr);
+  return nerr;
+}
+
+static void
+write_json(const char *file, const int dims[], int ndim)
+{
+  FILE *f = fopen(file, "w");
+  int i;
+  if(!f) {
+    QMP_error("cannot open %s", file);
+    return;
+  }
+  fprintf(f, "{\n  \"benchmark\": \"QMP_bench\",\n  \"qmp\": \"%s\",\n",
+	  QMP_version_str());
+  fprintf(f, "  \"nodes\": %d,\n  \"dims\": [", QMP_get_number_of_nodes());
+  for(i=0; i<ndim; i++) fprintf(f, "%s%d", i ? ", " : "", dims[i]);
+  fprintf(f, "],\n  \"results\": [\n");
+  for(i=0; i<nresults; i++) {
+    struct result *r = &results[i];
+    fprintf(f, "    {\"type\": \"%s\", \"neighbors\": %d, \"bytes\": %lu, "
+	    "\"iterations\": %d, \"min_us\": %.3f, \"p50_us\": %.3f, "
+	    "\"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+	    "\"avg_us\": %.3f, \"gbps\": %.4f}%s\n",
+	    type_name[r->type], r->nbr, (unsigned long)r->bytes, r->iters,
+	    r->min, r->p50, r->p90, r->p99, r->max, r->avg, r->gbps,
+	    i+1<nresults ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+}
+
+#define CSV_HEADER \
+  "type,neighbors,bytes,iterations,min_us,p50_us,p90_us,p99_us,max_us,avg_us,gbps"
+
+static void
+write_csv(const char *file)
+{
+  FILE *f = fopen(file, "w");
+  int i;
+  if(!f) {
+    QMP_error("cannot open %s", file);
+    return;
+  }
+  fprintf(f, "%s\n", CSV_HEADER);
+  for(i=0; i<nresults; i++) {
+    struct result *r = &results[i];
+    fprintf(f, "%s,%d,%lu,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f\n",
+	    type_name[r->type], r->nbr, (unsigned long)r->bytes, r->iters,
+	    r->min, r->p50, r->p90, r->p99, r->max, r->avg, r->gbps);
+  }
+  fclose(f);
+}
+
+/* number of points whose median time grew by more than the tolerance */
+static int
+compare_baseline(const char *file, double tolerance)
+{
+  FILE *f = fopen(file, "r");
+  char line[512], tname[32];
+  int i, nbr, iters, nreg = 0, nmatch = 0;
+  unsigned long bytes;
+  double mn, p50, p90, p99, mx, avg, gbps;
+  if(!f) {
+    QMP_error("cannot open baseline %s", file);
+    return 1;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "%31[^,],%d,%lu,%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf", tname,
+	      &nbr, &bytes, &iters, &mn, &p50, &p90, &p99, &mx, &avg, &gbps)!=11)
+      continue;
+    for(i=0; i<nresults; i++) {
+      struct result *r = &results[i];
+      if(r->nbr!=nbr || r->bytes!=bytes || strcmp(type_name[r->type], tname))
+	continue;
+      nmatch++;
+      if(r->p50 > p50*(1+0.01*tolerance)) {
+	printf("REGRESSION %-13s nbr %d bytes %9lu  p50 %10.3f us (baseline %10.3f, +%.1f%%)"
+	       "  %8.4f GB/s (baseline %8.4f)\n", tname, nbr, bytes, r->p50, p50,
+	       100*(r->p50/p50-1), r->gbps, gbps);
+	nreg++;
+      }
+    }
+  }
+  fclose(f);
+  printf("baseline %s: %d points compared, %d regressions (tolerance %g%%)\n",
+	 file, nmatch, nreg, tolerance);
+  return nreg;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct bench_args a;
+  QMP_status_t status;
+  QMP_thread_level_t req, prv;
+  int dims[MAXDIM], type, nbr, d, rank, nerr = 0, nreg = 0;
+  size_t bytes;
+
+  req = QMP_THREAD_SINGLE;
+  status = QMP_init_msg_passing(&argc, &argv, req, &prv);
+  if (status != QMP_SUCCESS) {
+    QMP_fprintf(stderr, "QMP_init failed\n");
+    return -1;
+  }
+  rank = QMP_get_node_number();
+
+  if(parse_args(argc, argv, &a)) {
+    if(rank==0) usage(argv[0]);
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  factor_nodes(QMP_get_number_of_nodes(), a.ndim, dims);
+  status = QMP_declare_logical_topology(dims, a.ndim);
+  if (status != QMP_SUCCESS) {
+    QMP_fprintf(stderr, "Cannot declare logical grid\n");
+    return -1;
+  }
+  /* QMP does not send to the own node */
+  for(nbr=d=0; d<a.ndim; d++)
+    if(dims[d]>1) {
+      nbr_axis[nbr++] = d;
+      nbr_axis[nbr++] = d;
+    }
+  if(a.maxnbr<=0 || a.maxnbr>nbr) a.maxnbr = nbr;
+  if(nbr==0) {
+    if(rank==0) printf("%s needs at least 2 nodes\n", argv[0]);
+    QMP_finalize_msg_passing();
+    return 0;
+  }
+
+  QMP_mem_t *smem[2*MAXDIM], *rmem[2*MAXDIM];
+  size_t span = 2*a.maxsize;
+  for(d=0; d<a.maxnbr; d++) {
+    smem[d] = QMP_allocate_memory(span);
+    rmem[d] = QMP_allocate_memory(span);
+    if(!smem[d] || !rmem[d]) {
+      QMP_error("cannot allocate %lu bytes", (unsigned long)span);
+      QMP_abort(1);
+    }
+  }
+  double *t = malloc((a.loops+1)*sizeof(double));
+
+  if(rank==0) {
+    printf("QMP_bench %s: %d nodes, dims", QMP_version_str(),
+	   QMP_get_number_of_nodes());
+    for(d=0; d<a.ndim; d++) printf(" %d", dims[d]);
+    printf("\n%-13s %4s %9s %7s %10s %10s %10s %10s %10s %9s\n",
+	   "type", "nbr", "bytes", "iters", "min_us", "p50_us", "p90_us",
+	   "p99_us", "max_us", "GB/s");
+  }
+
+  for(type=0; type<NTYPES; type++) {
+    if(!(a.types&(1<<type))) continue;
+    for(nbr=1; nbr<=a.maxnbr; nbr = (nbr==a.maxnbr) ? nbr+1 :
+	  (2*nbr<a.maxnbr ? 2*nbr : a.maxnbr)) {
+      for(bytes=a.minsize; bytes<=a.maxsize; bytes*=a.fac) {
+	int e = run_point(&a, type, nbr, bytes, smem, rmem, t);
+	struct result *r = &results[nresults-1];
+	if(rank==0) {
+	  printf("%-13s %4d %9lu %7d %10.3f %10.3f %10.3f %10.3f %10.3f %9.4f%s\n",
+		 type_name[type], nbr, (unsigned long)r->bytes, r->iters, r->min,
+		 r->p50, r->p90, r->p99, r->max, r->gbps, e ? "  BAD DATA" : "");
+	  fflush(stdout);
+	}
+	nerr += e;
+      }
+    }
+  }
+
+  if(rank==0) {
+    if(a.json) write_json(a.json, dims, a.ndim);
+    if(a.csv) write_csv(a.csv);
+    if(a.baseline) nreg = compare_baseline(a.baseline, a.tolerance);
+    if(a.verify) printf("verify: %d errors\n", nerr);
+  }
+  QMP_sum_int(&nreg);
+
+  free(t);
+  for(d=0; d<a.maxnbr; d++) {
+    QMP_free_memory(smem[d]);
+    QMP_free_memory(rmem[d]);
+  }
+  QMP_finalize_msg_passing();
+  return (nerr || nreg) ? 1 : 0;
+}
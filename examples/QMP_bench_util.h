@@ -0,0 +1,51 @@
+/*
+ * Helpers shared by the benchmarks: sorting and percentiles of the
+ * timing samples and the split of the nodes over the axes.  Inline so
+ * that each benchmark compiles cleanly using only some of them.
+ */
+#ifndef _QMP_BENCH_UTIL_H
+#define _QMP_BENCH_UTIL_H
+
+#include "qmp.h"
+
+/* qsort order of the timing samples */
+static inline int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x>y) - (x<y);
+}
+
+/* largest over all ranks of the percentile q of the n sorted samples */
+static inline double
+percentile(const double *t, int n, double q)
+{
+  double v = t[(int)(q*(n-1) + 0.5)];
+  QMP_max_double(&v);
+  return v;
+}
+
+/*
+ * Spread the prime factors of the number of nodes over ndim axes, the
+ * largest factor first onto the shortest axis, the last axis first
+ * among axes of the same length.
+ */
+static inline void
+factor_nodes(int nodes, int ndim, int dims[])
+{
+  int i, f;
+  for(i=0; i<ndim; i++) dims[i] = 1;
+  while(nodes>1) {
+    int k = ndim-1;
+    for(f=nodes; f>1; f--) {
+      int p;
+      for(p=2; p*p<=f && f%p; p++);
+      if(p*p>f && nodes%f==0) break;
+    }
+    for(i=ndim-2; i>=0; i--) if(dims[i]<dims[k]) k = i;
+    dims[k] *= f;
+    nodes /= f;
+  }
+}
+
+#endif /* _QMP_BENCH_UTIL_H */
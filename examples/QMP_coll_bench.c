@@ -0,0 +1,418 @@
+/*
+ * Benchmark of the QMP collectives.
+ *
+ * Every collective (barrier, broadcast, the scalar and array sums,
+ * max, min, xor, alltoall and the binary reduction) is timed call by
+ * call on the allocated, job and default communicators and on an even
+ * and odd split of the allocated communicator.  The array collectives
+ * are swept over their length.  For every point the min, median, 90th
+ * and 99th percentile and max latency are reported, each the largest
+ * over the ranks, and optionally written as JSON.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "qmp.h"
+#include "QMP_bench_util.h"
+
+enum {
+  BARRIER, BROADCAST, SUM_INT, SUM_UINT64, SUM_FLOAT, SUM_DOUBLE,
+  SUM_LONG_DOUBLE, SUM_DOUBLE_EXTENDED, MAX_FLOAT, MAX_DOUBLE, MIN_FLOAT,
+  MIN_DOUBLE, XOR_ULONG, SUM_FLOAT_ARRAY, SUM_DOUBLE_ARRAY,
+  SUM_LONG_DOUBLE_ARRAY, ALLTOALL, BINARY_REDUCTION, NOPS
+};
+
+static const struct {
+  const char *name;
+  size_t elem;		/* bytes per element */
+  int array;		/* swept over the length */
+} ops[NOPS] = {
+  { "barrier", 0, 0 },
+  { "broadcast", 1, 1 },
+  { "sum_int", sizeof(int), 0 },
+  { "sum_uint64_t", sizeof(uint64_t), 0 },
+  { "sum_float", sizeof(float), 0 },
+  { "sum_double", sizeof(double), 0 },
+  { "sum_long_double", sizeof(long double), 0 },
+  { "sum_double_extended", sizeof(double), 0 },
+  { "max_float", sizeof(float), 0 },
+  { "max_double", sizeof(double), 0 },
+  { "min_float", sizeof(float), 0 },
+  { "min_double", sizeof(double), 0 },
+  { "xor_ulong", sizeof(unsigned long), 0 },
+  { "sum_float_array", sizeof(float), 1 },
+  { "sum_double_array", sizeof(double), 1 },
+  { "sum_long_double_array", sizeof(long double), 1 },
+  { "alltoall", 1, 1 },	/* bytes to each rank */
+  { "binary_reduction", sizeof(double), 1 },
+};
+
+enum { C_ALLOCATED, C_JOB, C_DEFAULT, C_SPLIT, NCOMMS };
+static const char *comm_name[NCOMMS] = { "allocated", "job", "default", "split" };
+
+#define WARMUP 10
+#define MAXRESULTS 4096
+
+struct coll_args {
+  unsigned long ops;	/* bit masks */
+  int comms;
+  int minlen, maxlen, fac;
+  int loops;
+  int verify;
+  const char *json;
+};
+
+struct result {
+  int comm, op, len, nodes, iters;
+  double min, p50, p90, p99, max, avg;	/* microseconds */
+};
+
+static struct result results[MAXRESULTS];
+static int nresults = 0;
+
+/* length of the binary reduction, the function has no argument for it */
+static int bin_len;
+
+static void
+bin_sum(void *inout, void *in)
+{
+  double *a = (double *) inout, *b = (double *) in;
+  int i;
+  for(i=0; i<bin_len; i++) a[i] += b[i];
+}
+
+static void
+usage(const char *prog)
+{
+  int i;
+  printf("%s usage:\n", prog);
+  printf("  -ops list      comma separated collectives (all):\n");
+  for(i=0; i<NOPS; i++) printf("%s%s", (i%4) ? ", " : "\n                   ", ops[i].name);
+  printf("\n  -comms list    comma separated from allocated,job,default,split (all)\n");
+  printf("  -min n         smallest array length (1)\n");
+  printf("  -max n         largest array length (65536)\n");
+  printf("  -fac n         array length factor (4)\n");
+  printf("  -loops n       calls per point, fewer for long arrays (1000)\n");
+  printf("  -v             verify the results\n");
+  printf("  -json file     write the results as JSON\n");
+}
+
+static const char *
+op_name(int i)
+{
+  return ops[i].name;
+}
+
+static const char *
+comm_name_of(int i)
+{
+  return comm_name[i];
+}
+
+static int
+parse_list(const char *s, const char *(*name)(int), int n, unsigned long *mask)
+{
+  char buf[512], *tok;
+  int i;
+  strncpy(buf, s, sizeof(buf)-1);
+  buf[sizeof(buf)-1] = 0;
+  *mask = 0;
+  for(tok=strtok(buf, ","); tok; tok=strtok(NULL, ",")) {
+    if(strcmp(tok, "all")==0) {
+      *mask = (1UL<<n)-1;
+      continue;
+    }
+    for(i=0; i<n; i++)
+      if(strcmp(tok, name(i))==0) break;
+    if(i==n) return -1;
+    *mask |= 1UL<<i;
+  }
+  return *mask ? 0 : -1;
+}
+
+static int
+parse_args(int argc, char **argv, struct coll_args *a)
+{
+  int i;
+  unsigned long m;
+  a->ops = (1UL<<NOPS)-1;
+  a->comms = (1<<NCOMMS)-1;
+  a->minlen = 1;
+  a->maxlen = 65536;
+  a->fac = 4;
+  a->loops = 1000;
+  a->verify = 0;
+  a->json = NULL;
+
+  for(i=1; i<argc; i++) {
+    const char *o = argv[i];
+    if(strcmp(o, "-v")==0) { a->verify = 1; continue; }
+    if(i+1>=argc) return -1;
+    const char *v = argv[++i];
+    if(strcmp(o, "-ops")==0) {
+      if(parse_list(v, op_name, NOPS, &a->ops)) return -1;
+    }
+    else if(strcmp(o, "-comms")==0) {
+      if(parse_list(v, comm_name_of, NCOMMS, &m)) return -1;
+      a->comms = (int) m;
+    }
+    else if(strcmp(o, "-min")==0) a->minlen = atoi(v);
+    else if(strcmp(o, "-max")==0) a->maxlen = atoi(v);
+    else if(strcmp(o, "-fac")==0) a->fac = atoi(v);
+    else if(strcmp(o, "-loops")==0) a->loops = atoi(v);
+    else if(strcmp(o, "-json")==0) a->json = v;
+    else return -1;
+  }
+  if(a->minlen<1 || a->maxlen<a->minlen || a->fac<2 || a->loops<1) return -1;
+  return 0;
+}
+
+/* every element of the input of rank r is r+1; broadcast is from 0 */
+static void
+init(int op, char *buf, int len, int rank, int nodes)
+{
+  int i;
+  switch(op) {
+  case BROADCAST:
+    for(i=0; i<len; i++) buf[i] = (rank==0) ? (char)(i*7+1) : 0;
+    break;
+  case SUM_INT: *(int *)buf = rank+1; break;
+  case SUM_UINT64: *(uint64_t *)buf = rank+1; break;
+  case SUM_FLOAT: case MAX_FLOAT: case MIN_FLOAT:
+    *(float *)buf = rank+1;
+    break;
+  case SUM_DOUBLE: case SUM_DOUBLE_EXTENDED: case MAX_DOUBLE: case MIN_DOUBLE:
+    *(double *)buf = rank+1;
+    break;
+  case SUM_LONG_DOUBLE: *(long double *)buf = rank+1; break;
+  case XOR_ULONG: *(unsigned long *)buf = rank+1; break;
+  case SUM_FLOAT_ARRAY:
+    for(i=0; i<len; i++) ((float *)buf)[i] = rank+1;
+    break;
+  case SUM_DOUBLE_ARRAY: case BINARY_REDUCTION:
+    for(i=0; i<len; i++) ((double *)buf)[i] = rank+1;
+    break;
+  case SUM_LONG_DOUBLE_ARRAY:
+    for(i=0; i<len; i++) ((long double *)buf)[i] = rank+1;
+    break;
+  case ALLTOALL:
+    /* the send buffer follows the receive buffer */
+    for(i=0; i<len*nodes; i++) buf[len*nodes+i] = (char) rank;
+    break;
+  }
+}
+
+static QMP_status_t
+call(int op, QMP_comm_t comm, char *buf, int len, int nodes)
+{
+  switch(op) {
+  case BARRIER: return QMP_comm_barrier(comm);
+  case BROADCAST: return QMP_comm_broadcast(comm, buf, len);
+  case SUM_INT: return QMP_comm_sum_int(comm, (int *)buf);
+  case SUM_UINT64: return QMP_comm_sum_uint64_t(comm, (uint64_t *)buf);
+  case SUM_FLOAT: return QMP_comm_sum_float(comm, (float *)buf);
+  case SUM_DOUBLE: return QMP_comm_sum_double(comm, (double *)buf);
+  case SUM_LONG_DOUBLE: return QMP_comm_sum_long_double(comm, (long double *)buf);
+  case SUM_DOUBLE_EXTENDED: return QMP_comm_sum_double_extended(comm, (double *)buf);
+  case MAX_FLOAT: return QMP_comm_max_float(comm, (float *)buf);
+  case MAX_DOUBLE: return QMP_comm_max_double(comm, (double *)buf);
+  case MIN_FLOAT: return QMP_comm_min_float(comm, (float *)buf);
+  case MIN_DOUBLE: return QMP_comm_min_double(comm, (double *)buf);
+  case XOR_ULONG: return QMP_comm_xor_ulong(comm, (unsigned long *)buf);
+  case SUM_FLOAT_ARRAY: return QMP_comm_sum_float_array(comm, (float *)buf, len);
+  case SUM_DOUBLE_ARRAY: return QMP_comm_sum_double_array(comm, (double *)buf, len);
+  case SUM_LONG_DOUBLE_ARRAY:
+    return QMP_comm_sum_long_double_array(comm, (long double *)buf, len);
+  case ALLTOALL: return QMP_comm_alltoall(comm, buf, buf+len*nodes, len);
+  case BINARY_REDUCTION:
+    bin_len = len;
+    return QMP_comm_binary_reduction(comm, buf, len*sizeof(double), bin_sum);
+  }
+  return QMP_ERROR;
+}
+
+/* number of wrong elements after one call */
+static int
+check(int op, const char *buf, int len, int nodes)
+{
+  double sum = 0.5*nodes*(nodes+1);
+  unsigned long x = 0;
+  int i, r, nerr = 0;
+  for(r=1; r<=nodes; r++) x ^= (unsigned long) r;
+  switch(op) {
+  case BROADCAST:
+    for(i=0; i<len; i++) nerr += buf[i]!=(char)(i*7+1);
+    break;
+  case SUM_INT: nerr = *(const int *)buf!=(int)sum; break;
+  case SUM_UINT64: nerr = *(const uint64_t *)buf!=(uint64_t)sum; break;
+  case SUM_FLOAT: nerr = *(const float *)buf!=(float)sum; break;
+  case SUM_DOUBLE: case SUM_DOUBLE_EXTENDED:
+    nerr = *(const double *)buf!=sum;
+    break;
+  case SUM_LONG_DOUBLE: nerr = *(const long double *)buf!=sum; break;
+  case MAX_FLOAT: nerr = *(const float *)buf!=nodes; break;
+  case MAX_DOUBLE: nerr = *(const double *)buf!=nodes; break;
+  case MIN_FLOAT: nerr = *(const float *)buf!=1; break;
+  case MIN_DOUBLE: nerr = *(const double *)buf!=1; break;
+  case XOR_ULONG: nerr = *(const unsigned long *)buf!=x; break;
+  case SUM_FLOAT_ARRAY:
+    for(i=0; i<len; i++) nerr += ((const float *)buf)[i]!=(float)sum;
+    break;
+  case SUM_DOUBLE_ARRAY: case BINARY_REDUCTION:
+    for(i=0; i<len; i++) nerr += ((const double *)buf)[i]!=sum;
+    break;
+  case SUM_LONG_DOUBLE_ARRAY:
+    for(i=0; i<len; i++) nerr += ((const long double *)buf)[i]!=sum;
+    break;
+  case ALLTOALL:
+    for(i=0; i<len*nodes; i++) nerr += buf[i]!=(char)(i/len);
+    break;
+  }
+  return nerr;
+}
+
+static int
+run_point(struct coll_args *a, int c, QMP_comm_t comm, int op, int len,
+	  char *buf, double *t)
+{
+  int nodes = QMP_comm_get_number_of_nodes(comm);
+  int rank = QMP_comm_get_node_number(comm);
+  int i, iters = a->loops, nerr = 0;
+  double sum = 0, bytes = (double)len*ops[op].elem;
+
+  if(op==ALLTOALL) bytes *= nodes;
+  if(iters*bytes > 64.0*1024*1024) {
+    iters = (int)(64.0*1024*1024/bytes);
+    if(iters<20) iters = (a->loops<20) ? a->loops : 20;
+  }
+
+  QMP_comm_barrier(comm);
+  for(i=-WARMUP; i<iters; i++) {
+    init(op, buf, len, rank, nodes);
+    double t0 = QMP_time();
+    call(op, comm, buf, len, nodes);
+    if(i>=0) t[i] = 1e6*(QMP_time() - t0);
+  }
+  if(a->verify) nerr = check(op, buf, len, nodes);
+
+  struct result *r = &results[nresults<MAXRESULTS ? nresults : MAXRESULTS-1];
+  for(i=0; i<iters; i++) sum += t[i];
+  qsort(t, iters, sizeof(double), compare_double);
+  r->comm = c;
+  r->op = op;
+  r->len = len;
+  r->nodes = nodes;
+  r->iters = iters;
+  /* over the allocated communicator, which all the others partition */
+  r->min = percentile(t, iters, 0);
+  r->p50 = percentile(t, iters, 0.5);
+  r->p90 = percentile(t, iters, 0.9);
+  r->p99 = percentile(t, iters, 0.99);
+  r->max = percentile(t, iters, 1);
+  r->avg = sum/iters;
+  QMP_max_double(&r->avg);
+  QMP_sum_int(&nerr);
+  if(nresults<MAXRESULTS) nresults++;
+  return nerr;
+}
+
+static void
+write_json(const char *file)
+{
+  FILE *f = fopen(file, "w");
+  int i;
+  if(!f) {
+    QMP_error("cannot open %s", file);
+    return;
+  }
+  fprintf(f, "{\n  \"benchmark\": \"QMP_coll_bench\",\n  \"qmp\": \"%s\",\n",
+	  QMP_version_str());
+  fprintf(f, "  \"nodes\": %d,\n  \"results\": [\n", QMP_get_number_of_nodes());
+  for(i=0; i<nresults; i++) {
+    struct result *r = &results[i];
+    fprintf(f, "    {\"comm\": \"%s\", \"op\": \"%s\", \"length\": %d, "
+	    "\"bytes\": %lu, \"nodes\": %d, \"iterations\": %d, "
+	    "\"min_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+	    "\"p99_us\": %.3f, \"max_us\": %.3f, \"avg_us\": %.3f}%s\n",
+	    comm_name[r->comm], ops[r->op].name, r->len,
+	    (unsigned long)(r->len*ops[r->op].elem), r->nodes, r->iters,
+	    r->min, r->p50, r->p90, r->p99, r->max, r->avg,
+	    i+1<nresults ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct coll_args a;
+  QMP_status_t status;
+  QMP_thread_level_t req, prv;
+  QMP_comm_t comm[NCOMMS];
+  int c, op, len, rank, nodes, nerr = 0;
+
+  req = QMP_THREAD_SINGLE;
+  status = QMP_init_msg_passing(&argc, &argv, req, &prv);
+  if (status != QMP_SUCCESS) {
+    QMP_fprintf(stderr, "QMP_init failed\n");
+    return -1;
+  }
+  rank = QMP_get_node_number();
+  nodes = QMP_get_number_of_nodes();
+
+  if(parse_args(argc, argv, &a)) {
+    if(rank==0) usage(argv[0]);
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  comm[C_ALLOCATED] = QMP_comm_get_allocated();
+  comm[C_JOB] = QMP_comm_get_job();
+  comm[C_DEFAULT] = QMP_comm_get_default();
+  QMP_comm_split(comm[C_ALLOCATED], rank%2, rank, &comm[C_SPLIT]);
+
+  size_t nbytes = 2*(size_t)a.maxlen*sizeof(long double)*nodes;
+  char *buf = malloc(nbytes);
+  double *t = malloc((a.loops+1)*sizeof(double));
+  memset(buf, 0, nbytes);
+
+  if(rank==0) {
+    printf("QMP_coll_bench %s: %d nodes\n", QMP_version_str(), nodes);
+    printf("%-9s %-22s %7s %9s %6s %7s %9s %9s %9s %9s %9s\n", "comm", "op",
+	   "length", "bytes", "nodes", "iters", "min_us", "p50_us", "p90_us",
+	   "p99_us", "max_us");
+  }
+
+  for(c=0; c<NCOMMS; c++) {
+    if(!(a.comms&(1<<c))) continue;
+    for(op=0; op<NOPS; op++) {
+      if(!(a.ops&(1UL<<op))) continue;
+      for(len = ops[op].array ? a.minlen : 1; len<=a.maxlen;
+	  len = ops[op].array ? len*a.fac : a.maxlen+1) {
+	int e = run_point(&a, c, comm[c], op, len, buf, t);
+	struct result *r = &results[nresults-1];
+	if(rank==0) {
+	  printf("%-9s %-22s %7d %9lu %6d %7d %9.3f %9.3f %9.3f %9.3f %9.3f%s\n",
+		 comm_name[c], ops[op].name, len,
+		 (unsigned long)(len*ops[op].elem), r->nodes, r->iters,
+		 r->min, r->p50, r->p90, r->p99, r->max, e ? "  WRONG" : "");
+	  fflush(stdout);
+	}
+	nerr += e;
+      }
+    }
+  }
+
+  if(rank==0) {
+    if(a.json) write_json(a.json);
+    if(a.verify) printf("verify: %d errors\n", nerr);
+  }
+
+  free(t);
+  free(buf);
+  QMP_comm_free(comm[C_SPLIT]);
+  QMP_finalize_msg_passing();
+  return nerr ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Check of the communication matrix.
+ *
+ * Every node sends -loops times a message of -bytes bytes forward and
+ * one of twice as many bytes backward on a ring of all nodes, and one
+ * of three times as many bytes forward on a ring of the nodes of its
+ * parity, on a communicator split off the allocated one and freed
+ * before the dump.  Node 0 reads the matrix written by
+ * QMP_dump_comm_matrix back and compares every sender, receiver, bytes
+ * and messages with the expected traffic.  The matrix is dumped twice
+ * and both must be the same, the messages gathering the first dump
+ * are not part of the second.  Needs a message passing build, the
+ * single node build cannot send to itself.  Prints the number of
+ * errors and returns nonzero if there are any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+
+static int bytes = 64;
+static int loops = 5;
+static const char *file = "qmp_comm_matrix_test.txt";
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -bytes n       bytes of the forward messages (64)\n");
+  printf("  -loops n       exchanges (5)\n");
+  printf("  -file name     matrix file, removed at the end (%s)\n", file);
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-bytes")==0 && i+1<argc) {
+      bytes = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-loops")==0 && i+1<argc) {
+      loops = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-file")==0 && i+1<argc) {
+      file = argv[++i];
+    } else {
+      if(QMP_is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (bytes<1 || loops<1);
+}
+
+/* send nb bytes to node next and receive them from node prev of comm,
+   loops times */
+static int
+ring(QMP_comm_t comm, int next, int prev, size_t nb)
+{
+  int l, errs = 0;
+  char *sbuf = (char *) calloc(nb, 1);
+  char *rbuf = (char *) calloc(nb, 1);
+  QMP_msgmem_t mm[2];
+  QMP_msghandle_t mh[2];
+  mm[0] = QMP_declare_msgmem(rbuf, nb);
+  mm[1] = QMP_declare_msgmem(sbuf, nb);
+  mh[0] = QMP_comm_declare_receive_from(comm, mm[0], prev, 0);
+  mh[1] = QMP_comm_declare_send_to(comm, mm[1], next, 0);
+  QMP_msghandle_t both = QMP_declare_multiple(mh, 2);
+  for(l=0; l<loops; l++)
+    if(QMP_start(both)!=QMP_SUCCESS || QMP_wait(both)!=QMP_SUCCESS) errs++;
+  QMP_free_msghandle(both);
+  QMP_free_msgmem(mm[0]);
+  QMP_free_msgmem(mm[1]);
+  free(rbuf);
+  free(sbuf);
+  return errs;
+}
+
+/* compare the file with the expected bytes and messages of each pair */
+static int
+check_file(const char *name, int n, const double *bytes_exp,
+	   const double *msgs_exp)
+{
+  int i, errs = 0;
+  char line[256];
+  double *seen = (double *) calloc(n*n, sizeof(double));
+  FILE *f = fopen(name, "r");
+  if(f==NULL) {
+    fprintf(stderr, "cannot read %s\n", name);
+    free(seen);
+    return 1;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    int s, r;
+    unsigned long b, m;
+    if(line[0]=='#') continue;
+    if(sscanf(line, "%d %d %lu %lu", &s, &r, &b, &m)!=4 ||
+       s<0 || s>=n || r<0 || r>=n) {
+      fprintf(stderr, "%s: bad line %s", name, line);
+      errs++;
+      continue;
+    }
+    if(seen[s*n+r]++ || b!=bytes_exp[s*n+r] || m!=msgs_exp[s*n+r]) {
+      if(errs<5)
+	fprintf(stderr, "%s: %d to %d %lu bytes %lu messages, expected %g %g\n",
+		name, s, r, b, m, bytes_exp[s*n+r], msgs_exp[s*n+r]);
+      errs++;
+    }
+  }
+  fclose(f);
+  for(i=0; i<n*n; i++) {
+    if(!seen[i] && msgs_exp[i]!=0) {
+      if(errs<5)
+	fprintf(stderr, "%s: %d to %d missing\n", name, i/n, i%n);
+      errs++;
+    }
+  }
+  free(seen);
+  return errs;
+}
+
+/* dump the matrix and compare it on node 0 with the traffic of the
+   rings */
+static int
+check_dump(int n, int me)
+{
+  int s, d, errs = 0;
+  if(QMP_dump_comm_matrix(file)!=QMP_SUCCESS) errs++;
+  if(me!=0) return errs;
+  double *eb = (double *) calloc(2*n*n, sizeof(double));
+  double *em = eb + n*n;
+  for(s=0; s<n; s++) {
+    int to[3], nb[3] = { bytes, 2*bytes, 3*bytes };
+    to[0] = (s+1)%n;
+    to[1] = (s+n-1)%n;
+    to[2] = s%2 + 2*((s/2+1)%((n-s%2+1)/2));
+    for(d=0; d<3; d++) {
+      eb[s*n+to[d]] += (double)loops*nb[d];
+      em[s*n+to[d]] += loops;
+    }
+  }
+  errs += check_file(file, n, eb, em);
+  free(eb);
+  return errs;
+}
+
+int
+main(int argc, char *argv[])
+{
+  QMP_thread_level_t provided;
+  int errs = 0;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_SINGLE, &provided)
+     != QMP_SUCCESS) {
+    fprintf(stderr, "QMP_init failed\n");
+    return 1;
+  }
+  if(parse_args(argc, argv)) {
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  QMP_comm_t all = QMP_comm_get_allocated();
+  int n = QMP_comm_get_number_of_nodes(all);
+  int me = QMP_comm_get_node_number(all);
+
+  /* the rings of all nodes, forward and backward */
+  errs += ring(all, (me+1)%n, (me+n-1)%n, bytes);
+  errs += ring(all, (me+n-1)%n, (me+1)%n, 2*bytes);
+
+  /* the ring of the nodes of the same parity, parity+2k is node k */
+  QMP_comm_t half;
+  int p = me%2, m = (n-p+1)/2, k = me/2;
+  if(QMP_comm_split(all, p, me, &half)!=QMP_SUCCESS) {
+    QMP_fprintf(stderr, "cannot split the allocated communicator\n");
+    QMP_abort(1);
+  }
+  errs += ring(half, (k+1)%m, (k+m-1)%m, 3*bytes);
+  QMP_comm_free(half);
+
+  errs += check_dump(n, me);
+  /* the gather of the first dump must not show up in the second */
+  errs += check_dump(n, me);
+  if(me==0) remove(file);
+
+  QMP_comm_sum_int(all, &errs);
+  if(me==0)
+    printf("%d nodes, %d exchanges of %d bytes: %d errors\n", n, loops, bytes,
+	   errs);
+
+  QMP_finalize_msg_passing();
+  return errs!=0;
+}
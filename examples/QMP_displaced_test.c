@@ -0,0 +1,178 @@
+/*
+ * Check of the displaced sends and receives.
+ *
+ * On the logical topology of the layout of -lat, every node sends to
+ * every displacement with components in [-range,range] a message with
+ * its node number and the displacement, and receives one from every
+ * opposite displacement, all of them in flight at the same time.  The
+ * message from each displacement must come from the node at that
+ * displacement and carry the opposite displacement, which also holds
+ * when several displacements reach the same node.  Displacements whose
+ * message tag would be too large, far out in many dimensions, are
+ * rejected for the send and the matching receive alike and are
+ * counted and skipped.  A displacement with a component out of range
+ * must be rejected.  Needs a message passing build, the single node
+ * build cannot send to itself.  Prints the number of wrong messages
+ * and returns nonzero if there are any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+
+#define MAXDIM 8
+
+static int ndim = 4;
+static int lat[MAXDIM] = { 8, 8, 8, 8 };
+static int range = 1;
+static int loops = 3;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -lat x y ...   global lattice (8 8 8 8)\n");
+  printf("  -range n       largest displacement component, up to 3 (1)\n");
+  printf("  -loops n       exchanges per check (3)\n");
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-lat")==0) {
+      ndim = 0;
+      while(i+1<argc && ndim<MAXDIM && argv[i+1][0]!='-')
+	lat[ndim++] = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-range")==0 && i+1<argc) {
+      range = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-loops")==0 && i+1<argc) {
+      loops = atoi(argv[++i]);
+    } else {
+      if(QMP_is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (ndim<1 || range<1 || range>3 || loops<1);
+}
+
+/* the k-th displacement with components in [-range,range] */
+static void
+displacement(int k, int nd, int disp[])
+{
+  int i;
+  for(i=0; i<nd; i++) {
+    disp[i] = k%(2*range+1) - range;
+    k /= 2*range+1;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  QMP_thread_level_t provided;
+  int i, k, l, nd, ndisp, nmh = 0, nskip = 0, errs = 0;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_SINGLE, &provided)
+     != QMP_SUCCESS) {
+    fprintf(stderr, "QMP_init failed\n");
+    return 1;
+  }
+  if(parse_args(argc, argv)) {
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+  if(QMP_layout_grid(lat, ndim)!=QMP_SUCCESS) {
+    if(QMP_is_primary_node())
+      fprintf(stderr, "no layout of the lattice on %d nodes\n",
+	      QMP_get_number_of_nodes());
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  nd = QMP_get_logical_number_of_dimensions();
+  const int *geom = QMP_get_logical_dimensions();
+  const int *coord = QMP_get_logical_coordinates();
+  int node = QMP_get_node_number();
+  for(ndisp=1, i=0; i<nd; i++) ndisp *= 2*range+1;
+
+  /* message k: node number then displacement */
+  int *sbuf = (int *) malloc(ndisp*(nd+1)*sizeof(int));
+  int *rbuf = (int *) malloc(ndisp*(nd+1)*sizeof(int));
+  QMP_msgmem_t *mm = (QMP_msgmem_t *) malloc(2*ndisp*sizeof(QMP_msgmem_t));
+  QMP_msghandle_t *mh =
+    (QMP_msghandle_t *) malloc(2*ndisp*sizeof(QMP_msghandle_t));
+  int *skip = (int *) calloc(ndisp, sizeof(int));
+  int disp[MAXDIM], x[MAXDIM];
+
+  for(k=0; k<ndisp; k++) {
+    displacement(k, nd, disp);
+    mm[2*k] = QMP_declare_msgmem(rbuf+k*(nd+1), (nd+1)*sizeof(int));
+    mm[2*k+1] = QMP_declare_msgmem(sbuf+k*(nd+1), (nd+1)*sizeof(int));
+    /* the send to disp is rejected exactly when the receive from
+       -disp is, so the messages still pair up */
+    if((mh[nmh] = QMP_declare_receive_displaced(mm[2*k], disp, 0))) nmh++;
+    else { skip[k] = 1; nskip++; }
+    if((mh[nmh] = QMP_declare_send_displaced(mm[2*k+1], disp, 0))) nmh++;
+    sbuf[k*(nd+1)] = node;
+    for(i=0; i<nd; i++) sbuf[k*(nd+1)+1+i] = disp[i];
+  }
+  QMP_msghandle_t all = QMP_declare_multiple(mh, nmh);
+
+  for(l=0; l<loops; l++) {
+    for(k=0; k<ndisp*(nd+1); k++) rbuf[k] = -1;
+    if(QMP_start(all)!=QMP_SUCCESS || QMP_wait(all)!=QMP_SUCCESS) errs++;
+    for(k=0; k<ndisp; k++) {
+      const int *r = rbuf + k*(nd+1);
+      int bad = 0;
+      displacement(k, nd, disp);
+      if(skip[k]) continue;
+      for(i=0; i<nd; i++) {
+	x[i] = ((coord[i] + disp[i]) % geom[i] + geom[i]) % geom[i];
+	if(r[1+i]!=-disp[i]) bad = 1;
+      }
+      if(r[0]!=QMP_get_node_number_from(x)) bad = 1;
+      if(bad) {
+	if(errs<5)
+	  QMP_fprintf(stderr, "displacement %d: from node %d, expected %d\n",
+		      k, r[0], QMP_get_node_number_from(x));
+	errs++;
+      }
+    }
+  }
+
+  QMP_free_msghandle(all);
+  for(k=0; k<2*ndisp; k++) QMP_free_msgmem(mm[k]);
+
+  /* out of range components have no handle */
+  for(i=0; i<nd; i++) disp[i] = 0;
+  disp[0] = range>1 ? 4 : -4;
+  QMP_msgmem_t m = QMP_declare_msgmem(sbuf, sizeof(int));
+  QMP_msghandle_t h = QMP_declare_send_displaced(m, disp, 0);
+  if(h) {
+    QMP_fprintf(stderr, "displacement %d accepted\n", disp[0]);
+    QMP_free_msghandle(h);
+    errs++;
+  }
+  QMP_free_msgmem(m);
+
+  free(skip);
+  free(mh);
+  free(mm);
+  free(rbuf);
+  free(sbuf);
+
+  QMP_sum_int(&errs);
+  if(QMP_is_primary_node()) {
+    printf("lattice");
+    for(i=0; i<ndim; i++) printf(" %d", lat[i]);
+    printf(" on nodes");
+    for(i=0; i<nd; i++) printf(" %d", geom[i]);
+    printf(", %d displacements, %d without tag: %d errors\n", ndisp, nskip,
+	   errs);
+  }
+
+  QMP_finalize_msg_passing();
+  return errs!=0;
+}
@@ -0,0 +1,643 @@
+/*
+ * Dslash proxy: halo exchange overlapped with a Wilson or staggered
+ * stencil on a 4d lattice.
+ *
+ * The faces are packed (spin projected for Wilson, multiplied by the
+ * backward link), sent with persistent QMP message handles, and the
+ * interior is computed while they are in flight.  For every rank
+ * count the compute alone, the exchange alone, the sequential and the
+ * overlapped dslash are timed, giving the overlap efficiency
+ *   (compute + exchange - overlapped) / min(compute, exchange)
+ * and the time per site.  With -scaling the same is repeated on the
+ * first 1, 2, 4, ... ranks for weak (fixed local volume) or strong
+ * (fixed global volume) scaling curves.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+#include "QMP_bench_util.h"
+
+#define ND 4
+#define NC 3
+#define LINK (2*NC*NC)		/* floats per link */
+#define VEC (2*NC)		/* floats per color vector */
+
+enum { WILSON, STAGGERED };
+enum { SCALING_NONE, SCALING_WEAK, SCALING_STRONG };
+enum { T_COMP, T_COMM, T_SEQ, T_OVL, NTIMES };
+
+struct dslash_args {
+  int action;
+  int lat[ND];		/* local lattice */
+  int global[ND];	/* global lattice for strong scaling */
+  int nvec;		/* vectors per site */
+  int loops;
+  int scaling;
+  const char *json;
+};
+
+struct lattice {
+  int L[ND], vol;
+  int comm[ND];			/* axis split over ranks */
+  int *fwd[ND], *bwd[ND];	/* neighbor site, -1 if off node */
+  int nface[ND];
+  int *lo[ND], *hi[ND];		/* sites with x[mu]=0 and x[mu]=L-1 */
+};
+
+struct dslash {
+  struct lattice *lat;
+  int ns;			/* spins: 4 Wilson, 1 staggered */
+  int nvec;
+  int site, half;		/* floats per site and per face site */
+  float *psi, *out, *u;
+  QMP_mem_t *mem[4*ND];
+  float *send_fwd[ND], *send_bwd[ND], *recv_fwd[ND], *recv_bwd[ND];
+  QMP_msgmem_t mm[4*ND];
+  int nmm;
+  QMP_msghandle_t mh;
+};
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -action wilson|staggered   stencil (wilson)\n");
+  printf("  -lat x y z t               local lattice (8 8 8 8)\n");
+  printf("  -nvec n                    vectors per site (1)\n");
+  printf("  -loops n                   dslash applications per timing (50)\n");
+  printf("  -scaling weak|strong       repeat on the first 1, 2, 4, ... ranks\n");
+  printf("  -global x y z t            global lattice for strong scaling\n");
+  printf("                             (local lattice times all ranks)\n");
+  printf("  -json file                 write the results as JSON\n");
+}
+
+static int
+parse_args(int argc, char **argv, struct dslash_args *a)
+{
+  int i, mu;
+  a->action = WILSON;
+  for(mu=0; mu<ND; mu++) {
+    a->lat[mu] = 8;
+    a->global[mu] = 0;
+  }
+  a->nvec = 1;
+  a->loops = 50;
+  a->scaling = SCALING_NONE;
+  a->json = NULL;
+
+  for(i=1; i<argc; i++) {
+    const char *o = argv[i];
+    if(strcmp(o, "-lat")==0 || strcmp(o, "-global")==0) {
+      int *l = (o[1]=='l') ? a->lat : a->global;
+      if(i+ND>=argc) return -1;
+      for(mu=0; mu<ND; mu++) l[mu] = atoi(argv[++i]);
+      continue;
+    }
+    if(i+1>=argc) return -1;
+    const char *v = argv[++i];
+    if(strcmp(o, "-action")==0) {
+      if(strcmp(v, "wilson")==0) a->action = WILSON;
+      else if(strcmp(v, "staggered")==0) a->action = STAGGERED;
+      else return -1;
+    }
+    else if(strcmp(o, "-scaling")==0) {
+      if(strcmp(v, "weak")==0) a->scaling = SCALING_WEAK;
+      else if(strcmp(v, "strong")==0) a->scaling = SCALING_STRONG;
+      else return -1;
+    }
+    else if(strcmp(o, "-nvec")==0) a->nvec = atoi(v);
+    else if(strcmp(o, "-loops")==0) a->loops = atoi(v);
+    else if(strcmp(o, "-json")==0) a->json = v;
+    else return -1;
+  }
+  for(mu=0; mu<ND; mu++) if(a->lat[mu]<1) return -1;
+  if(a->nvec<1 || a->loops<1) return -1;
+  return 0;
+}
+
+static void
+lattice_init(struct lattice *lat, const int L[], const int dims[])
+{
+  int mu, nu, i, x[ND];
+  lat->vol = 1;
+  for(mu=0; mu<ND; mu++) {
+    lat->L[mu] = L[mu];
+    lat->vol *= L[mu];
+    lat->comm[mu] = dims[mu]>1;
+  }
+  for(mu=0; mu<ND; mu++) {
+    lat->fwd[mu] = malloc(lat->vol*sizeof(int));
+    lat->bwd[mu] = malloc(lat->vol*sizeof(int));
+    lat->nface[mu] = lat->vol/L[mu];
+    lat->lo[mu] = malloc(lat->nface[mu]*sizeof(int));
+    lat->hi[mu] = malloc(lat->nface[mu]*sizeof(int));
+  }
+  for(i=0; i<lat->vol; i++) {
+    int r = i;
+    for(mu=0; mu<ND; mu++) {
+      x[mu] = r % L[mu];
+      r /= L[mu];
+    }
+    for(mu=0; mu<ND; mu++) {
+      int stride = 1, f = 0, fs = 1;
+      for(nu=0; nu<mu; nu++) stride *= L[nu];
+      for(nu=0; nu<ND; nu++) {
+	if(nu==mu) continue;
+	f += x[nu]*fs;
+	fs *= L[nu];
+      }
+      if(x[mu]==0) lat->lo[mu][f] = i;
+      if(x[mu]==L[mu]-1) lat->hi[mu][f] = i;
+      if(x[mu]<L[mu]-1) lat->fwd[mu][i] = i + stride;
+      else lat->fwd[mu][i] = lat->comm[mu] ? -1 : i - (L[mu]-1)*stride;
+      if(x[mu]>0) lat->bwd[mu][i] = i - stride;
+      else lat->bwd[mu][i] = lat->comm[mu] ? -1 : i + (L[mu]-1)*stride;
+    }
+  }
+}
+
+static void
+lattice_free(struct lattice *lat)
+{
+  int mu;
+  for(mu=0; mu<ND; mu++) {
+    free(lat->fwd[mu]);
+    free(lat->bwd[mu]);
+    free(lat->lo[mu]);
+    free(lat->hi[mu]);
+  }
+}
+
+/* deterministic value in [-1,1) of global site g, component k */
+static float
+site_value(long g, int k)
+{
+  unsigned long h = (unsigned long)g*2654435761UL + (unsigned long)k*40503UL;
+  h ^= h>>13;
+  h *= 0x5bd1e995UL;
+  h ^= h>>15;
+  return (float)((h&0xffff)/32768.0 - 1.0);
+}
+
+static void
+fill_fields(struct dslash *D, QMP_comm_t comm, const int dims[])
+{
+  struct lattice *lat = D->lat;
+  const int *lc = QMP_comm_get_logical_coordinates(comm);
+  int i, mu, k;
+  for(i=0; i<lat->vol; i++) {
+    long g = 0;
+    int r = i;
+    for(mu=ND-1; mu>=0; mu--) {
+      int s = 1, nu;
+      for(nu=0; nu<mu; nu++) s *= lat->L[nu];
+      int x = r/s;
+      r %= s;
+      g = g*(lat->L[mu]*dims[mu]) + lc[mu]*lat->L[mu] + x;
+    }
+    for(k=0; k<D->site; k++) D->psi[i*D->site+k] = site_value(g, k);
+    for(k=0; k<ND*LINK; k++) D->u[i*ND*LINK+k] = site_value(g, 1000+k);
+  }
+}
+
+/* r = u a and r = u^dagger a for complex 3x3 u */
+static inline void
+mul(const float *u, const float *a, float *r)
+{
+  int i, j;
+  for(i=0; i<NC; i++) {
+    float re = 0, im = 0;
+    for(j=0; j<NC; j++) {
+      float ur = u[2*(NC*i+j)], ui = u[2*(NC*i+j)+1];
+      re += ur*a[2*j] - ui*a[2*j+1];
+      im += ur*a[2*j+1] + ui*a[2*j];
+    }
+    r[2*i] = re;
+    r[2*i+1] = im;
+  }
+}
+
+static inline void
+adj_mul(const float *u, const float *a, float *r)
+{
+  int i, j;
+  for(i=0; i<NC; i++) {
+    float re = 0, im = 0;
+    for(j=0; j<NC; j++) {
+      float ur = u[2*(NC*j+i)], ui = u[2*(NC*j+i)+1];
+      re += ur*a[2*j] + ui*a[2*j+1];
+      im += ur*a[2*j+1] - ui*a[2*j];
+    }
+    r[2*i] = re;
+    r[2*i+1] = im;
+  }
+}
+
+/*
+ * Spin projection (1 -+ gamma) keeping two spins; the gamma matrix is
+ * simplified to pairing spin s with s+2, which has the arithmetic of
+ * the real projectors.  Staggered fields have one spin and no
+ * projection.
+ */
+static inline void
+project(const float *p, int sign, float *h, int ns)
+{
+  int k;
+  if(ns==1) {
+    for(k=0; k<VEC; k++) h[k] = p[k];
+    return;
+  }
+  for(k=0; k<2*VEC; k++) h[k] = p[k] + sign*p[2*VEC+k];
+}
+
+/* fwd: sign -1 from the projection; bwd: sign +1 */
+static inline void
+reconstruct(float *o, const float *r, int sign, int ns)
+{
+  int k;
+  if(ns==1) {
+    for(k=0; k<VEC; k++) o[k] -= sign*r[k];
+    return;
+  }
+  for(k=0; k<2*VEC; k++) {
+    o[k] += r[k];
+    o[2*VEC+k] += sign*r[k];
+  }
+}
+
+/* link multiply of every color vector of a half spinor */
+static inline void
+half_mul(const float *u, const float *h, float *r, int ns, int adj)
+{
+  int s, nh = (ns==1) ? 1 : 2;
+  for(s=0; s<nh; s++) {
+    if(adj) adj_mul(u, h+s*VEC, r+s*VEC);
+    else mul(u, h+s*VEC, r+s*VEC);
+  }
+}
+
+static void
+pack(struct dslash *D)
+{
+  struct lattice *lat = D->lat;
+  float h[2*VEC];
+  int mu, j, v;
+  for(mu=0; mu<ND; mu++) {
+    if(!lat->comm[mu]) continue;
+    for(j=0; j<lat->nface[mu]; j++) {
+      int y = lat->lo[mu][j];
+      for(v=0; v<D->nvec; v++)
+	project(D->psi + y*D->site + v*D->site/D->nvec, -1,
+		D->send_bwd[mu] + (j*D->nvec+v)*(D->half/D->nvec), D->ns);
+      y = lat->hi[mu][j];
+      for(v=0; v<D->nvec; v++) {
+	project(D->psi + y*D->site + v*D->site/D->nvec, +1, h, D->ns);
+	half_mul(D->u + (y*ND+mu)*LINK, h,
+		 D->send_fwd[mu] + (j*D->nvec+v)*(D->half/D->nvec), D->ns, 1);
+      }
+    }
+  }
+}
+
+static void
+interior(struct dslash *D)
+{
+  struct lattice *lat = D->lat;
+  int vs = D->site/D->nvec;
+  float h[2*VEC], r[2*VEC];
+  int i, mu, v;
+  for(i=0; i<lat->vol; i++) {
+    float *o = D->out + i*D->site;
+    memset(o, 0, D->site*sizeof(float));
+    for(mu=0; mu<ND; mu++) {
+      int f = lat->fwd[mu][i], b = lat->bwd[mu][i];
+      for(v=0; v<D->nvec; v++) {
+	if(f>=0) {
+	  project(D->psi + f*D->site + v*vs, -1, h, D->ns);
+	  half_mul(D->u + (i*ND+mu)*LINK, h, r, D->ns, 0);
+	  reconstruct(o + v*vs, r, -1, D->ns);
+	}
+	if(b>=0) {
+	  project(D->psi + b*D->site + v*vs, +1, h, D->ns);
+	  half_mul(D->u + (b*ND+mu)*LINK, h, r, D->ns, 1);
+	  reconstruct(o + v*vs, r, +1, D->ns);
+	}
+      }
+    }
+  }
+}
+
+static void
+boundary(struct dslash *D)
+{
+  struct lattice *lat = D->lat;
+  int vs = D->site/D->nvec, hs = D->half/D->nvec;
+  float r[2*VEC];
+  int mu, j, v;
+  for(mu=0; mu<ND; mu++) {
+    if(!lat->comm[mu]) continue;
+    for(j=0; j<lat->nface[mu]; j++) {
+      int x = lat->hi[mu][j];
+      for(v=0; v<D->nvec; v++) {
+	half_mul(D->u + (x*ND+mu)*LINK, D->recv_fwd[mu] + (j*D->nvec+v)*hs,
+		 r, D->ns, 0);
+	reconstruct(D->out + x*D->site + v*vs, r, -1, D->ns);
+      }
+      x = lat->lo[mu][j];
+      for(v=0; v<D->nvec; v++)
+	reconstruct(D->out + x*D->site + v*vs,
+		    D->recv_bwd[mu] + (j*D->nvec+v)*hs, +1, D->ns);
+    }
+  }
+}
+
+static float *
+comm_buffer(struct dslash *D, size_t nbytes)
+{
+  QMP_mem_t *m = QMP_allocate_memory(nbytes);
+  if(!m) {
+    QMP_error("cannot allocate %lu bytes", (unsigned long)nbytes);
+    QMP_abort(1);
+  }
+  D->mem[D->nmm] = m;
+  return (float *) QMP_get_memory_pointer(m);
+}
+
+static void
+dslash_init(struct dslash *D, struct lattice *lat, int action, int nvec,
+	    QMP_comm_t comm)
+{
+  QMP_msghandle_t mh[4*ND];
+  int mu, n = 0;
+  D->lat = lat;
+  D->ns = (action==WILSON) ? 4 : 1;
+  D->nvec = nvec;
+  D->site = nvec*D->ns*VEC;
+  D->half = nvec*((action==WILSON) ? 2 : 1)*VEC;
+  D->psi = malloc(lat->vol*D->site*sizeof(float));
+  D->out = malloc(lat->vol*D->site*sizeof(float));
+  D->u = malloc(lat->vol*ND*LINK*sizeof(float));
+  D->nmm = 0;
+  D->mh = NULL;
+  for(mu=0; mu<ND; mu++) {
+    size_t nb = lat->nface[mu]*D->half*sizeof(float);
+    float **buf[4] = { &D->recv_fwd[mu], &D->recv_bwd[mu],
+		       &D->send_bwd[mu], &D->send_fwd[mu] };
+    int k;
+    if(!lat->comm[mu]) continue;
+    for(k=0; k<4; k++) {
+      *buf[k] = comm_buffer(D, nb);
+      D->mm[D->nmm++] = QMP_declare_msgmem(*buf[k], nb);
+    }
+    mh[n++] = QMP_comm_declare_receive_relative(comm, D->mm[D->nmm-4], mu, +1, 0);
+    mh[n++] = QMP_comm_declare_receive_relative(comm, D->mm[D->nmm-3], mu, -1, 0);
+    mh[n++] = QMP_comm_declare_send_relative(comm, D->mm[D->nmm-2], mu, -1, 0);
+    mh[n++] = QMP_comm_declare_send_relative(comm, D->mm[D->nmm-1], mu, +1, 0);
+  }
+  if(n>0) D->mh = QMP_declare_multiple(mh, n);
+}
+
+static void
+dslash_free(struct dslash *D)
+{
+  int i;
+  if(D->mh) QMP_free_msghandle(D->mh);
+  for(i=0; i<D->nmm; i++) {
+    QMP_free_msgmem(D->mm[i]);
+    QMP_free_memory(D->mem[i]);
+  }
+  free(D->psi);
+  free(D->out);
+  free(D->u);
+}
+
+static void
+apply(struct dslash *D, int mode)
+{
+  switch(mode) {
+  case T_COMP:
+    pack(D);
+    interior(D);
+    boundary(D);
+    break;
+  case T_COMM:
+    if(D->mh) {
+      QMP_start(D->mh);
+      QMP_wait(D->mh);
+    }
+    break;
+  case T_SEQ:
+    pack(D);
+    if(D->mh) {
+      QMP_start(D->mh);
+      QMP_wait(D->mh);
+    }
+    interior(D);
+    boundary(D);
+    break;
+  case T_OVL:
+    pack(D);
+    if(D->mh) QMP_start(D->mh);
+    interior(D);
+    if(D->mh) QMP_wait(D->mh);
+    boundary(D);
+    break;
+  }
+}
+
+struct point {
+  int nodes, dims[ND], L[ND];
+  double t[NTIMES];	/* seconds per application, slowest rank */
+  double overlap;	/* -1 without communication */
+  double ns_site, gflops, eff;
+  double norm;		/* |D psi|^2 */
+};
+
+static void
+run_point(struct dslash_args *a, QMP_comm_t comm, const int L[],
+	  const int dims[], struct point *p)
+{
+  struct lattice lat;
+  struct dslash D;
+  int mode, i, k;
+  double flops = (a->action==WILSON) ? 1320 : 570;
+
+  lattice_init(&lat, L, dims);
+  dslash_init(&D, &lat, a->action, a->nvec, comm);
+  fill_fields(&D, comm, dims);
+
+  p->nodes = QMP_comm_get_number_of_nodes(comm);
+  for(k=0; k<ND; k++) {
+    p->dims[k] = dims[k];
+    p->L[k] = L[k];
+  }
+  for(mode=0; mode<NTIMES; mode++) {
+    for(i=0; i<3; i++) apply(&D, mode);
+    QMP_comm_barrier(comm);
+    double t0 = QMP_time();
+    for(i=0; i<a->loops; i++) apply(&D, mode);
+    p->t[mode] = (QMP_time() - t0)/a->loops;
+    QMP_comm_max_double(comm, &p->t[mode]);
+  }
+
+  /* result of the overlapped schedule */
+  p->norm = 0;
+  for(i=0; i<lat.vol*D.site; i++) p->norm += (double)D.out[i]*D.out[i];
+  QMP_comm_sum_double(comm, &p->norm);
+
+  double tc = p->t[T_COMP], tx = p->t[T_COMM];
+  double mn = (tc<tx) ? tc : tx;
+  p->overlap = -1;
+  if(D.mh && mn>0) {
+    p->overlap = (tc + tx - p->t[T_OVL])/mn;
+    if(p->overlap<0) p->overlap = 0;
+    if(p->overlap>1) p->overlap = 1;
+  }
+  p->ns_site = 1e9*p->t[T_OVL]/lat.vol;
+  p->gflops = 1e-9*flops*a->nvec*lat.vol*p->nodes/p->t[T_OVL];
+
+  dslash_free(&D);
+  lattice_free(&lat);
+}
+
+static void
+print_header(void)
+{
+  printf("%5s %-9s %-11s %9s %9s %9s %9s %7s %8s %9s %6s %14s\n",
+	 "ranks", "dims", "local", "comp_us", "comm_us", "seq_us", "ovl_us",
+	 "overlap", "ns/site", "GF/s", "eff", "|D psi|^2");
+}
+
+static void
+print_point(const struct point *p)
+{
+  char dims[32], loc[32], ovl[16];
+  snprintf(dims, sizeof(dims), "%dx%dx%dx%d",
+	   p->dims[0], p->dims[1], p->dims[2], p->dims[3]);
+  snprintf(loc, sizeof(loc), "%dx%dx%dx%d", p->L[0], p->L[1], p->L[2], p->L[3]);
+  if(p->overlap<0) snprintf(ovl, sizeof(ovl), "-");
+  else snprintf(ovl, sizeof(ovl), "%.1f%%", 100*p->overlap);
+  printf("%5d %-9s %-11s %9.1f %9.1f %9.1f %9.1f %7s %8.2f %9.3f %6.3f %14.8e\n",
+	 p->nodes, dims, loc, 1e6*p->t[T_COMP], 1e6*p->t[T_COMM],
+	 1e6*p->t[T_SEQ], 1e6*p->t[T_OVL], ovl, p->ns_site, p->gflops,
+	 p->eff, p->norm);
+  fflush(stdout);
+}
+
+static void
+write_json(const char *file, struct dslash_args *a, struct point *pt, int n)
+{
+  static const char *scaling[] = { "none", "weak", "strong" };
+  FILE *f = fopen(file, "w");
+  int i;
+  if(!f) {
+    QMP_error("cannot open %s", file);
+    return;
+  }
+  fprintf(f, "{\n  \"benchmark\": \"QMP_dslash\",\n  \"qmp\": \"%s\",\n",
+	  QMP_version_str());
+  fprintf(f, "  \"action\": \"%s\",\n  \"nvec\": %d,\n  \"scaling\": \"%s\",\n",
+	  a->action==WILSON ? "wilson" : "staggered", a->nvec,
+	  scaling[a->scaling]);
+  fprintf(f, "  \"results\": [\n");
+  for(i=0; i<n; i++) {
+    struct point *p = &pt[i];
+    fprintf(f, "    {\"ranks\": %d, \"dims\": [%d, %d, %d, %d], "
+	    "\"local\": [%d, %d, %d, %d], \"comp_us\": %.3f, \"comm_us\": %.3f, "
+	    "\"seq_us\": %.3f, \"ovl_us\": %.3f, \"overlap\": %.4f, "
+	    "\"ns_per_site\": %.4f, \"gflops\": %.4f, \"efficiency\": %.4f}%s\n",
+	    p->nodes, p->dims[0], p->dims[1], p->dims[2], p->dims[3],
+	    p->L[0], p->L[1], p->L[2], p->L[3], 1e6*p->t[T_COMP],
+	    1e6*p->t[T_COMM], 1e6*p->t[T_SEQ], 1e6*p->t[T_OVL],
+	    p->overlap, p->ns_site, p->gflops, p->eff, i+1<n ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct dslash_args a;
+  QMP_status_t status;
+  QMP_thread_level_t req, prv;
+  struct point pt[64];
+  int npt = 0, nodes, rank, n, mu;
+
+  req = QMP_THREAD_SINGLE;
+  status = QMP_init_msg_passing(&argc, &argv, req, &prv);
+  if (status != QMP_SUCCESS) {
+    QMP_fprintf(stderr, "QMP_init failed\n");
+    return -1;
+  }
+  rank = QMP_get_node_number();
+  nodes = QMP_get_number_of_nodes();
+
+  if(parse_args(argc, argv, &a)) {
+    if(rank==0) usage(argv[0]);
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+  if(a.scaling==SCALING_STRONG && a.global[0]==0) {
+    int dims[ND];
+    factor_nodes(nodes, ND, dims);
+    for(mu=0; mu<ND; mu++) a.global[mu] = a.lat[mu]*dims[mu];
+  }
+
+  if(rank==0) {
+    printf("QMP_dslash %s: %s, %d vectors per site, %d nodes\n",
+	   QMP_version_str(), a.action==WILSON ? "wilson" : "staggered",
+	   a.nvec, nodes);
+    if(a.scaling==SCALING_STRONG)
+      printf("strong scaling, global lattice %dx%dx%dx%d\n",
+	     a.global[0], a.global[1], a.global[2], a.global[3]);
+    print_header();
+  }
+
+  n = (a.scaling==SCALING_NONE) ? nodes : 1;
+  while(1) {
+    QMP_comm_t comm;
+    int dims[ND], L[ND], ok = 1;
+    factor_nodes(n, ND, dims);
+    for(mu=0; mu<ND; mu++) {
+      if(a.scaling==SCALING_STRONG) {
+	L[mu] = a.global[mu]/dims[mu];
+	if(a.global[mu]%dims[mu]) ok = 0;
+      } else {
+	L[mu] = a.lat[mu];
+      }
+    }
+
+    /* the first n ranks run, the others wait */
+    QMP_comm_split(QMP_comm_get_allocated(), rank<n ? 0 : 1, rank, &comm);
+    if(!ok) {
+      if(rank==0) printf("%5d skipped, global lattice not divisible\n", n);
+    } else if(rank<n) {
+      struct point *p = &pt[npt];
+      QMP_comm_declare_logical_topology(comm, dims, ND);
+      run_point(&a, comm, L, dims, p);
+      /* rank 0 takes part in every point */
+      if(rank==0) {
+	if(a.scaling==SCALING_WEAK)
+	  p->eff = pt[0].t[T_OVL]/p->t[T_OVL];
+	else if(a.scaling==SCALING_STRONG)
+	  p->eff = pt[0].t[T_OVL]*pt[0].nodes/(p->t[T_OVL]*n);
+	else
+	  p->eff = 1;
+	print_point(p);
+      }
+    }
+    QMP_comm_free(comm);
+    QMP_barrier();
+    if(ok) npt++;
+
+    if(n==nodes || npt==64) break;
+    n = (2*n<nodes) ? 2*n : nodes;
+  }
+
+  if(rank==0 && a.json) write_json(a.json, &a, pt, npt);
+
+  QMP_finalize_msg_passing();
+  return 0;
+}
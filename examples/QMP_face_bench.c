@@ -0,0 +1,482 @@
+/*
+ * Face exchange with QMP derived message types versus manual packing.
+ *
+ * For a lexicographic or even-odd ordered 4d field with a given number
+ * of floats per site, the x_mu=L-1 face of every direction is sent to
+ * the next rank of a ring as
+ *   contig         a contiguous buffer of the same size (no packing),
+ *   pack           packed by hand into a contiguous buffer,
+ *   strided        QMP_declare_strided_msgmem,
+ *   strided-array  QMP_declare_strided_array_msgmem,
+ *   indexed        QMP_declare_indexed_msgmem,
+ * always received into a contiguous buffer.  The cost of declaring the
+ * message, the exchange time and the effective GB/s are reported, and
+ * the effective pack GB/s: the face bytes over the packing time for
+ * the hand pack, and over the exchange time in excess of the contig
+ * exchange of the same face for the derived types, which pack inside
+ * MPI.  An excess below 1% of the contig time is taken as 1%.  The
+ * fastest way to send each face is given by exchange time and by pack
+ * GB/s.  The strided message applies when
+ * the face is evenly strided, the strided array when it is evenly
+ * strided within each of the even and odd halves.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+#include "QMP_bench_util.h"
+
+#define ND 4
+#define MAXPIECES 16
+
+enum { LEX, EO, NLAYOUTS };
+static const char *layout_name[NLAYOUTS] = { "lex", "eo" };
+enum { M_CONTIG, M_PACK, M_STRIDED, M_STRIDED_ARRAY, M_INDEXED, NMETHODS };
+static const char *method_name[NMETHODS] =
+  { "contig", "pack", "strided", "strided-array", "indexed" };
+
+struct face_args {
+  int lat[ND];
+  int site;		/* floats per site */
+  int layouts;		/* bit mask */
+  int loops;
+  int verify;
+  const char *json;
+};
+
+/* face sites in memory order, as runs of consecutive sites */
+struct face {
+  int nsites, nruns;
+  int *start, *len;
+  int uniform;		/* all runs of equal length and spacing */
+  /* the runs as strided pieces of equal length and spacing, split
+     between the even and odd halves */
+  int npieces;
+  int pstart[MAXPIECES], plen[MAXPIECES], pnum[MAXPIECES], pstride[MAXPIECES];
+};
+
+struct result {
+  int layout, mu, method;
+  size_t bytes;
+  int nblocks;
+  double declare_us, pack_us, exch_us, gbps, pack_gbps;
+};
+
+static struct result results[NLAYOUTS*ND*NMETHODS];
+static int nresults = 0;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -lat x y z t        local lattice (8 8 8 8)\n");
+  printf("  -site n             floats per site, e.g. 24 to 72 (24)\n");
+  printf("  -layout lex|eo|all  site ordering (all)\n");
+  printf("  -loops n            exchanges per point (200)\n");
+  printf("  -v                  verify the received faces\n");
+  printf("  -json file          write the results as JSON\n");
+}
+
+static int
+parse_args(int argc, char **argv, struct face_args *a)
+{
+  int i, mu;
+  for(mu=0; mu<ND; mu++) a->lat[mu] = 8;
+  a->site = 24;
+  a->layouts = (1<<NLAYOUTS)-1;
+  a->loops = 200;
+  a->verify = 0;
+  a->json = NULL;
+
+  for(i=1; i<argc; i++) {
+    const char *o = argv[i];
+    if(strcmp(o, "-v")==0) { a->verify = 1; continue; }
+    if(strcmp(o, "-lat")==0) {
+      if(i+ND>=argc) return -1;
+      for(mu=0; mu<ND; mu++) a->lat[mu] = atoi(argv[++i]);
+      continue;
+    }
+    if(i+1>=argc) return -1;
+    const char *v = argv[++i];
+    if(strcmp(o, "-site")==0) a->site = atoi(v);
+    else if(strcmp(o, "-loops")==0) a->loops = atoi(v);
+    else if(strcmp(o, "-json")==0) a->json = v;
+    else if(strcmp(o, "-layout")==0) {
+      if(strcmp(v, "lex")==0) a->layouts = 1<<LEX;
+      else if(strcmp(v, "eo")==0) a->layouts = 1<<EO;
+      else if(strcmp(v, "all")==0) a->layouts = (1<<NLAYOUTS)-1;
+      else return -1;
+    }
+    else return -1;
+  }
+  for(mu=0; mu<ND; mu++) if(a->lat[mu]<1) return -1;
+  if((a->layouts&(1<<EO)) && a->lat[0]%2) {
+    if(QMP_get_node_number()==0)
+      printf("even-odd layout needs an even x extent\n");
+    return -1;
+  }
+  if(a->site<1 || a->loops<1) return -1;
+  return 0;
+}
+
+/* memory index of site x; even-odd stores the even sites first */
+static int
+site_index(int layout, const int L[], const int x[])
+{
+  int mu, lex = 0, vol = 1, p = 0;
+  for(mu=ND-1; mu>=0; mu--) lex = lex*L[mu] + x[mu];
+  if(layout==LEX) return lex;
+  for(mu=0; mu<ND; mu++) {
+    vol *= L[mu];
+    p += x[mu];
+  }
+  return (p%2)*(vol/2) + lex/2;
+}
+
+static int
+compare_int(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+static void
+face_init(struct face *f, int layout, const int L[], int mu)
+{
+  int i, k, vol = 1, half, x[ND], *s;
+  for(k=0; k<ND; k++) vol *= L[k];
+  half = (layout==EO) ? vol/2 : vol;
+  f->nsites = vol/L[mu];
+  s = malloc(f->nsites*sizeof(int));
+  for(i=k=0; i<vol; i++) {
+    int r = i, nu;
+    for(nu=0; nu<ND; nu++) {
+      x[nu] = r % L[nu];
+      r /= L[nu];
+    }
+    if(x[mu]==L[mu]-1) s[k++] = site_index(layout, L, x);
+  }
+  qsort(s, f->nsites, sizeof(int), compare_int);
+
+  f->start = malloc(f->nsites*sizeof(int));
+  f->len = malloc(f->nsites*sizeof(int));
+  f->nruns = 0;
+  for(i=0; i<f->nsites; i++) {
+    if(f->nruns>0 && f->start[f->nruns-1]+f->len[f->nruns-1]==s[i]) {
+      f->len[f->nruns-1]++;
+    } else {
+      f->start[f->nruns] = s[i];
+      f->len[f->nruns] = 1;
+      f->nruns++;
+    }
+  }
+  free(s);
+
+  f->uniform = 1;
+  for(i=1; i<f->nruns; i++)
+    if(f->len[i]!=f->len[0] ||
+       f->start[i]-f->start[i-1]!=f->start[1]-f->start[0]) f->uniform = 0;
+
+  /* greedy split into pieces of runs with equal length and spacing */
+  f->npieces = 0;
+  for(i=0; i<f->nruns; ) {
+    int p = f->npieces;
+    if(p==MAXPIECES) {
+      f->npieces = MAXPIECES+1;
+      break;
+    }
+    f->pstart[p] = f->start[i];
+    f->plen[p] = f->len[i];
+    f->pnum[p] = 1;
+    f->pstride[p] = f->len[i];
+    if(i+1<f->nruns && f->len[i+1]==f->len[i] &&
+       (f->start[i+1]<half)==(f->start[i]<half)) {
+      f->pstride[p] = f->start[i+1] - f->start[i];
+      for(k=i+1; k<f->nruns && f->len[k]==f->len[i] &&
+	    f->start[k]-f->start[k-1]==f->pstride[p] &&
+	    (f->start[k]<half)==(f->start[i]<half); k++)
+	f->pnum[p]++;
+    }
+    i += f->pnum[p];
+    f->npieces++;
+  }
+}
+
+static void
+face_free(struct face *f)
+{
+  free(f->start);
+  free(f->len);
+}
+
+static float
+site_value(int rank, int site, int k)
+{
+  return (float)((rank*7919 + site*31 + k) % 65536);
+}
+
+static void
+pack(const struct face *f, const float *field, float *buf, int site)
+{
+  int i;
+  for(i=0; i<f->nruns; i++) {
+    size_t n = (size_t)f->len[i]*site;
+    memcpy(buf, field + (size_t)f->start[i]*site, n*sizeof(float));
+    buf += n;
+  }
+}
+
+/* NULL if the method does not apply to this face */
+static QMP_msgmem_t
+declare(int method, const struct face *f, float *field, float *buf, int site)
+{
+  size_t sb = site*sizeof(float);
+  int i;
+  switch(method) {
+  case M_CONTIG:
+  case M_PACK:
+    return QMP_declare_msgmem(buf, f->nsites*sb);
+  case M_STRIDED:
+    if(!f->uniform) return NULL;
+    return QMP_declare_strided_msgmem(field + (size_t)f->start[0]*site,
+				      f->len[0]*sb, f->nruns,
+				      (f->nruns>1 ? f->start[1]-f->start[0] :
+				       f->len[0])*sb);
+  case M_STRIDED_ARRAY: {
+    if(f->npieces>MAXPIECES) return NULL;
+    void *base[MAXPIECES];
+    size_t blksize[MAXPIECES];
+    int nblocks[MAXPIECES];
+    ptrdiff_t stride[MAXPIECES];
+    for(i=0; i<f->npieces; i++) {
+      base[i] = field + (size_t)f->pstart[i]*site;
+      blksize[i] = f->plen[i]*sb;
+      nblocks[i] = f->pnum[i];
+      stride[i] = f->pstride[i]*sb;
+    }
+    return QMP_declare_strided_array_msgmem(base, blksize, nblocks, stride,
+					    f->npieces);
+  }
+  case M_INDEXED:
+    return QMP_declare_indexed_msgmem(field, f->len, f->start, (int)sb,
+				      f->nruns);
+  }
+  return NULL;
+}
+
+/* returns the number of wrong floats, -1 if the method does not apply */
+static int
+run_point(struct face_args *a, int layout, int mu, int method,
+	  const struct face *f, float *field, float *sbuf, float *rbuf,
+	  double *t, double contig_us, struct result *res)
+{
+  size_t bytes = (size_t)f->nsites*a->site*sizeof(float);
+  int nodes = QMP_get_number_of_nodes();
+  int rank = QMP_get_node_number();
+  int i, nerr = 0;
+  double t0;
+
+  /* the same on every rank, the faces have the same shape */
+  QMP_msgmem_t smm = declare(method, f, field, sbuf, a->site);
+  if(!smm) return -1;
+
+  res->layout = layout;
+  res->mu = mu;
+  res->method = method;
+  res->bytes = bytes;
+  res->nblocks = (method==M_CONTIG) ? 1 : f->nruns;
+
+  /* declaration of the message memory and handle */
+  int ndecl = (a->loops<100) ? a->loops : 100;
+  t0 = QMP_time();
+  for(i=0; i<ndecl; i++) {
+    QMP_msgmem_t m = declare(method, f, field, sbuf, a->site);
+    QMP_msghandle_t h = (nodes>1) ? QMP_declare_send_relative(m, 0, 1, 0) : NULL;
+    if(h) QMP_free_msghandle(h);
+    QMP_free_msgmem(m);
+  }
+  res->declare_us = 1e6*(QMP_time() - t0)/ndecl;
+  QMP_max_double(&res->declare_us);
+
+  res->pack_us = 0;
+  res->pack_gbps = 0;
+  if(method==M_PACK) {
+    t0 = QMP_time();
+    for(i=0; i<a->loops; i++) pack(f, field, sbuf, a->site);
+    res->pack_us = 1e6*(QMP_time() - t0)/a->loops;
+    QMP_max_double(&res->pack_us);
+    if(res->pack_us>0) res->pack_gbps = 1e-3*bytes/res->pack_us;
+  }
+
+  res->exch_us = 0;
+  res->gbps = 0;
+  if(nodes>1) {
+    QMP_msgmem_t rmm = QMP_declare_msgmem(rbuf, bytes);
+    QMP_msghandle_t mh[2];
+    mh[0] = QMP_declare_receive_relative(rmm, 0, -1, 0);
+    mh[1] = QMP_declare_send_relative(smm, 0, 1, 0);
+    QMP_msghandle_t h = QMP_declare_multiple(mh, 2);
+    memset(rbuf, 0, bytes);
+    QMP_barrier();
+    for(i=-10; i<a->loops; i++) {
+      t0 = QMP_time();
+      if(method==M_PACK) pack(f, field, sbuf, a->site);
+      QMP_start(h);
+      QMP_wait(h);
+      if(i>=0) t[i] = 1e6*(QMP_time() - t0);
+    }
+    qsort(t, a->loops, sizeof(double), compare_double);
+    res->exch_us = percentile(t, a->loops, 0.5);
+    res->gbps = 1e-3*bytes/res->exch_us;
+    if(method!=M_CONTIG && method!=M_PACK && contig_us>0) {
+      double extra = res->exch_us - contig_us;
+      if(extra<0.01*contig_us) extra = 0.01*contig_us;
+      res->pack_gbps = 1e-3*bytes/extra;
+    }
+
+    if(a->verify && method!=M_CONTIG) {
+      int src = (rank+nodes-1)%nodes, r, s, k;
+      const float *p = rbuf;
+      for(r=0; r<f->nruns; r++)
+	for(s=f->start[r]; s<f->start[r]+f->len[r]; s++)
+	  for(k=0; k<a->site; k++)
+	    nerr += *p++ != site_value(src, s, k);
+    }
+    QMP_free_msghandle(h);
+    QMP_free_msgmem(rmm);
+  }
+  QMP_free_msgmem(smm);
+  QMP_sum_int(&nerr);
+  return nerr;
+}
+
+static void
+write_json(const char *file, struct face_args *a)
+{
+  FILE *f = fopen(file, "w");
+  int i;
+  if(!f) {
+    QMP_error("cannot open %s", file);
+    return;
+  }
+  fprintf(f, "{\n  \"benchmark\": \"QMP_face_bench\",\n  \"qmp\": \"%s\",\n",
+	  QMP_version_str());
+  fprintf(f, "  \"nodes\": %d,\n  \"lattice\": [%d, %d, %d, %d],\n"
+	  "  \"site_floats\": %d,\n  \"results\": [\n", QMP_get_number_of_nodes(),
+	  a->lat[0], a->lat[1], a->lat[2], a->lat[3], a->site);
+  for(i=0; i<nresults; i++) {
+    struct result *r = &results[i];
+    fprintf(f, "    {\"layout\": \"%s\", \"mu\": %d, \"method\": \"%s\", "
+	    "\"bytes\": %lu, \"blocks\": %d, \"declare_us\": %.3f, "
+	    "\"pack_us\": %.3f, \"exchange_us\": %.3f, \"gbps\": %.4f, "
+	    "\"pack_gbps\": %.4f}%s\n",
+	    layout_name[r->layout], r->mu, method_name[r->method],
+	    (unsigned long)r->bytes, r->nblocks, r->declare_us, r->pack_us,
+	    r->exch_us, r->gbps, r->pack_gbps, i+1<nresults ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct face_args a;
+  QMP_status_t status;
+  QMP_thread_level_t req, prv;
+  int layout, mu, method, i, k, vol = 1, rank, nodes, nerr = 0;
+
+  req = QMP_THREAD_SINGLE;
+  status = QMP_init_msg_passing(&argc, &argv, req, &prv);
+  if (status != QMP_SUCCESS) {
+    QMP_fprintf(stderr, "QMP_init failed\n");
+    return -1;
+  }
+  rank = QMP_get_node_number();
+  nodes = QMP_get_number_of_nodes();
+
+  if(parse_args(argc, argv, &a)) {
+    if(rank==0) usage(argv[0]);
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+  /* a ring: every face goes to the next rank */
+  QMP_declare_logical_topology(&nodes, 1);
+
+  for(mu=0; mu<ND; mu++) vol *= a.lat[mu];
+  float *field = malloc((size_t)vol*a.site*sizeof(float));
+  size_t maxface = 0;
+  for(mu=0; mu<ND; mu++)
+    if((size_t)vol/a.lat[mu] > maxface) maxface = vol/a.lat[mu];
+  maxface *= a.site*sizeof(float);
+  QMP_mem_t *smem = QMP_allocate_memory(maxface);
+  QMP_mem_t *rmem = QMP_allocate_memory(maxface);
+  float *sbuf = QMP_get_memory_pointer(smem);
+  float *rbuf = QMP_get_memory_pointer(rmem);
+  double *t = malloc(a.loops*sizeof(double));
+  for(i=0; i<vol; i++)
+    for(k=0; k<a.site; k++) field[(size_t)i*a.site+k] = site_value(rank, i, k);
+  memset(sbuf, 0, maxface);
+
+  if(rank==0) {
+    printf("QMP_face_bench %s: %d nodes, lattice %dx%dx%dx%d, %d floats per site\n",
+	   QMP_version_str(), nodes, a.lat[0], a.lat[1], a.lat[2], a.lat[3],
+	   a.site);
+    if(nodes==1) printf("the exchange needs at least 2 nodes\n");
+    printf("%-6s %2s %-13s %9s %7s %10s %9s %9s %8s %9s\n", "layout", "mu",
+	   "method", "bytes", "blocks", "declare_us", "pack_us", "exch_us",
+	   "GB/s", "pack_GB/s");
+  }
+
+  for(layout=0; layout<NLAYOUTS; layout++) {
+    if(!(a.layouts&(1<<layout))) continue;
+    for(mu=0; mu<ND; mu++) {
+      struct face f;
+      int best = -1, bestpack = -1;
+      double contig_us = 0;
+      face_init(&f, layout, a.lat, mu);
+      for(method=0; method<NMETHODS; method++) {
+	struct result *r = &results[nresults];
+	int e = run_point(&a, layout, mu, method, &f, field, sbuf, rbuf, t,
+			  contig_us, r);
+	if(e<0) {
+	  if(rank==0) printf("%-6s %2d %-13s %9s\n", layout_name[layout], mu,
+			     method_name[method], "n/a");
+	  continue;
+	}
+	nresults++;
+	if(method==M_CONTIG) contig_us = r->exch_us;
+	if(method!=M_CONTIG &&
+	   (best<0 || r->exch_us < results[best].exch_us)) best = nresults-1;
+	if(method!=M_CONTIG && r->pack_gbps>0 &&
+	   (bestpack<0 || r->pack_gbps > results[bestpack].pack_gbps))
+	  bestpack = nresults-1;
+	if(rank==0) {
+	  printf("%-6s %2d %-13s %9lu %7d %10.3f %9.3f %9.3f %8.4f %9.4f%s\n",
+		 layout_name[layout], mu, method_name[method],
+		 (unsigned long)r->bytes, r->nblocks, r->declare_us,
+		 r->pack_us, r->exch_us, r->gbps, r->pack_gbps,
+		 e ? "  BAD DATA" : "");
+	  fflush(stdout);
+	}
+	nerr += e;
+      }
+      if(rank==0 && nodes>1 && best>=0)
+	printf("%-6s %2d best: %s by exchange, %s by pack GB/s\n",
+	       layout_name[layout], mu, method_name[results[best].method],
+	       bestpack>=0 ? method_name[results[bestpack].method] : "-");
+      face_free(&f);
+    }
+  }
+
+  if(rank==0) {
+    if(a.json) write_json(a.json, &a);
+    if(a.verify) printf("verify: %d errors\n", nerr);
+  }
+
+  free(t);
+  free(field);
+  QMP_free_memory(smem);
+  QMP_free_memory(rmem);
+  QMP_finalize_msg_passing();
+  return nerr ? 1 : 0;
+}
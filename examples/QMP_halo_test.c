@@ -0,0 +1,225 @@
+/*
+ * Check of the halo exchange.
+ *
+ * Every site of a field with ghost zones holds its global lattice
+ * coordinates.  After the exchange every ghost must hold the
+ * coordinates of the site it mirrors, with periodic wrapping: in
+ * QMP_HALO_FACES mode the ghosts with one coordinate outside the
+ * subgrid, in QMP_HALO_CORNERS mode all of them, which are filled by
+ * forwarding through the face neighbors.  Both QMP_declare_halo and
+ * QMP_declare_subgrid_halo are checked, for every depth up to -depth
+ * and on uneven layouts with -uneven.  Prints the number of wrong
+ * ghosts and returns nonzero if there are any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+
+#define MAXDIM 8
+
+static int ndim = 4;
+static int lat[MAXDIM] = { 8, 8, 8, 8 };
+static int maxdepth = 2;
+static int uneven = 0;
+static int loops = 3;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -lat x y ...   global lattice (8 8 8 8)\n");
+  printf("  -depth n       largest ghost depth checked (2)\n");
+  printf("  -uneven        allow uneven layouts\n");
+  printf("  -loops n       exchanges per check (3)\n");
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-lat")==0) {
+      ndim = 0;
+      while(i+1<argc && ndim<MAXDIM && argv[i+1][0]!='-')
+	lat[ndim++] = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-depth")==0 && i+1<argc) {
+      maxdepth = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-uneven")==0) {
+      uneven = 1;
+    } else if(strcmp(argv[i], "-loops")==0 && i+1<argc) {
+      loops = atoi(argv[++i]);
+    } else {
+      if(QMP_is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (ndim<1 || maxdepth<1 || loops<1);
+}
+
+/* number of sites of the padded subgrid, and its sizes */
+static size_t
+padded_sites(const int local[], int depth, int padded[])
+{
+  size_t n = 1;
+  int i;
+  for(i=0; i<ndim; i++) {
+    padded[i] = local[i] + 2*depth;
+    n *= padded[i];
+  }
+  return n;
+}
+
+/* the global coordinates of every site, -1 in the ghosts */
+static void
+fill(int *field, const int local[], const int origin[], int depth)
+{
+  int padded[MAXDIM], x[MAXDIM], i, ghost;
+  size_t n = padded_sites(local, depth, padded), s;
+  for(s=0; s<n; s++) {
+    size_t r = s;
+    ghost = 0;
+    for(i=0; i<ndim; i++) {
+      x[i] = (int)(r % padded[i]) - depth;
+      r /= padded[i];
+      if(x[i]<0 || x[i]>=local[i]) ghost = 1;
+    }
+    for(i=0; i<ndim; i++)
+      field[s*ndim+i] = ghost ? -1 : origin[i] + x[i];
+  }
+}
+
+/* number of wrong ghosts, those off more than one face are only
+   checked with corners */
+static int
+check(const int *field, const int local[], const int origin[], int depth,
+      int corners)
+{
+  int padded[MAXDIM], x[MAXDIM], i, nout, errs = 0;
+  size_t n = padded_sites(local, depth, padded), s;
+  for(s=0; s<n; s++) {
+    size_t r = s;
+    nout = 0;
+    for(i=0; i<ndim; i++) {
+      x[i] = (int)(r % padded[i]) - depth;
+      r /= padded[i];
+      if(x[i]<0 || x[i]>=local[i]) nout++;
+    }
+    if(nout==0 || (nout>1 && !corners)) continue;
+    for(i=0; i<ndim; i++) {
+      int g = ((origin[i] + x[i]) % lat[i] + lat[i]) % lat[i];
+      if(field[s*ndim+i]!=g) {
+	if(errs<5)
+	  QMP_fprintf(stderr, "depth %d %s: ghost %lu axis %d has %d, "
+		      "expected %d\n", depth, corners ? "corners" : "faces",
+		      (unsigned long)s, i, field[s*ndim+i], g);
+	errs++;
+	break;
+      }
+    }
+  }
+  return errs;
+}
+
+static int
+run(int subgrid, int depth, int corners)
+{
+  const int *local = QMP_get_subgrid_dimensions();
+  const int *origin = QMP_get_subgrid_origin();
+  int padded[MAXDIM], i, errs = 0;
+  size_t n = padded_sites(local, depth, padded);
+  int flags = corners ? QMP_HALO_CORNERS : QMP_HALO_FACES;
+
+  QMP_mem_t *mem = QMP_allocate_memory(n*ndim*sizeof(int));
+  if(!mem) {
+    QMP_fprintf(stderr, "cannot allocate the field\n");
+    return 1;
+  }
+  int *field = (int *) QMP_get_memory_pointer(mem);
+
+  QMP_halo_t h = subgrid ?
+    QMP_declare_subgrid_halo(field, depth, ndim*sizeof(int), flags) :
+    QMP_declare_halo(field, local, ndim, depth, ndim*sizeof(int), flags);
+  if(!h) {
+    QMP_fprintf(stderr, "cannot declare the halo\n");
+    QMP_free_memory(mem);
+    return 1;
+  }
+  for(i=0; i<loops; i++) {
+    fill(field, local, origin, depth);
+    if(QMP_halo_exchange(h)!=QMP_SUCCESS) errs++;
+    errs += check(field, local, origin, depth, corners);
+  }
+  QMP_free_halo(h);
+  QMP_free_memory(mem);
+  return errs;
+}
+
+int
+main(int argc, char *argv[])
+{
+  QMP_thread_level_t provided;
+  int depth, corners, subgrid, even = 1, i;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_SINGLE, &provided)
+     != QMP_SUCCESS) {
+    fprintf(stderr, "QMP_init failed\n");
+    return 1;
+  }
+  if(parse_args(argc, argv)) {
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  if(uneven) QMP_set_layout_uneven(QMP_TRUE);
+  if(QMP_layout_grid(lat, ndim)!=QMP_SUCCESS) {
+    if(QMP_is_primary_node())
+      fprintf(stderr, "no layout of the lattice on %d nodes\n",
+	      QMP_get_number_of_nodes());
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  /* QMP_declare_halo needs the same subgrid on every node, and no
+     ghost zone may be deeper than the smallest subgrid */
+  const int *local = QMP_get_subgrid_dimensions();
+  double lmin = local[0];
+  for(i=0; i<ndim; i++) {
+    double l = local[i];
+    QMP_max_double(&l);
+    if(l!=local[i]) even = 0;
+    if(local[i]<lmin) lmin = local[i];
+  }
+  QMP_min_double(&lmin);
+  QMP_sum_int(&even);
+  even = (even==QMP_get_number_of_nodes());
+  if(maxdepth>lmin) maxdepth = (int)lmin;
+
+  if(QMP_is_primary_node()) {
+    const int *geom = QMP_get_logical_dimensions();
+    printf("lattice");
+    for(i=0; i<ndim; i++) printf(" %d", lat[i]);
+    printf(" on nodes");
+    for(i=0; i<QMP_get_logical_number_of_dimensions(); i++)
+      printf(" %d", geom[i]);
+    printf("%s\n", even ? "" : " (uneven)");
+  }
+
+  int total = 0;
+  for(subgrid=!even; subgrid<2; subgrid++) {
+    for(depth=1; depth<=maxdepth; depth++) {
+      for(corners=0; corners<2; corners++) {
+	int errs = run(subgrid, depth, corners);
+	QMP_sum_int(&errs);
+	total += errs;
+	if(QMP_is_primary_node())
+	  printf("%-18s depth %d %-8s %d errors\n",
+		 subgrid ? "declare_subgrid" : "declare_halo", depth,
+		 corners ? "corners" : "faces", errs);
+      }
+    }
+  }
+
+  QMP_finalize_msg_passing();
+  return total!=0;
+}
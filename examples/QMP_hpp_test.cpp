@@ -0,0 +1,172 @@
+/*
+ * Check of the C++ interface qmp.hpp.
+ *
+ * The constexpr lattice helpers are checked at compile time.  Every
+ * node sends a std::vector forward and a std::array backward on a ring
+ * of all nodes with the handles combined by MsgHandle::multiple, each
+ * message memory declared from the range, and checks what arrives.  The
+ * sum and max of int64_t, float and long double values, of scalars, of
+ * a pointer and count and of a range, must give the exact values,
+ * including an int64_t beyond 32 bits.  Needs a message passing build,
+ * the single node build cannot send to itself.  Prints the number of
+ * errors and returns nonzero if there are any.
+ */
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "qmp.hpp"
+
+static int loops = 3;
+static int count = 100;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -count n       elements of the vector message (100)\n");
+  printf("  -loops n       exchanges (3)\n");
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-count")==0 && i+1<argc) {
+      count = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-loops")==0 && i+1<argc) {
+      loops = atoi(argv[++i]);
+    } else {
+      if(QMP::is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (count<1 || loops<1);
+}
+
+/* the lattice helpers are usable in constant expressions */
+namespace {
+  /* std::array comparison is constexpr only from C++20 */
+  template<size_t N>
+  constexpr bool same(const QMP::coords<N> &a, const QMP::coords<N> &b) {
+    for(size_t i=0; i<N; i++) if(a[i] != b[i]) return false;
+    return true;
+  }
+
+  constexpr QMP::coords<4> dims{ 4, 6, 2, 8 };
+  constexpr QMP::coords<4> x{ 3, 5, 1, 7 };
+  static_assert(QMP::volume(dims) == 384, "volume");
+  static_assert(QMP::lex_index(x, dims) == 383, "lex_index");
+  static_assert(QMP::lex_index(QMP::coords<4>{ 1, 0, 0, 0 }, dims) == 1,
+		"first coordinate runs fastest");
+  static_assert(same(QMP::lex_coords(QMP::lex_index(x, dims), dims), x),
+		"lex_coords inverts lex_index");
+  static_assert(QMP::parity(x) == 0, "parity");
+  static_assert(QMP::parity(QMP::shift(x, dims, 2, 1)) == 1, "parity");
+  static_assert(QMP::shift(x, dims, 0, 1)[0] == 0, "forward wraps");
+  static_assert(QMP::shift(QMP::coords<4>{}, dims, 3, -1)[3] == 7,
+		"backward wraps");
+  static_assert(same(QMP::local_dims(dims, QMP::coords<4>{ 2, 3, 1, 4 }),
+		     QMP::coords<4>{ 2, 2, 2, 2 }), "local_dims");
+  static_assert(QMP::local_dims(dims, QMP::coords<4>{ 3, 1, 1, 1 })[0] == 0,
+		"local_dims of an uneven split");
+  static_assert(QMP::datatype<std::int64_t>::value == QMP_TYPE_LONG ||
+		QMP::datatype<std::int64_t>::value == QMP_TYPE_INT64,
+		"int64_t is reducible");
+  static_assert(QMP::datatype<long double>::value == QMP_TYPE_LONG_DOUBLE,
+		"long double");
+  static_assert(!QMP::is_reducible_v<char *>, "pointers are not reducible");
+}
+
+/* ring exchange of a vector forward and an array backward */
+static int
+exchange(int n, int me)
+{
+  int errs = 0, l, i;
+  int next = (me+1)%n, prev = (me+n-1)%n;
+  std::vector<double> sfwd(count), rfwd(count);
+  std::array<int, 3> sbwd{}, rbwd{};
+  QMP::MsgMem msfwd(sfwd), mrfwd(rfwd), msbwd(sbwd), mrbwd(rbwd);
+
+  std::vector<QMP::MsgHandle> hs;
+  hs.push_back(QMP::MsgHandle::receive_from(mrfwd, prev));
+  hs.push_back(QMP::MsgHandle::receive_from(mrbwd, next));
+  hs.push_back(QMP::MsgHandle::send_to(msfwd, next));
+  hs.push_back(QMP::MsgHandle::send_to(msbwd, prev));
+  QMP::MsgHandle all = QMP::MsgHandle::multiple(std::move(hs));
+  if(!hs.empty()) errs++;
+
+  for(l=0; l<loops; l++) {
+    for(i=0; i<count; i++) sfwd[i] = me + 1e-3*i + l;
+    sbwd = { me, l, -1 };
+    if(all.start()!=QMP_SUCCESS || all.wait()!=QMP_SUCCESS) errs++;
+    for(i=0; i<count; i++) if(rfwd[i]!=prev + 1e-3*i + l) break;
+    if(i<count || rbwd[0]!=next || rbwd[1]!=l || rbwd[2]!=-1) {
+      if(errs<5)
+	QMP_fprintf(stderr, "exchange %d: from %g and %d, expected %d and %d\n",
+		    l, rfwd[0]-l, rbwd[0], prev, next);
+      errs++;
+    }
+  }
+  return errs;
+}
+
+/* sum and max, exact for these values */
+static int
+reductions(int n, int me)
+{
+  int errs = 0, i;
+  const std::int64_t big = (std::int64_t)1 << 40;
+  std::int64_t i64 = big*(me+1), i64max = big*(me+1);
+  float f = me + 0.5f;
+  long double ld = 0.25L*me, ldmax = 0.25L*me;
+  std::vector<float> fv(4);
+  long double la[2] = { 1.0L, (long double)me };
+  for(i=0; i<4; i++) fv[i] = (float)(i*me);
+
+  if(QMP::sum(i64)!=QMP_SUCCESS || QMP::max(i64max)!=QMP_SUCCESS ||
+     QMP::max(f)!=QMP_SUCCESS || QMP::sum(ld)!=QMP_SUCCESS ||
+     QMP::max(ldmax)!=QMP_SUCCESS || QMP::sum(fv)!=QMP_SUCCESS ||
+     QMP::sum(la, 2)!=QMP_SUCCESS)
+    errs++;
+
+  std::int64_t nn = (std::int64_t)n*(n-1)/2;
+  if(i64!=big*(nn+n)) errs++;
+  if(i64max!=big*n) errs++;
+  if(f!=n-0.5f) errs++;
+  if(ld!=0.25L*nn) errs++;
+  if(ldmax!=0.25L*(n-1)) errs++;
+  for(i=0; i<4; i++) if(fv[i]!=(float)(i*nn)) errs++;
+  if(la[0]!=n || la[1]!=nn) errs++;
+  if(errs)
+    QMP_fprintf(stderr, "reductions: sum %lld max %lld of int64_t, max %g "
+		"of float, sum %Lg max %Lg of long double\n", (long long)i64,
+		(long long)i64max, f, ld, ldmax);
+  return errs;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int errs = 0;
+  try {
+    QMP::Session session(&argc, &argv);
+    if(parse_args(argc, argv)) return 1;
+
+    int n = QMP::number_of_nodes(), me = QMP::node_number();
+    errs += exchange(n, me);
+    errs += reductions(n, me);
+
+    QMP::sum(errs);
+    if(QMP::is_primary_node())
+      printf("%d nodes, %d exchanges of %d doubles: %d errors\n", n, loops,
+	     count, errs);
+  } catch(const QMP::error &e) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return errs!=0;
+}
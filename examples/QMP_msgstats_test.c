@@ -0,0 +1,177 @@
+/*
+ * Check of the message handle statistics.
+ *
+ * On the logical topology of the layout of -lat, every node combines
+ * with QMP_declare_multiple a send forward and backward on each split
+ * axis and the matching receives, the messages on axis mu of
+ * (mu+1)*bytes bytes, and starts and waits for the combined handle
+ * -loops times.  QMP_get_msghandle_stats must then count -loops starts
+ * and completions of the combined handle with all of its bytes, and by
+ * axis and direction the two messages of each direction with their
+ * bytes, nothing on the axes which are not split and nothing outside
+ * the axes.  The latency histogram of every counter must hold all of
+ * its completions.  Run with -qmp-msg-report to also exercise the
+ * machine wide totals and print them at the end.  Needs a message
+ * passing build, the single node build cannot send to itself.  Prints
+ * the number of errors and returns nonzero if there are any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+
+#define MAXDIM 8
+
+static int ndim = 4;
+static int lat[MAXDIM] = { 8, 8, 8, 8 };
+static int bytes = 64;
+static int loops = 10;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -lat x y ...   global lattice (8 8 8 8)\n");
+  printf("  -bytes n       bytes of the messages on axis 0 (64)\n");
+  printf("  -loops n       starts of the combined handle (10)\n");
+  printf("  -qmp-msg-report  also print the machine wide totals\n");
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-lat")==0) {
+      ndim = 0;
+      while(i+1<argc && ndim<MAXDIM && argv[i+1][0]!='-')
+	lat[ndim++] = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-bytes")==0 && i+1<argc) {
+      bytes = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-loops")==0 && i+1<argc) {
+      loops = atoi(argv[++i]);
+    } else {
+      if(QMP_is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (ndim<1 || bytes<1 || loops<1);
+}
+
+/* compare a counter with the expected messages and bytes */
+static int
+check_counter(const char *name, const QMP_msg_counter_t *c, uint64_t starts,
+	      uint64_t completions, uint64_t nbytes)
+{
+  uint64_t hist = 0;
+  int i;
+  for(i=0; i<QMP_MSG_NBINS; i++) hist += c->histogram[i];
+  if(c->starts==starts && c->completions==completions && c->bytes==nbytes &&
+     hist==completions && c->latency>=0 && c->wait>=0 &&
+     c->latency_max<=c->latency)
+    return 0;
+  QMP_fprintf(stderr, "%s: %llu starts, %llu completions, %llu bytes, "
+	      "%llu in the histogram, expected %llu %llu %llu\n", name,
+	      (unsigned long long)c->starts, (unsigned long long)c->completions,
+	      (unsigned long long)c->bytes, (unsigned long long)hist,
+	      (unsigned long long)starts, (unsigned long long)completions,
+	      (unsigned long long)nbytes);
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  QMP_thread_level_t provided;
+  int i, mu, l, nd, nmh = 0, errs = 0;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_SINGLE, &provided)
+     != QMP_SUCCESS) {
+    fprintf(stderr, "QMP_init failed\n");
+    return 1;
+  }
+  if(parse_args(argc, argv)) {
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+  if(QMP_layout_grid(lat, ndim)!=QMP_SUCCESS) {
+    if(QMP_is_primary_node())
+      fprintf(stderr, "no layout of the lattice on %d nodes\n",
+	      QMP_get_number_of_nodes());
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  nd = QMP_get_logical_number_of_dimensions();
+  const int *geom = QMP_get_logical_dimensions();
+
+  /* per axis: receive from backward and forward, send backward and
+     forward */
+  char *buf[MAXDIM][4];
+  QMP_msgmem_t mm[MAXDIM][4];
+  QMP_msghandle_t mh[4*MAXDIM];
+  uint64_t total = 0;
+  for(mu=0; mu<nd; mu++) {
+    size_t n = (size_t)(mu+1)*bytes;
+    if(geom[mu]==1) continue;
+    for(i=0; i<4; i++) {
+      buf[mu][i] = (char *) malloc(n);
+      memset(buf[mu][i], i, n);
+      mm[mu][i] = QMP_declare_msgmem(buf[mu][i], n);
+    }
+    mh[nmh++] = QMP_declare_receive_relative(mm[mu][0], mu, -1, 0);
+    mh[nmh++] = QMP_declare_receive_relative(mm[mu][1], mu, +1, 0);
+    mh[nmh++] = QMP_declare_send_relative(mm[mu][2], mu, -1, 0);
+    mh[nmh++] = QMP_declare_send_relative(mm[mu][3], mu, +1, 0);
+    total += 4*n;
+  }
+  for(i=0; i<nmh; i++) if(!mh[i]) errs++;
+  if(nmh==0 || errs) {
+    if(QMP_is_primary_node())
+      fprintf(stderr, "no messages to check on %d nodes\n",
+	      QMP_get_number_of_nodes());
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+  QMP_msghandle_t all = QMP_declare_multiple(mh, nmh);
+
+  for(l=0; l<loops; l++)
+    if(QMP_start(all)!=QMP_SUCCESS || QMP_wait(all)!=QMP_SUCCESS) errs++;
+
+  QMP_msghandle_stats_t s;
+  char name[32];
+  if(QMP_get_msghandle_stats(all, &s)!=QMP_SUCCESS) errs++;
+  errs += check_counter("total", &s.total, loops, loops, loops*total);
+  for(mu=0; mu<QMP_MSG_MAXDIM; mu++) {
+    /* a send and a receive per direction */
+    uint64_t n = (mu<nd && geom[mu]>1) ? 2*loops : 0;
+    uint64_t b = n*(mu+1)*bytes;
+    for(i=0; i<2; i++) {
+      snprintf(name, sizeof(name), "axis %d %s", mu,
+	       i ? "forward" : "backward");
+      errs += check_counter(name, &s.dir[mu][i], n, n, b);
+    }
+  }
+  errs += check_counter("other", &s.other, 0, 0, 0);
+
+  QMP_free_msghandle(all);
+  for(mu=0; mu<nd; mu++) {
+    if(geom[mu]==1) continue;
+    for(i=0; i<4; i++) {
+      QMP_free_msgmem(mm[mu][i]);
+      free(buf[mu][i]);
+    }
+  }
+
+  QMP_sum_int(&errs);
+  if(QMP_is_primary_node()) {
+    printf("lattice");
+    for(i=0; i<ndim; i++) printf(" %d", lat[i]);
+    printf(" on nodes");
+    for(i=0; i<nd; i++) printf(" %d", geom[i]);
+    printf(", %d messages %d times: %d errors\n", nmh, loops, errs);
+  }
+
+  QMP_finalize_msg_passing();
+  return errs!=0;
+}
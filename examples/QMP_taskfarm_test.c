@@ -0,0 +1,142 @@
+/*
+ * Check of the task farm.
+ *
+ * Run with -qmp-job to split the nodes into job partitions.  Each job
+ * takes tasks with QMP_taskfarm_next until none are left and spends an
+ * uneven time on each, depending on the task and the job, so some jobs
+ * finish early and take more tasks.  After QMP_taskfarm_collect every
+ * task must have been completed exactly once, by the job which took
+ * it, with its result, and all nodes of a job must have been given the
+ * same tasks.  A second QMP_taskfarm_collect must give the same log.
+ * Prints the number of tasks per job and of errors and
+ * returns nonzero if there are any errors.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmp.h"
+
+static int ntasks = 100;
+static double maxms = 2;
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -qmp-job x ... job partitions\n");
+  printf("  -tasks n       number of tasks (100)\n");
+  printf("  -ms t          longest task in milliseconds (2)\n");
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-tasks")==0 && i+1<argc) {
+      ntasks = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-ms")==0 && i+1<argc) {
+      maxms = atof(argv[++i]);
+    } else {
+      if(QMP_is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (ntasks<0 || maxms<0);
+}
+
+/* uneven work: the time depends on the task and the job */
+static double
+work(int task, int job)
+{
+  double t = 1e-3*maxms*((task*7 + job*3)%10 + 1)/10;
+  double t0 = QMP_time();
+  while(QMP_time()-t0 < t);
+  return 0.5*task + 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  QMP_thread_level_t provided;
+  int i, c, task, errs = 0;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_SINGLE, &provided)
+     != QMP_SUCCESS) {
+    fprintf(stderr, "QMP_init failed\n");
+    return 1;
+  }
+  if(parse_args(argc, argv)) {
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  QMP_comm_t all = QMP_comm_get_allocated();
+  QMP_comm_t job = QMP_comm_get_job();
+  int jobno = QMP_get_job_number();
+  int njobs = QMP_get_number_of_jobs();
+  int jobroot = QMP_comm_get_node_number(job)==0;
+
+  /* times each task was taken and job+1 of the last job taking it,
+     counted on node 0 of the job */
+  double *taken = (double *) calloc(2*(ntasks>0 ? ntasks : 1), sizeof(double));
+  double *takenby = taken + ntasks;
+  double *pertask = (double *) calloc(njobs, sizeof(double));
+
+  QMP_taskfarm_t tf = QMP_taskfarm_create(ntasks);
+  if(!tf) {
+    QMP_fprintf(stderr, "cannot create the task farm\n");
+    QMP_abort(1);
+  }
+
+  while((task = QMP_taskfarm_next(tf)) >= 0) {
+    double lo = task, hi = task;
+    QMP_comm_min_double(job, &lo);
+    QMP_comm_max_double(job, &hi);
+    if(lo!=hi) errs++;
+    double result = work(task, jobno);
+    if(QMP_taskfarm_complete(tf, task, result)!=QMP_SUCCESS) errs++;
+    if(jobroot) {
+      taken[task] += 1;
+      takenby[task] = jobno + 1;
+      pertask[jobno] += 1;
+    }
+  }
+
+  if(ntasks>0) QMP_comm_sum_double_array(all, taken, 2*ntasks);
+  if(njobs>0) QMP_comm_sum_double_array(all, pertask, njobs);
+
+  /* the log is the same on every node, node 0 checks it */
+  int root = QMP_comm_get_node_number(all)==0;
+  for(c=0; c<2; c++) {
+    if(QMP_taskfarm_collect(tf, NULL)!=QMP_SUCCESS) errs++;
+    for(i=0; root && i<ntasks; i++) {
+      int j;
+      double result;
+      int bad = (taken[i]!=1);
+      if(QMP_taskfarm_get_record(tf, i, &j, NULL, &result)!=QMP_SUCCESS)
+	bad = 1;
+      else if(j+1!=takenby[i] || result!=0.5*i + 1)
+	bad = 1;
+      if(bad) {
+	if(errs<5)
+	  QMP_fprintf(stderr, "collect %d: task %d taken %g times, last by "
+		      "job %g\n", c, i, taken[i], takenby[i]-1);
+	errs++;
+      }
+    }
+  }
+  QMP_taskfarm_free(tf);
+
+  QMP_comm_sum_int(all, &errs);
+  if(root) {
+    printf("%d tasks on %d jobs:", ntasks, njobs);
+    for(i=0; i<njobs; i++) printf(" %g", pertask[i]);
+    printf(", %d errors\n", errs);
+  }
+  free(pertask);
+  free(taken);
+
+  QMP_finalize_msg_passing();
+  return errs!=0;
+}
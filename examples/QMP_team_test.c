@@ -0,0 +1,153 @@
+/*
+ * Check of the thread team reductions.
+ *
+ * A team of -threads pthreads, the main thread being thread 0, repeats
+ * QMP_team_sum_double, QMP_team_sum_double_array,
+ * QMP_team_sum_float_array, QMP_team_max_double and QMP_team_min_double
+ * with values which depend on the iteration, the node and the thread,
+ * so a thread leaving a reduction early or reading a stale result is
+ * seen as a wrong value.  Every thread checks every result.  Prints the
+ * number of wrong results and returns nonzero if there are any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "qmp.h"
+
+#define MAXLEN 1024
+
+static int nthreads = 4;
+static int iters = 1000;
+static int length = 37;
+static int node, nodes;
+static QMP_team_t team;
+
+struct thread_arg {
+  pthread_t thread;
+  int tid;
+  int errs;
+};
+
+static void
+usage(const char *prog)
+{
+  printf("%s usage:\n", prog);
+  printf("  -threads n     threads per node (4)\n");
+  printf("  -iters n       repetitions (1000)\n");
+  printf("  -length n      array length, up to %d (37)\n", MAXLEN);
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-threads")==0 && i+1<argc) {
+      nthreads = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-iters")==0 && i+1<argc) {
+      iters = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-length")==0 && i+1<argc) {
+      length = atoi(argv[++i]);
+    } else {
+      if(QMP_is_primary_node()) usage(argv[0]);
+      return 1;
+    }
+  }
+  return (nthreads<1 || iters<1 || length<1 || length>MAXLEN);
+}
+
+/* id of a thread over the job, 0 .. nodes*nthreads-1 */
+#define GLOBAL_ID(tid) ((double)node*nthreads + (tid))
+
+static void *
+worker(void *p)
+{
+  struct thread_arg *a = (struct thread_arg *) p;
+  int tid = a->tid, it, i;
+  double n = (double)nodes*nthreads;
+  double id = GLOBAL_ID(tid);
+  double d, da[MAXLEN];
+  float fa[MAXLEN];
+
+  for(it=0; it<iters; it++) {
+    /* sum of it+id+1 over all threads */
+    d = it + id + 1;
+    if(QMP_team_sum_double(team, tid, &d)!=QMP_SUCCESS ||
+       d!=n*it + n*(n+1)/2) a->errs++;
+
+    for(i=0; i<length; i++) da[i] = i + it + id;
+    if(QMP_team_sum_double_array(team, tid, da, length)!=QMP_SUCCESS)
+      a->errs++;
+    for(i=0; i<length; i++)
+      if(da[i]!=n*(i+it) + n*(n-1)/2) { a->errs++; break; }
+
+    /* small integers, exact in float */
+    for(i=0; i<length; i++) fa[i] = (float)((i + it + tid)%8);
+    if(QMP_team_sum_float_array(team, tid, fa, length)!=QMP_SUCCESS)
+      a->errs++;
+    for(i=0; i<length; i++) {
+      int j, s = 0;
+      for(j=0; j<nthreads; j++) s += (i + it + j)%8;
+      if(fa[i]!=(float)nodes*s) { a->errs++; break; }
+    }
+
+    /* the largest and smallest id, shifted each iteration */
+    d = id - it;
+    if(QMP_team_max_double(team, tid, &d)!=QMP_SUCCESS || d!=n-1-it)
+      a->errs++;
+    d = id + it;
+    if(QMP_team_min_double(team, tid, &d)!=QMP_SUCCESS || d!=it)
+      a->errs++;
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  QMP_thread_level_t provided;
+  struct thread_arg *args;
+  int t, errs = 0;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_FUNNELED, &provided)
+     != QMP_SUCCESS) {
+    fprintf(stderr, "QMP_init failed\n");
+    return 1;
+  }
+  if(parse_args(argc, argv)) {
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+  node = QMP_get_node_number();
+  nodes = QMP_get_number_of_nodes();
+
+  team = QMP_team_create(nthreads);
+  if(!team) {
+    QMP_fprintf(stderr, "cannot create the team\n");
+    QMP_abort(1);
+  }
+
+  args = (struct thread_arg *) calloc(nthreads, sizeof(struct thread_arg));
+  for(t=0; t<nthreads; t++) args[t].tid = t;
+  for(t=1; t<nthreads; t++) {
+    if(pthread_create(&args[t].thread, NULL, worker, &args[t])) {
+      QMP_fprintf(stderr, "cannot create thread %d\n", t);
+      QMP_abort(1);
+    }
+  }
+  /* thread 0 communicates, so it is the main thread */
+  worker(&args[0]);
+  for(t=1; t<nthreads; t++) pthread_join(args[t].thread, NULL);
+  for(t=0; t<nthreads; t++) errs += args[t].errs;
+  free(args);
+  QMP_team_free(team);
+
+  QMP_sum_int(&errs);
+  if(QMP_is_primary_node())
+    printf("%d nodes, %d threads, %d iterations: %d errors\n",
+	   nodes, nthreads, iters, errs);
+
+  QMP_finalize_msg_passing();
+  return errs!=0;
+}
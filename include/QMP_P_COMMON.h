@@ -5,6 +5,8 @@
 #include <dmalloc.h>
 #endif
 
+#include <sched.h>
+
 #include "qmp_config.h"
 #include "QMP_profiling.h"
 #include "qmp.h"
@@ -71,8 +73,17 @@ typedef struct QMP_machine
   QMP_status_t err_code;
 
   QMP_thread_level_t thread_level;
+
+  /* number of ranks on each physical node (1 if not uniform) */
+  int ranks_per_node;
+
+  /* physical node hierarchy of this rank */
+  QMP_node_map_t nodemap;
+
+  /* how logical topologies are mapped onto the nodes */
+  QMP_topology_mapping_t topo_mapping;
 } QMP_machine_t;
-#define QMP_MACHINE_INIT 0.0, 0, QMP_SWITCH, NULL, 0, QMP_FALSE, 0, 0, 0,0, QMP_SUCCESS, QMP_THREAD_SINGLE
+#define QMP_MACHINE_INIT 0.0, 0, QMP_SWITCH, NULL, 0, QMP_FALSE, 0, 0, 0,0, QMP_SUCCESS, QMP_THREAD_SINGLE, 1, {1,0,1,0,1,-1}, QMP_MAP_LEX
 extern QMP_machine_t *QMP_machine;
 
 /*
@@ -92,12 +103,27 @@ typedef struct QMP_logical_topology
   // permutation map of coordinate axes
   int mapdim, *map;
 
+  /* log2 of the sizes if all are powers of two, else NULL */
+  int *log_size;
+
+  /* rank <-> coordinate tables, NULL if too large to store */
+  /* rank_coords[rank*dimension+i], coord_rank[lexicographic index] */
+  int *rank_coords, *coord_rank;
+
+  /* cache of displaced neighbors, open addressing on the wrapped */
+  /* displacement (lexicographic index), empty slots have key -1 */
+  int neigh_size, neigh_count;
+  int *neigh_key, *neigh_rank;
+
   /* Neighboring nodes of the form */
   /* neigh(isign,direction)   */ 
   /*  where  isign    = +1 : plus direction */
   /*                  =  0 : negative direction */
   /*  where  dir      = 0 .. dimension-1 */
   int *neigh[2];
+
+  /* probed links to the neighbors, [2*dir+(isign>0)], NULL if not probed */
+  double *link_latency, *link_bandwidth;
 } QMP_logical_topology_t;
 
 struct QMP_comm_struct {
@@ -113,6 +139,17 @@ struct QMP_comm_struct {
 
   QMP_logical_topology_t *topo;
 
+  /* communicators split from this one, for reuse, and the number of
+     splits done on this one, the same on all nodes */
+  struct QMP_split_cache *split_cache;
+  int nsplits;
+
+  /* the cache entry whose communicator this one uses, or NULL */
+  struct QMP_split_cache *split_entry;
+
+  /* point-to-point traffic sent on this communicator, by peer */
+  struct QMP_comm_traffic *traffic;
+
 #ifdef COMM_TYPES
   COMM_TYPES
 #endif
@@ -120,7 +157,19 @@ struct QMP_comm_struct {
 #ifndef COMM_TYPES_INIT
 #define COMM_TYPES_INIT
 #endif
-#define QMP_COMM_INIT 0,0,0,0,0,NULL COMM_TYPES_INIT
+#define QMP_COMM_INIT 0,0,0,0,0,NULL,NULL,0,NULL,NULL COMM_TYPES_INIT
+
+/* a split done before: this node's color and key and the resulting
+   communicator, used by refs communicators returned by QMP_comm_split.
+   An entry dropped from the cache while in use is freed by the last of
+   them. */
+#define QMP_SPLIT_CACHE_MAX 4
+struct QMP_split_cache {
+  int color, key;
+  QMP_comm_t comm;
+  int refs, dropped;
+  struct QMP_split_cache *next;
+};
 #define QMP_topo_declared(comm) ((comm)->topo==NULL?QMP_FALSE:QMP_TRUE)
 
 // predefined communicators
@@ -128,10 +177,30 @@ extern QMP_comm_t QMP_allocated_comm;
 extern QMP_comm_t QMP_job_comm;
 extern QMP_comm_t QMP_default_comm;
 
+/* how a QMP_mem_t was allocated */
+enum MEM_kind
+{
+  MEM_malloc,
+  MEM_mapped,
+  MEM_comms,
+  MEM_shared,
+  MEM_file
+};
+
 /* Message Memory structure */
 struct QMP_mem_struct {
   void *aligned_ptr;
   void *allocated_ptr;
+  size_t nbytes;       /* bytes at allocated_ptr */
+  size_t alignment;
+  enum MEM_kind kind;
+  int fd;              /* file behind MEM_file memory */
+  int flags;
+  int pool_class;      /* size class of pool blocks, else -1 */
+  struct QMP_mem_struct *next;  /* in the pool free list */
+#ifdef MEM_TYPES
+  MEM_TYPES
+#endif
 };
 
 
@@ -202,18 +271,173 @@ struct QMP_msghandle_struct {
   int dir;
   int priority;
   int paired;
+  int disp;        /* displacement code for displaced handles, else -1 */
   char *base;
   QMP_comm_t comm;
   QMP_status_t err_code;
   QMP_msghandle_t next;
+  int id;          /* sequence number, names the handle in traces */
+  struct QMP_peer_traffic *traffic;  /* counters of the peer of a send */
+  double t_start;  /* of the last QMP_start */
+  double t_done;   /* completion seen by the backend, 0 if not yet */
+  QMP_msg_counter_t stats;
 #ifdef MH_TYPES
   MH_TYPES
 #endif
 };
 
+/* Thread team for intra-process reductions */
+#define QMP_CACHE_LINE 64
+
+struct QMP_team_slot {
+  void *buf;       /* this thread's partial result */
+  int sense;       /* this thread's barrier sense */
+  char pad[QMP_CACHE_LINE - sizeof(void *) - sizeof(int)];
+};
+
+struct QMP_team_struct {
+  /* barrier state, on its own cache line */
+  int count;
+  int sense;
+  char pad[QMP_CACHE_LINE - 2*sizeof(int)];
+
+  struct QMP_team_slot *slot;
+  void *slot_allocated;
+  int nthreads;
+  QMP_comm_t comm;
+
+  /* result of the global reduction, read by all threads */
+  void *result;
+  size_t result_size;
+  QMP_status_t status;
+};
+
+/* Halo exchange schedule */
+struct QMP_halo_copy {
+  int nblk;                    /* 0 unless the axis is local */
+  int *sidx[2], *ridx[2], *len[2];
+};
+
+struct QMP_halo_struct {
+  QMP_comm_t comm;
+  char *field;
+  int ndim;
+  int depth;
+  size_t sitesize;
+  int flags;
+  int *padded;                 /* local size plus ghosts */
+
+  int nstage;                  /* 1 for faces, ndim for corners */
+  int active;                  /* stage in flight, -1 if idle */
+  QMP_msghandle_t *stage;      /* NULL if a stage has no messages */
+  struct QMP_halo_copy *copy;  /* per axis */
+  QMP_msgmem_t *mm;
+  int nmm;
+};
+
+/* Task farm over the job partitions */
+struct QMP_taskfarm_struct {
+  int ntasks;
+  int counter;      /* task counter without a message passing backend */
+  int current;      /* task this job is working on */
+  double start;     /* time the current task was handed out */
+
+  /* completion log of this job, job is the job number plus 1 (0 if
+     not done), and the logs of all jobs combined by collect, laid out
+     the same */
+  double *job, *seconds, *result;
+  double *all;
+#ifdef TF_TYPES
+  TF_TYPES
+#endif
+};
+
+/* allocation behind QMP_mem_t, in QMP_mem.c, and the buffer pool */
+extern QMP_mem_t *QMP_mem_allocate_raw(size_t nbytes, size_t alignment, int flags);
+extern void QMP_mem_free_raw(QMP_mem_t *mem);
+extern int QMP_pool_routed;
+/* largest allocation routed through the pool, larger ones would waste
+   up to a quarter of their size in the class rounding */
+#define QMP_POOL_ROUTED_MAX ((size_t)4<<20)
+extern void QMP_pool_release(QMP_mem_t *mem);
+
+/* largest number of ranks times dimensions for rank <-> coordinate tables */
+#define QMP_TOPO_TABLE_MAX (1<<22)
+
+/* largest displacement component of displaced handles */
+#define QMP_MAX_DISPLACEMENT 3
+
+/* largest code of a displacement, its message tag must stay below
+   32767, the smallest MPI_TAG_UB allowed by the standard */
+#define QMP_MAX_DISPLACED_CODE 32000
+
+/* node aware mapping of a logical topology, in QMP_node.c */
+extern QMP_status_t QMP_node_map_topology(QMP_comm_t comm);
+extern int QMP_get_socket_id(void);
+
 #define QMP_assert(x) if(!(x)) QMP_FATAL("assert failed "#x)
-#define QMP_alloc(v,t,n) v = (t *) malloc((n)*sizeof(t))
-#define QMP_free(x) free(x)
+/* allocations are accounted per category, see QMP_memstats.c */
+#define QMP_alloc_cat(v,t,n,c) \
+  v = (t *) QMP_tracked_malloc((n)*sizeof(t), c, __FILE__, __LINE__)
+#define QMP_alloc(v,t,n) QMP_alloc_cat(v,t,n,QMP_MEMCAT_INTERNAL)
+#define QMP_free(x) QMP_tracked_free(x)
+
+/* spin lock on an int, for the short critical sections of the
+   statistics, the timers and the memory pool */
+#define QMP_spin_lock(l) \
+  do { while(__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) sched_yield(); } \
+  while(0)
+#define QMP_spin_unlock(l) __atomic_store_n(l, 0, __ATOMIC_RELEASE)
+
+extern void *QMP_tracked_malloc(size_t nbytes, QMP_mem_category_t cat,
+				const char *file, int line);
+extern void QMP_tracked_free(void *p);
+/* account memory not allocated through QMP_alloc, flags for user memory */
+extern void QMP_mem_account(QMP_mem_category_t cat, int flags,
+			    ptrdiff_t nbytes, int nobjects);
+extern int QMP_mem_report_enabled;
+extern void QMP_memory_report(void);
+extern void QMP_machine_range(double v, double r[3]);
+
+/* communication matrix, see QMP_commmatrix.c */
+extern struct QMP_peer_traffic *QMP_comm_traffic_peer(QMP_comm_t comm,
+						      int node);
+extern void QMP_comm_traffic_start(QMP_msghandle_t mh);
+extern void QMP_comm_traffic_free(QMP_comm_t comm);
+extern char *QMP_comm_matrix_file;
+
+/* per thread timers by category, see QMP_timer.c */
+extern void QMP_timer_enter(int cat);
+extern void QMP_timer_leave(void);
+extern void QMP_timer_reset(void);
+extern double QMP_timer_thread_total(void);
+
+/* load imbalance, see QMP_imbalance.c */
+extern double QMP_blocked_begin(void);
+extern void QMP_blocked_end(double t0);
+extern void QMP_imbalance_init(void);
+extern int QMP_imbalance_enabled;
+extern double QMP_imbalance_threshold;
+
+/* link probe, see QMP_probe.c */
+extern int QMP_probe_pending;
+extern void QMP_set_layout_probe_weights(const QMP_logical_topology_t *topo,
+					 const double *weights);
+
+/* message handle statistics, see QMP_msgstats.c */
+extern void QMP_msgstats_start(QMP_msghandle_t mh);
+extern void QMP_msgstats_complete(QMP_msghandle_t mh, double wait_start);
+extern int QMP_msg_report_enabled;
+extern void QMP_msg_report(void);
+
+/* call tracer, see QMP_trace.c */
+extern int QMP_trace_on;
+extern void QMP_trace_init(int sample, unsigned long size, const char *prefix);
+extern void QMP_trace_enter(const char *name);
+extern void QMP_trace_leave(void);
+extern void QMP_trace_args(long bytes, int peer, int axis, int dir, int handle);
+extern void QMP_trace_handle(QMP_msghandle_t mh);
+extern void QMP_trace_finalize(void);
 
 
 
@@ -251,10 +475,15 @@ struct QMP_msghandle_struct {
 #define LEAVE_INIT
 
 /**
- *  entry and exit to all other functions
+ *  entry and exit to all other functions, timed in the category
+ *  QMP_TIMER_CAT of the file unless given with ENTER_CAT
  */
-#define ENTER START_DEBUG START_TIMING CHECKS
-#define LEAVE END_DEBUG   END_TIMING
+#ifndef QMP_TIMER_CAT
+#define QMP_TIMER_CAT QMP_TIMER_OTHER
+#endif
+#define ENTER_CAT(cat) START_DEBUG START_TIMING(cat) START_TRACE CHECKS
+#define ENTER ENTER_CAT(QMP_TIMER_CAT)
+#define LEAVE END_TRACE END_DEBUG   END_TIMING
 
 /**
  *  turn on function debugging
@@ -268,22 +497,30 @@ extern int QMP_stack_level;
 #define END_DEBUG
 #endif
 
+/**
+ *  call tracing (-qmp-trace), annotate the current call with
+ *  QMP_TRACE_ARGS(bytes, peer, axis, dir, handle), -1 if unknown
+ */
+#define START_TRACE { if(QMP_trace_on) QMP_trace_enter(__func__); }
+#define END_TRACE   { if(QMP_trace_on) QMP_trace_leave(); }
+#define QMP_TRACE_ARGS(b,p,a,d,h) \
+  { if(QMP_trace_on) QMP_trace_args(b,p,a,d,h); }
+#define QMP_TRACE_HANDLE(mh) { if(QMP_trace_on) QMP_trace_handle(mh); }
+
+/**
+ *  time blocked in waits and collectives, for the imbalance report
+ */
+#define BLOCKED_BEGIN double qmp_blocked_t0 = QMP_blocked_begin()
+#define BLOCKED_END   QMP_blocked_end(qmp_blocked_t0)
+
 /**
  *  turn on function timing
  */
 #ifdef QMP_BUILD_TIMING
-#define START_TIMING					\
-  { if(QMP_global_m->inited) {				\
-      if(QMP_global_m->timer_started==0)		\
-	QMP_global_m->total_qmp_time -= QMP_time();	\
-      QMP_global_m->timer_started++; } }
-#define END_TIMING					\
-  { if(QMP_global_m->inited) {				\
-      QMP_global_m->timer_started--;			\
-      if(QMP_global_m->timer_started==0)		\
-	QMP_global_m->total_qmp_time += QMP_time(); } }
+#define START_TIMING(cat) { QMP_timer_enter(cat); }
+#define END_TIMING { QMP_timer_leave(); }
 #else
-#define START_TIMING
+#define START_TIMING(cat)
 #define END_TIMING
 #endif
 
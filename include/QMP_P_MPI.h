@@ -4,16 +4,23 @@
 #include <mpi.h>
 
 #define TAG_CHANNEL  11
+#define TAG_DISPLACED 16
 
 // machine specific datatypes
 
 #define MM_TYPES MPI_Datatype mpi_type;
 
 #define MH_TYPES MH_TYPES_MPI
-#define MH_TYPES_MPI MPI_Request request, *request_array;
+#define MH_TYPES_MPI MPI_Request request, *request_array; QMP_msghandle_t *child_array;
 
-#define COMM_TYPES MPI_Comm mpicomm;
-#define COMM_TYPES_INIT ,MPI_COMM_NULL
+#define MEM_TYPES MPI_Win win;
+
+#define TF_TYPES MPI_Win win; int *win_base;
+
+#define COMM_TYPES MPI_Comm mpicomm; MPI_Request pending;
+#define COMM_TYPES_INIT ,MPI_COMM_NULL,MPI_REQUEST_NULL
+
+extern MPI_Comm QMP_node_mpicomm;
 
 // machine specific routines
 
@@ -23,10 +30,21 @@
 #define QMP_COMM_SPLIT QMP_COMM_SPLIT_MPI
 #define QMP_GET_HIDDEN_COMM QMP_GET_MPI_COMM
 #define QMP_COMM_FREE QMP_COMM_FREE_MPI
+#define QMP_COMM_DUP QMP_COMM_DUP_MPI
+#define QMP_COMM_SHARE QMP_COMM_SHARE_MPI
+#define QMP_COMM_IDUP QMP_COMM_IDUP_MPI
+#define QMP_COMM_COMPLETE QMP_COMM_COMPLETE_MPI
 #define QMP_SET_TOPO QMP_SET_TOPO_MPI
 #define QMP_COMM_GET_LOGICAL_COORDINATES_FROM QMP_COMM_GET_LOGICAL_COORDINATES_FROM_MPI
 #define QMP_COMM_GET_NODE_NUMBER_FROM QMP_COMM_GET_NODE_NUMBER_FROM_MPI
+#define QMP_COMM_GET_HOST_IDS QMP_COMM_GET_HOST_IDS_MPI
+#define QMP_COMM_ALLOCATED_RANK QMP_COMM_ALLOCATED_RANK_MPI
 #define QMP_ERROR_STRING QMP_ERROR_STRING_MPI
+#define QMP_ALLOC_COMMS QMP_ALLOC_COMMS_MPI
+#define QMP_FREE_COMMS QMP_FREE_COMMS_MPI
+#define QMP_ALLOC_SHARED QMP_ALLOC_SHARED_MPI
+#define QMP_FREE_SHARED QMP_FREE_SHARED_MPI
+#define QMP_SHARED_QUERY QMP_SHARED_QUERY_MPI
 #define QMP_DECLARE_MSGMEM QMP_DECLARE_MSGMEM_MPI
 #define QMP_FREE_MSGMEM QMP_FREE_MSGMEM_MPI
 #define QMP_ALLOC_MSGHANDLE QMP_ALLOC_MSGHANDLE_MPI
@@ -49,8 +67,12 @@
 #define QMP_COMM_MAX_DOUBLE QMP_COMM_MAX_DOUBLE_MPI
 #define QMP_COMM_MIN_DOUBLE QMP_COMM_MIN_DOUBLE_MPI
 #define QMP_COMM_XOR_ULONG QMP_COMM_XOR_ULONG_MPI
+#define QMP_COMM_ALLREDUCE QMP_COMM_ALLREDUCE_MPI
 #define QMP_COMM_ALLTOALL QMP_COMM_ALLTOALL_MPI
 #define QMP_COMM_BINARY_REDUCTION QMP_COMM_BINARY_REDUCTION_MPI
+#define QMP_TASKFARM_CREATE QMP_TASKFARM_CREATE_MPI
+#define QMP_TASKFARM_FETCH QMP_TASKFARM_FETCH_MPI
+#define QMP_TASKFARM_FREE QMP_TASKFARM_FREE_MPI
 
 #define QMP_TIME MPI_Wtime
 
@@ -74,6 +96,18 @@ QMP_status_t QMP_get_mpi_comm(QMP_comm_t comm, void** mpicomm);
 #define QMP_COMM_FREE_MPI QMP_comm_free_mpi
 QMP_status_t QMP_comm_free_mpi(QMP_comm_t comm);
 
+#define QMP_COMM_DUP_MPI QMP_comm_dup_mpi
+QMP_status_t QMP_comm_dup_mpi(QMP_comm_t comm, QMP_comm_t newcomm);
+
+#define QMP_COMM_SHARE_MPI QMP_comm_share_mpi
+QMP_status_t QMP_comm_share_mpi(QMP_comm_t comm, QMP_comm_t newcomm);
+
+#define QMP_COMM_IDUP_MPI QMP_comm_idup_mpi
+QMP_status_t QMP_comm_idup_mpi(QMP_comm_t comm, QMP_comm_t newcomm);
+
+#define QMP_COMM_COMPLETE_MPI QMP_comm_complete_mpi
+void QMP_comm_complete_mpi(QMP_comm_t comm);
+
 #define QMP_SET_TOPO_MPI QMP_set_topo_mpi
 QMP_status_t QMP_set_topo_mpi(QMP_comm_t comm);
 
@@ -83,9 +117,30 @@ void QMP_comm_get_logical_coordinates_from_mpi(int *c, int nd, QMP_comm_t comm,
 #define QMP_COMM_GET_NODE_NUMBER_FROM_MPI QMP_comm_get_node_number_from_mpi
 int QMP_comm_get_node_number_from_mpi(QMP_comm_t comm, const int* coords);
 
+#define QMP_COMM_GET_HOST_IDS_MPI QMP_comm_get_host_ids_mpi
+void QMP_comm_get_host_ids_mpi(QMP_comm_t comm, int *ids);
+
+#define QMP_COMM_ALLOCATED_RANK_MPI QMP_comm_allocated_rank_mpi
+int QMP_comm_allocated_rank_mpi(QMP_comm_t comm, int node);
+
 #define QMP_ERROR_STRING_MPI QMP_error_string_mpi
 const char* QMP_error_string_mpi(QMP_status_t code);
 
+#define QMP_ALLOC_COMMS_MPI QMP_alloc_comms_mpi
+QMP_status_t QMP_alloc_comms_mpi(QMP_mem_t *mem);
+
+#define QMP_FREE_COMMS_MPI QMP_free_comms_mpi
+void QMP_free_comms_mpi(QMP_mem_t *mem);
+
+#define QMP_ALLOC_SHARED_MPI QMP_alloc_shared_mpi
+QMP_status_t QMP_alloc_shared_mpi(QMP_mem_t *mem);
+
+#define QMP_FREE_SHARED_MPI QMP_free_shared_mpi
+void QMP_free_shared_mpi(QMP_mem_t *mem);
+
+#define QMP_SHARED_QUERY_MPI QMP_shared_query_mpi
+void *QMP_shared_query_mpi(QMP_mem_t *mem, int local_rank);
+
 #define QMP_DECLARE_MSGMEM_MPI QMP_declare_msgmem_mpi
 void QMP_declare_msgmem_mpi(QMP_msgmem_t mem);
 
@@ -152,10 +207,23 @@ QMP_status_t QMP_comm_min_double_mpi(QMP_comm_t comm, double *value);
 #define QMP_COMM_XOR_ULONG_MPI QMP_comm_xor_ulong_mpi
 QMP_status_t QMP_comm_xor_ulong_mpi(QMP_comm_t comm, unsigned long *value);
 
+#define QMP_COMM_ALLREDUCE_MPI QMP_comm_allreduce_mpi
+QMP_status_t QMP_comm_allreduce_mpi(QMP_comm_t comm, void *value, int count,
+				    QMP_datatype_t type, QMP_op_t op);
+
 #define QMP_COMM_ALLTOALL_MPI QMP_comm_alltoall_mpi
 QMP_status_t QMP_comm_alltoall_mpi(QMP_comm_t comm, char* recvbuffer, char* sendbuffer, int count);
 
 #define QMP_COMM_BINARY_REDUCTION_MPI QMP_comm_binary_reduction_mpi
 QMP_status_t QMP_comm_binary_reduction_mpi(QMP_comm_t comm, void *lbuffer, size_t count, QMP_binary_func bfunc);
 
+#define QMP_TASKFARM_CREATE_MPI QMP_taskfarm_create_mpi
+void QMP_taskfarm_create_mpi(QMP_taskfarm_t tf);
+
+#define QMP_TASKFARM_FETCH_MPI QMP_taskfarm_fetch_mpi
+int QMP_taskfarm_fetch_mpi(QMP_taskfarm_t tf);
+
+#define QMP_TASKFARM_FREE_MPI QMP_taskfarm_free_mpi
+void QMP_taskfarm_free_mpi(QMP_taskfarm_t tf);
+
 #endif /* _QMP_P_MPI_H */
@@ -1,504 +1,388 @@
-#ifdef QMP_BUILD_PROFILING
-
+/*
+ * Profiling interface, generated by gen_profiling.py from qmp.h.
+ * Do not edit.
+ *
+ * With QMP_BUILD_PROFILING the library defines every function below as
+ * PQMP_<name>, and lib/QMP_profiling.c provides weak QMP_<name> entry
+ * points that call them.  A profiling library can define QMP_<name>
+ * itself and call PQMP_<name>.  The variadic output functions
+ * (QMP_printf, QMP_info, ...) are not included.
+ */
 #ifndef __QMP_PROFILING_H
 #define __QMP_PROFILING_H
-#include "qmp.h" 
-QMP_status_t       QMP_init_msg_passing (int* argc, char*** argv,
-						QMP_thread_level_t required,
-						QMP_thread_level_t *provided)
- __attribute__ ((weak, alias ("PQMP_init_msg_passing")));
-
- QMP_bool_t         QMP_is_initialized(void)
- __attribute__ ((weak, alias ("PQMP_is_initialized")));
-
- void               QMP_finalize_msg_passing (void)
- __attribute__ ((weak, alias ("PQMP_finalize_msg_passing")));
-
- void               QMP_abort (int error_code)
- __attribute__ ((weak, alias ("PQMP_abort")));
-
- void               QMP_abort_string (int error_code, char *message)
- __attribute__ ((weak, alias ("PQMP_abort_string")));
-
-
-
- QMP_ictype_t       QMP_get_msg_passing_type (void)
- __attribute__ ((weak, alias ("PQMP_get_msg_passing_type")));
-
- int                QMP_get_number_of_nodes (void)
- __attribute__ ((weak, alias ("PQMP_get_number_of_nodes")));
-
- int                QMP_get_node_number (void)
- __attribute__ ((weak, alias ("PQMP_get_node_number")));
-
- QMP_bool_t         QMP_is_primary_node (void)
- __attribute__ ((weak, alias ("PQMP_is_primary_node")));
-
- int                QMP_get_allocated_number_of_dimensions (void)
- __attribute__ ((weak, alias ("PQMP_get_allocated_number_of_dimensions")));
-
- const int*         QMP_get_allocated_dimensions (void)
- __attribute__ ((weak, alias ("PQMP_get_allocated_dimensions")));
-
- const int*         QMP_get_allocated_coordinates (void)
- __attribute__ ((weak, alias ("PQMP_get_allocated_coordinates")));
-
-
-
-
- int                QMP_io_node(int node)
- __attribute__ ((weak, alias ("PQMP_io_node")));
-
- int                QMP_master_io_node(void)
- __attribute__ ((weak, alias ("PQMP_master_io_node")));
-
-
-
- QMP_status_t       QMP_declare_logical_topology (const int dims[],
-							int ndim)
- __attribute__ ((weak, alias ("PQMP_declare_logical_topology")));
-
- QMP_bool_t         QMP_logical_topology_is_declared (void)
- __attribute__ ((weak, alias ("PQMP_logical_topology_is_declared ")));
-
- int                QMP_get_logical_number_of_dimensions (void)
- __attribute__ ((weak, alias ("PQMP_get_logical_number_of_dimensions")));
-
- const int*         QMP_get_logical_dimensions (void)
- __attribute__ ((weak, alias ("PQMP_get_logical_dimensions")));
-
- const int*         QMP_get_logical_coordinates (void)
- __attribute__ ((weak, alias ("PQMP_get_logical_coordinates ")));
-
- int*               QMP_get_logical_coordinates_from (int node)
- __attribute__ ((weak, alias ("PQMP_get_logical_coordinates_from")));
-
- int                QMP_get_node_number_from (const int coordinates[])
- __attribute__ ((weak, alias ("PQMP_get_node_number_from")));
-
-
-
- QMP_status_t       QMP_layout_grid (const int dimensions[], int ndims)
- __attribute__ ((weak, alias ("PQMP_layout_grid")));
-
- const int*         QMP_get_subgrid_dimensions (void)
- __attribute__ ((weak, alias ("PQMP_get_subgrid_dimensions")));
-
- int                QMP_get_number_of_subgrid_sites (void)
- __attribute__ ((weak, alias ("PQMP_get_number_of_subgrid_sites")));
-
-
-
-
- QMP_mem_t*         QMP_allocate_memory (size_t nbytes)
- __attribute__ ((weak, alias ("PQMP_allocate_memory")));
-
- QMP_mem_t*         QMP_allocate_aligned_memory (size_t nbytes,
-						       size_t alignment,
-						       int flags)
- __attribute__ ((weak, alias ("PQMP_allocate_aligned_memory")));
-
- void*              QMP_get_memory_pointer (QMP_mem_t* mem)
- __attribute__ ((weak, alias ("PQMP_get_memory_pointer")));
-
- void               QMP_free_memory (QMP_mem_t* mem)
- __attribute__ ((weak, alias ("PQMP_free_memory")));
-
- QMP_msgmem_t       QMP_declare_msgmem (const void* mem, size_t nbytes)
- __attribute__ ((weak, alias ("PQMP_declare_msgmem")));
-
- QMP_msgmem_t       QMP_declare_strided_msgmem (void* base, 
-						      size_t blksize,
-						      int nblocks,
-						      ptrdiff_t stride)
- __attribute__ ((weak, alias ("PQMP_declare_strided_msgmem")));
-
- QMP_msgmem_t   QMP_declare_strided_array_msgmem (void* base[],
-							size_t blksize[],
-							int nblocks[],
-							ptrdiff_t stride[],
-							int num)
- __attribute__ ((weak, alias ("PQMP_declare_strided_array_msgmem")));
-
- void               QMP_free_msgmem (QMP_msgmem_t m)
- __attribute__ ((weak, alias ("PQMP_free_msgmem")));
-
-
-
- QMP_msghandle_t    QMP_declare_receive_relative (QMP_msgmem_t m, 
-							int axis,
-							int dir,
-							int priority)
- __attribute__ ((weak, alias ("PQMP_declare_receive_relative")));
-
- QMP_msghandle_t    QMP_declare_send_relative    (QMP_msgmem_t m,
-							int axis,
-							int dir,
-							int priority)
- __attribute__ ((weak, alias ("PQMP_declare_send_relative")));
-
- QMP_msghandle_t    QMP_declare_send_to     (QMP_msgmem_t m, 
-						   int rem_node_rank,
-						   int priority)
- __attribute__ ((weak, alias ("PQMP_declare_send_to")));
-
- QMP_msghandle_t    QMP_declare_receive_from(QMP_msgmem_t m, 
-						   int rem_node_rank,
-						   int priority)
- __attribute__ ((weak, alias ("PQMP_declare_receive_from")));
-
- void               QMP_free_msghandle (QMP_msghandle_t h)
- __attribute__ ((weak, alias ("PQMP_free_msghandle")));
-
- QMP_msghandle_t    QMP_declare_multiple (QMP_msghandle_t msgh[], 
-						int num)
- __attribute__ ((weak, alias ("PQMP_declare_multiple")));
-
- QMP_status_t       QMP_start (QMP_msghandle_t h)
- __attribute__ ((weak, alias ("PQMP_start")));
-
- QMP_status_t       QMP_wait (QMP_msghandle_t h)
- __attribute__ ((weak, alias ("PQMP_wait")));
-
- QMP_status_t       QMP_wait_all (QMP_msghandle_t h[], int num)
- __attribute__ ((weak, alias ("PQMP_wait_all")));
-
- QMP_bool_t         QMP_is_complete (QMP_msghandle_t h)
- __attribute__ ((weak, alias ("PQMP_is_complete")));
-
-
-
- QMP_status_t       QMP_barrier (void)
- __attribute__ ((weak, alias ("PQMP_barrier")));
-
- QMP_status_t       QMP_broadcast (void* buffer, size_t nbytes)
- __attribute__ ((weak, alias ("PQMP_broadcast")));
-
- QMP_status_t       QMP_sum_int (int *value)
- __attribute__ ((weak, alias ("PQMP_sum_int")));
-
- QMP_status_t       QMP_sum_float (float *value)
- __attribute__ ((weak, alias ("PQMP_sum_float")));
-
- QMP_status_t       QMP_sum_double (double *value)
- __attribute__ ((weak, alias ("PQMP_sum_double")));
-
- QMP_status_t       QMP_sum_long_double (long double *value)
- __attribute__ ((weak, alias ("PQMP_sum_long_double")));
-
- QMP_status_t       QMP_sum_double_extended (double *value)
- __attribute__ ((weak, alias ("PQMP_sum_double_extended")));
-
- QMP_status_t       QMP_sum_float_array (float value[], int length)
- __attribute__ ((weak, alias ("PQMP_sum_float_array")));
-
- QMP_status_t       QMP_sum_double_array (double value[], int length)
- __attribute__ ((weak, alias ("PQMP_sum_double_array")));
-
- QMP_status_t       QMP_sum_long_double_array (long double value[], int length)
- __attribute__ ((weak, alias ("PQMP_sum_long_double_array")));
-
- QMP_status_t       QMP_max_float (float* value)
- __attribute__ ((weak, alias ("PQMP_max_float")));
-
- QMP_status_t       QMP_max_double (double* value)
- __attribute__ ((weak, alias ("PQMP_max_double")));
-
- QMP_status_t       QMP_min_float (float* value)
- __attribute__ ((weak, alias ("PQMP_min_float")));
-
- QMP_status_t       QMP_min_double (double* value)
- __attribute__ ((weak, alias ("PQMP_min_double")));
-
- QMP_status_t       QMP_xor_ulong (unsigned long* value)
- __attribute__ ((weak, alias ("PQMP_xor_ulong")));
-
- QMP_status_t       QMP_binary_reduction (void* lbuffer, size_t buflen,
-						QMP_binary_func bfunc)
- __attribute__ ((weak, alias ("PQMP_binary_reduction")));
-
-
-
- const char*        QMP_error_string (QMP_status_t code)
- __attribute__ ((weak, alias ("PQMP_error_string")));
-
- QMP_status_t       QMP_get_error_number (QMP_msghandle_t mh)
- __attribute__ ((weak, alias ("PQMP_get_error_number")));
-
- const char*        QMP_get_error_string (QMP_msghandle_t mh)
- __attribute__ ((weak, alias ("PQMP_get_error_string")));
-
-
-
- int                QMP_verbose (int level)
- __attribute__ ((weak, alias ("PQMP_verbose")));
-
- int                QMP_profcontrol (int level)
- __attribute__ ((weak, alias ("PQMP_profcontrol")));
-
- int   QMP_printf             (const char *format, ...)
- __attribute__ ((weak, alias ("PQMP_printf")));
-
- int   QMP_fprintf            (FILE* stream, const char *format, ...)
- __attribute__ ((weak, alias ("PQMP_fprintf")));
-
- int   QMP_info               (const char *format, ...)
- __attribute__ ((weak, alias ("PQMP_info")));
- int   QMP_error              (const char *format, ...)
- __attribute__ ((weak, alias ("PQMP_error")));
-
-
- void  QMP_reset_total_qmp_time(void)
- __attribute__ ((weak, alias ("PQMP_reset_total_qmp_time")));
- double QMP_get_total_qmp_time(void)
- __attribute__ ((weak, alias ("PQMP_get_total_qmp_time")));
 
+#if defined(QMP_BUILD_PROFILING) && !defined(QMP_PROFILING_WRAPPERS)
 #define QMP_init_msg_passing PQMP_init_msg_passing
 #define QMP_is_initialized PQMP_is_initialized
 #define QMP_finalize_msg_passing PQMP_finalize_msg_passing
 #define QMP_abort PQMP_abort
 #define QMP_abort_string PQMP_abort_string
+#define QMP_comm_get_allocated PQMP_comm_get_allocated
+#define QMP_comm_set_allocated PQMP_comm_set_allocated
+#define QMP_comm_get_job PQMP_comm_get_job
+#define QMP_comm_set_job PQMP_comm_set_job
+#define QMP_comm_get_default PQMP_comm_get_default
+#define QMP_comm_set_default PQMP_comm_set_default
+#define QMP_comm_split PQMP_comm_split
+#define QMP_comm_free PQMP_comm_free
+#define QMP_comm_get_number_of_colors PQMP_comm_get_number_of_colors
+#define QMP_comm_get_color PQMP_comm_get_color
+#define QMP_comm_get_key PQMP_comm_get_key
+#define QMP_get_hidden_comm PQMP_get_hidden_comm
 #define QMP_get_msg_passing_type PQMP_get_msg_passing_type
 #define QMP_get_number_of_nodes PQMP_get_number_of_nodes
+#define QMP_comm_get_number_of_nodes PQMP_comm_get_number_of_nodes
 #define QMP_get_node_number PQMP_get_node_number
+#define QMP_comm_get_node_number PQMP_comm_get_node_number
+#define QMP_get_number_of_jobs PQMP_get_number_of_jobs
+#define QMP_get_job_number PQMP_get_job_number
+#define QMP_get_number_of_job_geometry_dimensions PQMP_get_number_of_job_geometry_dimensions
+#define QMP_get_job_geometry PQMP_get_job_geometry
 #define QMP_is_primary_node PQMP_is_primary_node
+#define QMP_comm_is_primary_node PQMP_comm_is_primary_node
 #define QMP_get_allocated_number_of_dimensions PQMP_get_allocated_number_of_dimensions
 #define QMP_get_allocated_dimensions PQMP_get_allocated_dimensions
 #define QMP_get_allocated_coordinates PQMP_get_allocated_coordinates
+#define QMP_get_node_map PQMP_get_node_map
+#define QMP_set_topology_mapping PQMP_set_topology_mapping
 #define QMP_io_node PQMP_io_node
 #define QMP_master_io_node PQMP_master_io_node
 #define QMP_declare_logical_topology PQMP_declare_logical_topology
+#define QMP_comm_declare_logical_topology PQMP_comm_declare_logical_topology
+#define QMP_declare_logical_topology_map PQMP_declare_logical_topology_map
+#define QMP_comm_declare_logical_topology_map PQMP_comm_declare_logical_topology_map
 #define QMP_logical_topology_is_declared PQMP_logical_topology_is_declared
+#define QMP_comm_logical_topology_is_declared PQMP_comm_logical_topology_is_declared
 #define QMP_get_logical_number_of_dimensions PQMP_get_logical_number_of_dimensions
+#define QMP_comm_get_logical_number_of_dimensions PQMP_comm_get_logical_number_of_dimensions
 #define QMP_get_logical_dimensions PQMP_get_logical_dimensions
+#define QMP_comm_get_logical_dimensions PQMP_comm_get_logical_dimensions
 #define QMP_get_logical_coordinates PQMP_get_logical_coordinates
+#define QMP_comm_get_logical_coordinates PQMP_comm_get_logical_coordinates
 #define QMP_get_logical_coordinates_from PQMP_get_logical_coordinates_from
+#define QMP_comm_get_logical_coordinates_from PQMP_comm_get_logical_coordinates_from
+#define QMP_get_logical_coordinates_from2 PQMP_get_logical_coordinates_from2
+#define QMP_comm_get_logical_coordinates_from2 PQMP_comm_get_logical_coordinates_from2
 #define QMP_get_node_number_from PQMP_get_node_number_from
+#define QMP_comm_get_node_number_from PQMP_comm_get_node_number_from
+#define QMP_get_neighbor PQMP_get_neighbor
+#define QMP_comm_get_neighbor PQMP_comm_get_neighbor
+#define QMP_probe_links PQMP_probe_links
+#define QMP_comm_probe_links PQMP_comm_probe_links
+#define QMP_get_link_probe PQMP_get_link_probe
+#define QMP_comm_get_link_probe PQMP_comm_get_link_probe
 #define QMP_layout_grid PQMP_layout_grid
+#define QMP_set_layout_weights PQMP_set_layout_weights
+#define QMP_query_layout_grid PQMP_query_layout_grid
+#define QMP_set_layout_uneven PQMP_set_layout_uneven
 #define QMP_get_subgrid_dimensions PQMP_get_subgrid_dimensions
+#define QMP_get_subgrid_origin PQMP_get_subgrid_origin
+#define QMP_get_node_subgrid PQMP_get_node_subgrid
 #define QMP_get_number_of_subgrid_sites PQMP_get_number_of_subgrid_sites
+#define QMP_get_site_owner PQMP_get_site_owner
 #define QMP_allocate_memory PQMP_allocate_memory
 #define QMP_allocate_aligned_memory PQMP_allocate_aligned_memory
 #define QMP_get_memory_pointer PQMP_get_memory_pointer
+#define QMP_get_node_shared_pointer PQMP_get_node_shared_pointer
 #define QMP_free_memory PQMP_free_memory
+#define QMP_set_memory_directory PQMP_set_memory_directory
+#define QMP_mem_prefetch PQMP_mem_prefetch
+#define QMP_mem_writeback PQMP_mem_writeback
+#define QMP_mem_evict PQMP_mem_evict
+#define QMP_pool_allocate PQMP_pool_allocate
+#define QMP_pool_free PQMP_pool_free
+#define QMP_pool_trim PQMP_pool_trim
+#define QMP_pool_set_limit PQMP_pool_set_limit
+#define QMP_pool_enable PQMP_pool_enable
+#define QMP_get_memory_stats PQMP_get_memory_stats
 #define QMP_declare_msgmem PQMP_declare_msgmem
 #define QMP_declare_strided_msgmem PQMP_declare_strided_msgmem
 #define QMP_declare_strided_array_msgmem PQMP_declare_strided_array_msgmem
+#define QMP_declare_indexed_msgmem PQMP_declare_indexed_msgmem
 #define QMP_free_msgmem PQMP_free_msgmem
 #define QMP_declare_receive_relative PQMP_declare_receive_relative
+#define QMP_comm_declare_receive_relative PQMP_comm_declare_receive_relative
 #define QMP_declare_send_relative PQMP_declare_send_relative
+#define QMP_comm_declare_send_relative PQMP_comm_declare_send_relative
 #define QMP_declare_send_to PQMP_declare_send_to
+#define QMP_comm_declare_send_to PQMP_comm_declare_send_to
 #define QMP_declare_receive_from PQMP_declare_receive_from
+#define QMP_comm_declare_receive_from PQMP_comm_declare_receive_from
+#define QMP_declare_send_displaced PQMP_declare_send_displaced
+#define QMP_comm_declare_send_displaced PQMP_comm_declare_send_displaced
+#define QMP_declare_receive_displaced PQMP_declare_receive_displaced
+#define QMP_comm_declare_receive_displaced PQMP_comm_declare_receive_displaced
+#define QMP_change_address PQMP_change_address
+#define QMP_change_address_multiple PQMP_change_address_multiple
 #define QMP_free_msghandle PQMP_free_msghandle
 #define QMP_declare_multiple PQMP_declare_multiple
+#define QMP_declare_send_recv_pairs PQMP_declare_send_recv_pairs
+#define QMP_clear_to_send PQMP_clear_to_send
 #define QMP_start PQMP_start
 #define QMP_wait PQMP_wait
 #define QMP_wait_all PQMP_wait_all
 #define QMP_is_complete PQMP_is_complete
+#define QMP_get_msghandle_stats PQMP_get_msghandle_stats
+#define QMP_dump_comm_matrix PQMP_dump_comm_matrix
 #define QMP_barrier PQMP_barrier
+#define QMP_comm_barrier PQMP_comm_barrier
 #define QMP_broadcast PQMP_broadcast
+#define QMP_comm_broadcast PQMP_comm_broadcast
 #define QMP_sum_int PQMP_sum_int
+#define QMP_comm_sum_int PQMP_comm_sum_int
+#define QMP_sum_uint64_t PQMP_sum_uint64_t
+#define QMP_comm_sum_uint64_t PQMP_comm_sum_uint64_t
 #define QMP_sum_float PQMP_sum_float
+#define QMP_comm_sum_float PQMP_comm_sum_float
 #define QMP_sum_double PQMP_sum_double
+#define QMP_comm_sum_double PQMP_comm_sum_double
 #define QMP_sum_long_double PQMP_sum_long_double
+#define QMP_comm_sum_long_double PQMP_comm_sum_long_double
 #define QMP_sum_double_extended PQMP_sum_double_extended
+#define QMP_comm_sum_double_extended PQMP_comm_sum_double_extended
 #define QMP_sum_float_array PQMP_sum_float_array
+#define QMP_comm_sum_float_array PQMP_comm_sum_float_array
 #define QMP_sum_double_array PQMP_sum_double_array
+#define QMP_comm_sum_double_array PQMP_comm_sum_double_array
+#define QMP_sum_long_double_array PQMP_sum_long_double_array
+#define QMP_comm_sum_long_double_array PQMP_comm_sum_long_double_array
 #define QMP_max_float PQMP_max_float
+#define QMP_comm_max_float PQMP_comm_max_float
 #define QMP_max_double PQMP_max_double
+#define QMP_comm_max_double PQMP_comm_max_double
 #define QMP_min_float PQMP_min_float
+#define QMP_comm_min_float PQMP_comm_min_float
 #define QMP_min_double PQMP_min_double
+#define QMP_comm_min_double PQMP_comm_min_double
 #define QMP_xor_ulong PQMP_xor_ulong
+#define QMP_comm_xor_ulong PQMP_comm_xor_ulong
+#define QMP_allreduce PQMP_allreduce
+#define QMP_comm_allreduce PQMP_comm_allreduce
+#define QMP_comm_alltoall PQMP_comm_alltoall
 #define QMP_binary_reduction PQMP_binary_reduction
+#define QMP_comm_binary_reduction PQMP_comm_binary_reduction
+#define QMP_declare_halo PQMP_declare_halo
+#define QMP_comm_declare_halo PQMP_comm_declare_halo
+#define QMP_declare_subgrid_halo PQMP_declare_subgrid_halo
+#define QMP_halo_start PQMP_halo_start
+#define QMP_halo_wait PQMP_halo_wait
+#define QMP_halo_exchange PQMP_halo_exchange
+#define QMP_free_halo PQMP_free_halo
+#define QMP_taskfarm_create PQMP_taskfarm_create
+#define QMP_taskfarm_next PQMP_taskfarm_next
+#define QMP_taskfarm_complete PQMP_taskfarm_complete
+#define QMP_taskfarm_collect PQMP_taskfarm_collect
+#define QMP_taskfarm_get_record PQMP_taskfarm_get_record
+#define QMP_taskfarm_free PQMP_taskfarm_free
+#define QMP_team_create PQMP_team_create
+#define QMP_comm_team_create PQMP_comm_team_create
+#define QMP_team_free PQMP_team_free
+#define QMP_team_sum_double PQMP_team_sum_double
+#define QMP_team_sum_float_array PQMP_team_sum_float_array
+#define QMP_team_sum_double_array PQMP_team_sum_double_array
+#define QMP_team_max_double PQMP_team_max_double
+#define QMP_team_min_double PQMP_team_min_double
 #define QMP_error_string PQMP_error_string
 #define QMP_get_error_number PQMP_get_error_number
 #define QMP_get_error_string PQMP_get_error_string
 #define QMP_verbose PQMP_verbose
 #define QMP_profcontrol PQMP_profcontrol
-#define QMP_printf PQMP_printf
-#define QMP_fprintf PQMP_fprintf
-#define QMP_info PQMP_info
-#define QMP_error PQMP_error
+#define QMP_time PQMP_time
 #define QMP_reset_total_qmp_time PQMP_reset_total_qmp_time
 #define QMP_get_total_qmp_time PQMP_get_total_qmp_time
-
-extern QMP_status_t       QMP_init_msg_passing (int* argc, char*** argv,
-						QMP_thread_level_t required,
-						QMP_thread_level_t *provided);
-
-extern QMP_bool_t         QMP_is_initialized(void);
-
-extern void               QMP_finalize_msg_passing (void);
-
-extern void               QMP_abort (int error_code);
-
-extern void               QMP_abort_string (int error_code, char *message);
-
-
-
-extern QMP_ictype_t       QMP_get_msg_passing_type (void);
-
-extern int                QMP_get_number_of_nodes (void);
-
-extern int                QMP_get_node_number (void);
-
-extern QMP_bool_t         QMP_is_primary_node (void);
-
-extern int                QMP_get_allocated_number_of_dimensions (void);
-
-extern const int*         QMP_get_allocated_dimensions (void);
-
-extern const int*         QMP_get_allocated_coordinates (void);
-
-
-
-
-extern int                QMP_io_node(int node);
-
-extern int                QMP_master_io_node(void);
-
-
-
-extern QMP_status_t       QMP_declare_logical_topology (const int dims[],
-							int ndim);
-
-extern QMP_bool_t         QMP_logical_topology_is_declared (void);
-
-extern int                QMP_get_logical_number_of_dimensions (void);
-
-extern const int*         QMP_get_logical_dimensions (void);
-
-extern const int*         QMP_get_logical_coordinates (void);
-
-extern int*               QMP_get_logical_coordinates_from (int node);
-
-extern int                QMP_get_node_number_from (const int coordinates[]);
-
-
-
-extern QMP_status_t       QMP_layout_grid (const int dimensions[], int ndims);
-
-extern const int*         QMP_get_subgrid_dimensions (void);
-
-extern int                QMP_get_number_of_subgrid_sites (void);
-
-
-
-
-extern QMP_mem_t*         QMP_allocate_memory (size_t nbytes);
-
-extern QMP_mem_t*         QMP_allocate_aligned_memory (size_t nbytes,
-						       size_t alignment,
-						       int flags);
-
-extern void*              QMP_get_memory_pointer (QMP_mem_t* mem);
-
-extern void               QMP_free_memory (QMP_mem_t* mem);
-
-extern QMP_msgmem_t       QMP_declare_msgmem (const void* mem, size_t nbytes);
-
-extern QMP_msgmem_t       QMP_declare_strided_msgmem (void* base, 
-						      size_t blksize,
-						      int nblocks,
-						      ptrdiff_t stride);
-
-extern QMP_msgmem_t   QMP_declare_strided_array_msgmem (void* base[],
-							size_t blksize[],
-							int nblocks[],
-							ptrdiff_t stride[],
-							int num);
-
-extern void               QMP_free_msgmem (QMP_msgmem_t m);
-
-
-
-extern QMP_msghandle_t    QMP_declare_receive_relative (QMP_msgmem_t m, 
-							int axis,
-							int dir,
-							int priority);
-
-extern QMP_msghandle_t    QMP_declare_send_relative    (QMP_msgmem_t m,
-							int axis,
-							int dir,
-							int priority);
-
-extern QMP_msghandle_t    QMP_declare_send_to     (QMP_msgmem_t m, 
-						   int rem_node_rank,
-						   int priority);
-
-extern QMP_msghandle_t    QMP_declare_receive_from(QMP_msgmem_t m, 
-						   int rem_node_rank,
-						   int priority);
-
-extern void               QMP_free_msghandle (QMP_msghandle_t h);
-
-extern QMP_msghandle_t    QMP_declare_multiple (QMP_msghandle_t msgh[], 
-						int num);
-
-extern QMP_status_t       QMP_start (QMP_msghandle_t h);
-
-extern QMP_status_t       QMP_wait (QMP_msghandle_t h);
-
-extern QMP_status_t       QMP_wait_all (QMP_msghandle_t h[], int num);
-
-extern QMP_bool_t         QMP_is_complete (QMP_msghandle_t h);
-
-
-
-extern QMP_status_t       QMP_barrier (void);
-
-extern QMP_status_t       QMP_broadcast (void* buffer, size_t nbytes);
-
-extern QMP_status_t       QMP_sum_int (int *value);
-
-extern QMP_status_t       QMP_sum_float (float *value);
-
-extern QMP_status_t       QMP_sum_double (double *value);
-
-extern QMP_status_t       QMP_sum_long_double (long double *value);
-
-extern QMP_status_t       QMP_sum_double_extended (double *value);
-
-extern QMP_status_t       QMP_sum_float_array (float value[], int length);
-
-extern QMP_status_t       QMP_sum_double_array (double value[], int length);
-
-extern QMP_status_t       QMP_max_float (float* value);
-
-extern QMP_status_t       QMP_max_double (double* value);
-
-extern QMP_status_t       QMP_min_float (float* value);
-
-extern QMP_status_t       QMP_min_double (double* value);
-
-extern QMP_status_t       QMP_xor_ulong (unsigned long* value);
-
-extern QMP_status_t       QMP_binary_reduction (void* lbuffer, size_t buflen,
-						QMP_binary_func bfunc);
-
-
-
-extern const char*        QMP_error_string (QMP_status_t code);
-
-extern QMP_status_t       QMP_get_error_number (QMP_msghandle_t mh);
-
-extern const char*        QMP_get_error_string (QMP_msghandle_t mh);
-
-
-
-extern int                QMP_verbose (int level);
-
-extern int                QMP_profcontrol (int level);
-
-extern int   QMP_printf             (const char *format, ...);
-
-extern int   QMP_fprintf            (FILE* stream, const char *format, ...);
-
-extern int   QMP_info               (const char *format, ...);
-extern int   QMP_error              (const char *format, ...);
-
-
-extern void  QMP_reset_total_qmp_time(void);
-extern double QMP_get_total_qmp_time(void);
-#endif
+#define QMP_get_timer_report PQMP_get_timer_report
+#define QMP_report_imbalance PQMP_report_imbalance
+#define QMP_version_str PQMP_version_str
+#define QMP_version_int PQMP_version_int
 #endif
+
+/*
+ * QMP_PROFILED(F, V) lists the functions without their QMP_ prefix:
+ *   F(return type, name, (parameters), (arguments)) returning a value,
+ *   V(name, (parameters), (arguments)) returning void.
+ */
+#define QMP_PROFILED(F, V) \
+  F(QMP_status_t, init_msg_passing, (int* argc, char*** argv, QMP_thread_level_t required, QMP_thread_level_t *provided), (argc, argv, required, provided)) \
+  F(QMP_bool_t, is_initialized, (void), ()) \
+  V(finalize_msg_passing, (void), ()) \
+  V(abort, (int error_code), (error_code)) \
+  V(abort_string, (int error_code, char *message), (error_code, message)) \
+  F(QMP_comm_t, comm_get_allocated, (void), ()) \
+  F(QMP_status_t, comm_set_allocated, (QMP_comm_t comm), (comm)) \
+  F(QMP_comm_t, comm_get_job, (void), ()) \
+  F(QMP_status_t, comm_set_job, (QMP_comm_t comm), (comm)) \
+  F(QMP_comm_t, comm_get_default, (void), ()) \
+  F(QMP_status_t, comm_set_default, (QMP_comm_t comm), (comm)) \
+  F(QMP_status_t, comm_split, (QMP_comm_t comm, int color, int key, QMP_comm_t *newcomm), (comm, color, key, newcomm)) \
+  F(QMP_status_t, comm_free, (QMP_comm_t comm), (comm)) \
+  F(int, comm_get_number_of_colors, (QMP_comm_t comm), (comm)) \
+  F(int, comm_get_color, (QMP_comm_t comm), (comm)) \
+  F(int, comm_get_key, (QMP_comm_t comm), (comm)) \
+  F(QMP_status_t, get_hidden_comm, (QMP_comm_t comm, void** hiddencomm), (comm, hiddencomm)) \
+  F(QMP_ictype_t, get_msg_passing_type, (void), ()) \
+  F(int, get_number_of_nodes, (void), ()) \
+  F(int, comm_get_number_of_nodes, (QMP_comm_t comm), (comm)) \
+  F(int, get_node_number, (void), ()) \
+  F(int, comm_get_node_number, (QMP_comm_t comm), (comm)) \
+  F(int, get_number_of_jobs, (void), ()) \
+  F(int, get_job_number, (void), ()) \
+  F(int, get_number_of_job_geometry_dimensions, (void), ()) \
+  F(const int *, get_job_geometry, (void), ()) \
+  F(QMP_bool_t, is_primary_node, (void), ()) \
+  F(QMP_bool_t, comm_is_primary_node, (QMP_comm_t comm), (comm)) \
+  F(int, get_allocated_number_of_dimensions, (void), ()) \
+  F(const int*, get_allocated_dimensions, (void), ()) \
+  F(const int*, get_allocated_coordinates, (void), ()) \
+  F(QMP_status_t, get_node_map, (QMP_node_map_t *map), (map)) \
+  F(QMP_status_t, set_topology_mapping, (QMP_topology_mapping_t mapping), (mapping)) \
+  F(int, io_node, (int node), (node)) \
+  F(int, master_io_node, (void), ()) \
+  F(QMP_status_t, declare_logical_topology, (const int dims[], int ndim), (dims, ndim)) \
+  F(QMP_status_t, comm_declare_logical_topology, (QMP_comm_t comm, const int dims[], int ndim), (comm, dims, ndim)) \
+  F(QMP_status_t, declare_logical_topology_map, (const int dims[], int ndim, const int map[], int mapdim), (dims, ndim, map, mapdim)) \
+  F(QMP_status_t, comm_declare_logical_topology_map, (QMP_comm_t comm, const int dims[], int ndim, const int map[], int mapdim), (comm, dims, ndim, map, mapdim)) \
+  F(QMP_bool_t, logical_topology_is_declared, (void), ()) \
+  F(QMP_bool_t, comm_logical_topology_is_declared, (QMP_comm_t comm), (comm)) \
+  F(int, get_logical_number_of_dimensions, (void), ()) \
+  F(int, comm_get_logical_number_of_dimensions, (QMP_comm_t comm), (comm)) \
+  F(const int*, get_logical_dimensions, (void), ()) \
+  F(const int*, comm_get_logical_dimensions, (QMP_comm_t comm), (comm)) \
+  F(const int*, get_logical_coordinates, (void), ()) \
+  F(const int*, comm_get_logical_coordinates, (QMP_comm_t comm), (comm)) \
+  F(int*, get_logical_coordinates_from, (int node), (node)) \
+  F(int*, comm_get_logical_coordinates_from, (QMP_comm_t comm, int node), (comm, node)) \
+  V(get_logical_coordinates_from2, (int coords[], int node), (coords, node)) \
+  V(comm_get_logical_coordinates_from2, (QMP_comm_t comm, int coords[], int node), (comm, coords, node)) \
+  F(int, get_node_number_from, (const int coordinates[]), (coordinates)) \
+  F(int, comm_get_node_number_from, (QMP_comm_t comm, const int coordinates[]), (comm, coordinates)) \
+  F(int, get_neighbor, (const int disp[]), (disp)) \
+  F(int, comm_get_neighbor, (QMP_comm_t comm, const int disp[]), (comm, disp)) \
+  F(QMP_status_t, probe_links, (void), ()) \
+  F(QMP_status_t, comm_probe_links, (QMP_comm_t comm), (comm)) \
+  F(QMP_status_t, get_link_probe, (int axis, int isign, double *latency, double *bandwidth), (axis, isign, latency, bandwidth)) \
+  F(QMP_status_t, comm_get_link_probe, (QMP_comm_t comm, int axis, int isign, double *latency, double *bandwidth), (comm, axis, isign, latency, bandwidth)) \
+  F(QMP_status_t, layout_grid, (const int dimensions[], int ndims), (dimensions, ndims)) \
+  F(QMP_status_t, set_layout_weights, (const double weights[], int nweights), (weights, nweights)) \
+  F(QMP_status_t, query_layout_grid, (const int dimensions[], int ndims, int nnodes, int nsquares[], double *cost), (dimensions, ndims, nnodes, nsquares, cost)) \
+  F(QMP_status_t, set_layout_uneven, (QMP_bool_t allow), (allow)) \
+  F(const int*, get_subgrid_dimensions, (void), ()) \
+  F(const int*, get_subgrid_origin, (void), ()) \
+  F(QMP_status_t, get_node_subgrid, (int node, int origin[], int extent[]), (node, origin, extent)) \
+  F(int, get_number_of_subgrid_sites, (void), ()) \
+  F(QMP_status_t, get_site_owner, (const int global_coords[], int n, int owner[], int local_index[]), (global_coords, n, owner, local_index)) \
+  F(QMP_mem_t*, allocate_memory, (size_t nbytes), (nbytes)) \
+  F(QMP_mem_t*, allocate_aligned_memory, (size_t nbytes, size_t alignment, int flags), (nbytes, alignment, flags)) \
+  F(void*, get_memory_pointer, (QMP_mem_t* mem), (mem)) \
+  F(void*, get_node_shared_pointer, (QMP_mem_t* mem, int local_rank), (mem, local_rank)) \
+  V(free_memory, (QMP_mem_t* mem), (mem)) \
+  F(QMP_status_t, set_memory_directory, (const char *dir), (dir)) \
+  F(QMP_status_t, mem_prefetch, (QMP_mem_t* mem, size_t offset, size_t len), (mem, offset, len)) \
+  F(QMP_status_t, mem_writeback, (QMP_mem_t* mem, size_t offset, size_t len, QMP_bool_t wait), (mem, offset, len, wait)) \
+  F(QMP_status_t, mem_evict, (QMP_mem_t* mem, size_t offset, size_t len), (mem, offset, len)) \
+  F(QMP_mem_t*, pool_allocate, (size_t nbytes, size_t alignment, int flags), (nbytes, alignment, flags)) \
+  V(pool_free, (QMP_mem_t* mem), (mem)) \
+  F(size_t, pool_trim, (size_t keep), (keep)) \
+  V(pool_set_limit, (size_t limit), (limit)) \
+  V(pool_enable, (QMP_bool_t enable), (enable)) \
+  F(QMP_status_t, get_memory_stats, (QMP_memory_stats_t *stats), (stats)) \
+  F(QMP_msgmem_t, declare_msgmem, (const void* mem, size_t nbytes), (mem, nbytes)) \
+  F(QMP_msgmem_t, declare_strided_msgmem, (void* base, size_t blksize, int nblocks, ptrdiff_t stride), (base, blksize, nblocks, stride)) \
+  F(QMP_msgmem_t, declare_strided_array_msgmem, (void* base[], size_t blksize[], int nblocks[], ptrdiff_t stride[], int num), (base, blksize, nblocks, stride, num)) \
+  F(QMP_msgmem_t, declare_indexed_msgmem, (void* base, int blocklen[], int index[], int elemsize, int count), (base, blocklen, index, elemsize, count)) \
+  V(free_msgmem, (QMP_msgmem_t m), (m)) \
+  F(QMP_msghandle_t, declare_receive_relative, (QMP_msgmem_t m, int axis, int dir, int priority), (m, axis, dir, priority)) \
+  F(QMP_msghandle_t, comm_declare_receive_relative, (QMP_comm_t comm, QMP_msgmem_t m, int axis, int dir, int priority), (comm, m, axis, dir, priority)) \
+  F(QMP_msghandle_t, declare_send_relative, (QMP_msgmem_t m, int axis, int dir, int priority), (m, axis, dir, priority)) \
+  F(QMP_msghandle_t, comm_declare_send_relative, (QMP_comm_t comm, QMP_msgmem_t m, int axis, int dir, int priority), (comm, m, axis, dir, priority)) \
+  F(QMP_msghandle_t, declare_send_to, (QMP_msgmem_t m, int rem_node_rank, int priority), (m, rem_node_rank, priority)) \
+  F(QMP_msghandle_t, comm_declare_send_to, (QMP_comm_t comm, QMP_msgmem_t m, int rem_node_rank, int priority), (comm, m, rem_node_rank, priority)) \
+  F(QMP_msghandle_t, declare_receive_from, (QMP_msgmem_t m, int rem_node_rank, int priority), (m, rem_node_rank, priority)) \
+  F(QMP_msghandle_t, comm_declare_receive_from, (QMP_comm_t comm, QMP_msgmem_t m, int rem_node_rank, int priority), (comm, m, rem_node_rank, priority)) \
+  F(QMP_msghandle_t, declare_send_displaced, (QMP_msgmem_t m, const int disp[], int priority), (m, disp, priority)) \
+  F(QMP_msghandle_t, comm_declare_send_displaced, (QMP_comm_t comm, QMP_msgmem_t m, const int disp[], int priority), (comm, m, disp, priority)) \
+  F(QMP_msghandle_t, declare_receive_displaced, (QMP_msgmem_t m, const int disp[], int priority), (m, disp, priority)) \
+  F(QMP_msghandle_t, comm_declare_receive_displaced, (QMP_comm_t comm, QMP_msgmem_t m, const int disp[], int priority), (comm, m, disp, priority)) \
+  F(QMP_status_t, change_address, (QMP_msghandle_t msg, void *addr), (msg, addr)) \
+  F(QMP_status_t, change_address_multiple, (QMP_msghandle_t msg, void *addr[], int naddr), (msg, addr, naddr)) \
+  V(free_msghandle, (QMP_msghandle_t h), (h)) \
+  F(QMP_msghandle_t, declare_multiple, (QMP_msghandle_t msgh[], int num), (msgh, num)) \
+  F(QMP_msghandle_t, declare_send_recv_pairs, (QMP_msghandle_t msgh[], int num), (msgh, num)) \
+  F(QMP_status_t, clear_to_send, (QMP_msghandle_t mh, QMP_clear_to_send_t cts), (mh, cts)) \
+  F(QMP_status_t, start, (QMP_msghandle_t h), (h)) \
+  F(QMP_status_t, wait, (QMP_msghandle_t h), (h)) \
+  F(QMP_status_t, wait_all, (QMP_msghandle_t h[], int num), (h, num)) \
+  F(QMP_bool_t, is_complete, (QMP_msghandle_t h), (h)) \
+  F(QMP_status_t, get_msghandle_stats, (QMP_msghandle_t h, QMP_msghandle_stats_t *stats), (h, stats)) \
+  F(QMP_status_t, dump_comm_matrix, (const char *filename), (filename)) \
+  F(QMP_status_t, barrier, (void), ()) \
+  F(QMP_status_t, comm_barrier, (QMP_comm_t comm), (comm)) \
+  F(QMP_status_t, broadcast, (void* buffer, size_t nbytes), (buffer, nbytes)) \
+  F(QMP_status_t, comm_broadcast, (QMP_comm_t comm, void* buffer, size_t nbytes), (comm, buffer, nbytes)) \
+  F(QMP_status_t, sum_int, (int *value), (value)) \
+  F(QMP_status_t, comm_sum_int, (QMP_comm_t comm, int *value), (comm, value)) \
+  F(QMP_status_t, sum_uint64_t, (uint64_t *value), (value)) \
+  F(QMP_status_t, comm_sum_uint64_t, (QMP_comm_t comm, uint64_t *value), (comm, value)) \
+  F(QMP_status_t, sum_float, (float *value), (value)) \
+  F(QMP_status_t, comm_sum_float, (QMP_comm_t comm, float *value), (comm, value)) \
+  F(QMP_status_t, sum_double, (double *value), (value)) \
+  F(QMP_status_t, comm_sum_double, (QMP_comm_t comm, double *value), (comm, value)) \
+  F(QMP_status_t, sum_long_double, (long double *value), (value)) \
+  F(QMP_status_t, comm_sum_long_double, (QMP_comm_t comm, long double *value), (comm, value)) \
+  F(QMP_status_t, sum_double_extended, (double *value), (value)) \
+  F(QMP_status_t, comm_sum_double_extended, (QMP_comm_t comm, double *value), (comm, value)) \
+  F(QMP_status_t, sum_float_array, (float value[], int length), (value, length)) \
+  F(QMP_status_t, comm_sum_float_array, (QMP_comm_t comm, float value[], int length), (comm, value, length)) \
+  F(QMP_status_t, sum_double_array, (double value[], int length), (value, length)) \
+  F(QMP_status_t, comm_sum_double_array, (QMP_comm_t comm, double value[], int length), (comm, value, length)) \
+  F(QMP_status_t, sum_long_double_array, (long double value[], int length), (value, length)) \
+  F(QMP_status_t, comm_sum_long_double_array, (QMP_comm_t comm, long double value[], int length), (comm, value, length)) \
+  F(QMP_status_t, max_float, (float* value), (value)) \
+  F(QMP_status_t, comm_max_float, (QMP_comm_t comm, float* value), (comm, value)) \
+  F(QMP_status_t, max_double, (double* value), (value)) \
+  F(QMP_status_t, comm_max_double, (QMP_comm_t comm, double* value), (comm, value)) \
+  F(QMP_status_t, min_float, (float* value), (value)) \
+  F(QMP_status_t, comm_min_float, (QMP_comm_t comm, float* value), (comm, value)) \
+  F(QMP_status_t, min_double, (double* value), (value)) \
+  F(QMP_status_t, comm_min_double, (QMP_comm_t comm, double* value), (comm, value)) \
+  F(QMP_status_t, xor_ulong, (unsigned long* value), (value)) \
+  F(QMP_status_t, comm_xor_ulong, (QMP_comm_t comm, unsigned long* value), (comm, value)) \
+  F(QMP_status_t, allreduce, (void *value, int count, QMP_datatype_t type, QMP_op_t op), (value, count, type, op)) \
+  F(QMP_status_t, comm_allreduce, (QMP_comm_t comm, void *value, int count, QMP_datatype_t type, QMP_op_t op), (comm, value, count, type, op)) \
+  F(QMP_status_t, comm_alltoall, (QMP_comm_t comm, char* recvbuffer, char* sendbuffer, int count), (comm, recvbuffer, sendbuffer, count)) \
+  F(QMP_status_t, binary_reduction, (void* lbuffer, size_t buflen, QMP_binary_func bfunc), (lbuffer, buflen, bfunc)) \
+  F(QMP_status_t, comm_binary_reduction, (QMP_comm_t comm, void* lbuffer, size_t buflen, QMP_binary_func bfunc), (comm, lbuffer, buflen, bfunc)) \
+  F(QMP_halo_t, declare_halo, (void *field, const int local[], int ndim, int depth, size_t sitesize, int flags), (field, local, ndim, depth, sitesize, flags)) \
+  F(QMP_halo_t, comm_declare_halo, (QMP_comm_t comm, void *field, const int local[], int ndim, int depth, size_t sitesize, int flags), (comm, field, local, ndim, depth, sitesize, flags)) \
+  F(QMP_halo_t, declare_subgrid_halo, (void *field, int depth, size_t sitesize, int flags), (field, depth, sitesize, flags)) \
+  F(QMP_status_t, halo_start, (QMP_halo_t h), (h)) \
+  F(QMP_status_t, halo_wait, (QMP_halo_t h), (h)) \
+  F(QMP_status_t, halo_exchange, (QMP_halo_t h), (h)) \
+  V(free_halo, (QMP_halo_t h), (h)) \
+  F(QMP_taskfarm_t, taskfarm_create, (int ntasks), (ntasks)) \
+  F(int, taskfarm_next, (QMP_taskfarm_t tf), (tf)) \
+  F(QMP_status_t, taskfarm_complete, (QMP_taskfarm_t tf, int task, double result), (tf, task, result)) \
+  F(QMP_status_t, taskfarm_collect, (QMP_taskfarm_t tf, const char *logfile), (tf, logfile)) \
+  F(QMP_status_t, taskfarm_get_record, (QMP_taskfarm_t tf, int task, int *job, double *seconds, double *result), (tf, task, job, seconds, result)) \
+  V(taskfarm_free, (QMP_taskfarm_t tf), (tf)) \
+  F(QMP_team_t, team_create, (int nthreads), (nthreads)) \
+  F(QMP_team_t, comm_team_create, (QMP_comm_t comm, int nthreads), (comm, nthreads)) \
+  V(team_free, (QMP_team_t team), (team)) \
+  F(QMP_status_t, team_sum_double, (QMP_team_t team, int tid, double *value), (team, tid, value)) \
+  F(QMP_status_t, team_sum_float_array, (QMP_team_t team, int tid, float value[], int length), (team, tid, value, length)) \
+  F(QMP_status_t, team_sum_double_array, (QMP_team_t team, int tid, double value[], int length), (team, tid, value, length)) \
+  F(QMP_status_t, team_max_double, (QMP_team_t team, int tid, double *value), (team, tid, value)) \
+  F(QMP_status_t, team_min_double, (QMP_team_t team, int tid, double *value), (team, tid, value)) \
+  F(const char*, error_string, (QMP_status_t code), (code)) \
+  F(QMP_status_t, get_error_number, (QMP_msghandle_t mh), (mh)) \
+  F(const char*, get_error_string, (QMP_msghandle_t mh), (mh)) \
+  F(int, verbose, (int level), (level)) \
+  F(int, profcontrol, (int level), (level)) \
+  F(double, time, (void), ()) \
+  V(reset_total_qmp_time, (void), ()) \
+  F(double, get_total_qmp_time, (void), ()) \
+  F(QMP_status_t, get_timer_report, (QMP_timer_report_t *report), (report)) \
+  F(QMP_status_t, report_imbalance, (void), ()) \
+  F(const char *, version_str, (void), ()) \
+  F(int, version_int, (void), ()) \
+
+#endif /* __QMP_PROFILING_H */
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+#
+# Generate QMP_profiling.h from the declarations in qmp.h.
+#
+#   cd include && ./gen_profiling.py > QMP_profiling.h
+#
+# Every non-variadic function declared in qmp.h and defined in lib/ gets
+# a rename to PQMP_<name> (used when the library is built with
+# QMP_BUILD_PROFILING) and an entry in the QMP_PROFILED list, which
+# lib/QMP_profiling.c expands into the weak QMP_<name> entry points.
+
+import glob
+import os
+import re
+import sys
+
+here = os.path.dirname(os.path.abspath(__file__))
+src = open(os.path.join(here, "qmp.h")).read()
+src = re.sub(r"/\*.*?\*/", "", src, flags=re.S)
+src = re.sub(r"//[^\n]*", "", src)
+src = re.sub(r"^\s*#[^\n]*", "", src, flags=re.M)
+src = re.sub(r'extern\s+"C"\s*\{', "", src)
+
+defined = set()
+for f in glob.glob(os.path.join(here, "..", "lib", "*.c")):
+    for m in re.finditer(r"^(QMP_\w+)\s*\(", open(f).read(), re.M):
+        defined.add(m.group(1))
+
+decl = re.compile(r"extern\s+([^;()]*?)\b(QMP_\w+)\s*\(([^;]*?)\)\s*;", re.S)
+
+funcs = []
+for m in decl.finditer(src):
+    ret = " ".join(m.group(1).split())
+    name = m.group(2)
+    params = " ".join(m.group(3).split())
+    if "..." in params or name not in defined:
+        continue
+    args = []
+    if params not in ("", "void"):
+        for p in params.split(","):
+            p = re.sub(r"\[[^\]]*\]", "", p).strip()
+            args.append(re.search(r"(\w+)$", p).group(1))
+    funcs.append((ret, name, params, ", ".join(args)))
+
+out = sys.stdout
+out.write("""/*
+ * Profiling interface, generated by gen_profiling.py from qmp.h.
+ * Do not edit.
+ *
+ * With QMP_BUILD_PROFILING the library defines every function below as
+ * PQMP_<name>, and lib/QMP_profiling.c provides weak QMP_<name> entry
+ * points that call them.  A profiling library can define QMP_<name>
+ * itself and call PQMP_<name>.  The variadic output functions
+ * (QMP_printf, QMP_info, ...) are not included.
+ */
+#ifndef __QMP_PROFILING_H
+#define __QMP_PROFILING_H
+
+#if defined(QMP_BUILD_PROFILING) && !defined(QMP_PROFILING_WRAPPERS)
+""")
+for ret, name, params, args in funcs:
+    out.write("#define %s P%s\n" % (name, name))
+out.write("""#endif
+
+/*
+ * QMP_PROFILED(F, V) lists the functions without their QMP_ prefix:
+ *   F(return type, name, (parameters), (arguments)) returning a value,
+ *   V(name, (parameters), (arguments)) returning void.
+ */
+#define QMP_PROFILED(F, V) \\
+""")
+for ret, name, params, args in funcs:
+    short = name[len("QMP_"):]
+    if ret == "void":
+        out.write("  V(%s, (%s), (%s)) \\\n" % (short, params, args))
+    else:
+        out.write("  F(%s, %s, (%s), (%s)) \\\n" % (ret, short, params, args))
+out.write("""
+#endif /* __QMP_PROFILING_H */
+""")
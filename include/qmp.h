@@ -168,14 +168,170 @@ typedef enum QMP_clear_to_send
   QMP_CTS_READY = 1
 } QMP_clear_to_send_t;
 
+/**
+ * Element types of QMP_allreduce.
+ */
+typedef enum QMP_datatype
+{
+  QMP_TYPE_INT,
+  QMP_TYPE_UNSIGNED,
+  QMP_TYPE_LONG,
+  QMP_TYPE_UNSIGNED_LONG,
+  QMP_TYPE_INT64,
+  QMP_TYPE_UINT64,
+  QMP_TYPE_FLOAT,
+  QMP_TYPE_DOUBLE,
+  QMP_TYPE_LONG_DOUBLE,
+  QMP_TYPE_N
+} QMP_datatype_t;
+
+/**
+ * Operations of QMP_allreduce.  The bitwise operations only apply to
+ * the integer types.
+ */
+typedef enum QMP_op
+{
+  QMP_OP_SUM,
+  QMP_OP_PROD,
+  QMP_OP_MAX,
+  QMP_OP_MIN,
+  QMP_OP_BAND,
+  QMP_OP_BOR,
+  QMP_OP_BXOR,
+  QMP_OP_N
+} QMP_op_t;
+
 #define QMP_ALIGN_ANY     0
 #define QMP_ALIGN_DEFAULT 64
 
+/**
+ * Memory type flags.
+ * QMP_MEM_COMMS: memory from the message passing layer (MPI_Alloc_mem),
+ *   which the network may keep registered.
+ * QMP_MEM_FAST: huge pages (hugetlbfs if available, else transparent
+ *   huge pages), left untouched so pages are placed by first touch.
+ *   Takes precedence over QMP_MEM_COMMS for blocks of a huge page or more.
+ * QMP_MEM_INTERLEAVE: pages interleaved over all NUMA nodes.
+ * QMP_MEM_NODE_SHARED: a segment of a window shared by the ranks of the
+ *   physical node, collective over those ranks.
+ * QMP_MEM_FILEBACKED: a shared mapping of an unlinked file in the
+ *   directory set by QMP_set_memory_directory (-qmp-mem-dir, else
+ *   $TMPDIR or /tmp), for data larger than RAM.  Never pooled.
+ * QMP_MEM_NONCACHE has no effect.
+ */
 #define QMP_MEM_NONCACHE  0x01
 #define QMP_MEM_COMMS     0x02
 #define QMP_MEM_FAST      0x04
+#define QMP_MEM_INTERLEAVE 0x08
+#define QMP_MEM_NODE_SHARED 0x10
+#define QMP_MEM_FILEBACKED 0x20
 #define QMP_MEM_DEFAULT   (QMP_MEM_COMMS|QMP_MEM_FAST)
 
+/**
+ * Categories of memory allocated by QMP.
+ * Datatypes are message passing datatypes, counted as objects only.
+ */
+typedef enum QMP_mem_category
+{
+  QMP_MEMCAT_USER,        /* QMP_allocate_memory */
+  QMP_MEMCAT_MSGMEM,      /* message memory descriptors */
+  QMP_MEMCAT_MSGHANDLE,   /* message handles */
+  QMP_MEMCAT_DATATYPE,    /* backend datatypes */
+  QMP_MEMCAT_INTERNAL,    /* topologies, staging buffers, ... */
+  QMP_MEMCAT_N
+} QMP_mem_category_t;
+
+/* number of QMP_MEM_* flag bits counted separately */
+#define QMP_MEM_NFLAGS 6
+
+typedef struct QMP_mem_counter
+{
+  size_t current;         /* bytes in use */
+  size_t peak;            /* high-water mark of current */
+  size_t count;           /* objects in use */
+  size_t allocations;     /* objects ever allocated */
+} QMP_mem_counter_t;
+
+typedef struct QMP_memory_stats
+{
+  QMP_mem_counter_t category[QMP_MEMCAT_N];
+  /* QMP_MEMCAT_USER bytes by flag bit, flag[i] for flag 1<<i */
+  QMP_mem_counter_t flag[QMP_MEM_NFLAGS];
+  QMP_mem_counter_t total;
+} QMP_memory_stats_t;
+
+/**
+ * Categories of the QMP call timers.
+ */
+typedef enum QMP_timer_category
+{
+  QMP_TIMER_P2P_START,    /* QMP_start */
+  QMP_TIMER_P2P_WAIT,     /* QMP_wait, QMP_is_complete */
+  QMP_TIMER_COLLECTIVE,   /* reductions, broadcasts, barriers */
+  QMP_TIMER_TOPOLOGY,     /* topologies and communicators */
+  QMP_TIMER_MEMORY,       /* memory, message memory and handles */
+  QMP_TIMER_OTHER,
+  QMP_TIMER_N
+} QMP_timer_category_t;
+
+typedef struct QMP_timer_report
+{
+  double seconds[QMP_TIMER_N];
+  uint64_t calls[QMP_TIMER_N];   /* calls entering the category */
+  double total;                  /* seconds in QMP calls */
+  int nthreads;                  /* threads that called QMP */
+} QMP_timer_report_t;
+
+/* latency histogram bins: bin 0 below 1us, bin k in [2^(k-1),2^k) us,
+   the last bin open ended */
+#define QMP_MSG_NBINS 24
+/* axes of relative message handles counted separately */
+#define QMP_MSG_MAXDIM 8
+
+typedef struct QMP_msg_counter
+{
+  uint64_t starts;        /* QMP_start calls */
+  uint64_t completions;   /* messages seen complete */
+  uint64_t bytes;         /* bytes of the completed messages */
+  double latency;         /* seconds from QMP_start to completion, summed */
+  double latency_max;
+  double wait;            /* seconds blocked in QMP_wait, summed */
+  uint32_t histogram[QMP_MSG_NBINS];  /* of the latency */
+} QMP_msg_counter_t;
+
+typedef struct QMP_msghandle_stats
+{
+  QMP_msg_counter_t total;
+  /* the handle, or the handles combined by QMP_declare_multiple, by
+     axis and direction, dir[mu][0] backward and dir[mu][1] forward */
+  QMP_msg_counter_t dir[QMP_MSG_MAXDIM][2];
+  /* handles not declared relative, or beyond QMP_MSG_MAXDIM */
+  QMP_msg_counter_t other;
+} QMP_msghandle_stats_t;
+
+/**
+ * Physical node hierarchy of a rank.
+ */
+typedef struct QMP_node_map
+{
+  int num_hosts;    /* number of physical nodes in the allocation */
+  int host_id;      /* node of this rank, 0 .. num_hosts-1 */
+  int local_size;   /* number of ranks on this node */
+  int local_rank;   /* rank within this node */
+  int num_sockets;  /* number of sockets in use on this node */
+  int socket_id;    /* socket this rank runs on, -1 if unknown */
+} QMP_node_map_t;
+
+/**
+ * Placement of logical topologies onto physical nodes.
+ */
+typedef enum QMP_topology_mapping
+{
+  QMP_MAP_LEX = 0,       /* lexicographic in node number */
+  QMP_MAP_NODE_BLOCK,    /* ranks of a node form a compact block */
+  QMP_MAP_NODE_CURVE     /* node blocks ordered along a space filling curve */
+} QMP_topology_mapping_t;
+
 /**
  * Memory type 
  */
@@ -196,6 +352,21 @@ typedef struct QMP_comm_struct * QMP_comm_t;
  */
 typedef struct QMP_msghandle_struct * QMP_msghandle_t;
 
+/**
+ * Thread team
+ */
+typedef struct QMP_team_struct * QMP_team_t;
+
+/**
+ * Halo exchange schedule
+ */
+typedef struct QMP_halo_struct * QMP_halo_t;
+
+/**
+ * Task farm
+ */
+typedef struct QMP_taskfarm_struct * QMP_taskfarm_t;
+
 /**
  * binary reduction function.
  *
@@ -427,6 +598,23 @@ extern const int*         QMP_get_allocated_coordinates (void);
 
 
 
+/**
+ * Get the physical node hierarchy of this rank.
+ *
+ * @param map returns the node map.
+ * @return QMP_SUCCESS.
+ */
+extern QMP_status_t       QMP_get_node_map (QMP_node_map_t *map);
+
+/**
+ * Set how logical topologies declared afterwards are placed onto
+ * physical nodes.  Also set by the -qmp-node-map lex|block|curve
+ * command line option.  Block and curve placement need the same number
+ * of ranks on every node and fall back to lexicographic otherwise.
+ */
+extern QMP_status_t       QMP_set_topology_mapping (QMP_topology_mapping_t mapping);
+
+
 /****************
  *  I/O layout  *
  ****************/
@@ -619,6 +807,55 @@ extern int                QMP_get_node_number_from (const int coordinates[]);
 extern int                QMP_comm_get_node_number_from (QMP_comm_t comm,
 							 const int coordinates[]);
 
+/**
+ * Get the node number at a displacement from this node.
+ *
+ * The displacement wraps around the periodic logical topology.
+ * Results are cached, so repeated lookups are cheap.
+ *
+ * @param disp displacement in each logical direction.
+ * @return node number.
+ */
+extern int                QMP_get_neighbor (const int disp[]);
+
+extern int                QMP_comm_get_neighbor (QMP_comm_t comm,
+						 const int disp[]);
+
+/**
+ * Measure the latency and bandwidth of the links to the logical
+ * neighbors in every direction with short shifts of small and large
+ * messages.  Node 0 prints the average and worst link per direction,
+ * and nodes whose outgoing link is much slower than the average of its
+ * direction report it.  Unless QMP_set_layout_weights was called, the
+ * inverse bandwidth per axis becomes the layout weight, and axes of
+ * length 1 get the mean weight of the measured ones.  The weights are
+ * only kept when the probed topology is the one QMP_layout_grid chose,
+ * whose axes are the lattice axes, not for a topology declared by
+ * -qmp-geom or QMP_declare_logical_topology.  Done for the first
+ * declared topology with the -qmp-probe command line option.
+ * Collective over the communicator.
+ *
+ * @return QMP_ERROR if no logical topology is declared.
+ */
+extern QMP_status_t       QMP_probe_links (void);
+extern QMP_status_t       QMP_comm_probe_links (QMP_comm_t comm);
+
+/**
+ * Get the probed link from this node to its neighbor along an axis.
+ *
+ * @param axis the axis.
+ * @param isign direction, positive or negative.
+ * @param latency returns the seconds per small message (may be NULL).
+ * @param bandwidth returns the bytes per second (may be NULL).
+ * Both are 0 along axes of length 1.
+ * @return QMP_ERROR if the links were not probed.
+ */
+extern QMP_status_t       QMP_get_link_probe (int axis, int isign,
+					      double *latency, double *bandwidth);
+extern QMP_status_t       QMP_comm_get_link_probe (QMP_comm_t comm, int axis,
+						   int isign, double *latency,
+						   double *bandwidth);
+
 
 /**********************************************
  *  Problem Specification (physical lattice)  *
@@ -631,15 +868,89 @@ extern int                QMP_comm_get_node_number_from (QMP_comm_t comm,
 extern QMP_status_t       QMP_layout_grid (const int dimensions[], int ndims);
 
 /**
- * Return logical (lattice) subgrid sizes.
+ * Axis weight which keeps QMP_layout_grid from splitting an axis.
+ */
+#define QMP_LAYOUT_NO_SPLIT (-1.0)
+
+/**
+ * Set the relative communication cost per lattice axis used by
+ * QMP_layout_grid to choose a layout (default 1 for every axis).
+ * An axis with weight QMP_LAYOUT_NO_SPLIT is never divided.
+ *
+ * @param weights cost weight of each axis.
+ * @param nweights number of weights, 0 restores the defaults.
+ */
+extern QMP_status_t       QMP_set_layout_weights (const double weights[],
+						  int nweights);
+
+/**
+ * Return the node grid QMP_layout_grid would choose for the lattice
+ * on a given number of nodes, without declaring a topology.
+ * The layout minimizes the weighted halo surface of a subgrid.
+ *
+ * @param dimensions lattice size.
+ * @param ndims number of lattice dimensions.
+ * @param nnodes number of nodes.
+ * @param nsquares returns the number of nodes along each axis.
+ * @param cost returns the cost of the layout (may be NULL).
+ * @return QMP_SUCCESS if a valid layout exists.
+ */
+extern QMP_status_t       QMP_query_layout_grid (const int dimensions[], int ndims,
+						 int nnodes, int nsquares[],
+						 double *cost);
+
+/**
+ * Allow QMP_layout_grid to split axes whose length is not divisible by
+ * the number of nodes along them (default off).  The sites are then
+ * spread as evenly as possible: subgrid extents along an axis differ
+ * by at most one, the larger ones on the lower node coordinates.
+ * Layouts with the smallest largest subgrid are preferred, so an even
+ * layout is still chosen whenever one exists.
+ *
+ * @param allow QMP_TRUE to allow uneven subgrids.
+ */
+extern QMP_status_t       QMP_set_layout_uneven (QMP_bool_t allow);
+
+/**
+ * Return logical (lattice) subgrid sizes of this node.
  */
 extern const int*         QMP_get_subgrid_dimensions (void);
 
+/**
+ * Return the global coordinates of the first site of this node's
+ * subgrid.
+ */
+extern const int*         QMP_get_subgrid_origin (void);
+
+/**
+ * Return the subgrid origin and size of any node.
+ *
+ * @param node node number.
+ * @param origin returns the global coordinates of its first site (may be NULL).
+ * @param extent returns its subgrid size (may be NULL).
+ */
+extern QMP_status_t       QMP_get_node_subgrid (int node, int origin[],
+						int extent[]);
+
 /**
  * Return logical (lattice) subgrid number of sites.
  */
 extern int                QMP_get_number_of_subgrid_sites (void);
 
+/**
+ * Find the owners of a list of global lattice sites, using the layout
+ * from QMP_layout_grid.  Coordinates outside the lattice are wrapped.
+ *
+ * @param global_coords n sites of ndim coordinates each.
+ * @param n number of sites.
+ * @param owner node number owning each site (may be NULL).
+ * @param local_index lexicographic index of each site in the owner's
+ *        subgrid (may be NULL).
+ * @return QMP_ERROR if no layout has been set.
+ */
+extern QMP_status_t       QMP_get_site_owner (const int global_coords[], int n,
+					      int owner[], int local_index[]);
+
 
 /***********************************
  *  Communication memory routines  *
@@ -674,6 +985,16 @@ extern QMP_mem_t*         QMP_allocate_aligned_memory (size_t nbytes,
  */
 extern void*              QMP_get_memory_pointer (QMP_mem_t* mem);
 
+/**
+ * Get pointer to the segment of another rank on the same physical node
+ * for memory allocated with QMP_MEM_NODE_SHARED.
+ * @param mem pointer to memory structure.
+ * @param local_rank rank within the physical node (see QMP_get_node_map).
+ * @return pointer to the segment, 0 if it is not accessible.
+ */
+extern void*              QMP_get_node_shared_pointer (QMP_mem_t* mem,
+						       int local_rank);
+
 /**
  * Free allocated memory structure.
  *
@@ -681,6 +1002,114 @@ extern void*              QMP_get_memory_pointer (QMP_mem_t* mem);
  */
 extern void               QMP_free_memory (QMP_mem_t* mem);
 
+/*
+ *  File backed memory
+ *
+ *  The ranges are byte offsets from the memory pointer.  Message memory
+ *  may point into file backed memory; prefetching the range before a
+ *  send is started lets the pages stream in while other work is done.
+ *  For other memory these calls do nothing.
+ */
+
+/**
+ * Set the directory for QMP_MEM_FILEBACKED memory, e.g. node local NVMe.
+ * @param dir directory name.
+ * @return QMP_SUCCESS, or QMP_INVALID_ARG if the name is too long.
+ */
+extern QMP_status_t       QMP_set_memory_directory (const char *dir);
+
+/**
+ * Hint that a range of file backed memory will be used soon
+ * (madvise MADV_WILLNEED).
+ * @param mem pointer to a memory structure.
+ * @param offset first byte of the range.
+ * @param len length of the range in bytes.
+ * @return QMP_SUCCESS.
+ */
+extern QMP_status_t       QMP_mem_prefetch (QMP_mem_t* mem, size_t offset,
+					    size_t len);
+
+/**
+ * Write a range of file backed memory back to its file.
+ * @param mem pointer to a memory structure.
+ * @param offset first byte of the range.
+ * @param len length of the range in bytes.
+ * @param wait QMP_FALSE to only schedule the writes.
+ * @return QMP_SUCCESS, or QMP_ERROR if the write fails.
+ */
+extern QMP_status_t       QMP_mem_writeback (QMP_mem_t* mem, size_t offset,
+					     size_t len, QMP_bool_t wait);
+
+/**
+ * Write a range of file backed memory back and drop it from RAM.
+ * It is read back from the file when touched again.
+ * @param mem pointer to a memory structure.
+ * @param offset first byte of the range.
+ * @param len length of the range in bytes.
+ * @return QMP_SUCCESS, or QMP_ERROR if the write fails.
+ */
+extern QMP_status_t       QMP_mem_evict (QMP_mem_t* mem, size_t offset,
+					 size_t len);
+
+/*
+ *  Buffer pool
+ *
+ *  Freed blocks are kept in size classes, four per power of two, and
+ *  handed out again for the same flags, so buffers keep their pages and network
+ *  registration when message handles are rebuilt.  QMP_free_memory
+ *  returns pool blocks to the pool.
+ */
+
+/**
+ * Allocate memory from the buffer pool.
+ * @param nbytes number of bytes of memory to allocate.
+ * @param alignment required alignment for memory.
+ * @param flags memory type flags (QMP_MEM_NODE_SHARED is not pooled).
+ * @return pointer to a memory structure, 0 if no memory.
+ */
+extern QMP_mem_t*         QMP_pool_allocate (size_t nbytes,
+					     size_t alignment,
+					     int flags);
+
+/**
+ * Return memory to the buffer pool.
+ * @param mem pointer to a memory structure.
+ */
+extern void               QMP_pool_free (QMP_mem_t* mem);
+
+/**
+ * Release cached pool blocks, largest first, until at most keep
+ * bytes remain cached.
+ * @param keep number of cached bytes to keep.
+ * @return number of bytes released.
+ */
+extern size_t             QMP_pool_trim (size_t keep);
+
+/**
+ * Set the most bytes the pool keeps cached (default 256MB).
+ * Blocks freed beyond the limit are released, largest first.
+ * @param limit cached byte limit.
+ */
+extern void               QMP_pool_set_limit (size_t limit);
+
+/**
+ * Route QMP_allocate_memory and QMP_allocate_aligned_memory of up to
+ * 4MB through the buffer pool (also set by the -qmp-mem-pool command
+ * line option).
+ * @param enable QMP_TRUE to use the pool.
+ */
+extern void               QMP_pool_enable (QMP_bool_t enable);
+
+/**
+ * Get the memory QMP has allocated on this rank, per category and per
+ * flag, with high-water marks.  A machine-wide report and a list of
+ * objects not freed are printed at QMP_finalize_msg_passing with the
+ * -qmp-mem-report command line option.
+ * @param stats filled with the current counters.
+ * @return QMP_SUCCESS.
+ */
+extern QMP_status_t       QMP_get_memory_stats (QMP_memory_stats_t *stats);
+
 /**
  * Create a message memory using memory created by user.
  * 
@@ -819,6 +1248,53 @@ extern QMP_msghandle_t    QMP_comm_declare_receive_from(QMP_comm_t comm,
 							int rem_node_rank,
 							int priority);
 
+/**
+ * Declare an endpoint for message send channel operation to the node
+ * at a displacement from this node (e.g. a diagonal or multi-hop
+ * neighbor).
+ *
+ * Each displacement uses its own message tag, so any number of
+ * displaced messages can be in flight at the same time.  Components
+ * must lie in [-3,3].  Every displacement within the first five
+ * logical directions has a tag; one with nonzero components further
+ * out may have none, and then QMP_INVALID_ARG is set and no handle is
+ * returned.  The matching receive on the remote node uses the
+ * opposite displacement.
+ *
+ * @param m a message memory handle.
+ * @param disp displacement in each logical direction.
+ * @param priority priority of this communication.
+ *
+ * @return QMP_msghandle_t caller should check whether it is null.
+ */
+extern QMP_msghandle_t    QMP_declare_send_displaced (QMP_msgmem_t m,
+						      const int disp[],
+						      int priority);
+
+extern QMP_msghandle_t    QMP_comm_declare_send_displaced (QMP_comm_t comm,
+							   QMP_msgmem_t m,
+							   const int disp[],
+							   int priority);
+
+/**
+ * Declare an endpoint for message channel receiving operation from
+ * the node at a displacement from this node.
+ *
+ * @param m a message memory handle.
+ * @param disp displacement in each logical direction.
+ * @param priority priority of this communication.
+ *
+ * @return QMP_msghandle_t caller should check whether it is null.
+ */
+extern QMP_msghandle_t    QMP_declare_receive_displaced (QMP_msgmem_t m,
+							 const int disp[],
+							 int priority);
+
+extern QMP_msghandle_t    QMP_comm_declare_receive_displaced (QMP_comm_t comm,
+							      QMP_msgmem_t m,
+							      const int disp[],
+							      int priority);
+
 extern QMP_status_t QMP_change_address(QMP_msghandle_t msg, void *addr);
 extern QMP_status_t QMP_change_address_multiple(QMP_msghandle_t msg, void *addr[], int naddr);
 
@@ -896,6 +1372,35 @@ extern QMP_status_t       QMP_wait_all (QMP_msghandle_t h[], int num);
  */
 extern QMP_bool_t         QMP_is_complete (QMP_msghandle_t h);
 
+/**
+ * Get the message statistics of a message handle since it was declared.
+ * For a handle combining several messages, the latency of each message
+ * runs until that message completed, and its wait time is the part of
+ * the wait spent before it completed.  A machine-wide summary over all
+ * handles is printed at QMP_finalize_msg_passing with the
+ * -qmp-msg-report command line option.
+ *
+ * @param h a message handle.
+ * @param stats filled with the counters of the handle.
+ * @return QMP_SUCCESS.
+ */
+extern QMP_status_t       QMP_get_msghandle_stats (QMP_msghandle_t h,
+						   QMP_msghandle_stats_t *stats);
+
+/**
+ * Write the point-to-point traffic of all ranks to a file, one line
+ * "sender receiver bytes messages" per pair of ranks that communicated,
+ * with ranks of the allocated communicator.  Counts the messages started
+ * on any communicator since QMP_init_msg_passing.  Collective over the
+ * allocated communicator, node 0 writes the file.  Also written at
+ * QMP_finalize_msg_passing with the -qmp-comm-matrix file command line
+ * option.
+ *
+ * @param filename the file to write.
+ * @return QMP_SUCCESS, or QMP_ERROR if the file cannot be written.
+ */
+extern QMP_status_t       QMP_dump_comm_matrix (const char *filename);
+
 
 /***********************
  *  Global Operations  *
@@ -1056,6 +1561,25 @@ extern QMP_status_t       QMP_xor_ulong (unsigned long* value);
 
 extern QMP_status_t       QMP_comm_xor_ulong (QMP_comm_t comm, unsigned long* value);
 
+/**
+ * Global in place reduction of an array in its own type, without
+ * conversion.
+ *
+ * @param value pointer to the elements.
+ * @param count number of elements.
+ * @param type  type of the elements.
+ * @param op    reduction operation.
+ *
+ * @return QMP_SUCCESS, QMP_INVALID_ARG for a bitwise operation on a
+ * floating point type.
+ */
+extern QMP_status_t       QMP_allreduce (void *value, int count,
+					 QMP_datatype_t type, QMP_op_t op);
+
+extern QMP_status_t       QMP_comm_allreduce (QMP_comm_t comm, void *value,
+					      int count, QMP_datatype_t type,
+					      QMP_op_t op);
+
 /**
  * Transposition
  */
@@ -1078,6 +1602,170 @@ extern QMP_status_t       QMP_comm_binary_reduction (QMP_comm_t comm,
 						     QMP_binary_func bfunc);
 
 
+/********************
+ *  Halo exchange   *
+ ********************/
+
+/**
+ * Halo modes: exchange the faces only, or also the edges and corners
+ * by forwarding the ghosts through the face neighbors in ndim stages.
+ */
+#define QMP_HALO_FACES   0
+#define QMP_HALO_CORNERS 1
+
+/**
+ * Declare a halo exchange for a field with ghost zones.
+ *
+ * The field is lexicographic (first index fastest) over the local
+ * volume padded by depth sites on each side, with sitesize bytes per
+ * site.  In QMP_HALO_CORNERS mode the ghosts of every diagonal
+ * neighbor are filled too, still with only 2*ndim messages per node.
+ *
+ * @param field pointer to the padded field.
+ * @param local local lattice size without ghosts.
+ * @param ndim number of dimensions, at least those of the logical
+ *        topology; further axes are periodic on the node.
+ * @param depth width of the ghost zone.
+ * @param sitesize bytes per site.
+ * @param flags QMP_HALO_FACES or QMP_HALO_CORNERS.
+ * @return the schedule, NULL on error.
+ */
+extern QMP_halo_t         QMP_declare_halo (void *field, const int local[],
+					    int ndim, int depth,
+					    size_t sitesize, int flags);
+
+extern QMP_halo_t         QMP_comm_declare_halo (QMP_comm_t comm, void *field,
+						 const int local[], int ndim,
+						 int depth, size_t sitesize,
+						 int flags);
+
+/**
+ * Declare a halo exchange for a field on this node's subgrid from
+ * QMP_layout_grid.  Works for uneven layouts, where the face sizes
+ * differ from node to node.
+ */
+extern QMP_halo_t         QMP_declare_subgrid_halo (void *field, int depth,
+						    size_t sitesize, int flags);
+
+/**
+ * Start and finish a halo exchange.  Computation on the interior can be
+ * overlapped between the two.  In corner mode the later stages are
+ * posted by QMP_halo_wait.
+ */
+extern QMP_status_t       QMP_halo_start (QMP_halo_t h);
+
+extern QMP_status_t       QMP_halo_wait (QMP_halo_t h);
+
+extern QMP_status_t       QMP_halo_exchange (QMP_halo_t h);
+
+/**
+ * Free a halo exchange schedule.
+ */
+extern void               QMP_free_halo (QMP_halo_t h);
+
+
+/***************
+ *  Task farm  *
+ ***************/
+
+/**
+ * Create a task farm which hands out tasks 0 .. ntasks-1 dynamically
+ * to the job partitions (see -qmp-job).  Jobs that finish early take
+ * more tasks.  Collective over the allocated communicator.
+ *
+ * @param ntasks number of tasks.
+ * @return the task farm, NULL if no memory.
+ */
+extern QMP_taskfarm_t     QMP_taskfarm_create (int ntasks);
+
+/**
+ * Get the next task for this job.  Collective over the job
+ * communicator, all its nodes get the same task.
+ *
+ * @return task number, -1 when no tasks are left.
+ */
+extern int                QMP_taskfarm_next (QMP_taskfarm_t tf);
+
+/**
+ * Log the completion of a task with a result value.  Called by the
+ * nodes of the job, the result from node 0 of the job is kept.
+ */
+extern QMP_status_t       QMP_taskfarm_complete (QMP_taskfarm_t tf, int task,
+						 double result);
+
+/**
+ * Combine the completion logs of all jobs on every node.  If logfile
+ * is not NULL, node 0 writes one line per task to it.  May be called
+ * again, for example while tasks are still being handed out, and then
+ * combines the tasks completed so far.  Collective over the allocated
+ * communicator.
+ */
+extern QMP_status_t       QMP_taskfarm_collect (QMP_taskfarm_t tf,
+						const char *logfile);
+
+/**
+ * Get the job, run time and result of a task after QMP_taskfarm_collect.
+ *
+ * @return QMP_ERROR if the task was not completed.
+ */
+extern QMP_status_t       QMP_taskfarm_get_record (QMP_taskfarm_t tf, int task,
+						   int *job, double *seconds,
+						   double *result);
+
+/**
+ * Free a task farm.  Collective over the allocated communicator.
+ */
+extern void               QMP_taskfarm_free (QMP_taskfarm_t tf);
+
+
+/**************************
+ *  Thread team reductions  *
+ **************************/
+
+/**
+ * Create a team of threads which can do global reductions from inside
+ * a parallel region.  Must be called outside of the parallel region.
+ *
+ * @param nthreads number of threads in the team.
+ * @return the team, NULL if no memory.
+ */
+extern QMP_team_t         QMP_team_create (int nthreads);
+
+extern QMP_team_t         QMP_comm_team_create (QMP_comm_t comm, int nthreads);
+
+/**
+ * Free a thread team.
+ */
+extern void               QMP_team_free (QMP_team_t team);
+
+/**
+ * Global in place sums over all threads of the team and all nodes of
+ * the team's communicator.  These must be called by every thread of
+ * the team with its thread number tid (0 .. nthreads-1).  Thread 0
+ * does the communication, so it must be allowed to call QMP.
+ * Every thread gets the result.
+ *
+ * @return QMP_SUCCESS when the global sum is a success.
+ */
+extern QMP_status_t       QMP_team_sum_double (QMP_team_t team, int tid,
+					       double *value);
+
+extern QMP_status_t       QMP_team_sum_float_array (QMP_team_t team, int tid,
+						    float value[], int length);
+
+extern QMP_status_t       QMP_team_sum_double_array (QMP_team_t team, int tid,
+						     double value[], int length);
+
+/**
+ * Maximum and minimum over all threads of the team and all nodes.
+ */
+extern QMP_status_t       QMP_team_max_double (QMP_team_t team, int tid,
+					       double *value);
+
+extern QMP_status_t       QMP_team_min_double (QMP_team_t team, int tid,
+					       double *value);
+
+
 /*******************************
  *  Error reporting functions  *
  *******************************/
@@ -1151,8 +1839,47 @@ extern int   QMP_error              (const char *format, ...);
 
 extern double QMP_time(void);
 extern void   QMP_reset_total_qmp_time(void);
+/**
+ * Seconds spent in QMP calls by the calling thread since the last
+ * QMP_reset_total_qmp_time, so with several threads each gets its own
+ * time.  QMP_get_timer_report gives the sum over threads.
+ */
 extern double QMP_get_total_qmp_time(void);
 
+/**
+ * Get the time spent in QMP calls by category, summed over the threads
+ * of this rank.  The time of nested calls is charged to the innermost
+ * category, so the categories add up to the total.  Needs a library
+ * built with timing (QMP_TIMING in CMake, --enable-timing).
+ *
+ * Timing adds two clock reads to every outermost QMP call.  The target
+ * of 20 ns per call is not met: on x86 the clock is the time stamp
+ * counter, and on a virtual machine where it takes 20 ns to read a call
+ * costs about 47 ns more than without timing.
+ *
+ * @param report filled with the seconds and calls per category.
+ * @return QMP_SUCCESS, or QMP_ERROR without timing.
+ */
+extern QMP_status_t QMP_get_timer_report(QMP_timer_report_t *report);
+
+/**
+ * Report the load imbalance since the previous report or since
+ * QMP_init_msg_passing.  The time the calling thread spends outside
+ * of QMP_wait, barriers and reductions is the compute time of its rank,
+ * so with several threads call it from the one that communicates, and
+ * always from the same one.  The median is found to 1/4096 of the
+ * spread of the compute times.  Node 0 prints the
+ * spread of the compute and blocked times, the slowest ranks print
+ * their host, and ranks whose compute time was more than the threshold
+ * above the median in at least 3/4 of the reports are flagged.  Also
+ * called at QMP_finalize_msg_passing with the -qmp-imbalance [percent]
+ * command line option, which sets the threshold (default 5).
+ * Collective over the allocated communicator.
+ *
+ * @return QMP_SUCCESS, or the error of the reduction.
+ */
+extern QMP_status_t QMP_report_imbalance(void);
+
 /**
  *  Version information
  */
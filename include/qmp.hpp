@@ -9,175 +9,382 @@
  *----------------------------------------------------------------------------
  *
  * Description:
- *     Qcd Message Passing Pacakge C++ Public Header File 
- *
- * Author:  
- *      Chulwoo Jung
- *      Physics Department,Coulmbia University
- *
- * Revision History:
- *   $Log: not supported by cvs2svn $
- *   Revision 1.2  2003/02/13 16:41:16  chen
- *   minor change
- *
- *   Revision 1.1  2003/02/13 16:37:55  chen
- *   add qmp.hpp remove qmp.hh
- *
- *   Revision 1.1  2003/02/13 16:22:24  chen
- *   qmp version 1.2
- *
+ *     Qcd Message Passing Package C++ Public Header File
  *
+ *     Header only C++17 wrapper over qmp.h.  The classes own a single
+ *     QMP handle each and are movable but not copyable, every call is
+ *     an inline call of the C function.  Constructors throw QMP::error
+ *     on failure, the other operations return the QMP_status_t of the
+ *     C call.
  *
+ *     The reductions sum, max, min and prod reduce in the type of their
+ *     argument through QMP_comm_allreduce, so for example sum of a float
+ *     is a float reduction and not the double accumulation of
+ *     QMP_sum_float.
  */
+#ifndef _QMP_HPP
+#define _QMP_HPP
 
-/** 
- * Declareing SIGN as an enum class enables setting defaults for
- * priority and overloading SendTo and SendRelative. 
- */
-#ifndef _QMP_CPP_H
-#define _QMP_CPP_H
-
-enum SIGN {PLUS = 1, MINUS = -1};
-
-namespace QMP { 
-
-  QMP_status_t      init(int* argc, char ***argv, 
-			 QMP_smpaddr_type_t option = QMP_SMP_ONE_ADDRESS);
-
-  void              finalize(void);
-
-  QMP_u32_t         getSMPCount (void);
-  QMP_ictype_t      getMsgPassingType (void);
-  QMP_u32_t         getNumberOfNodes (void);
-  QMP_u32_t         getNodeNumber(void);
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-  const QMP_u32_t   getAllocatedNumberOfDimensions(void);
-  const QMP_u32_t*  getAllocatedDimensions(void);
-  const QMP_u32_t*  getAllocatedCoordinates(void);
+#include "qmp.h"
 
-  QMP_bool_t        declareLogicalTopology (const QMP_u32_t *dims, 
-					    QMP_u32_t ndim);
-  QMP_bool_t        logicalTopologyIsDeclared(void);
-  const QMP_u32_t   getLogicalNumberOfDimensions(void);
-  const QMP_u32_t*  getLogicalDimensions(void);
-  const QMP_u32_t*  getLogicalCoordinates(void);
+namespace QMP {
 
-  const QMP_u32_t   getNodeNumberFrom (const QMP_u32_t *coor);
-  const QMP_u32_t*  getLogicalCoordinatedFrom (QMP_u32_t nodenum);
-
-  QMP_bool_t        layoutGrid (QMP_u32_t *lattDim, QMP_u32_t ndims);
-  const QMP_u32_t*  getSubgridDimensions(void);
-
-  const char*       errorString(QMP_status_t code);
-
-  void*             allocateAlignedMemory(QMP_u32_t nbytes);
-  void              freeAlignedMemory(void *ab);
+  /**
+   * Failure of a QMP call in a constructor.
+   */
+  class error : public std::runtime_error {
+  public:
+    explicit error(const char *call, QMP_status_t status = QMP_ERROR)
+      : std::runtime_error(std::string(call) + ": " +
+			   QMP_error_string(status)),
+	status_(status) {}
+    QMP_status_t status() const noexcept { return status_; }
+  private:
+    QMP_status_t status_;
+  };
 
-  class MessageMemory {
+  /**
+   * Initialize QMP for the lifetime of the object.
+   */
+  class Session {
+  public:
+    Session(int *argc, char ***argv,
+	    QMP_thread_level_t required = QMP_THREAD_SINGLE) {
+      QMP_status_t status =
+	QMP_init_msg_passing(argc, argv, required, &provided_);
+      if(status != QMP_SUCCESS) throw error("QMP_init_msg_passing", status);
+    }
+    ~Session() { QMP_finalize_msg_passing(); }
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    QMP_thread_level_t provided() const noexcept { return provided_; }
+  private:
+    QMP_thread_level_t provided_;
+  };
 
-    MessageMemory  (void){};
-    ~MessageMemory (void);
+  inline int number_of_nodes(QMP_comm_t comm = QMP_comm_get_default())
+  { return QMP_comm_get_number_of_nodes(comm); }
 
-    MessageMemory (const void *buffer, QMP_u32_t blksize, 
-		   QMP_u32_t nblocks = 1, QMP_u32_t stride = 0);
+  inline int node_number(QMP_comm_t comm = QMP_comm_get_default())
+  { return QMP_comm_get_node_number(comm); }
 
-    MessageMemory (const void **buffer, QMP_u32_t *blksize, 
-		   QMP_u32_t *nblocks , QMP_u32_t *stride, QMP_u32_t n);
+  inline bool is_primary_node() { return QMP_is_primary_node(); }
 
-    void Init     (const void *buffer, QMP_u32_t blksize, 
-		   QMP_u32_t nblocks = 1, QMP_u32_t stride = 0);
+  inline QMP_status_t barrier(QMP_comm_t comm = QMP_comm_get_default())
+  { return QMP_comm_barrier(comm); }
 
+  /**
+   * Memory from QMP_allocate_memory.
+   */
+  class Memory {
+  public:
+    Memory() noexcept = default;
+    explicit Memory(size_t nbytes)
+      : m_(QMP_allocate_memory(nbytes)) { if(!m_) throw std::bad_alloc(); }
+    Memory(size_t nbytes, size_t alignment, int flags = 0)
+      : m_(QMP_allocate_aligned_memory(nbytes, alignment, flags))
+    { if(!m_) throw std::bad_alloc(); }
+    Memory(Memory &&o) noexcept : m_(o.release()) {}
+    Memory &operator=(Memory &&o) noexcept
+    { if(this != &o) { reset(); m_ = o.release(); } return *this; }
+    Memory(const Memory &) = delete;
+    Memory &operator=(const Memory &) = delete;
+    ~Memory() { reset(); }
+
+    void *data() const noexcept
+    { return m_ ? QMP_get_memory_pointer(m_) : nullptr; }
+    template<class T> T *as() const noexcept
+    { return static_cast<T *>(data()); }
+
+    QMP_mem_t *get() const noexcept { return m_; }
+    QMP_mem_t *release() noexcept { QMP_mem_t *m = m_; m_ = nullptr; return m; }
+    void reset() noexcept { if(m_) QMP_free_memory(m_); m_ = nullptr; }
+    explicit operator bool() const noexcept { return m_ != nullptr; }
+  private:
+    QMP_mem_t *m_ = nullptr;
   };
 
-  class MessageOperation{
+  /* a non owning range, trivially copyable and not a std::array */
+  template<class R, class = void>
+  struct is_view : std::is_trivially_copyable<R> {};
+  template<class R>
+  struct is_view<R, std::void_t<decltype(std::tuple_size<R>::value)>>
+    : std::false_type {};
 
-    virtual QMP_status_t start(void)  = 0;
-    virtual QMP_status_t isComplete(void) = 0;
-    virtual QMP_status_t wait(void) = 0;
-    virtual QMP_status_t getErrorNumber (void) const  = 0;
-    virtual const char * getErrorString (void)  = 0;
-  };
+  /**
+   * Message memory.  It must outlive the message handles declared on it,
+   * so declare it before them.
+   */
+  class MsgMem {
+  public:
+    MsgMem() noexcept = default;
 
-  class SingleOperation : public MessageOperation{
+    /** Adopt a message memory from the C API. */
+    explicit MsgMem(QMP_msgmem_t m) : m_(m)
+    { if(!m_) throw error("QMP_declare_msgmem"); }
 
-    /**
-     *  SingleOperation refers to a (possibly multiple strided)
-     * MessageOperation to a specific wire or a node.
-     */
-    SingleOperation (void){};
-    ~SingleOperation(void){};
-    
-    QMP_status_t declareSend (MessageMemory *mm, 
-			      QMP_s32_t dimension, SIGN sign, 
-			      QMP_s32_t priority = DEFAULT_PRIORITY);
-
-    QMP_status_t declareSend (MessageMemory *mm, QMP_s32_t remoteHost, 
-			      QMP_s32_t priority = DEFAULT_PRIORITY);
-
-    QMP_status_t declareReceive (MessageMemory *mm, QMP_s32_t dimension, 
-				 SIGN sign, 
-				 QMP_s32_t priority  = DEFAULT_PRIORITY);
-    QMP_status_t declareReceive (MessageMemory *mm, QMP_s32_t remoteHos, 
-				 QMP_s32_t priority  = DEFAULT_PRIORITY);
+    MsgMem(const void *p, size_t nbytes)
+      : MsgMem(QMP_declare_msgmem(p, nbytes)) {}
+
+    /** n elements of type T from p. */
+    template<class T, class = std::enable_if_t<!std::is_void_v<T>>>
+    MsgMem(T *p, size_t n) : MsgMem(QMP_declare_msgmem(p, n*sizeof(T)))
+    { static_assert(std::is_trivially_copyable_v<T>,
+		    "message elements must be trivially copyable"); }
 
     /**
-     *  It is NOT allowed to "re-use" MessageOperations
+     * A contiguous range, std::vector, std::array, T[n], or a view such
+     * as std::span which may also be a temporary.
      */
-    QMP_status_t start (void);
-    QMP_status_t isComplete (void);
-    QMP_status_t wait (void);
-    QMP_status_t getErrorNumber (void) const;
-    const char * getErrorString (void);
+    template<class R, class = decltype(std::data(std::declval<R &>())),
+	     class = decltype(std::size(std::declval<R &>())),
+	     class = std::enable_if_t<std::is_lvalue_reference_v<R> ||
+				      is_view<R>::value>>
+    explicit MsgMem(R &&r) : MsgMem(std::data(r), std::size(r)) {}
+
+    static MsgMem strided(void *base, size_t blksize, int nblocks,
+			  ptrdiff_t stride)
+    { return MsgMem(QMP_declare_strided_msgmem(base, blksize, nblocks,
+					       stride)); }
+
+    static MsgMem strided_array(void *base[], size_t blksize[],
+				int nblocks[], ptrdiff_t stride[], int num)
+    { return MsgMem(QMP_declare_strided_array_msgmem(base, blksize, nblocks,
+						     stride, num)); }
+
+    static MsgMem indexed(void *base, int blocklen[], int index[],
+			  int elemsize, int count)
+    { return MsgMem(QMP_declare_indexed_msgmem(base, blocklen, index,
+					       elemsize, count)); }
+
+    MsgMem(MsgMem &&o) noexcept : m_(o.release()) {}
+    MsgMem &operator=(MsgMem &&o) noexcept
+    { if(this != &o) { reset(); m_ = o.release(); } return *this; }
+    MsgMem(const MsgMem &) = delete;
+    MsgMem &operator=(const MsgMem &) = delete;
+    ~MsgMem() { reset(); }
+
+    QMP_msgmem_t get() const noexcept { return m_; }
+    QMP_msgmem_t release() noexcept
+    { QMP_msgmem_t m = m_; m_ = nullptr; return m; }
+    void reset() noexcept { if(m_) QMP_free_msgmem(m_); m_ = nullptr; }
+    explicit operator bool() const noexcept { return m_ != nullptr; }
+  private:
+    QMP_msgmem_t m_ = nullptr;
   };
 
-
-  class MultiOperation : public MessageOperation{
+  /**
+   * Message handle, a single send or receive or a multiple.
+   */
+  class MsgHandle {
+  public:
+    MsgHandle() noexcept = default;
+
+    /** Adopt a message handle from the C API. */
+    explicit MsgHandle(QMP_msghandle_t h) : h_(h)
+    { if(!h_) throw error("QMP_declare_msghandle"); }
+
+    static MsgHandle send_relative(const MsgMem &m, int axis, int dir,
+				   int priority = 0)
+    { return MsgHandle(QMP_declare_send_relative(m.get(), axis, dir,
+						 priority)); }
+    static MsgHandle send_relative(QMP_comm_t comm, const MsgMem &m,
+				   int axis, int dir, int priority = 0)
+    { return MsgHandle(QMP_comm_declare_send_relative(comm, m.get(), axis,
+						      dir, priority)); }
+
+    static MsgHandle receive_relative(const MsgMem &m, int axis, int dir,
+				      int priority = 0)
+    { return MsgHandle(QMP_declare_receive_relative(m.get(), axis, dir,
+						    priority)); }
+    static MsgHandle receive_relative(QMP_comm_t comm, const MsgMem &m,
+				      int axis, int dir, int priority = 0)
+    { return MsgHandle(QMP_comm_declare_receive_relative(comm, m.get(), axis,
+							 dir, priority)); }
+
+    static MsgHandle send_to(const MsgMem &m, int node, int priority = 0)
+    { return MsgHandle(QMP_declare_send_to(m.get(), node, priority)); }
+    static MsgHandle send_to(QMP_comm_t comm, const MsgMem &m, int node,
+			     int priority = 0)
+    { return MsgHandle(QMP_comm_declare_send_to(comm, m.get(), node,
+						priority)); }
+
+    static MsgHandle receive_from(const MsgMem &m, int node, int priority = 0)
+    { return MsgHandle(QMP_declare_receive_from(m.get(), node, priority)); }
+    static MsgHandle receive_from(QMP_comm_t comm, const MsgMem &m, int node,
+				  int priority = 0)
+    { return MsgHandle(QMP_comm_declare_receive_from(comm, m.get(), node,
+						     priority)); }
 
     /**
-     *  MultiOperation  refers to a collection of SingleOperation's
-     *  No 2 SingleOperation's should have same wire or the node.
-     *  Receiving and Sending operation is considered separate.
+     * Combine the handles into one, which takes ownership of them as
+     * QMP_declare_multiple does.  The handles are left empty.
      */
-    MultiOperation (void){};
-    ~MultiOperation(void){};
-
-    MultiOperation(SingleOperation *msgops, QMP_u32_t nmsgops);
-    MultiOperation(SingleOperation **msgops, QMP_u32_t nmsgops);
-
-    void init(SingleOperation *msgops, QMP_u32_t nmsgops);
-    void init(SingleOperation **msgops, QMP_u32_t nmsgops);
-
-    QMP_status_t start(void);
-    QMP_status_t isComplete(void);
-    QMP_status_t wait(void);
-    QMP_status_t getErrorNumber (void) const;
-    const char * getErrorString (void);
+    static MsgHandle multiple(std::vector<MsgHandle> &&hs) {
+      std::vector<QMP_msghandle_t> raw;
+      raw.reserve(hs.size());
+      for(auto &h : hs) raw.push_back(h.get());
+      MsgHandle mh(QMP_declare_multiple(raw.data(), (int)raw.size()));
+      for(auto &h : hs) h.release();
+      hs.clear();
+      return mh;
+    }
+
+    QMP_status_t start() const { return QMP_start(h_); }
+    QMP_status_t wait() const { return QMP_wait(h_); }
+    bool is_complete() const { return QMP_is_complete(h_); }
+    QMP_status_t clear_to_send(QMP_clear_to_send_t cts) const
+    { return QMP_clear_to_send(h_, cts); }
+    QMP_status_t change_address(void *addr) const
+    { return QMP_change_address(h_, addr); }
+
+    MsgHandle(MsgHandle &&o) noexcept : h_(o.release()) {}
+    MsgHandle &operator=(MsgHandle &&o) noexcept
+    { if(this != &o) { reset(); h_ = o.release(); } return *this; }
+    MsgHandle(const MsgHandle &) = delete;
+    MsgHandle &operator=(const MsgHandle &) = delete;
+    ~MsgHandle() { reset(); }
+
+    QMP_msghandle_t get() const noexcept { return h_; }
+    QMP_msghandle_t release() noexcept
+    { QMP_msghandle_t h = h_; h_ = nullptr; return h; }
+    void reset() noexcept { if(h_) QMP_free_msghandle(h_); h_ = nullptr; }
+    explicit operator bool() const noexcept { return h_ != nullptr; }
+  private:
+    QMP_msghandle_t h_ = nullptr;
   };
 
-
-  QMP_status_t sumInt(QMP_s32_t *i);
-  QMP_status_t sumFloat(QMP_float_t *x);
-  QMP_status_t sumDouble(QMP_double_t *x);
-
-  QMP_status_t sumFloatArray(QMP_float_t *x, QMP_u32_t length);
-  QMP_status_t sumDoubleArray(QMP_double_t *x, QMP_u32_t length);
-
-  QMP_status_t maxInt(QMP_s32_t *i);
-  QMP_status_t maxFloat(QMP_float_t *x);
-  QMP_status_t maxDouble(QMP_double_t *x);
-
-  QMP_status_t minInt(QMP_s32_t *i);
-  QMP_status_t minFloat(QMP_float_t *x);
-  QMP_status_t minDouble(QMP_double_t *x);
-
-  QMP_status_t binaryReduction( void *localvalue, QMP_u32_t nbytes, QMP_binary_func funcptr);
-  typedef void (*QMP_binary_func) (void* inoutvec, void* invec);
+  /**
+   * QMP_datatype_t of a reduction element type, selected at compile
+   * time.  int64_t and uint64_t are one of long or long long.
+   */
+  template<class T> struct datatype {};
+#define QMP_HPP_DATATYPE(T, D)					\
+  template<> struct datatype<T>					\
+    : std::integral_constant<QMP_datatype_t, D> {}
+  QMP_HPP_DATATYPE(int, QMP_TYPE_INT);
+  QMP_HPP_DATATYPE(unsigned int, QMP_TYPE_UNSIGNED);
+  QMP_HPP_DATATYPE(long, QMP_TYPE_LONG);
+  QMP_HPP_DATATYPE(unsigned long, QMP_TYPE_UNSIGNED_LONG);
+  QMP_HPP_DATATYPE(long long, QMP_TYPE_INT64);
+  QMP_HPP_DATATYPE(unsigned long long, QMP_TYPE_UINT64);
+  QMP_HPP_DATATYPE(float, QMP_TYPE_FLOAT);
+  QMP_HPP_DATATYPE(double, QMP_TYPE_DOUBLE);
+  QMP_HPP_DATATYPE(long double, QMP_TYPE_LONG_DOUBLE);
+#undef QMP_HPP_DATATYPE
+  static_assert(sizeof(long long) == 8, "long long is not 64 bits");
+
+  template<class T, class = void>
+  struct is_reducible : std::false_type {};
+  template<class T>
+  struct is_reducible<T, std::void_t<decltype(datatype<T>::value)>>
+    : std::true_type {};
+  template<class T>
+  inline constexpr bool is_reducible_v = is_reducible<T>::value;
 
   /**
-   * Maybe using QMP_u64_t is more consistent instead of using long as in C binding?
+   * Global in place reduction of count elements of type T.
+   */
+  template<class T>
+  inline QMP_status_t allreduce(QMP_op_t op, T *value, int count,
+				QMP_comm_t comm = QMP_comm_get_default()) {
+    static_assert(is_reducible_v<T>, "no QMP_datatype_t for this type");
+    return QMP_comm_allreduce(comm, value, count, datatype<T>::value, op);
+  }
+
+  /*
+   * sum, max, min and prod of a scalar, of an array (pointer, count)
+   * and of a contiguous range, in place.
+   */
+#define QMP_HPP_REDUCTION(NAME, OP)					\
+  template<class T, class = std::enable_if_t<is_reducible_v<T>>>	\
+  inline QMP_status_t NAME(T &value,					\
+			   QMP_comm_t comm = QMP_comm_get_default())	\
+  { return allreduce(OP, &value, 1, comm); }				\
+  template<class T, class = std::enable_if_t<is_reducible_v<T>>>	\
+  inline QMP_status_t NAME(T *value, int count,				\
+			   QMP_comm_t comm = QMP_comm_get_default())	\
+  { return allreduce(OP, value, count, comm); }				\
+  template<class R, class T = std::remove_reference_t<			\
+		      decltype(*std::data(std::declval<R &>()))>,	\
+	   class = std::enable_if_t<is_reducible_v<T>>>			\
+  inline QMP_status_t NAME(R &range,					\
+			   QMP_comm_t comm = QMP_comm_get_default())	\
+  { return allreduce(OP, std::data(range), (int)std::size(range), comm); }
+  QMP_HPP_REDUCTION(sum, QMP_OP_SUM)
+  QMP_HPP_REDUCTION(max, QMP_OP_MAX)
+  QMP_HPP_REDUCTION(min, QMP_OP_MIN)
+  QMP_HPP_REDUCTION(prod, QMP_OP_PROD)
+#undef QMP_HPP_REDUCTION
+
+  /*
+   * Lattice and machine topology helpers, lexicographic order with the
+   * first coordinate running fastest as in QMP_get_node_number_from.
    */
-  QMP_status_t globalXor(QMP_u64_t *lval);
-  QMP_status_t broadcast(void *buf, QMP_u32_t nbytes);
-  QMP_status_t waitForBarrier(QMP_s32_t milliseconds);
-}
-#endif
+  template<size_t N>
+  using coords = std::array<int, N>;
+
+  template<size_t N>
+  constexpr long volume(const coords<N> &dims) {
+    long v = 1;
+    for(size_t i=0; i<N; i++) v *= dims[i];
+    return v;
+  }
+
+  template<size_t N>
+  constexpr long lex_index(const coords<N> &x, const coords<N> &dims) {
+    long index = 0;
+    for(size_t i=N; i-->0; ) index = index*dims[i] + x[i];
+    return index;
+  }
+
+  template<size_t N>
+  constexpr coords<N> lex_coords(long index, const coords<N> &dims) {
+    coords<N> x{};
+    for(size_t i=0; i<N; i++) {
+      x[i] = (int)(index % dims[i]);
+      index /= dims[i];
+    }
+    return x;
+  }
+
+  template<size_t N>
+  constexpr int parity(const coords<N> &x) {
+    int s = 0;
+    for(size_t i=0; i<N; i++) s += x[i];
+    return s & 1;
+  }
+
+  /** The periodic neighbor of x, dir steps along axis. */
+  template<size_t N>
+  constexpr coords<N> shift(coords<N> x, const coords<N> &dims,
+			    int axis, int dir) {
+    x[axis] = ((x[axis] + dir) % dims[axis] + dims[axis]) % dims[axis];
+    return x;
+  }
+
+  /** The local lattice of a node, zero if dims does not divide. */
+  template<size_t N>
+  constexpr coords<N> local_dims(const coords<N> &global,
+				 const coords<N> &machine) {
+    coords<N> l{};
+    for(size_t i=0; i<N; i++)
+      l[i] = global[i] % machine[i] ? 0 : global[i] / machine[i];
+    return l;
+  }
+
+} // namespace QMP
+
+#endif /* _QMP_HPP */
@@ -4,6 +4,7 @@
 #include <sys/time.h>
 #include <assert.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_COLLECTIVE
 #include "QMP_P_COMMON.h"
 
 
@@ -11,7 +12,7 @@ QMP_status_t
 QMP_clear_to_send(QMP_msghandle_t mh, QMP_clear_to_send_t cts)
 {
   QMP_status_t err = QMP_SUCCESS;
-  ENTER;
+  ENTER_CAT(QMP_TIMER_P2P_START);
 
   QMP_assert(mh!=NULL);
   QMP_assert((mh->type==MH_send)||(mh->type==MH_recv)||(mh->type==MH_multiple));
@@ -29,13 +30,16 @@ QMP_status_t
 QMP_start(QMP_msghandle_t mh)
 {
   QMP_status_t err = QMP_SUCCESS;
-  ENTER;
+  ENTER_CAT(QMP_TIMER_P2P_START);
 
   QMP_assert(mh!=NULL);
   QMP_assert((mh->type==MH_send)||(mh->type==MH_recv)||(mh->type==MH_multiple));
   QMP_assert(mh->activeP==0);
   mh->activeP = 1;
   mh->uses++;
+  QMP_TRACE_HANDLE(mh);
+  QMP_msgstats_start(mh);
+  QMP_comm_traffic_start(mh);
 #ifdef QMP_START
   err = QMP_START(mh);
 #endif
@@ -49,7 +53,7 @@ QMP_bool_t
 QMP_is_complete(QMP_msghandle_t mh)
 {
   QMP_bool_t done = QMP_TRUE;
-  ENTER;
+  ENTER_CAT(QMP_TIMER_P2P_WAIT);
 
   QMP_assert(mh!=NULL);
   QMP_assert((mh->type==MH_send)||(mh->type==MH_recv)||(mh->type==MH_multiple));
@@ -57,7 +61,10 @@ QMP_is_complete(QMP_msghandle_t mh)
 #ifdef QMP_IS_COMPLETE
     done = QMP_IS_COMPLETE(mh);
 #endif
-    if(done) mh->activeP = 0;
+    if(done) {
+      mh->activeP = 0;
+      QMP_msgstats_complete(mh, -1);
+    }
   }
 
   LEAVE;
@@ -68,17 +75,25 @@ QMP_status_t
 QMP_wait(QMP_msghandle_t mh)
 {
   QMP_status_t err = QMP_SUCCESS;
-  ENTER;
+  ENTER_CAT(QMP_TIMER_P2P_WAIT);
+  BLOCKED_BEGIN;
 
   QMP_assert(mh!=NULL);
   QMP_assert((mh->type==MH_send)||(mh->type==MH_recv)||(mh->type==MH_multiple));
+  QMP_TRACE_HANDLE(mh);
   if(mh->activeP) {
+    /* the time stamp of BLOCKED_BEGIN, which is 0 when nested */
+    double t = qmp_blocked_t0>0 ? qmp_blocked_t0 : QMP_time();
 #ifdef QMP_WAIT
     err = QMP_WAIT(mh);
 #endif
-    if(err==QMP_SUCCESS) mh->activeP = 0;
+    if(err==QMP_SUCCESS) {
+      mh->activeP = 0;
+      QMP_msgstats_complete(mh, t);
+    }
   }
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -87,7 +102,7 @@ QMP_status_t
 QMP_get_hidden_comm(QMP_comm_t comm, void** hiddencomm)
 {
   QMP_status_t err = QMP_SUCCESS;
-  ENTER;
+  ENTER_CAT(QMP_TIMER_TOPOLOGY);
 
 #ifdef QMP_GET_HIDDEN_COMM
   err=QMP_GET_HIDDEN_COMM(comm,hiddencomm);
@@ -101,7 +116,7 @@ QMP_status_t
 QMP_wait_all(QMP_msghandle_t mh[], int num)
 {
   QMP_status_t err = QMP_SUCCESS;
-  ENTER;
+  ENTER_CAT(QMP_TIMER_P2P_WAIT);
 
 #ifdef QMP_WAIT_ALL
   int i;
@@ -130,11 +145,13 @@ QMP_comm_barrier(QMP_comm_t comm)
 {
   QMP_status_t status = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_BARRIER
   status = QMP_COMM_BARRIER(comm);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return status;
 }
@@ -158,11 +175,14 @@ QMP_comm_broadcast(QMP_comm_t comm, void *send_buf, size_t count)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)count, -1, -1, 0, -1);
 
 #ifdef QMP_COMM_BROADCAST
   err = QMP_COMM_BROADCAST(comm, send_buf, count);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -186,11 +206,11 @@ QMP_comm_sum_int (QMP_comm_t comm, int *value)
 {
   QMP_status_t err;
   ENTER;
+  BLOCKED_BEGIN;
 
-  double x = (double) *value;
-  err = QMP_comm_sum_double(comm, &x);
-  *value = (int) x;
+  err = QMP_comm_allreduce(comm, value, 1, QMP_TYPE_INT, QMP_OP_SUM);
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -224,11 +244,13 @@ QMP_comm_sum_uint64_t(QMP_comm_t comm, uint64_t *value)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_SUM_UINT64_T
   err = QMP_COMM_SUM_UINT64_T(comm, value);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -238,11 +260,14 @@ QMP_comm_sum_float (QMP_comm_t comm, float *value)
 {
   QMP_status_t err;
   ENTER;
+  BLOCKED_BEGIN;
 
+  /* accumulate in double for accuracy, QMP_comm_allreduce sums floats */
   double x = (double) *value;
   err = QMP_comm_sum_double(comm, &x);
   *value = (float) x;
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -264,11 +289,13 @@ QMP_comm_sum_double (QMP_comm_t comm, double *value)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_SUM_DOUBLE
   err = QMP_COMM_SUM_DOUBLE(comm, value);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -290,11 +317,13 @@ QMP_comm_sum_long_double (QMP_comm_t comm, long double *value)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_SUM_LONG_DOUBLE
   err = QMP_COMM_SUM_LONG_DOUBLE(comm, value);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -316,12 +345,14 @@ QMP_comm_sum_double_extended (QMP_comm_t comm, double *value)
 {
   QMP_status_t err;
   ENTER;
+  BLOCKED_BEGIN;
   long double ld = *value;
 
   err = QMP_comm_sum_long_double(comm, &ld);
 
-  *value = ld
+  *value = ld;
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -343,11 +374,14 @@ QMP_comm_sum_float_array (QMP_comm_t comm, float value[], int count)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)(count*sizeof(float)), -1, -1, 0, -1);
 
 #ifdef QMP_COMM_SUM_FLOAT_ARRAY
   err = QMP_COMM_SUM_FLOAT_ARRAY(comm, value, count);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -369,11 +403,14 @@ QMP_comm_sum_double_array (QMP_comm_t comm, double value[], int count)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)(count*sizeof(double)), -1, -1, 0, -1);
 
 #ifdef QMP_COMM_SUM_DOUBLE_ARRAY
   err = QMP_COMM_SUM_DOUBLE_ARRAY(comm, value, count);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -395,11 +432,14 @@ QMP_comm_sum_long_double_array (QMP_comm_t comm, long double value[], int count)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)(count*sizeof(long double)), -1, -1, 0, -1);
 
 #ifdef QMP_COMM_SUM_LONG_DOUBLE_ARRAY
   err = QMP_COMM_SUM_LONG_DOUBLE_ARRAY(comm, value, count);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -421,11 +461,11 @@ QMP_comm_max_float (QMP_comm_t comm, float *value)
 {
   QMP_status_t err;
   ENTER;
+  BLOCKED_BEGIN;
 
-  double x = (double) *value;
-  err = QMP_comm_max_double(comm, &x);
-  *value = (float) x;
+  err = QMP_comm_allreduce(comm, value, 1, QMP_TYPE_FLOAT, QMP_OP_MAX);
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -447,11 +487,11 @@ QMP_comm_min_float (QMP_comm_t comm, float *value)
 {
   QMP_status_t err;
   ENTER;
+  BLOCKED_BEGIN;
 
-  double x = (double) *value;
-  err = QMP_comm_min_double(comm, &x);
-  *value = (float) x;
+  err = QMP_comm_allreduce(comm, value, 1, QMP_TYPE_FLOAT, QMP_OP_MIN);
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -473,11 +513,13 @@ QMP_comm_max_double (QMP_comm_t comm, double *value)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_MAX_DOUBLE
   err = QMP_COMM_MAX_DOUBLE(comm, value);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -499,11 +541,13 @@ QMP_comm_min_double (QMP_comm_t comm, double *value)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_MIN_DOUBLE
   err = QMP_COMM_MIN_DOUBLE(comm, value);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -525,11 +569,13 @@ QMP_comm_xor_ulong (QMP_comm_t comm, unsigned long *value)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
 
 #ifdef QMP_COMM_XOR_ULONG
   err = QMP_COMM_XOR_ULONG(comm, value);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -546,16 +592,69 @@ QMP_xor_ulong (unsigned long *value)
   return err;
 }
 
+static const size_t datatype_size[QMP_TYPE_N] = {
+  sizeof(int), sizeof(unsigned), sizeof(long), sizeof(unsigned long),
+  sizeof(int64_t), sizeof(uint64_t),
+  sizeof(float), sizeof(double), sizeof(long double)
+};
+
+QMP_status_t
+QMP_comm_allreduce (QMP_comm_t comm, void *value, int count,
+		    QMP_datatype_t type, QMP_op_t op)
+{
+  QMP_status_t err = QMP_SUCCESS;
+  ENTER;
+
+  if(type<0 || type>=QMP_TYPE_N || op<0 || op>=QMP_OP_N || count<0) {
+    err = QMP_INVALID_ARG;
+    goto leave;
+  }
+  if(type>=QMP_TYPE_FLOAT && op>=QMP_OP_BAND) {
+    QMP_error("QMP_comm_allreduce: bitwise operation on floating point type");
+    err = QMP_INVALID_ARG;
+    goto leave;
+  }
+
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)(count*datatype_size[type]), -1, -1, 0, -1);
+
+#ifdef QMP_COMM_ALLREDUCE
+  err = QMP_COMM_ALLREDUCE(comm, value, count, type, op);
+#endif
+
+  BLOCKED_END;
+ leave:
+  LEAVE;
+  return err;
+}
+
+QMP_status_t
+QMP_allreduce (void *value, int count, QMP_datatype_t type, QMP_op_t op)
+{
+  QMP_status_t err;
+  ENTER;
+
+  err = QMP_comm_allreduce(QMP_comm_get_default(), value, count, type, op);
+
+  LEAVE;
+  return err;
+}
+
 QMP_status_t
 QMP_comm_alltoall (QMP_comm_t comm, char* recvbuffer, char* sendbuffer, int ncount)
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)ncount*comm->num_nodes, -1, -1, 0, -1);
 
 #ifdef QMP_COMM_ALLTOALL
   err = QMP_COMM_ALLTOALL(comm, recvbuffer, sendbuffer, ncount);
+#else
+  memcpy(recvbuffer, sendbuffer, ncount);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -565,6 +664,8 @@ QMP_comm_binary_reduction (QMP_comm_t comm, void *lbuffer, size_t count, QMP_bin
 {
   QMP_status_t err = QMP_SUCCESS;
   ENTER;
+  BLOCKED_BEGIN;
+  QMP_TRACE_ARGS((long)count, -1, -1, 0, -1);
 
   QMP_assert(bfunc!=NULL);
 
@@ -572,6 +673,7 @@ QMP_comm_binary_reduction (QMP_comm_t comm, void *lbuffer, size_t count, QMP_bin
   err = QMP_COMM_BINARY_REDUCTION(comm, lbuffer, count, bfunc);
 #endif
 
+  BLOCKED_END;
   LEAVE;
   return err;
 }
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_COLLECTIVE
+#include "QMP_P_COMMON.h"
+
+/*
+ * Rank to rank communication matrix.
+ *
+ * Every communicator keeps the bytes and messages sent to each peer,
+ * by the peer's rank in the allocated communicator.  The counters of a
+ * peer are found when a send is declared and the handle points to them,
+ * so QMP_start only adds.  Tables of freed communicators are merged
+ * into one kept until finalize.  QMP_dump_comm_matrix gathers the rows
+ * of all ranks on node 0.
+ */
+
+struct QMP_peer_traffic {
+  int peer;
+  uint64_t bytes, messages;
+};
+
+/* open addressing on the peer, empty slots are NULL */
+struct QMP_comm_traffic {
+  int size, count;
+  struct QMP_peer_traffic **slot;
+  struct QMP_comm_traffic *prev, *next;
+};
+
+char *QMP_comm_matrix_file = NULL;
+
+static struct QMP_comm_traffic *tables = NULL;  /* of all communicators */
+static struct QMP_comm_traffic *retired = NULL; /* of freed ones */
+static int table_lock = 0;
+
+static struct QMP_comm_traffic *
+new_table(void)
+{
+  struct QMP_comm_traffic *t;
+  QMP_alloc(t, struct QMP_comm_traffic, 1);
+  t->size = 8;
+  t->count = 0;
+  QMP_alloc(t->slot, struct QMP_peer_traffic *, t->size);
+  memset(t->slot, 0, t->size*sizeof(struct QMP_peer_traffic *));
+  t->prev = NULL;
+  t->next = tables;
+  if(tables) tables->prev = t;
+  tables = t;
+  return t;
+}
+
+static struct QMP_peer_traffic **
+find_slot(struct QMP_comm_traffic *t, int peer)
+{
+  int i = peer & (t->size-1);
+  while(t->slot[i] && t->slot[i]->peer!=peer) i = (i+1) & (t->size-1);
+  return &t->slot[i];
+}
+
+/* counters of peer, created if needed */
+static struct QMP_peer_traffic *
+find_peer(struct QMP_comm_traffic *t, int peer)
+{
+  struct QMP_peer_traffic **s = find_slot(t, peer);
+  if(*s==NULL) {
+    if(2*(t->count+1)>t->size) {
+      struct QMP_peer_traffic **old = t->slot;
+      int i, n = t->size;
+      t->size *= 2;
+      QMP_alloc(t->slot, struct QMP_peer_traffic *, t->size);
+      memset(t->slot, 0, t->size*sizeof(struct QMP_peer_traffic *));
+      for(i=0; i<n; i++) if(old[i]) *find_slot(t, old[i]->peer) = old[i];
+      QMP_free(old);
+      s = find_slot(t, peer);
+    }
+    QMP_alloc(*s, struct QMP_peer_traffic, 1);
+    (*s)->peer = peer;
+    (*s)->bytes = 0;
+    (*s)->messages = 0;
+    t->count++;
+  }
+  return *s;
+}
+
+struct QMP_peer_traffic *
+QMP_comm_traffic_peer(QMP_comm_t comm, int node)
+{
+  struct QMP_peer_traffic *p;
+  int peer = node;
+#ifdef QMP_COMM_ALLOCATED_RANK
+  if(comm!=QMP_allocated_comm) peer = QMP_COMM_ALLOCATED_RANK(comm, node);
+#endif
+  QMP_spin_lock(&table_lock);
+  if(comm->traffic==NULL) comm->traffic = new_table();
+  p = find_peer(comm->traffic, peer);
+  QMP_spin_unlock(&table_lock);
+  return p;
+}
+
+static void
+add_send(QMP_msghandle_t mh)
+{
+  __atomic_add_fetch(&mh->traffic->bytes, (uint64_t)mh->mm->nbytes,
+		     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mh->traffic->messages, 1, __ATOMIC_RELAXED);
+}
+
+void
+QMP_comm_traffic_start(QMP_msghandle_t mh)
+{
+  QMP_msghandle_t c;
+  if(mh->type==MH_multiple) {
+    for(c=mh->next; c; c=c->next) if(c->traffic) add_send(c);
+  } else if(mh->traffic) {
+    add_send(mh);
+  }
+}
+
+static void
+free_table(struct QMP_comm_traffic *t)
+{
+  int i;
+  if(t->prev) t->prev->next = t->next;
+  else tables = t->next;
+  if(t->next) t->next->prev = t->prev;
+  for(i=0; i<t->size; i++) QMP_free(t->slot[i]);
+  QMP_free(t->slot);
+  QMP_free(t);
+}
+
+void
+QMP_comm_traffic_free(QMP_comm_t comm)
+{
+  struct QMP_comm_traffic *t = comm->traffic;
+  int i;
+  if(t==NULL) return;
+  QMP_spin_lock(&table_lock);
+  if(retired==NULL) retired = new_table();
+  for(i=0; i<t->size; i++) {
+    if(t->slot[i]) {
+      struct QMP_peer_traffic *p = find_peer(retired, t->slot[i]->peer);
+      p->bytes += t->slot[i]->bytes;
+      p->messages += t->slot[i]->messages;
+    }
+  }
+  free_table(t);
+  comm->traffic = NULL;
+  QMP_spin_unlock(&table_lock);
+}
+
+
+/* row of this rank: peer, bytes and messages of each peer sent to */
+static uint64_t *
+local_row(int *npeer)
+{
+  int n = QMP_allocated_comm->num_nodes, i, k = 0;
+  uint64_t *bytes, *msgs, *row;
+  struct QMP_comm_traffic *t;
+  QMP_alloc(bytes, uint64_t, n);
+  QMP_alloc(msgs, uint64_t, n);
+  memset(bytes, 0, n*sizeof(uint64_t));
+  memset(msgs, 0, n*sizeof(uint64_t));
+  QMP_spin_lock(&table_lock);
+  for(t=tables; t; t=t->next) {
+    for(i=0; i<t->size; i++) {
+      struct QMP_peer_traffic *p = t->slot[i];
+      if(p==NULL) continue;
+      bytes[p->peer] += __atomic_load_n(&p->bytes, __ATOMIC_RELAXED);
+      msgs[p->peer] += __atomic_load_n(&p->messages, __ATOMIC_RELAXED);
+    }
+  }
+  QMP_spin_unlock(&table_lock);
+  for(i=0; i<n; i++) if(msgs[i]) k++;
+  QMP_alloc(row, uint64_t, 3*k+1);
+  k = 0;
+  for(i=0; i<n; i++) {
+    if(msgs[i]==0) continue;
+    row[3*k] = i;
+    row[3*k+1] = bytes[i];
+    row[3*k+2] = msgs[i];
+    k++;
+  }
+  QMP_free(bytes);
+  QMP_free(msgs);
+  *npeer = k;
+  return row;
+}
+
+static void
+write_row(FILE *f, int rank, const uint64_t *row, int npeer)
+{
+  int i;
+  for(i=0; i<npeer; i++)
+    fprintf(f, "%d %lu %lu %lu\n", rank, (unsigned long)row[3*i],
+	    (unsigned long)row[3*i+1], (unsigned long)row[3*i+2]);
+}
+
+/**
+ * Write the point-to-point traffic of all ranks to a file.
+ */
+QMP_status_t
+QMP_dump_comm_matrix (const char *filename)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  QMP_comm_t comm = QMP_allocated_comm;
+  int n = comm->num_nodes, me = comm->nodeid, npeer, r;
+  double *counts;
+  FILE *f = NULL;
+  ENTER;
+
+  uint64_t *row = local_row(&npeer);
+  QMP_alloc(counts, double, n);
+  memset(counts, 0, n*sizeof(double));
+  counts[me] = npeer;
+  status = QMP_comm_sum_double_array(comm, counts, n);
+  if(status!=QMP_SUCCESS) goto leave;
+
+  if(me==0) {
+    f = fopen(filename, "w");
+    if(f==NULL) {
+      QMP_error("QMP_dump_comm_matrix: cannot write %s", filename);
+      status = QMP_ERROR;
+    } else {
+      fprintf(f, "# QMP point-to-point traffic of %d ranks\n", n);
+      fprintf(f, "# sender receiver bytes messages\n");
+      write_row(f, 0, row, npeer);
+    }
+  }
+  for(r=1; r<n; r++) {
+    int nr = (int)counts[r];
+    if(nr==0 || (me!=0 && me!=r)) continue;
+    uint64_t *buf = row;
+    if(me==0) QMP_alloc(buf, uint64_t, 3*nr);
+    QMP_msgmem_t mm = QMP_declare_msgmem(buf, 3*nr*sizeof(uint64_t));
+    QMP_msghandle_t mh = (me==0) ?
+      QMP_comm_declare_receive_from(comm, mm, r, 0) :
+      QMP_comm_declare_send_to(comm, mm, 0, 0);
+    mh->traffic = NULL;   /* the gather is not part of the matrix */
+    QMP_start(mh);
+    QMP_wait(mh);
+    QMP_free_msghandle(mh);
+    QMP_free_msgmem(mm);
+    if(me==0) {
+      if(f) write_row(f, r, buf, nr);
+      QMP_free(buf);
+    }
+  }
+  if(f) fclose(f);
+
+ leave:
+  QMP_free(counts);
+  QMP_free(row);
+  LEAVE;
+  return status;
+}
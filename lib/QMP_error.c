@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_OTHER
 #include "QMP_P_COMMON.h"
 
 /**
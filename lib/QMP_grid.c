@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#define QMP_TIMER_CAT QMP_TIMER_TOPOLOGY
 #include "QMP_P_COMMON.h"
 
 /* The subgrid geometry */
@@ -15,21 +16,367 @@ typedef struct QMP_subgrid
   /* Number of sites in each subgrid */
   int vol;
 
+  /* Global lattice size and number of nodes along each axis */
+  int *global;
+  int *nsquares;
+
+  /* This node's subgrid origin in the global lattice */
+  int *origin;
+
+  /* per axis tables indexed by the global coordinate x at offset[i]+x:
+     node coordinate and local coordinate of the site; and the subgrid
+     extent for node coordinate c at noffset[i]+c */
+  int *offset, *site_node, *site_local;
+  int *noffset, *node_extent;
+
 } QMP_subgrid_t;
 
-static QMP_subgrid_t subgrid;
+static QMP_subgrid_t subgrid = { 0, NULL, 0, NULL, NULL, NULL, NULL, NULL,
+				  NULL, NULL, NULL };
+
+/* per axis cost weights for the layout, QMP_LAYOUT_NO_SPLIT forbids a split */
+static double *layout_weight = NULL;
+static int layout_nweight = 0;
+
+/* allow subgrids of different sizes */
+static QMP_bool_t layout_uneven = QMP_FALSE;
+
+/* relative cost of a face that stays inside a physical node */
+#define INTRA_NODE_COST 0.1
+
+/* cache of layouts already found */
+typedef struct layout_cache {
+  int ndim, nnodes, ppn;
+  int *dims;
+  int *nsquares;
+  double cost;
+  struct layout_cache *next;
+} layout_cache_t;
+
+static layout_cache_t *layout_cache = NULL;
+
+static void
+clear_layout_cache(void)
+{
+  while(layout_cache) {
+    layout_cache_t *c = layout_cache;
+    layout_cache = c->next;
+    QMP_free(c->dims);
+    QMP_free(c->nsquares);
+    QMP_free(c);
+  }
+}
 
-static int prime[] = {2,3,5,7,11,13,17,19,23,29,31,37,41,43,47,53};
-#define MAXPRIMES (sizeof(prime)/sizeof(int))
+/* weights from the link probe, used if none were set */
+static double *probe_weight = NULL;
+static int probe_nweight = 0;
+/* the topology QMP_layout_grid declared, or is declaring */
+static const QMP_logical_topology_t *layout_topo = NULL;
+static int layout_declaring = 0;
+
+static double
+axis_weight(int i)
+{
+  if(layout_nweight>0) {
+    if(i<layout_nweight) return layout_weight[i];
+  } else if(i<probe_nweight) {
+    return probe_weight[i];
+  }
+  return 1.0;
+}
+
+/*
+ * Weights of the axes of a probed topology.  They are weights of the
+ * lattice axes only if QMP_layout_grid chose the topology, those of a
+ * topology from -qmp-geom or QMP_declare_logical_topology are dropped.
+ */
+void
+QMP_set_layout_probe_weights(const QMP_logical_topology_t *topo,
+			     const double *weights)
+{
+  int i, n = topo->dimension;
+  if(!layout_declaring && topo!=layout_topo) return;
+  QMP_free(probe_weight);
+  QMP_alloc(probe_weight, double, n);
+  for(i=0; i<n; i++) probe_weight[i] = weights[i];
+  probe_nweight = n;
+  if(layout_nweight==0) clear_layout_cache();
+}
 
-#if 0
-/* Check if a is a factor of b */
-static unsigned 
-is_factor(unsigned a, unsigned b)
+/*
+ * Extent along each axis of the block of lexicographically consecutive
+ * ranks that share a physical node.  The ranks of a node only form a
+ * block if ppn is a product of the fastest running extents times a
+ * divisor of the next one.  Otherwise every extent is set to 1.
+ */
+static void
+node_block(int *b, const int *nsquares, int ndim, int ppn)
 {
-  return ((b % a) == 0 ? 1 : 0);
+  int i, r = ppn;
+  const int *map = NULL;
+  if(QMP_args->lmaplen==ndim) map = QMP_args->lmap;
+  for(i=0; i<ndim; i++) b[i] = 1;
+  for(i=0; i<ndim && r>1; i++) {
+    int k = map ? map[i] : i;
+    if(r>=nsquares[k]) {
+      if(r%nsquares[k]!=0) break;
+      b[k] = nsquares[k];
+      r /= nsquares[k];
+    } else {
+      if(nsquares[k]%r!=0) break;
+      b[k] = r;
+      r = 1;
+    }
+  }
+  if(r>1) for(i=0; i<ndim; i++) b[i] = 1;
+}
+
+/* largest subgrid extent along an axis */
+#define MAX_EXTENT(d,n) (((d)+(n)-1)/(n))
+
+/*
+ * Communication cost of a layout: the halo surface of the largest
+ * subgrid summed over the split axes, weighted per axis, with the faces
+ * that stay inside a physical node discounted.
+ */
+static double
+layout_cost(const int *dims, const int *nsquares, int ndim, int ppn)
+{
+  int i, b[ndim];
+  double vol = 1, cost = 0;
+  for(i=0; i<ndim; i++) vol *= MAX_EXTENT(dims[i], nsquares[i]);
+  node_block(b, nsquares, ndim, ppn);
+  for(i=0; i<ndim; i++) {
+    if(nsquares[i]>1) {
+      double face = vol/MAX_EXTENT(dims[i], nsquares[i]);
+      double off = (b[i]<nsquares[i]) ? 1.0/b[i] : 0.0;
+      cost += axis_weight(i) * 2 * face * (off + INTRA_NODE_COST*(1-off));
+    }
+  }
+  return cost;
+}
+
+/* an axis of length d can be split into f parts */
+static int
+can_split(int d, int f)
+{
+  if(layout_uneven) return f<=d;
+  return d%f==0;
+}
+
+/* try all factorizations of n over the remaining axes; layouts with
+   the smallest largest subgrid win, then the smallest cost */
+static void
+search_layout(const int *dims, int ndim, int ppn, int i, int n,
+	      int *trial, int *best, double *bestvol, double *bestcost)
+{
+  if(i==ndim-1) {
+    if(!can_split(dims[i], n)) return;
+    if(n>1 && axis_weight(i)<0) return;
+    trial[i] = n;
+    int j;
+    double v = 1;
+    for(j=0; j<ndim; j++) v *= MAX_EXTENT(dims[j], trial[j]);
+    double c = layout_cost(dims, trial, ndim, ppn);
+    if(*bestcost<0 || v<*bestvol ||
+       (v==*bestvol && c < *bestcost*(1-1e-12))) {
+      for(j=0; j<ndim; j++) best[j] = trial[j];
+      *bestvol = v;
+      *bestcost = c;
+    }
+    return;
+  }
+  int f;
+  for(f=1; f<=n; f++) {
+    if(n%f!=0 || !can_split(dims[i], f)) continue;
+    if(f>1 && axis_weight(i)<0) break;
+    trial[i] = f;
+    search_layout(dims, ndim, ppn, i+1, n/f, trial, best, bestvol, bestcost);
+  }
+}
+
+/*
+ * Find the cheapest layout of nnodes on the grid, using the cache.
+ * Returns the cost, or a negative value if there is no valid layout.
+ */
+static double
+find_layout(const int *dims, int ndim, int nnodes, int *nsquares)
+{
+  int i, ppn = QMP_machine->ranks_per_node;
+  layout_cache_t *c;
+
+  if(nnodes%ppn!=0) ppn = 1;
+  for(c=layout_cache; c; c=c->next) {
+    if(c->ndim!=ndim || c->nnodes!=nnodes || c->ppn!=ppn) continue;
+    for(i=0; i<ndim; i++) if(c->dims[i]!=dims[i]) break;
+    if(i<ndim) continue;
+    for(i=0; i<ndim; i++) nsquares[i] = c->nsquares[i];
+    return c->cost;
+  }
+
+  int trial[ndim];
+  double vol = 0, cost = -1;
+  search_layout(dims, ndim, ppn, 0, nnodes, trial, nsquares, &vol, &cost);
+
+  QMP_alloc(c, layout_cache_t, 1);
+  c->ndim = ndim;
+  c->nnodes = nnodes;
+  c->ppn = ppn;
+  c->cost = cost;
+  QMP_alloc(c->dims, int, ndim);
+  QMP_alloc(c->nsquares, int, ndim);
+  for(i=0; i<ndim; i++) {
+    c->dims[i] = dims[i];
+    c->nsquares[i] = (cost<0) ? 0 : nsquares[i];
+  }
+  c->next = layout_cache;
+  layout_cache = c;
+
+  return cost;
+}
+
+/*
+ * Set the relative communication cost of each lattice axis.
+ */
+QMP_status_t
+QMP_set_layout_weights (const double weights[], int nweights)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+  int i;
+
+  QMP_free(layout_weight);
+  layout_weight = NULL;
+  layout_nweight = 0;
+  if(nweights>0) {
+    QMP_alloc(layout_weight, double, nweights);
+    for(i=0; i<nweights; i++) layout_weight[i] = weights[i];
+    layout_nweight = nweights;
+  }
+  clear_layout_cache();
+
+  LEAVE;
+  return status;
+}
+
+/*
+ * Allow lattice extents which are not divisible by the node grid.
+ */
+QMP_status_t
+QMP_set_layout_uneven (QMP_bool_t allow)
+{
+  ENTER;
+  if(allow!=layout_uneven) {
+    layout_uneven = allow;
+    clear_layout_cache();
+  }
+  LEAVE;
+  return QMP_SUCCESS;
+}
+
+/*
+ * Find the layout QMP_layout_grid would choose for a number of nodes.
+ */
+QMP_status_t
+QMP_query_layout_grid (const int dims[], int ndim, int nnodes,
+		       int nsquares[], double *cost)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+
+  double c = find_layout(dims, ndim, nnodes, nsquares);
+  if(c<0) {
+    int i;
+    for(i=0; i<ndim; i++) nsquares[i] = 0;
+    status = QMP_ERROR;
+  }
+  if(cost) *cost = c;
+
+  LEAVE;
+  return status;
+}
+
+static void
+free_subgrid(void)
+{
+  QMP_free(subgrid.length);
+  QMP_free(subgrid.global);
+  QMP_free(subgrid.nsquares);
+  QMP_free(subgrid.origin);
+  QMP_free(subgrid.offset);
+  QMP_free(subgrid.site_node);
+  QMP_free(subgrid.site_local);
+  QMP_free(subgrid.noffset);
+  QMP_free(subgrid.node_extent);
+  subgrid.length = NULL;
+  subgrid.global = NULL;
+  subgrid.nsquares = NULL;
+  subgrid.origin = NULL;
+  subgrid.offset = NULL;
+  subgrid.site_node = NULL;
+  subgrid.site_local = NULL;
+  subgrid.noffset = NULL;
+  subgrid.node_extent = NULL;
+}
+
+/* the remainder goes to the lowest node coordinates */
+static int
+block_extent(int d, int n, int c)
+{
+  return d/n + (c < d%n);
+}
+
+static int
+block_origin(int d, int n, int c)
+{
+  return c*(d/n) + ((c < d%n) ? c : d%n);
+}
+
+/* subgrid of this node and tables for QMP_get_site_owner */
+static void
+set_subgrid(const int *dims, const int *nsquares, int ndim)
+{
+  int i, x, c, n = 0, nn = 0;
+  int nld = QMP_get_logical_number_of_dimensions();
+  const int *lc = QMP_get_logical_coordinates();
+
+  free_subgrid();
+  subgrid.dimension = ndim;
+  QMP_alloc(subgrid.length, int, ndim);
+  QMP_alloc(subgrid.global, int, ndim);
+  QMP_alloc(subgrid.nsquares, int, ndim);
+  QMP_alloc(subgrid.origin, int, ndim);
+  QMP_alloc(subgrid.offset, int, ndim);
+  QMP_alloc(subgrid.noffset, int, ndim);
+  subgrid.vol = 1;
+  for(i=0; i<ndim; i++) {
+    c = (i<nld) ? lc[i] : 0;
+    subgrid.global[i] = dims[i];
+    subgrid.nsquares[i] = nsquares[i];
+    subgrid.length[i] = block_extent(dims[i], nsquares[i], c);
+    subgrid.origin[i] = block_origin(dims[i], nsquares[i], c);
+    subgrid.vol *= subgrid.length[i];
+    subgrid.offset[i] = n;
+    subgrid.noffset[i] = nn;
+    n += dims[i];
+    nn += nsquares[i];
+  }
+
+  QMP_alloc(subgrid.site_node, int, n);
+  QMP_alloc(subgrid.site_local, int, n);
+  QMP_alloc(subgrid.node_extent, int, nn);
+  for(i=0; i<ndim; i++) {
+    for(c=0; c<nsquares[i]; c++) {
+      int o = block_origin(dims[i], nsquares[i], c);
+      int l = block_extent(dims[i], nsquares[i], c);
+      subgrid.node_extent[subgrid.noffset[i]+c] = l;
+      for(x=o; x<o+l; x++) {
+	subgrid.site_node[subgrid.offset[i]+x] = c;
+	subgrid.site_local[subgrid.offset[i]+x] = x - o;
+      }
+    }
+  }
 }
-#endif
 
 /*
  * QMP_layout_grid
@@ -43,12 +390,10 @@ QMP_layout_grid (const int *dims, int ndim)
   QMP_status_t status = QMP_SUCCESS;
   ENTER;
   int i;
-  int *squaresize;
   int *nsquares;
 
-  QMP_alloc(squaresize, int, ndim);
   QMP_alloc(nsquares, int, ndim);
-  if(nsquares == NULL || squaresize == NULL) {
+  if(nsquares == NULL) {
      QMP_FATAL("Unable to malloc in QMP_layout_grid");
   }
 
@@ -58,55 +403,22 @@ QMP_layout_grid (const int *dims, int ndim)
 
   /* If logical topology not set, this machine allows configuration of size */
   if (! QMP_logical_topology_is_declared()) {
-    int j, k, n;
 
-    /* Initialize subgrid and machine size */
-    for(i=0; i<ndim; ++i) {
-      squaresize[i] = dims[i];
-      nsquares[i] = 1;
-    }
-
-    n = QMP_get_number_of_nodes();
-    k = MAXPRIMES-1;
-    while(n>1) {
-      /* figure out which prime to divide by starting with largest */
-      while( (n%prime[k]!=0) && (k>0) ) --k;
-
-      /* figure out which direction to divide */
-      /* find largest divisible dimension of h-cubes */
-      /* if one direction with largest dimension has already been
-	 divided, divide it again.  Otherwise divide first direction
-	 with largest dimension. */
-      j = -1;
-      for(i=0; i<ndim; i++) {
-	if(squaresize[i]%prime[k]==0) {
-	  if( (j<0) || (squaresize[i]>squaresize[j]) ) {
-	    j = i;
-	  } else if(squaresize[i]==squaresize[j]) {
-	    if(nsquares[j]==1) j = i;
-	  }
-	}
-      }
- 
-      /* This can fail if we run out of prime factors in the dimensions */
-      if(j<0) {
-	QMP_error("Not enough prime factors for QMP_layout_grid\n");
-	status = QMP_ERROR;
-	goto leave;
-      }
-
-      /* do the surgery */
-      n /= prime[k];
-      squaresize[j] /= prime[k];
-      nsquares[j] *= prime[k];
+    if(find_layout(dims, ndim, QMP_get_number_of_nodes(), nsquares) < 0) {
+      QMP_error("No valid layout of %i nodes for QMP_layout_grid\n",
+		QMP_get_number_of_nodes());
+      status = QMP_ERROR;
+      goto leave;
     }
-
     /* now set logical topology */
+    layout_declaring = 1;
     status = QMP_declare_logical_topology(nsquares, ndim);
+    layout_declaring = 0;
     if (status != QMP_SUCCESS) {
       QMP_error("QMP_layout_grid: error creating logical topology\n");
       goto leave;
     }
+    layout_topo = QMP_comm_get_default()->topo;
 
   } else {  /* Logical topology is already declared */
 
@@ -122,29 +434,21 @@ QMP_layout_grid (const int *dims, int ndim)
     }
     for( ; i<ndim; i++) nsquares[i] = 1;
 
-    /* calculate subgrid size */
+    /* check subgrid size */
     for(i=0; i<ndim; i++) {
-      if(dims[i]%nsquares[i] != 0) {
+      if(!can_split(dims[i], nsquares[i])) {
 	QMP_error("grid size does not fit on logical topology\n");
 	status = QMP_ERROR;
 	goto leave;
       }
-      squaresize[i] = dims[i]/nsquares[i];
     }
 
   }
 
   /* now we should have the layout done so we just set the results */
-  QMP_alloc(subgrid.length, int, ndim);
-
-  subgrid.vol = 1;
-  for(i=0; i<ndim; i++) {
-    subgrid.length[i] = squaresize[i];
-    subgrid.vol *= squaresize[i];
-  }
+  set_subgrid(dims, nsquares, ndim);
 
  leave:
-  QMP_free(squaresize);
   QMP_free(nsquares);
   LEAVE;
   return status;
@@ -167,3 +471,110 @@ QMP_get_number_of_subgrid_sites (void)
   LEAVE;
   return subgrid.vol;
 }
+
+/* Return the origin of this node's subgrid in the global lattice */
+const int *
+QMP_get_subgrid_origin (void)
+{
+  ENTER;
+  LEAVE;
+  return (const int *) subgrid.origin;
+}
+
+/* Return the subgrid origin and size of any node */
+QMP_status_t
+QMP_get_node_subgrid (int node, int origin[], int extent[])
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+
+  if(subgrid.length==NULL) {
+    QMP_error("QMP_get_node_subgrid: QMP_layout_grid not called\n");
+    status = QMP_ERROR;
+  } else {
+    int i, nd = subgrid.dimension;
+    int nld = QMP_get_logical_number_of_dimensions();
+    int lc[nld>0 ? nld : 1];
+    if(nld>0) QMP_get_logical_coordinates_from2(lc, node);
+    for(i=0; i<nd; i++) {
+      int c = (i<nld) ? lc[i] : 0;
+      int d = subgrid.global[i], n = subgrid.nsquares[i];
+      if(origin) origin[i] = block_origin(d, n, c);
+      if(extent) extent[i] = block_extent(d, n, c);
+    }
+  }
+
+  LEAVE;
+  return status;
+}
+
+/* Halo exchange of a field on this node's subgrid */
+QMP_halo_t
+QMP_declare_subgrid_halo (void *field, int depth, size_t sitesize, int flags)
+{
+  QMP_halo_t h = NULL;
+  ENTER_CAT(QMP_TIMER_MEMORY);
+  if(subgrid.length==NULL) {
+    QMP_error("QMP_declare_subgrid_halo: QMP_layout_grid not called\n");
+    QMP_SET_STATUS_CODE(QMP_ERROR);
+  } else {
+    h = QMP_declare_halo(field, subgrid.length, subgrid.dimension, depth,
+			 sitesize, flags);
+  }
+  LEAVE;
+  return h;
+}
+
+/**
+ * Find the node owning each of a list of global lattice sites and the
+ * lexicographic index of the site within that node's subgrid.
+ */
+QMP_status_t
+QMP_get_site_owner (const int global_coords[], int n, int owner[],
+		    int local_index[])
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+
+  if(subgrid.site_node==NULL) {
+    QMP_error("QMP_get_site_owner: QMP_layout_grid not called\n");
+    status = QMP_ERROR;
+    goto leave;
+  }
+
+  QMP_comm_t comm = QMP_comm_get_default();
+  const int *coord_rank = comm->topo->coord_rank;
+  int nd = subgrid.dimension;
+  int nld = QMP_comm_get_logical_number_of_dimensions(comm);
+  int k;
+  for(k=0; k<n; k++) {
+    const int *x = global_coords + k*nd;
+    int i, nl = 0, li = 0, ns = 1, ls = 1;
+    for(i=0; i<nd; i++) {
+      int g = subgrid.global[i], xi = x[i];
+      if(xi<0 || xi>=g) xi = ((xi%g)+g)%g;
+      int c = subgrid.site_node[subgrid.offset[i]+xi];
+      nl += c*ns;
+      li += subgrid.site_local[subgrid.offset[i]+xi]*ls;
+      ns *= subgrid.nsquares[i];
+      ls *= subgrid.node_extent[subgrid.noffset[i]+c];
+    }
+    if(owner) {
+      if(coord_rank) {
+	owner[k] = coord_rank[nl];
+      } else {
+	int c[nld];
+	for(i=0; i<nld; i++) {
+	  c[i] = nl % subgrid.nsquares[i];
+	  nl /= subgrid.nsquares[i];
+	}
+	owner[k] = QMP_comm_get_node_number_from(comm, c);
+      }
+    }
+    if(local_index) local_index[k] = li;
+  }
+
+ leave:
+  LEAVE;
+  return status;
+}
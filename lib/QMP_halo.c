@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_MEMORY
+#include "QMP_P_COMMON.h"
+
+/*
+ * Halo exchange of a lexicographically ordered field with ghost zones.
+ *
+ * The field is stored with a halo of depth sites on every side; site
+ * x (x[i] from -depth to local[i]+depth-1) is at
+ *   sum_i (x[i]+depth) * prod_{j<i} (local[j]+2*depth)
+ * with sitesize bytes per site.
+ *
+ * In face mode all 2*ndim faces are exchanged concurrently.  In corner
+ * mode the exchange runs in ndim stages, one per direction.  Stage mu
+ * includes the ghosts of directions nu<mu received in earlier stages,
+ * so edges and corners reach the diagonal neighbors through the face
+ * neighbors while still using only 2*ndim messages.
+ */
+
+/* contiguous runs of sites inside the box lo <= p < hi of padded coords */
+static void
+region_blocks(QMP_halo_t h, const int lo[], const int hi[],
+	      int *nblk, int **index, int **len)
+{
+  int i, nd = h->ndim, n = 1;
+  for(i=1; i<nd; i++) n *= hi[i] - lo[i];
+  QMP_alloc(*index, int, n);
+  QMP_alloc(*len, int, n);
+
+  int p[nd], k = 0;
+  for(i=0; i<nd; i++) p[i] = lo[i];
+  while(1) {
+    int idx = 0;
+    for(i=nd-1; i>=0; i--) idx = idx*h->padded[i] + p[i];
+    if(k>0 && (*index)[k-1]+(*len)[k-1]==idx) {
+      (*len)[k-1] += hi[0] - lo[0];
+    } else {
+      (*index)[k] = idx;
+      (*len)[k] = hi[0] - lo[0];
+      k++;
+    }
+    for(i=1; i<nd; i++) {
+      if(++p[i]<hi[i]) break;
+      p[i] = lo[i];
+    }
+    if(i>=nd) break;
+  }
+  *nblk = k;
+}
+
+/* box of the face sent towards direction sign along mu (send!=0),
+   or of the ghosts received from there */
+static void
+face_box(QMP_halo_t h, int mu, int sign, int send, int lo[], int hi[])
+{
+  int i, d = h->depth;
+  for(i=0; i<h->ndim; i++) {
+    int l = h->padded[i] - 2*d;
+    if(i==mu) {
+      if(send) lo[i] = (sign>0) ? l : d;
+      else     lo[i] = (sign>0) ? l+d : 0;
+      hi[i] = lo[i] + d;
+    } else if((h->flags&QMP_HALO_CORNERS) && i<mu) {
+      lo[i] = 0;
+      hi[i] = h->padded[i];
+    } else {
+      lo[i] = d;
+      hi[i] = d + l;
+    }
+  }
+}
+
+static QMP_msghandle_t
+face_handle(QMP_halo_t h, int mu, int sign, int send)
+{
+  int lo[h->ndim], hi[h->ndim], n, *index, *len;
+  QMP_msghandle_t mh;
+
+  face_box(h, mu, sign, send, lo, hi);
+  region_blocks(h, lo, hi, &n, &index, &len);
+  QMP_msgmem_t mm = QMP_declare_indexed_msgmem(h->field, len, index,
+					       (int)h->sitesize, n);
+  QMP_free(index);
+  QMP_free(len);
+  h->mm[h->nmm++] = mm;
+
+  if(send) mh = QMP_comm_declare_send_relative(h->comm, mm, mu, sign, 0);
+  else     mh = QMP_comm_declare_receive_relative(h->comm, mm, mu, sign, 0);
+  return mh;
+}
+
+/* axis of logical length 1 (or beyond the logical dimensions): the
+   node is its own neighbor, copy locally */
+static void
+local_copy_init(QMP_halo_t h, int mu)
+{
+  struct QMP_halo_copy *c = &h->copy[mu];
+  int lo[h->ndim], hi[h->ndim], s, n;
+  for(s=0; s<2; s++) {
+    int sign = s ? 1 : -1;
+    face_box(h, mu, sign, 1, lo, hi);
+    region_blocks(h, lo, hi, &n, &c->sidx[s], &c->len[s]);
+    QMP_free(c->len[s]);
+    /* the ghosts on the opposite side get this face */
+    face_box(h, mu, -sign, 0, lo, hi);
+    region_blocks(h, lo, hi, &c->nblk, &c->ridx[s], &c->len[s]);
+    QMP_assert(n==c->nblk);
+  }
+}
+
+static void
+local_copy(QMP_halo_t h, int mu)
+{
+  struct QMP_halo_copy *c = &h->copy[mu];
+  size_t ss = h->sitesize;
+  int s, i;
+  if(c->nblk==0) return;
+  for(s=0; s<2; s++)
+    for(i=0; i<c->nblk; i++)
+      memcpy(h->field + c->ridx[s][i]*ss, h->field + c->sidx[s][i]*ss,
+	     c->len[s][i]*ss);
+}
+
+/* run the local copies of stage k and post its messages */
+static QMP_status_t
+start_stage(QMP_halo_t h, int k)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  int mu;
+  if(h->flags&QMP_HALO_CORNERS) {
+    local_copy(h, k);
+  } else {
+    for(mu=0; mu<h->ndim; mu++) local_copy(h, mu);
+  }
+  if(h->stage[k]) status = QMP_start(h->stage[k]);
+  return status;
+}
+
+
+/**
+ * Declare a halo exchange schedule for a field with ghost zones.
+ */
+QMP_halo_t
+QMP_comm_declare_halo (QMP_comm_t comm, void *field, const int local[],
+		       int ndim, int depth, size_t sitesize, int flags)
+{
+  QMP_halo_t h = NULL;
+  int mu;
+  ENTER;
+
+  QMP_assert(QMP_comm_logical_topology_is_declared(comm));
+  int nld = QMP_comm_get_logical_number_of_dimensions(comm);
+  if(ndim<nld || depth<1) {
+    QMP_error("QMP_declare_halo: invalid ndim %d or depth %d", ndim, depth);
+    QMP_SET_STATUS_CODE(QMP_INVALID_ARG);
+    goto leave;
+  }
+  for(mu=0; mu<ndim; mu++) {
+    if(local[mu]<depth) {
+      QMP_error("QMP_declare_halo: local size %d smaller than depth %d",
+		local[mu], depth);
+      QMP_SET_STATUS_CODE(QMP_INVALID_ARG);
+      goto leave;
+    }
+  }
+
+  QMP_alloc(h, struct QMP_halo_struct, 1);
+  if(!h) {
+    QMP_SET_STATUS_CODE(QMP_NOMEM_ERR);
+    goto leave;
+  }
+  h->comm = comm;
+  h->field = (char *) field;
+  h->ndim = ndim;
+  h->depth = depth;
+  h->sitesize = sitesize;
+  h->flags = flags;
+  h->active = -1;
+  h->nmm = 0;
+  h->nstage = (flags&QMP_HALO_CORNERS) ? ndim : 1;
+  QMP_alloc(h->padded, int, ndim);
+  QMP_alloc(h->mm, QMP_msgmem_t, 4*ndim);
+  QMP_alloc(h->stage, QMP_msghandle_t, h->nstage);
+  QMP_alloc(h->copy, struct QMP_halo_copy, ndim);
+  for(mu=0; mu<ndim; mu++) h->padded[mu] = local[mu] + 2*depth;
+
+  const int *lsize = QMP_comm_get_logical_dimensions(comm);
+  QMP_msghandle_t *mh;
+  int nmh = 0, k;
+  QMP_alloc(mh, QMP_msghandle_t, 4*ndim);
+  for(k=0; k<h->nstage; k++) h->stage[k] = NULL;
+  for(mu=0; mu<ndim; mu++) {
+    h->copy[mu].nblk = 0;
+    if(mu>=nld || lsize[mu]==1) {
+      local_copy_init(h, mu);
+    } else {
+      mh[nmh++] = face_handle(h, mu, -1, 0);
+      mh[nmh++] = face_handle(h, mu, +1, 0);
+      mh[nmh++] = face_handle(h, mu, +1, 1);
+      mh[nmh++] = face_handle(h, mu, -1, 1);
+    }
+    if((flags&QMP_HALO_CORNERS) && nmh>0) {
+      h->stage[mu] = QMP_declare_multiple(mh, nmh);
+      nmh = 0;
+    }
+  }
+  if(nmh>0) h->stage[0] = QMP_declare_multiple(mh, nmh);
+  QMP_free(mh);
+
+ leave:
+  LEAVE;
+  return h;
+}
+
+QMP_halo_t
+QMP_declare_halo (void *field, const int local[], int ndim, int depth,
+		  size_t sitesize, int flags)
+{
+  QMP_halo_t h;
+  ENTER;
+  h = QMP_comm_declare_halo(QMP_comm_get_default(), field, local, ndim,
+			    depth, sitesize, flags);
+  LEAVE;
+  return h;
+}
+
+/**
+ * Start a halo exchange.  In corner mode only the first stage is posted,
+ * the remaining stages are driven by QMP_halo_wait.
+ */
+QMP_status_t
+QMP_halo_start (QMP_halo_t h)
+{
+  QMP_status_t status;
+  ENTER_CAT(QMP_TIMER_P2P_START);
+  QMP_assert(h->active<0);
+  h->active = 0;
+  status = start_stage(h, 0);
+  LEAVE;
+  return status;
+}
+
+/**
+ * Finish a halo exchange.
+ */
+QMP_status_t
+QMP_halo_wait (QMP_halo_t h)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER_CAT(QMP_TIMER_P2P_WAIT);
+  QMP_assert(h->active>=0);
+  while(status==QMP_SUCCESS) {
+    if(h->stage[h->active]) status = QMP_wait(h->stage[h->active]);
+    if(++h->active==h->nstage) break;
+    if(status==QMP_SUCCESS) status = start_stage(h, h->active);
+  }
+  h->active = -1;
+  LEAVE;
+  return status;
+}
+
+QMP_status_t
+QMP_halo_exchange (QMP_halo_t h)
+{
+  QMP_status_t status;
+  ENTER_CAT(QMP_TIMER_P2P_START);
+  status = QMP_halo_start(h);
+  if(status==QMP_SUCCESS) status = QMP_halo_wait(h);
+  LEAVE;
+  return status;
+}
+
+/**
+ * Free a halo exchange schedule.
+ */
+void
+QMP_free_halo (QMP_halo_t h)
+{
+  int i, s;
+  ENTER;
+  if(h) {
+    for(i=0; i<h->nstage; i++)
+      if(h->stage[i]) QMP_free_msghandle(h->stage[i]);
+    for(i=0; i<h->nmm; i++) QMP_free_msgmem(h->mm[i]);
+    for(i=0; i<h->ndim; i++) {
+      if(h->copy[i].nblk>0) {
+	for(s=0; s<2; s++) {
+	  QMP_free(h->copy[i].sidx[s]);
+	  QMP_free(h->copy[i].ridx[s]);
+	  QMP_free(h->copy[i].len[s]);
+	}
+      }
+    }
+    QMP_free(h->copy);
+    QMP_free(h->stage);
+    QMP_free(h->mm);
+    QMP_free(h->padded);
+    QMP_free(h);
+  }
+  LEAVE;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_COLLECTIVE
+#include "QMP_P_COMMON.h"
+
+/*
+ * Load imbalance and straggler detection.
+ *
+ * Time blocked in QMP_wait, barriers and reductions is summed per
+ * thread (only the outermost of nested calls counts), and the rest of
+ * the wall clock time of the thread calling QMP_report_imbalance is its
+ * compute time, so blocking in other threads can not make it negative.
+ * Each report closes a period: the compute and blocked times of the
+ * period are compared across the allocated communicator with reductions
+ * of fixed size, the slowest ranks print their host, and ranks whose
+ * compute time was above the median by more than the threshold in at
+ * least 3/4 of the periods are flagged.
+ */
+
+#define NSLOWEST 3
+#define MIN_PERIOD 1e-3   /* seconds of compute */
+#define NBINS 64          /* histogram bins per pass of the median */
+
+int QMP_imbalance_enabled = 0;
+double QMP_imbalance_threshold = 5;   /* percent above the median */
+
+static __thread int64_t tl_blocked_ns = 0;
+static __thread int64_t tl_period_blocked = 0;
+static __thread int tl_depth = 0;
+
+static double period_start = -1;
+static int periods = 0, periods_above = 0;
+
+double
+QMP_blocked_begin(void)
+{
+  if(tl_depth++>0) return 0;
+  return QMP_time();
+}
+
+void
+QMP_blocked_end(double t0)
+{
+  if(--tl_depth>0) return;
+  tl_blocked_ns += (int64_t)(1e9*(QMP_time() - t0));
+}
+
+void
+QMP_imbalance_init(void)
+{
+  period_start = QMP_time();
+  tl_period_blocked = tl_blocked_ns;
+}
+
+/* median of v over comm, to 1/NBINS^2 of [lo,hi], from two histograms
+   narrowing down on the bin of the middle rank */
+static QMP_status_t
+comm_median(QMP_comm_t comm, double v, double lo, double hi, double *median)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  int counts[NBINS], pass, b, mybin, in = 1;
+  int below = (comm->num_nodes - 1)/2;
+
+  for(pass=0; pass<2 && hi>lo; pass++) {
+    double w = (hi - lo)/NBINS;
+    memset(counts, 0, sizeof(counts));
+    mybin = (int)((v - lo)/w);
+    if(mybin<0) mybin = 0;
+    if(mybin>=NBINS) mybin = NBINS-1;
+    if(in) counts[mybin] = 1;
+    status = QMP_comm_allreduce(comm, counts, NBINS, QMP_TYPE_INT, QMP_OP_SUM);
+    if(status!=QMP_SUCCESS) break;
+    for(b=0; b<NBINS-1 && below>=counts[b]; b++) below -= counts[b];
+    in = in && (mybin==b);
+    lo += b*w;
+    hi = lo + w;
+  }
+  *median = 0.5*(lo + hi);
+  return status;
+}
+
+/* place of this rank among the NSLOWEST largest v, ties broken by
+   rank, or NSLOWEST */
+static QMP_status_t
+comm_place(QMP_comm_t comm, double v, int *place)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  int k;
+
+  *place = NSLOWEST;
+  for(k=0; k<NSLOWEST && k<comm->num_nodes; k++) {
+    double top = (*place<k) ? -DBL_MAX : v;
+    status = QMP_comm_max_double(comm, &top);
+    if(status!=QMP_SUCCESS) break;
+    int r = (*place>=k && v==top) ? comm->nodeid : comm->num_nodes;
+    status = QMP_comm_allreduce(comm, &r, 1, QMP_TYPE_INT, QMP_OP_MIN);
+    if(status!=QMP_SUCCESS) break;
+    if(r==comm->nodeid) *place = k;
+  }
+  return status;
+}
+
+/**
+ * Report the load imbalance since the last report.
+ */
+QMP_status_t
+QMP_report_imbalance (void)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  QMP_comm_t comm = QMP_allocated_comm;
+  int me = comm->nodeid, k;
+  double median;
+  ENTER;
+
+  /* the reductions below are not part of the period */
+  double t = QMP_time();
+  if(period_start<0) QMP_imbalance_init();
+  double blocked = 1e-9*(tl_blocked_ns - tl_period_blocked);
+  double mine = (t - period_start) - blocked;
+
+  double c[3], w[3];
+  QMP_machine_range(mine, c);
+  QMP_machine_range(blocked, w);
+  /* too short to tell, e.g. finalize right after a report */
+  if(c[2]<MIN_PERIOD) goto leave;
+  status = comm_median(comm, mine, c[0], c[2], &median);
+  if(status!=QMP_SUCCESS) goto leave;
+  status = comm_place(comm, mine, &k);
+  if(status!=QMP_SUCCESS) goto leave;
+  periods++;
+  if(mine>median*(1+0.01*QMP_imbalance_threshold)) periods_above++;
+
+  if(me==0)
+    QMP_info("imbalance period %d: compute min %.3f median %.3f avg %.3f "
+	     "max %.3f s (%.1f%% over avg), blocked min %.3f avg %.3f max %.3f s",
+	     periods, c[0], median, c[1], c[2],
+	     (c[1]>0) ? 100*(c[2]/c[1]-1) : 0.0, w[0], w[1], w[2]);
+
+  if(k<NSLOWEST && comm->num_nodes>1)
+    QMP_info("imbalance slowest %d: rank %d on %s, compute %.3f s "
+	     "(%+.1f%% of median), blocked %.3f s", k+1, me,
+	     QMP_machine->host ? QMP_machine->host : "?", mine,
+	     (median>0) ? 100*(mine/median-1) : 0.0, blocked);
+  if(periods_above>0 && 4*periods_above>=3*periods)
+    QMP_info("imbalance: rank %d on %s computed more than %g%% above the "
+	     "median in %d of %d periods", me,
+	     QMP_machine->host ? QMP_machine->host : "?",
+	     QMP_imbalance_threshold, periods_above, periods);
+
+ leave:
+  period_start = QMP_time();
+  tl_period_blocked = tl_blocked_ns;
+  LEAVE;
+  return status;
+}
@@ -3,9 +3,11 @@
 #include <stdlib.h>
 #define __USE_UNIX98 /* needed to get gethostname from GNU unistd.h */
 #include <unistd.h>
+#include <sys/time.h>
 #include <ctype.h>
 #include <stdarg.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_TOPOLOGY
 #include "QMP_P_COMMON.h"
 
 // static library data
@@ -176,6 +178,107 @@ get_int_array(int *len, const char *tag, int *argc, char ***argv)
 }
 
 
+static char *
+get_string(const char *tag, int *argc, char ***argv)
+{
+  int first, last, *a=NULL;
+  char *c=NULL;
+  get_arg(*argc, *argv, tag, &first, &last, &c, &a);
+  QMP_free(a);
+  remove_from_args(argc, argv, first, last);
+  return c;
+}
+
+
+static int
+get_flag(const char *tag, int *argc, char ***argv)
+{
+  int first, last, *a=NULL;
+  char *c=NULL;
+  get_arg(*argc, *argv, tag, &first, &last, &c, &a);
+  QMP_free(a);
+  remove_from_args(argc, argv, first, first);
+  return first>=0;
+}
+
+
+/* flag with an optional integer value */
+static int
+get_flag_value(const char *tag, int *value, int *argc, char ***argv)
+{
+  int first, last, *a=NULL;
+  char *c=NULL;
+  get_arg(*argc, *argv, tag, &first, &last, &c, &a);
+  if(a) *value = a[0];
+  QMP_free(a);
+  remove_from_args(argc, argv, first, c ? first : last);
+  return first>=0;
+}
+
+
+/* -qmp-trace [sample] [-qmp-trace-events n] [-qmp-trace-file prefix] */
+static int trace_enabled = 0;
+static int trace_sample = 1;
+static int trace_events = 1<<16;
+static char *trace_file = NULL;
+
+/* startup phases timed for -qmp-init-profile */
+enum { INIT_MACHINE, INIT_ARGS, INIT_JOB, INIT_DEFAULT, INIT_FINISH, INIT_NPHASE };
+static const char *init_phase_name[INIT_NPHASE] =
+  { "machine", "arguments", "job comm", "default comm", "finish" };
+static double init_phase_time[INIT_NPHASE+1];
+static int init_profile = 0;
+
+/* QMP_time may not work before the machine is initialized */
+static double
+wall_time(void)
+{
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return ( (double) tp.tv_sec + (double) tp.tv_usec * 1.e-6 );
+}
+
+static void
+init_phase_report(void)
+{
+  double total = 0;
+  int i;
+  for(i=0; i<INIT_NPHASE; i++) {
+    double t = init_phase_time[i+1] - init_phase_time[i];
+    QMP_comm_max_double(QMP_allocated_comm, &t);
+    if(QMP_allocated_comm->nodeid==0)
+      QMP_info("init %-12s %10.6f s", init_phase_name[i], t);
+    total += t;
+  }
+  if(QMP_allocated_comm->nodeid==0)
+    QMP_info("init %-12s %10.6f s (sum of maxima)", "total", total);
+}
+
+
+/*
+ * Communicator with the same nodes as parent, as left by a split with
+ * a single color and key 0.  The copy is started nonblocking and
+ * waited for at the end of QMP_init_msg_passing.
+ */
+static QMP_comm_t
+comm_copy(QMP_comm_t parent)
+{
+#ifdef QMP_COMM_IDUP
+  QMP_comm_t comm;
+  QMP_alloc(comm, struct QMP_comm_struct, 1);
+  *comm = (struct QMP_comm_struct) {QMP_COMM_INIT};
+  comm->ncolors = 1;
+  comm->color = 0;
+  comm->key = 0;
+  QMP_COMM_IDUP(parent, comm);
+#else
+  QMP_comm_t comm = NULL;
+  QMP_comm_split(parent, 0, 0, &comm);
+#endif
+  return comm;
+}
+
+
 static int
 get_color(void)
 {
@@ -209,7 +312,7 @@ get_color(void)
 static void
 process_args(int* argc, char*** argv)
 {
-  ENTER;
+  ENTER_CAT(QMP_TIMER_OTHER);
 
 #ifdef QMP_MPI
   int* nmpi = get_int_array(&QMP_args->geomlen, "-qmp-nmpi", argc, argv);
@@ -243,6 +346,31 @@ process_args(int* argc, char*** argv)
   QMP_args->lmap = get_int_array(&QMP_args->lmaplen, "-qmp-logic-map", argc, argv);
   QMP_args->jobgeom = get_int_array(&QMP_args->njobdim, "-qmp-job", argc, argv);
 
+  init_profile = get_flag("-qmp-init-profile", argc, argv);
+  if(get_flag("-qmp-mem-pool", argc, argv)) QMP_pool_routed = 1;
+  if(get_flag("-qmp-mem-report", argc, argv)) QMP_mem_report_enabled = 1;
+  if(get_flag("-qmp-msg-report", argc, argv)) QMP_msg_report_enabled = 1;
+  trace_enabled = get_flag_value("-qmp-trace", &trace_sample, argc, argv);
+  get_flag_value("-qmp-trace-events", &trace_events, argc, argv);
+  trace_file = get_string("-qmp-trace-file", argc, argv);
+  if(get_flag("-qmp-probe", argc, argv)) QMP_probe_pending = 1;
+  int threshold = -1;
+  if(get_flag_value("-qmp-imbalance", &threshold, argc, argv)) {
+    QMP_imbalance_enabled = 1;
+    if(threshold>0) QMP_imbalance_threshold = threshold;
+  }
+  QMP_comm_matrix_file = get_string("-qmp-comm-matrix", argc, argv);
+  char *memdir = get_string("-qmp-mem-dir", argc, argv);
+  if(memdir) QMP_set_memory_directory(memdir);
+  char *nodemap = get_string("-qmp-node-map", argc, argv);
+  if(nodemap) {
+    if(strcmp(nodemap,"lex")==0) QMP_machine->topo_mapping = QMP_MAP_LEX;
+    else if(strcmp(nodemap,"block")==0) QMP_machine->topo_mapping = QMP_MAP_NODE_BLOCK;
+    else if(strcmp(nodemap,"curve")==0) QMP_machine->topo_mapping = QMP_MAP_NODE_CURVE;
+    else if(QMP_allocated_comm->nodeid==0)
+      QMP_error("unknown -qmp-node-map %s, expected lex, block or curve", nodemap);
+  }
+
   QMP_assert(QMP_args->amaplen>=0);
   QMP_assert(QMP_args->lmaplen>=0);
 
@@ -251,20 +379,30 @@ process_args(int* argc, char*** argv)
 					QMP_args->amap, QMP_args->amaplen);
   if(QMP_comm_logical_topology_is_declared(QMP_allocated_comm)) QMP_machine->ic_type = QMP_MESH;
 
+  init_phase_time[INIT_JOB] = wall_time();
+
   // set job communicator and topology (if any)
-  int color = get_color();
-  QMP_comm_split(QMP_allocated_comm, color, 0, &QMP_job_comm);
-  if(QMP_args->jobgeom && QMP_get_msg_passing_type()==QMP_MESH) {
-    int i, ndim = QMP_args->njobdim;
-    int geom[ndim];
-    const int *ad = QMP_get_allocated_dimensions();
-    for(i=0; i<ndim; i++) geom[i] = ad[i] / QMP_args->jobgeom[i];
-    QMP_comm_declare_logical_topology_map(QMP_job_comm, geom, ndim,
-					  QMP_args->amap, QMP_args->amaplen);
+  // without job partitions it has the same nodes as the allocated one
+  if(QMP_args->jobgeom) {
+    int color = get_color();
+    QMP_comm_split(QMP_allocated_comm, color, 0, &QMP_job_comm);
+    if(QMP_get_msg_passing_type()==QMP_MESH) {
+      int i, ndim = QMP_args->njobdim;
+      int geom[ndim];
+      const int *ad = QMP_get_allocated_dimensions();
+      for(i=0; i<ndim; i++) geom[i] = ad[i] / QMP_args->jobgeom[i];
+      QMP_comm_declare_logical_topology_map(QMP_job_comm, geom, ndim,
+					    QMP_args->amap, QMP_args->amaplen);
+    }
+  } else {
+    QMP_job_comm = comm_copy(QMP_allocated_comm);
   }
+  init_phase_time[INIT_DEFAULT] = wall_time();
 
-  // set default communicator
-  QMP_comm_split(QMP_job_comm, 0, 0, &QMP_default_comm);
+  // set default communicator, copied from the allocated one if the job
+  // communicator is still being created
+  if(QMP_args->jobgeom) QMP_default_comm = comm_copy(QMP_job_comm);
+  else QMP_default_comm = comm_copy(QMP_allocated_comm);
 
   LEAVE;
 }
@@ -280,6 +418,7 @@ QMP_init_msg_passing (int* argc, char*** argv, QMP_thread_level_t required,
   QMP_assert(QMP_machine->inited==QMP_FALSE);
   QMP_machine->inited = QMP_TRUE;
   QMP_machine->err_code = QMP_SUCCESS;
+  init_phase_time[INIT_MACHINE] = wall_time();
 
 #ifdef QMP_INIT_MACHINE
   QMP_INIT_MACHINE(argc, argv, required, provided);
@@ -293,19 +432,31 @@ QMP_init_msg_passing (int* argc, char*** argv, QMP_thread_level_t required,
   QMP_allocated_comm->ncolors = 1;
   QMP_allocated_comm->color = 0;
   QMP_allocated_comm->key = 0;
+  QMP_machine->nodemap.socket_id = QMP_get_socket_id();
   *provided = required;
 #endif
   QMP_machine->mnodes = QMP_allocated_comm->num_nodes;
   QMP_machine->mnodeid = QMP_allocated_comm->nodeid;
   QMP_machine->thread_level = *provided;
 
+  init_phase_time[INIT_ARGS] = wall_time();
   process_args(argc, argv);
+  init_phase_time[INIT_FINISH] = wall_time();
 
 #ifdef QMP_INIT_FINISH
   QMP_INIT_FINISH();
 #endif
+#ifdef QMP_COMM_COMPLETE
+  /* finish the copies while still single threaded, so the getters are
+     plain reads which are safe from any thread */
+  QMP_COMM_COMPLETE(QMP_job_comm);
+  QMP_COMM_COMPLETE(QMP_default_comm);
+#endif
+  init_phase_time[INIT_NPHASE] = wall_time();
 
-  QMP_barrier();
+  if(init_profile) init_phase_report();
+  QMP_imbalance_init();
+  if(trace_enabled) QMP_trace_init(trace_sample, trace_events, trace_file);
 
   LEAVE_INIT;
   return QMP_machine->err_code;
@@ -317,6 +468,12 @@ void
 QMP_finalize_msg_passing(void)
 {
   ENTER_INIT;
+  QMP_trace_finalize();
+  if(QMP_imbalance_enabled) QMP_report_imbalance();
+  if(QMP_comm_matrix_file) QMP_dump_comm_matrix(QMP_comm_matrix_file);
+  if(QMP_msg_report_enabled) QMP_msg_report();
+  QMP_pool_trim(0);
+  if(QMP_mem_report_enabled) QMP_memory_report();
   QMP_machine->inited = QMP_FALSE;
 #ifdef QMP_FINALIZE_MSG_PASSING
   QMP_FINALIZE_MSG_PASSING();
@@ -1,10 +1,21 @@
+#define _GNU_SOURCE /* needed to get MAP_HUGETLB and MADV_HUGEPAGE */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_MEMORY
 #include "QMP_P_COMMON.h"
 
+/* transparent huge page size */
+#define QMP_THP_SIZE (2UL<<20)
+/* mbind policy, from linux/mempolicy.h */
+#define QMP_MPOL_INTERLEAVE 3
+
 
 /**
  * allocate memory with default alignment and flags.
@@ -22,21 +33,266 @@ QMP_allocate_memory (size_t nbytes)
 }
 
 
+/* default hugetlbfs page size, 0 if unknown */
+static size_t
+huge_page_size(void)
+{
+  static size_t hps = 1;
+  if(hps==1) {
+    char line[128];
+    unsigned long kb;
+    size_t s = 0;
+    FILE *f = fopen("/proc/meminfo", "r");
+    if(f) {
+      while(fgets(line, sizeof(line), f)) {
+	if(sscanf(line, "Hugepagesize: %lu kB", &kb)==1) {
+	  s = ((size_t)kb)<<10;
+	  break;
+	}
+      }
+      fclose(f);
+    }
+    hps = s;
+  }
+  return hps;
+}
+
+/* interleave the pages over all online NUMA nodes */
+static void
+interleave_pages(void *p, size_t len)
+{
+#ifdef SYS_mbind
+  unsigned long mask = 0;
+  int a, b, n;
+  FILE *f = fopen("/sys/devices/system/node/online", "r");
+  if(!f) return;
+  /* list of ranges like 0-3,6 */
+  while((n = fscanf(f, "%d-%d", &a, &b))>0) {
+    if(n==1) b = a;
+    for(; a<=b && a<(int)(8*sizeof(mask)); a++) mask |= 1UL<<a;
+    if(fgetc(f)!=',') break;
+  }
+  fclose(f);
+  if(mask&(mask-1))
+    syscall(SYS_mbind, p, len, QMP_MPOL_INTERLEAVE, &mask,
+	    8*sizeof(mask), 0);
+#else
+  _QMP_UNUSED_ARGUMENT(p);
+  _QMP_UNUSED_ARGUMENT(len);
+#endif
+}
+
+/* anonymous mapping, huge pages for QMP_MEM_FAST */
+static int
+map_memory(QMP_mem_t *mem, size_t nbytes, int flags)
+{
+  size_t hps = huge_page_size();
+  size_t extra = (mem->alignment>QMP_THP_SIZE) ? mem->alignment : 0;
+  void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if((flags&QMP_MEM_FAST) && hps && nbytes>=hps) {
+    mem->nbytes = ((nbytes+extra+hps-1)/hps)*hps;
+    p = mmap(NULL, mem->nbytes, PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  }
+#endif
+  if(p==MAP_FAILED) {
+    mem->nbytes = nbytes + mem->alignment;
+    p = mmap(NULL, mem->nbytes, PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(p==MAP_FAILED) return 0;
+#ifdef MADV_HUGEPAGE
+    if((flags&QMP_MEM_FAST) && nbytes>=QMP_THP_SIZE)
+      madvise(p, mem->nbytes, MADV_HUGEPAGE);
+#endif
+  }
+  if(flags&QMP_MEM_INTERLEAVE) interleave_pages(p, mem->nbytes);
+
+  mem->allocated_ptr = p;
+  mem->kind = MEM_mapped;
+  return 1;
+}
+
+/* directory of the files behind QMP_MEM_FILEBACKED memory */
+static char mem_dir[4096] = "";
+
 /**
- * allocate memory with specified alignment and flags.
+ * Set the directory for file backed memory.
  */
-QMP_mem_t *
-QMP_allocate_aligned_memory (size_t nbytes, size_t alignment, int flags)
+QMP_status_t
+QMP_set_memory_directory (const char *dir)
 {
-  _QMP_UNUSED_ARGUMENT(flags);
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+  if(strlen(dir)<sizeof(mem_dir)-16) {
+    strcpy(mem_dir, dir);
+  } else {
+    status = QMP_INVALID_ARG;
+  }
+  LEAVE;
+  return status;
+}
 
-  QMP_mem_t *mem;
+/* shared mapping of a new unlinked file, so nothing is left behind */
+static int
+map_file(QMP_mem_t *mem, size_t nbytes)
+{
+  char path[sizeof(mem_dir)+16];
+  const char *dir = mem_dir;
+  if(dir[0]=='\0') dir = getenv("TMPDIR");
+  if(dir==NULL || strlen(dir)>=sizeof(mem_dir)-16) dir = "/tmp";
+  int len = snprintf(path, sizeof(path), "%s/qmp_mem_XXXXXX", dir);
+  if(len<0 || (size_t)len>=sizeof(path)) {
+    QMP_error("QMP_MEM_FILEBACKED: directory name too long");
+    return 0;
+  }
+
+  int fd = mkstemp(path);
+  if(fd<0) {
+    QMP_error("QMP_MEM_FILEBACKED: cannot create a file in %s", dir);
+    return 0;
+  }
+  unlink(path);
+  mem->nbytes = nbytes + mem->alignment;
+  /* reserve the blocks now, a full file system would otherwise show up
+     as SIGBUS on first touch of a sparse file */
+  void *p = MAP_FAILED;
+  if(posix_fallocate(fd, 0, (off_t)mem->nbytes)==0)
+    p = mmap(NULL, mem->nbytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p==MAP_FAILED) {
+    QMP_error("QMP_MEM_FILEBACKED: cannot map %lu bytes in %s",
+	      (unsigned long)mem->nbytes, dir);
+    close(fd);
+    return 0;
+  }
+
+  mem->fd = fd;
+  mem->allocated_ptr = p;
+  mem->kind = MEM_file;
+  return 1;
+}
+
+/* page aligned part of the mapping covering [offset, offset+len) of the
+   user memory, returns 0 if empty */
+static size_t
+page_range(QMP_mem_t *mem, size_t offset, size_t len, char **start)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  char *base = (char *) mem->allocated_ptr;
+  char *b = ((char *) mem->aligned_ptr) + offset;
+  char *e = b + len;
+  if(e>base+mem->nbytes) e = base + mem->nbytes;
+  b = base + ((size_t)(b-base))/page*page;
+  *start = b;
+  return (e>b) ? (size_t)(e-b) : 0;
+}
+
+/**
+ * Hint that a range of memory will be needed soon.
+ */
+QMP_status_t
+QMP_mem_prefetch (QMP_mem_t *mem, size_t offset, size_t len)
+{
+  char *b;
+  ENTER;
+  if(mem->kind==MEM_file) {
+    size_t n = page_range(mem, offset, len, &b);
+    if(n) madvise(b, n, MADV_WILLNEED);
+  }
+  LEAVE;
+  return QMP_SUCCESS;
+}
+
+/**
+ * Write a range of file backed memory back to its file.
+ */
+QMP_status_t
+QMP_mem_writeback (QMP_mem_t *mem, size_t offset, size_t len, QMP_bool_t wait)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  char *b;
   ENTER;
+  if(mem->kind==MEM_file) {
+    size_t n = page_range(mem, offset, len, &b);
+    if(n && msync(b, n, (wait==QMP_TRUE) ? MS_SYNC : MS_ASYNC)!=0)
+      status = QMP_ERROR;
+  }
+  LEAVE;
+  return status;
+}
 
-  QMP_alloc(mem, QMP_mem_t, 1);
+/**
+ * Drop a range of file backed memory from RAM, it is read back from
+ * the file when touched again.
+ */
+QMP_status_t
+QMP_mem_evict (QMP_mem_t *mem, size_t offset, size_t len)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  char *b;
+  ENTER;
+  if(mem->kind==MEM_file) {
+    size_t n = page_range(mem, offset, len, &b);
+    /* dirty pages must reach the file before they are dropped */
+    if(n && (msync(b, n, MS_SYNC)!=0 || madvise(b, n, MADV_DONTNEED)!=0))
+      status = QMP_ERROR;
+  }
+  LEAVE;
+  return status;
+}
+
+/* allocate a memory structure according to the flags, bypassing the pool */
+QMP_mem_t *
+QMP_mem_allocate_raw (size_t nbytes, size_t alignment, int flags)
+{
+  QMP_mem_t *mem;
+  int done = 0;
+
+  QMP_alloc_cat(mem, QMP_mem_t, 1, QMP_MEMCAT_USER);
   if(mem) {
-    QMP_alloc(mem->allocated_ptr, char, nbytes+alignment);
-    if(mem->allocated_ptr) {
+    mem->flags = flags;
+    mem->pool_class = -1;
+    mem->next = NULL;
+    mem->alignment = alignment;
+    mem->nbytes = nbytes + alignment;
+    mem->allocated_ptr = NULL;
+
+    if(flags&QMP_MEM_FILEBACKED) {
+      /* no fallback to RAM for data that does not fit there */
+      if(!map_file(mem, nbytes)) {
+	QMP_free(mem);
+	QMP_SET_STATUS_CODE(QMP_NOMEM_ERR);
+	return NULL;
+      }
+      done = 1;
+    } else if(flags&QMP_MEM_NODE_SHARED) {
+#ifdef QMP_ALLOC_SHARED
+      if(QMP_ALLOC_SHARED(mem)==QMP_SUCCESS) {
+	mem->kind = MEM_shared;
+	done = 1;
+      }
+#endif
+    } else if((flags&QMP_MEM_COMMS) &&
+	      !((flags&QMP_MEM_FAST) && nbytes>=QMP_THP_SIZE)) {
+#ifdef QMP_ALLOC_COMMS
+      if(QMP_ALLOC_COMMS(mem)==QMP_SUCCESS) {
+	mem->kind = MEM_comms;
+	done = 1;
+      }
+#endif
+    }
+    if(!done && (flags&(QMP_MEM_FAST|QMP_MEM_INTERLEAVE)))
+      done = map_memory(mem, nbytes, flags);
+    if(!done) {
+      mem->nbytes = nbytes + alignment;
+      mem->allocated_ptr = malloc(mem->nbytes);
+      mem->kind = MEM_malloc;
+      done = (mem->allocated_ptr!=NULL);
+    }
+
+    if(done) {
+      QMP_mem_account(QMP_MEMCAT_USER, flags, (ptrdiff_t)mem->nbytes, 0);
       if(alignment) {
 	mem->aligned_ptr = (void *)
 	  (((((size_t)(mem->allocated_ptr))+alignment-1)/alignment)*alignment);
@@ -46,9 +302,58 @@ QMP_allocate_aligned_memory (size_t nbytes, size_t alignment, int flags)
     } else {
       QMP_free(mem);
       mem = NULL;
+      QMP_SET_STATUS_CODE(QMP_NOMEM_ERR);
     }
   }
 
+  return mem;
+}
+
+void
+QMP_mem_free_raw (QMP_mem_t* mem)
+{
+  QMP_mem_account(QMP_MEMCAT_USER, mem->flags, -(ptrdiff_t)mem->nbytes, 0);
+  switch(mem->kind) {
+  case MEM_mapped:
+    munmap(mem->allocated_ptr, mem->nbytes);
+    break;
+  case MEM_file:
+    munmap(mem->allocated_ptr, mem->nbytes);
+    close(mem->fd);
+    break;
+  case MEM_comms:
+#ifdef QMP_FREE_COMMS
+    QMP_FREE_COMMS(mem);
+#endif
+    break;
+  case MEM_shared:
+#ifdef QMP_FREE_SHARED
+    QMP_FREE_SHARED(mem);
+#endif
+    break;
+  default:
+    free(mem->allocated_ptr);
+    break;
+  }
+  QMP_free(mem);
+}
+
+/**
+ * allocate memory with specified alignment and flags.
+ */
+QMP_mem_t *
+QMP_allocate_aligned_memory (size_t nbytes, size_t alignment, int flags)
+{
+  QMP_mem_t *mem;
+  ENTER;
+
+  if(QMP_pool_routed && nbytes<=QMP_POOL_ROUTED_MAX &&
+     !(flags&(QMP_MEM_NODE_SHARED|QMP_MEM_FILEBACKED))) {
+    mem = QMP_pool_allocate(nbytes, alignment, flags);
+  } else {
+    mem = QMP_mem_allocate_raw(nbytes, alignment, flags);
+  }
+
   LEAVE;
   return mem;
 }
@@ -66,6 +371,32 @@ QMP_get_memory_pointer (QMP_mem_t* mem)
 }
 
 
+/**
+ * Get pointer to the segment of another rank of the physical node.
+ */
+void *
+QMP_get_node_shared_pointer (QMP_mem_t* mem, int local_rank)
+{
+  void *p = NULL;
+  ENTER;
+  if(mem->kind==MEM_shared) {
+#ifdef QMP_SHARED_QUERY
+    p = QMP_SHARED_QUERY(mem, local_rank);
+    if(p && mem->alignment) {
+      /* same offset as the aligned pointer of the owner,
+	 exact for alignments up to the page size */
+      p = (void *)
+	(((((size_t)p)+mem->alignment-1)/mem->alignment)*mem->alignment);
+    }
+#endif
+  } else if(local_rank==QMP_machine->nodemap.local_rank) {
+    p = mem->aligned_ptr;
+  }
+  LEAVE;
+  return p;
+}
+
+
 /**
  * Free aligned memory
  */
@@ -74,8 +405,8 @@ QMP_free_memory (QMP_mem_t* mem)
 {
   ENTER;
   if(mem) {
-    QMP_free(mem->allocated_ptr);
-    QMP_free(mem);
+    if(mem->pool_class>=0) QMP_pool_release(mem);
+    else QMP_mem_free_raw(mem);
   }
   LEAVE;
 }
@@ -88,7 +419,7 @@ QMP_declare_msgmem(const void *buf, size_t nbytes)
   struct QMP_msgmem_struct *mem;
   ENTER;
 
-  QMP_alloc(mem, struct QMP_msgmem_struct, 1);
+  QMP_alloc_cat(mem, struct QMP_msgmem_struct, 1, QMP_MEMCAT_MSGMEM);
 
   if (mem) {
     mem->type = MM_user_buf;
@@ -121,7 +452,7 @@ QMP_declare_strided_msgmem (void* base,
   if( stride == (ptrdiff_t)blksize || nblocks == 1 ) { /* Not really strided */
     mem = QMP_declare_msgmem(base, blksize*nblocks);
   } else { /* Really strided */
-    QMP_alloc(mem, struct QMP_msgmem_struct, 1);
+    QMP_alloc_cat(mem, struct QMP_msgmem_struct, 1, QMP_MEMCAT_MSGMEM);
 
     if (mem) {
       mem->type = MM_strided_buf;
@@ -159,16 +490,16 @@ QMP_declare_strided_array_msgmem (void* base[],
   if(narray==1) {
     mem = QMP_declare_strided_msgmem(base[0], blksize[0], nblocks[0], stride[0]);
   } else {
-    QMP_alloc(mem, struct QMP_msgmem_struct, 1);
+    QMP_alloc_cat(mem, struct QMP_msgmem_struct, 1, QMP_MEMCAT_MSGMEM);
 
     if (mem) {
       mem->type = MM_strided_array_buf;
       mem->mem = (char *)base[0];
       mem->mm.sa.narray = narray;
-      QMP_alloc(mem->mm.sa.disp, ptrdiff_t, narray);
-      QMP_alloc(mem->mm.sa.blksize, size_t, narray);
-      QMP_alloc(mem->mm.sa.nblocks, int, narray);
-      QMP_alloc(mem->mm.sa.stride, ptrdiff_t, narray);
+      QMP_alloc_cat(mem->mm.sa.disp, ptrdiff_t, narray, QMP_MEMCAT_MSGMEM);
+      QMP_alloc_cat(mem->mm.sa.blksize, size_t, narray, QMP_MEMCAT_MSGMEM);
+      QMP_alloc_cat(mem->mm.sa.nblocks, int, narray, QMP_MEMCAT_MSGMEM);
+      QMP_alloc_cat(mem->mm.sa.stride, ptrdiff_t, narray, QMP_MEMCAT_MSGMEM);
       int i, nb=0;
       for(i=0; i<narray; i++) {
 	nb += blksize[i]*nblocks[i];
@@ -203,15 +534,15 @@ QMP_declare_indexed_msgmem (void* base,
   struct QMP_msgmem_struct *mem;
   ENTER;
 
-  QMP_alloc(mem, struct QMP_msgmem_struct, 1);
+  QMP_alloc_cat(mem, struct QMP_msgmem_struct, 1, QMP_MEMCAT_MSGMEM);
 
   if (mem) {
     mem->type = MM_indexed_buf;
     mem->mem = (char *)base;
     mem->mm.in.elemsize = elemsize;
     mem->mm.in.count = count;
-    QMP_alloc(mem->mm.in.blocklen, int, count);
-    QMP_alloc(mem->mm.in.index, int, count);
+    QMP_alloc_cat(mem->mm.in.blocklen, int, count, QMP_MEMCAT_MSGMEM);
+    QMP_alloc_cat(mem->mm.in.index, int, count, QMP_MEMCAT_MSGMEM);
     int i, nb=0;
     for(i=0; i<count; i++) {
       mem->mm.in.blocklen[i] = blocklen[i];
@@ -242,6 +573,7 @@ QMP_free_msgmem(QMP_msgmem_t mem)
   QMP_FREE_MSGMEM(mem);
 #endif
   if ( mem->type == MM_indexed_buf) {
+    QMP_free(mem->mm.in.blocklen);
     QMP_free(mem->mm.in.index);
   } else if ( mem->type == MM_strided_array_buf) {
     QMP_free(mem->mm.sa.disp);
@@ -256,13 +588,15 @@ QMP_free_msgmem(QMP_msgmem_t mem)
 
 
 /* Alloc message handler */
+static int next_msghandle_id = 0;
+
 static QMP_msghandle_t 
 alloc_msghandle(void)
 {
   QMP_msghandle_t mh;
   ENTER;
 
-  QMP_alloc(mh, struct QMP_msghandle_struct, 1);
+  QMP_alloc_cat(mh, struct QMP_msghandle_struct, 1, QMP_MEMCAT_MSGHANDLE);
   if (mh) {
     mh->type = MH_empty;
     mh->activeP = 0;
@@ -277,6 +611,14 @@ alloc_msghandle(void)
     mh->uses = 0;
     mh->priority = 0;
     mh->paired = 0;
+    mh->disp = -1;
+    mh->traffic = NULL;
+    mh->axis = -1;
+    mh->dir = 0;
+    mh->t_start = 0;
+    mh->t_done = 0;
+    memset(&mh->stats, 0, sizeof(mh->stats));
+    mh->id = __atomic_fetch_add(&next_msghandle_id, 1, __ATOMIC_RELAXED);
   }
 #ifdef QMP_ALLOC_MSGHANDLE
   QMP_ALLOC_MSGHANDLE(mh);
@@ -331,7 +673,8 @@ QMP_free_msghandle (QMP_msghandle_t msgh)
 
 
 static QMP_msghandle_t
-declare_receive(QMP_comm_t comm, QMP_msgmem_t mm, int sourceNode, int axis, int dir, int priority)
+declare_receive(QMP_comm_t comm, QMP_msgmem_t mm, int sourceNode, int axis, int dir,
+		int disp, int priority)
 {
   QMP_msghandle_t mh;
   ENTER;
@@ -351,6 +694,7 @@ declare_receive(QMP_comm_t comm, QMP_msgmem_t mm, int sourceNode, int axis, int
     mh->srce_node = sourceNode;
     mh->axis = axis;
     mh->dir = dir;
+    mh->disp = disp;
     mh->priority = priority;
     mh->next = NULL;
 
@@ -373,7 +717,8 @@ declare_receive(QMP_comm_t comm, QMP_msgmem_t mm, int sourceNode, int axis, int
 
 
 static QMP_msghandle_t
-declare_send(QMP_comm_t comm, QMP_msgmem_t mm, int destNode, int axis, int dir, int priority)
+declare_send(QMP_comm_t comm, QMP_msgmem_t mm, int destNode, int axis, int dir,
+	     int disp, int priority)
 {
   QMP_msghandle_t mh;
   ENTER;
@@ -391,8 +736,10 @@ declare_send(QMP_comm_t comm, QMP_msgmem_t mm, int destNode, int axis, int dir,
     mh->comm = comm;
     mh->dest_node = destNode;
     mh->srce_node = QMP_comm_get_node_number(comm);
+    mh->traffic = QMP_comm_traffic_peer(comm, destNode);
     mh->axis = axis;
     mh->dir = dir;
+    mh->disp = disp;
     mh->priority = priority;
     mh->next = NULL;
 
@@ -421,7 +768,7 @@ QMP_comm_declare_receive_from (QMP_comm_t comm, QMP_msgmem_t mm, int sourceNode,
   QMP_msghandle_t mh;
   ENTER;
 
-  mh = declare_receive(comm, mm, sourceNode, -1, 0, priority);
+  mh = declare_receive(comm, mm, sourceNode, -1, 0, -1, priority);
 
   LEAVE;
   return mh;
@@ -433,7 +780,7 @@ QMP_declare_receive_from (QMP_msgmem_t mm, int sourceNode, int priority)
   QMP_msghandle_t mh;
   ENTER;
 
-  mh = declare_receive(QMP_comm_get_default(), mm, sourceNode, -1, 0, priority);
+  mh = declare_receive(QMP_comm_get_default(), mm, sourceNode, -1, 0, -1, priority);
 
   LEAVE;
   return mh;
@@ -451,7 +798,7 @@ QMP_comm_declare_receive_relative(QMP_comm_t comm, QMP_msgmem_t mm, int dir, int
 
   int ii = (isign > 0) ? 1 : 0;
   int sourceNode = comm->topo->neigh[ii][dir];
-  mh = declare_receive(comm, mm, sourceNode, dir, isign, priority);
+  mh = declare_receive(comm, mm, sourceNode, dir, isign, -1, priority);
 
   LEAVE;
   return mh;
@@ -476,7 +823,7 @@ QMP_comm_declare_send_to (QMP_comm_t comm, QMP_msgmem_t mm, int destNode, int pr
   QMP_msghandle_t mh;
   ENTER;
 
-  mh = declare_send(comm, mm, destNode, -1, 0, priority);
+  mh = declare_send(comm, mm, destNode, -1, 0, -1, priority);
 
   LEAVE;
   return mh;
@@ -489,7 +836,7 @@ QMP_declare_send_to (QMP_msgmem_t mm, int destNode, int priority)
   QMP_msghandle_t mh;
   ENTER;
 
-  mh = declare_send(QMP_comm_get_default(), mm, destNode, -1, 0, priority);
+  mh = declare_send(QMP_comm_get_default(), mm, destNode, -1, 0, -1, priority);
 
   LEAVE;
   return mh;
@@ -508,7 +855,7 @@ QMP_comm_declare_send_relative (QMP_comm_t comm, QMP_msgmem_t mm, int dir, int i
 
   int ii = (isign > 0) ? 1 : 0;
   int destNode = comm->topo->neigh[ii][dir];
-  mh = declare_send(comm, mm, destNode, dir, isign, priority);
+  mh = declare_send(comm, mm, destNode, dir, isign, -1, priority);
 
   LEAVE;
   return mh;
@@ -527,6 +874,105 @@ QMP_declare_send_relative (QMP_msgmem_t mm, int dir, int isign, int priority)
 }
 
 
+/* code of a displacement, unique for each vector with all components
+   in [-QMP_MAX_DISPLACEMENT,QMP_MAX_DISPLACEMENT], or -1.  A zero
+   component has digit 0, so the directions after the last nonzero
+   component add nothing and the code does not grow with the number of
+   dimensions. */
+static int
+displacement_code(QMP_comm_t comm, const int disp[], int sign)
+{
+  int i, code = 0;
+  int nd = QMP_comm_get_logical_number_of_dimensions(comm);
+  for(i=nd-1; i>=0; i--) {
+    int d = sign*disp[i];
+    if(d<-QMP_MAX_DISPLACEMENT || d>QMP_MAX_DISPLACEMENT) {
+      QMP_error("displacement %d in direction %d exceeds %d", disp[i], i,
+		QMP_MAX_DISPLACEMENT);
+      return -1;
+    }
+    int digit = d>=0 ? d : QMP_MAX_DISPLACEMENT - d;
+    if(code > (QMP_MAX_DISPLACED_CODE - digit)/(2*QMP_MAX_DISPLACEMENT+1)) {
+      QMP_error("displacement with nonzero direction %d has no message tag",
+		i);
+      return -1;
+    }
+    code = code*(2*QMP_MAX_DISPLACEMENT+1) + digit;
+  }
+  return code;
+}
+
+
+/* The receive from +disp matches the send to -disp of the source node,
+   so it uses the code of -disp. */
+QMP_msghandle_t
+QMP_comm_declare_receive_displaced (QMP_comm_t comm, QMP_msgmem_t mm,
+				    const int disp[], int priority)
+{
+  QMP_msghandle_t mh = NULL;
+  ENTER;
+
+  QMP_assert(QMP_comm_logical_topology_is_declared(comm));
+
+  int code = displacement_code(comm, disp, -1);
+  if(code>=0) {
+    int sourceNode = QMP_comm_get_neighbor(comm, disp);
+    mh = declare_receive(comm, mm, sourceNode, -1, 0, code, priority);
+  } else {
+    QMP_SET_STATUS_CODE(QMP_INVALID_ARG);
+  }
+
+  LEAVE;
+  return mh;
+}
+
+QMP_msghandle_t
+QMP_declare_receive_displaced (QMP_msgmem_t mm, const int disp[], int priority)
+{
+  QMP_msghandle_t mh;
+  ENTER;
+
+  mh = QMP_comm_declare_receive_displaced(QMP_comm_get_default(), mm, disp, priority);
+
+  LEAVE;
+  return mh;
+}
+
+
+QMP_msghandle_t
+QMP_comm_declare_send_displaced (QMP_comm_t comm, QMP_msgmem_t mm,
+				 const int disp[], int priority)
+{
+  QMP_msghandle_t mh = NULL;
+  ENTER;
+
+  QMP_assert(QMP_comm_logical_topology_is_declared(comm));
+
+  int code = displacement_code(comm, disp, 1);
+  if(code>=0) {
+    int destNode = QMP_comm_get_neighbor(comm, disp);
+    mh = declare_send(comm, mm, destNode, -1, 0, code, priority);
+  } else {
+    QMP_SET_STATUS_CODE(QMP_INVALID_ARG);
+  }
+
+  LEAVE;
+  return mh;
+}
+
+QMP_msghandle_t
+QMP_declare_send_displaced (QMP_msgmem_t mm, const int disp[], int priority)
+{
+  QMP_msghandle_t mh;
+  ENTER;
+
+  mh = QMP_comm_declare_send_displaced(QMP_comm_get_default(), mm, disp, priority);
+
+  LEAVE;
+  return mh;
+}
+
+
 /* Declare multiple messages */
 /* What this does is just link the first (non-null) messages
  * to subsequent messages */
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_OTHER
+#include "QMP_P_COMMON.h"
+
+/*
+ * Memory accounting.
+ *
+ * Every QMP_alloc carries a small header with its size, category and
+ * allocation site, and is kept on a list of live blocks so the objects
+ * still allocated at finalize can be listed.  Memory handed to users
+ * by QMP_allocate_memory and backend datatypes are accounted through
+ * QMP_mem_account.
+ */
+
+struct mem_header {
+  size_t nbytes;
+  const char *file;
+  struct mem_header *prev, *next;
+  int line;
+  int cat;
+};
+#define HEADER_SIZE ((sizeof(struct mem_header)+15)/16*16)
+
+static const char *category_name[QMP_MEMCAT_N] =
+  { "user", "msgmem", "msghandle", "datatype", "internal" };
+static const char *flag_name[QMP_MEM_NFLAGS] =
+  { "noncache", "comms", "fast", "interleave", "node_shared", "filebacked" };
+
+static QMP_memory_stats_t stats;
+static struct mem_header *live = NULL;
+static int live_lock = 0;
+
+int QMP_mem_report_enabled = 0;
+
+static void
+counter_add(QMP_mem_counter_t *c, ptrdiff_t nbytes, int nobjects)
+{
+  size_t cur = __atomic_add_fetch(&c->current, (size_t)nbytes, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+  while(cur>peak &&
+	!__atomic_compare_exchange_n(&c->peak, &peak, cur, 1,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  __atomic_add_fetch(&c->count, (size_t)nobjects, __ATOMIC_RELAXED);
+  if(nobjects>0)
+    __atomic_add_fetch(&c->allocations, (size_t)nobjects, __ATOMIC_RELAXED);
+}
+
+void
+QMP_mem_account(QMP_mem_category_t cat, int flags, ptrdiff_t nbytes,
+		int nobjects)
+{
+  int i;
+  counter_add(&stats.category[cat], nbytes, nobjects);
+  counter_add(&stats.total, nbytes, nobjects);
+  for(i=0; i<QMP_MEM_NFLAGS; i++)
+    if(flags&(1<<i)) counter_add(&stats.flag[i], nbytes, nobjects);
+}
+
+void *
+QMP_tracked_malloc(size_t nbytes, QMP_mem_category_t cat,
+		   const char *file, int line)
+{
+  struct mem_header *h = (struct mem_header *) malloc(HEADER_SIZE + nbytes);
+  if(!h) return NULL;
+  h->nbytes = nbytes;
+  h->file = file;
+  h->line = line;
+  h->cat = cat;
+  h->prev = NULL;
+  QMP_spin_lock(&live_lock);
+  h->next = live;
+  if(live) live->prev = h;
+  live = h;
+  QMP_spin_unlock(&live_lock);
+  QMP_mem_account(cat, 0, (ptrdiff_t)nbytes, 1);
+  return ((char *)h) + HEADER_SIZE;
+}
+
+void
+QMP_tracked_free(void *p)
+{
+  if(!p) return;
+  struct mem_header *h = (struct mem_header *) (((char *)p) - HEADER_SIZE);
+  QMP_spin_lock(&live_lock);
+  if(h->prev) h->prev->next = h->next;
+  else live = h->next;
+  if(h->next) h->next->prev = h->prev;
+  QMP_spin_unlock(&live_lock);
+  QMP_mem_account(h->cat, 0, -(ptrdiff_t)h->nbytes, -1);
+  free(h);
+}
+
+
+/**
+ * Get the memory allocated by QMP on this rank.
+ */
+QMP_status_t
+QMP_get_memory_stats(QMP_memory_stats_t *s)
+{
+  ENTER;
+  *s = stats;
+  LEAVE;
+  return QMP_SUCCESS;
+}
+
+
+/* min, average and max of v over the allocated communicator */
+void
+QMP_machine_range(double v, double r[3])
+{
+  r[0] = -v;
+  r[1] = v;
+  r[2] = v;
+  QMP_comm_max_double(QMP_allocated_comm, &r[0]);
+  QMP_comm_sum_double(QMP_allocated_comm, &r[1]);
+  QMP_comm_max_double(QMP_allocated_comm, &r[2]);
+  r[0] = -r[0];
+  r[1] /= QMP_allocated_comm->num_nodes;
+}
+
+static void
+report_counter(const char *name, QMP_mem_counter_t *c)
+{
+  double cur[3], peak[3];
+  QMP_machine_range((double)c->current, cur);
+  QMP_machine_range((double)c->peak, peak);
+  if(QMP_allocated_comm->nodeid==0)
+    QMP_info("mem %-12s current %10.0f %12.0f %10.0f  peak %10.0f %12.0f %10.0f",
+	     name, cur[0], cur[1], cur[2], peak[0], peak[1], peak[2]);
+}
+
+#define MAX_SITES 32
+
+/* objects of the user visible categories still allocated, by site */
+static void
+report_leaks(void)
+{
+  struct { const char *file; int line, cat, n; size_t nbytes; } site[MAX_SITES];
+  int nsite = 0, i;
+  struct mem_header *h;
+  QMP_spin_lock(&live_lock);
+  for(h=live; h; h=h->next) {
+    if(h->cat==QMP_MEMCAT_INTERNAL || h->cat==QMP_MEMCAT_USER) continue;
+    for(i=0; i<nsite; i++)
+      if(site[i].line==h->line && strcmp(site[i].file, h->file)==0) break;
+    if(i==nsite) {
+      if(nsite==MAX_SITES) continue;
+      site[i].file = h->file;
+      site[i].line = h->line;
+      site[i].cat = h->cat;
+      site[i].n = 0;
+      site[i].nbytes = 0;
+      nsite++;
+    }
+    site[i].n++;
+    site[i].nbytes += h->nbytes;
+  }
+  QMP_spin_unlock(&live_lock);
+  for(i=0; i<nsite; i++)
+    QMP_info("mem leak %s: %d objects (%lu bytes) allocated at %s:%d",
+	     category_name[site[i].cat], site[i].n,
+	     (unsigned long)site[i].nbytes, site[i].file, site[i].line);
+  if(stats.category[QMP_MEMCAT_USER].count>0)
+    QMP_info("mem leak user: %lu QMP_mem_t not freed (%lu bytes)",
+	     (unsigned long)stats.category[QMP_MEMCAT_USER].count,
+	     (unsigned long)stats.category[QMP_MEMCAT_USER].current);
+  if(stats.category[QMP_MEMCAT_DATATYPE].count>0)
+    QMP_info("mem leak datatype: %lu datatypes not freed",
+	     (unsigned long)stats.category[QMP_MEMCAT_DATATYPE].count);
+}
+
+/*
+ * Machine wide min/avg/max of the current and peak bytes per category
+ * and flag, and the objects still allocated on each rank.  Collective
+ * over the allocated communicator.
+ */
+void
+QMP_memory_report(void)
+{
+  int i;
+  if(QMP_allocated_comm->nodeid==0)
+    QMP_info("mem %-12s current %10s %12s %10s  peak %10s %12s %10s",
+	     "bytes", "min", "avg", "max", "min", "avg", "max");
+  for(i=0; i<QMP_MEMCAT_N; i++)
+    report_counter(category_name[i], &stats.category[i]);
+  for(i=0; i<QMP_MEM_NFLAGS; i++)
+    report_counter(flag_name[i], &stats.flag[i]);
+  report_counter("total", &stats.total);
+  report_leaks();
+}
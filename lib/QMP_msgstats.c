@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_OTHER
+#include "QMP_P_COMMON.h"
+
+/*
+ * Message handle statistics.
+ *
+ * QMP_start stamps a handle and the messages it combines, and the
+ * completion is seen in QMP_wait or QMP_is_complete.  A backend that
+ * sees the messages of a combined handle complete one by one sets their
+ * t_done, otherwise they complete with the handle.  The counters of a
+ * handle are only updated by the thread completing it.  With
+ * -qmp-msg-report every completed message is also added to the totals
+ * of the rank by axis and direction, under a lock since threads may
+ * complete handles concurrently.
+ */
+
+int QMP_msg_report_enabled = 0;
+
+static QMP_msghandle_stats_t rank_stats;
+static int rank_lock = 0;
+
+static void
+counter_add(QMP_msg_counter_t *c, size_t bytes, double latency, double wait)
+{
+  uint64_t us = (uint64_t)(latency*1e6);
+  int bin = us ? 64 - __builtin_clzll(us) : 0;
+  if(bin>=QMP_MSG_NBINS) bin = QMP_MSG_NBINS - 1;
+  c->completions++;
+  c->bytes += bytes;
+  c->latency += latency;
+  if(latency>c->latency_max) c->latency_max = latency;
+  c->wait += wait;
+  c->histogram[bin]++;
+}
+
+static void
+counter_merge(QMP_msg_counter_t *c, const QMP_msg_counter_t *a)
+{
+  int i;
+  c->starts += a->starts;
+  c->completions += a->completions;
+  c->bytes += a->bytes;
+  c->latency += a->latency;
+  if(a->latency_max>c->latency_max) c->latency_max = a->latency_max;
+  c->wait += a->wait;
+  for(i=0; i<QMP_MSG_NBINS; i++) c->histogram[i] += a->histogram[i];
+}
+
+/* counter of a single message by axis and direction */
+static QMP_msg_counter_t *
+dir_counter(QMP_msghandle_stats_t *s, QMP_msghandle_t mh)
+{
+  if(mh->axis>=0 && mh->axis<QMP_MSG_MAXDIM)
+    return &s->dir[mh->axis][mh->dir>0];
+  return &s->other;
+}
+
+/* completion of a single message, wait_start>0 inside QMP_wait */
+static size_t
+message_done(QMP_msghandle_t mh, double t, double wait_start)
+{
+  size_t bytes = mh->mm->nbytes;
+  double done = (mh->t_done>0) ? mh->t_done : t;
+  double wait = (wait_start>0 && done>wait_start) ? done - wait_start : 0;
+  counter_add(&mh->stats, bytes, done - mh->t_start, wait);
+  if(QMP_msg_report_enabled) {
+    QMP_msg_counter_t *r = dir_counter(&rank_stats, mh);
+    r->starts++;
+    counter_add(r, bytes, done - mh->t_start, wait);
+  }
+  return bytes;
+}
+
+void
+QMP_msgstats_start(QMP_msghandle_t mh)
+{
+  double t = QMP_time();
+  QMP_msghandle_t c;
+  mh->t_start = t;
+  mh->t_done = 0;
+  mh->stats.starts++;
+  if(mh->type==MH_multiple) {
+    for(c=mh->next; c; c=c->next) {
+      c->t_start = t;
+      c->t_done = 0;
+      c->stats.starts++;
+    }
+  }
+}
+
+void
+QMP_msgstats_complete(QMP_msghandle_t mh, double wait_start)
+{
+  double t = QMP_time();
+  double wait = (wait_start>0) ? t - wait_start : 0;
+  size_t bytes = 0;
+  QMP_msghandle_t c;
+  if(QMP_msg_report_enabled) QMP_spin_lock(&rank_lock);
+  if(mh->type==MH_multiple) {
+    for(c=mh->next; c; c=c->next) bytes += message_done(c, t, wait_start);
+    counter_add(&mh->stats, bytes, t - mh->t_start, wait);
+  } else {
+    message_done(mh, t, wait_start);
+  }
+  if(QMP_msg_report_enabled) QMP_spin_unlock(&rank_lock);
+}
+
+
+/**
+ * Get the message statistics of a message handle.
+ */
+QMP_status_t
+QMP_get_msghandle_stats(QMP_msghandle_t mh, QMP_msghandle_stats_t *stats)
+{
+  QMP_msghandle_t c;
+  ENTER;
+  QMP_assert(mh!=NULL);
+  memset(stats, 0, sizeof(QMP_msghandle_stats_t));
+  stats->total = mh->stats;
+  if(mh->type==MH_multiple) {
+    for(c=mh->next; c; c=c->next)
+      counter_merge(dir_counter(stats, c), &c->stats);
+  } else {
+    *dir_counter(stats, mh) = mh->stats;
+  }
+  LEAVE;
+  return QMP_SUCCESS;
+}
+
+
+static void
+report_counter(const char *name, QMP_msg_counter_t *c)
+{
+  double n = (double)c->completions;
+  QMP_comm_sum_double(QMP_allocated_comm, &n);
+  if(n==0) return;
+
+  double bytes[3], lat[3], wait[3], lmax = c->latency_max;
+  double mean = c->completions ? c->latency/c->completions : 0;
+  QMP_machine_range((double)c->bytes, bytes);
+  QMP_machine_range(1e6*mean, lat);
+  QMP_machine_range(c->wait, wait);
+  QMP_comm_max_double(QMP_allocated_comm, &lmax);
+  /* rank blocked longest */
+  double slow = (c->wait==wait[2]) ? QMP_allocated_comm->nodeid : -1;
+  QMP_comm_max_double(QMP_allocated_comm, &slow);
+  if(QMP_allocated_comm->nodeid==0)
+    QMP_info("msg %-8s %10.0f %12.0f %12.0f %12.0f %8.1f %8.1f %8.1f %10.0f"
+	     " %8.4f %8.4f %8.4f %5.0f", name, n, bytes[0], bytes[1], bytes[2],
+	     lat[0], lat[1], lat[2], 1e6*lmax, wait[0], wait[1], wait[2], slow);
+}
+
+/*
+ * Machine wide messages, min/avg/max over ranks of the bytes, mean
+ * latency (us) and wait time (s) per axis and direction, the longest
+ * latency, the rank that waited longest and the latency histogram.
+ * Collective over the allocated communicator.
+ */
+void
+QMP_msg_report(void)
+{
+  QMP_msghandle_stats_t s;
+  QMP_msg_counter_t total;
+  char name[16];
+  int mu, i;
+
+  QMP_spin_lock(&rank_lock);
+  s = rank_stats;
+  QMP_spin_unlock(&rank_lock);
+  memset(&total, 0, sizeof(total));
+
+  if(QMP_allocated_comm->nodeid==0)
+    QMP_info("msg %-8s %10s %12s %12s %12s %8s %8s %8s %10s %8s %8s %8s %5s",
+	     "", "messages", "bytes min", "avg", "max", "us min", "avg", "max",
+	     "us peak", "wait min", "avg", "max", "rank");
+  for(mu=0; mu<QMP_MSG_MAXDIM; mu++) {
+    for(i=0; i<2; i++) {
+      snprintf(name, sizeof(name), "%d%c", mu, i ? '+' : '-');
+      report_counter(name, &s.dir[mu][i]);
+      counter_merge(&total, &s.dir[mu][i]);
+    }
+  }
+  report_counter("other", &s.other);
+  counter_merge(&total, &s.other);
+  report_counter("total", &total);
+
+  double hist[QMP_MSG_NBINS];
+  for(i=0; i<QMP_MSG_NBINS; i++) hist[i] = total.histogram[i];
+  QMP_comm_sum_double_array(QMP_allocated_comm, hist, QMP_MSG_NBINS);
+  if(QMP_allocated_comm->nodeid==0) {
+    char line[QMP_MSG_NBINS*24];
+    int len = 0;
+    for(i=0; i<QMP_MSG_NBINS; i++) {
+      if(hist[i]==0) continue;
+      if(i<QMP_MSG_NBINS-1)
+	len += snprintf(line+len, sizeof(line)-len, " <%luus:%.0f",
+			1UL<<i, hist[i]);
+      else
+	len += snprintf(line+len, sizeof(line)-len, " >=%luus:%.0f",
+			1UL<<(i-1), hist[i]);
+    }
+    if(len>0) QMP_info("msg latency%s", line);
+  }
+}
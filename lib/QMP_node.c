@@ -0,0 +1,240 @@
+#define _GNU_SOURCE /* needed to get sched_getcpu */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_TOPOLOGY
+#include "QMP_P_COMMON.h"
+
+/**
+ * Socket the calling rank runs on, -1 if unknown.
+ */
+int
+QMP_get_socket_id(void)
+{
+  int s = -1;
+  int cpu = sched_getcpu();
+  if(cpu>=0) {
+    char fn[128];
+    snprintf(fn, sizeof(fn),
+	     "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    FILE *f = fopen(fn, "r");
+    if(f) {
+      if(fscanf(f, "%d", &s)!=1) s = -1;
+      fclose(f);
+    }
+  }
+  return s;
+}
+
+/**
+ * Get the physical node hierarchy of this rank.
+ */
+QMP_status_t
+QMP_get_node_map(QMP_node_map_t *map)
+{
+  ENTER;
+  *map = QMP_machine->nodemap;
+  LEAVE;
+  return QMP_SUCCESS;
+}
+
+/**
+ * Set how logical topologies are placed onto physical nodes.
+ */
+QMP_status_t
+QMP_set_topology_mapping(QMP_topology_mapping_t mapping)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+  if(mapping==QMP_MAP_LEX || mapping==QMP_MAP_NODE_BLOCK ||
+     mapping==QMP_MAP_NODE_CURVE) {
+    QMP_machine->topo_mapping = mapping;
+  } else {
+    status = QMP_INVALID_ARG;
+  }
+  LEAVE;
+  return status;
+}
+
+
+static void
+lex_coord(int *x, int n, const int *l, int nd)
+{
+  int i;
+  for(i=0; i<nd; i++) {
+    x[i] = n % l[i];
+    n /= l[i];
+  }
+}
+
+static int
+lex_index(const int *x, const int *l, int nd)
+{
+  int i, n = 0;
+  for(i=nd-1; i>=0; i--) n = n*l[i] + x[i];
+  return n;
+}
+
+/* find the most compact block of ppn ranks which tiles the grid */
+static void
+search_block(const int *dims, int nd, int i, int r, int *trial,
+	     int *best, int *bestcost)
+{
+  if(i==nd) {
+    if(r!=1) return;
+    int k, cost = 0;
+    for(k=0; k<nd; k++) {
+      int ppn = 1, j;
+      for(j=0; j<nd; j++) if(j!=k) ppn *= trial[j];
+      if(trial[k]<dims[k]) cost += ppn;
+    }
+    if(*bestcost<0 || cost<*bestcost) {
+      for(k=0; k<nd; k++) best[k] = trial[k];
+      *bestcost = cost;
+    }
+    return;
+  }
+  int f;
+  for(f=1; f<=r; f++) {
+    if(r%f!=0 || dims[i]%f!=0) continue;
+    trial[i] = f;
+    search_block(dims, nd, i+1, r/f, trial, best, bestcost);
+  }
+}
+
+/* n-th point of a Morton (Z-order) curve restricted to the grid l */
+static void
+curve_coords(int **order, const int *l, int nd, int npts)
+{
+  int i, bits[nd], maxbits = 0;
+  long m, ncodes = 1;
+  for(i=0; i<nd; i++) {
+    bits[i] = 0;
+    while((1<<bits[i])<l[i]) bits[i]++;
+    if(bits[i]>maxbits) maxbits = bits[i];
+    ncodes <<= bits[i];
+  }
+  int k = 0;
+  for(m=0; m<ncodes && k<npts; m++) {
+    int x[nd], lvl, pos = 0;
+    for(i=0; i<nd; i++) x[i] = 0;
+    for(lvl=0; lvl<maxbits; lvl++) {
+      for(i=0; i<nd; i++) {
+	if(lvl<bits[i]) {
+	  x[i] |= (int)((m>>pos)&1) << lvl;
+	  pos++;
+	}
+      }
+    }
+    for(i=0; i<nd; i++) if(x[i]>=l[i]) break;
+    if(i<nd) continue;
+    for(i=0; i<nd; i++) order[k][i] = x[i];
+    k++;
+  }
+}
+
+typedef struct {
+  int host;
+  int rank;
+} host_rank_t;
+
+static int
+cmp_host_rank(const void *a, const void *b)
+{
+  const host_rank_t *x = a, *y = b;
+  if(x->host!=y->host) return (x->host<y->host) ? -1 : 1;
+  return (x->rank<y->rank) ? -1 : (x->rank>y->rank);
+}
+
+/* fill the rank <-> coordinate tables, returns 0 if not possible */
+static int
+build_tables(QMP_comm_t comm, QMP_topology_mapping_t mapping)
+{
+  QMP_logical_topology_t *topo = comm->topo;
+  int nd = topo->dimension;
+  int *dims = topo->logical_size;
+  int np = comm->num_nodes;
+  int i, r;
+
+  host_rank_t *hr;
+  QMP_alloc(hr, host_rank_t, np);
+  int *hostid;
+  QMP_alloc(hostid, int, np);
+#ifdef QMP_COMM_GET_HOST_IDS
+  QMP_COMM_GET_HOST_IDS(comm, hostid);
+#else
+  for(r=0; r<np; r++) hostid[r] = 0;
+#endif
+  for(r=0; r<np; r++) {
+    hr[r].host = hostid[r];
+    hr[r].rank = r;
+  }
+  QMP_free(hostid);
+  qsort(hr, np, sizeof(host_rank_t), cmp_host_rank);
+
+  /* every node needs the same number of ranks */
+  int ppn = 1;
+  while(ppn<np && hr[ppn].host==hr[0].host) ppn++;
+  for(r=0; r<np; r++) {
+    if(hr[r].host!=hr[(r/ppn)*ppn].host) break;
+    if(r%ppn==0 && r>0 && hr[r].host==hr[r-1].host) break;
+  }
+
+  int b[nd], trial[nd], cost = -1;
+  if(r==np) search_block(dims, nd, 0, ppn, trial, b, &cost);
+  if(cost<0) {
+    QMP_free(hr);
+    return 0;
+  }
+
+  int nn[nd], nhosts = np/ppn;
+  for(i=0; i<nd; i++) nn[i] = dims[i]/b[i];
+
+  int **order;
+  QMP_alloc(order, int *, nhosts);
+  QMP_alloc(order[0], int, nhosts*nd);
+  for(r=1; r<nhosts; r++) order[r] = order[0] + r*nd;
+  if(mapping==QMP_MAP_NODE_CURVE) {
+    curve_coords(order, nn, nd, nhosts);
+  } else {
+    for(r=0; r<nhosts; r++) lex_coord(order[r], r, nn, nd);
+  }
+
+  QMP_alloc(topo->rank_coords, int, np*nd);
+  QMP_alloc(topo->coord_rank, int, np);
+  for(r=0; r<np; r++) {
+    int rank = hr[r].rank;
+    int *x = topo->rank_coords + rank*nd;
+    lex_coord(x, r%ppn, b, nd);
+    for(i=0; i<nd; i++) x[i] += order[r/ppn][i]*b[i];
+    topo->coord_rank[lex_index(x, dims, nd)] = rank;
+  }
+
+  QMP_free(order[0]);
+  QMP_free(order);
+  QMP_free(hr);
+  return 1;
+}
+
+/*
+ * Place the ranks of each physical node onto a compact block of the
+ * logical grid.  The blocks are ordered lexicographically or along a
+ * space filling curve.  Fills the rank <-> coordinate tables of the
+ * topology, or leaves them empty for the plain lexicographic map.
+ */
+QMP_status_t
+QMP_node_map_topology(QMP_comm_t comm)
+{
+  ENTER;
+
+  QMP_topology_mapping_t mapping = QMP_machine->topo_mapping;
+  if(mapping!=QMP_MAP_LEX && comm->topo->map==NULL) {
+    if(!build_tables(comm, mapping) && comm->nodeid==0)
+      QMP_info("uneven ranks per node, using lexicographic topology map");
+  }
+
+  LEAVE;
+  return QMP_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_MEMORY
+#include "QMP_P_COMMON.h"
+
+/*
+ * Buffer pool with four size classes per power of two.
+ *
+ * A block of class c holds class_bytes(c) bytes after alignment, at
+ * most 25% more than asked for.  Larger requests than the largest
+ * class are not pooled.  Freed blocks go
+ * on the free list of their class and are reused for requests with the
+ * same flags whose alignment they satisfy.  When more than the limit is
+ * cached the largest classes are released first, since those are the
+ * ones least likely to be asked for again in the same size.
+ */
+
+#define POOL_MIN_SHIFT 12
+#define POOL_MAX_SHIFT 48
+#define POOL_NCLASS (4*(POOL_MAX_SHIFT-POOL_MIN_SHIFT))
+#define POOL_DEFAULT_LIMIT ((size_t)256<<20)
+
+static struct {
+  QMP_mem_t *head[POOL_NCLASS];
+  size_t cached;
+  size_t limit;
+  int lock;     /* the pool may be used from several threads */
+} pool = { {NULL}, 0, POOL_DEFAULT_LIMIT, 0 };
+
+int QMP_pool_routed = 0;
+
+/* (4+s)/4 times 2^shift for class c = 4*(shift-POOL_MIN_SHIFT)+s */
+static size_t
+class_bytes(int c)
+{
+  return (size_t)(4 + c%4) << (POOL_MIN_SHIFT + c/4 - 2);
+}
+
+/* smallest class holding nbytes, -1 if too large for the pool */
+static int
+size_class(size_t nbytes)
+{
+  if(nbytes<=((size_t)1<<POOL_MIN_SHIFT)) return 0;
+  int shift = 63 - __builtin_clzll((unsigned long long)(nbytes-1));
+  int s = (int)((nbytes - 1)>>(shift-2)) + 1 - 4;
+  int c = 4*(shift - POOL_MIN_SHIFT) + s;
+  return (c<POOL_NCLASS) ? c : -1;
+}
+
+/* unlink blocks, largest first, until at most keep bytes are cached;
+   returns the list of unlinked blocks.  Called with the lock held. */
+static QMP_mem_t *
+evict(size_t keep)
+{
+  QMP_mem_t *victims = NULL;
+  int c;
+  for(c=POOL_NCLASS-1; c>=0 && pool.cached>keep; c--) {
+    while(pool.head[c] && pool.cached>keep) {
+      QMP_mem_t *m = pool.head[c];
+      pool.head[c] = m->next;
+      pool.cached -= class_bytes(c);
+      m->next = victims;
+      victims = m;
+    }
+  }
+  return victims;
+}
+
+static size_t
+release_list(QMP_mem_t *m)
+{
+  size_t n = 0;
+  while(m) {
+    QMP_mem_t *next = m->next;
+    n += class_bytes(m->pool_class);
+    QMP_mem_free_raw(m);
+    m = next;
+  }
+  return n;
+}
+
+/* return a pool block, without ENTER/LEAVE for use from QMP_free_memory */
+void
+QMP_pool_release(QMP_mem_t *mem)
+{
+  int c = mem->pool_class;
+  QMP_spin_lock(&pool.lock);
+  mem->next = pool.head[c];
+  pool.head[c] = mem;
+  pool.cached += class_bytes(c);
+  QMP_mem_t *victims = (pool.cached>pool.limit) ? evict(pool.limit) : NULL;
+  QMP_spin_unlock(&pool.lock);
+  release_list(victims);
+}
+
+
+/**
+ * Allocate memory from the buffer pool.
+ */
+QMP_mem_t *
+QMP_pool_allocate (size_t nbytes, size_t alignment, int flags)
+{
+  QMP_mem_t *mem, **p;
+  ENTER;
+
+  int c = size_class(nbytes);
+  if(c<0 || (flags&(QMP_MEM_NODE_SHARED|QMP_MEM_FILEBACKED))) {
+    mem = QMP_mem_allocate_raw(nbytes, alignment, flags);
+    goto leave;
+  }
+
+  QMP_spin_lock(&pool.lock);
+  for(p=&pool.head[c]; *p; p=&(*p)->next) {
+    QMP_mem_t *m = *p;
+    if(m->flags==flags &&
+       (alignment==0 || ((size_t)m->aligned_ptr)%alignment==0)) break;
+  }
+  mem = *p;
+  if(mem) {
+    *p = mem->next;
+    mem->next = NULL;
+    pool.cached -= class_bytes(c);
+  }
+  QMP_spin_unlock(&pool.lock);
+
+  if(!mem) {
+    mem = QMP_mem_allocate_raw(class_bytes(c), alignment, flags);
+    if(mem) mem->pool_class = c;
+  }
+
+ leave:
+  LEAVE;
+  return mem;
+}
+
+/**
+ * Return memory to the buffer pool.
+ */
+void
+QMP_pool_free (QMP_mem_t *mem)
+{
+  ENTER;
+  if(mem) {
+    if(mem->pool_class>=0) QMP_pool_release(mem);
+    else QMP_mem_free_raw(mem);
+  }
+  LEAVE;
+}
+
+/**
+ * Release cached blocks until at most keep bytes remain.
+ */
+size_t
+QMP_pool_trim (size_t keep)
+{
+  size_t n;
+  ENTER;
+  QMP_spin_lock(&pool.lock);
+  QMP_mem_t *victims = evict(keep);
+  QMP_spin_unlock(&pool.lock);
+  n = release_list(victims);
+  LEAVE;
+  return n;
+}
+
+/**
+ * Set the most bytes the pool keeps cached.
+ */
+void
+QMP_pool_set_limit (size_t limit)
+{
+  ENTER;
+  pool.limit = limit;
+  QMP_pool_trim(limit);
+  LEAVE;
+}
+
+/**
+ * Route the QMP_allocate_* calls through the pool.
+ */
+void
+QMP_pool_enable (QMP_bool_t enable)
+{
+  ENTER;
+  QMP_pool_routed = (enable==QMP_TRUE);
+  LEAVE;
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_OTHER
+#include "QMP_P_COMMON.h"
+
+/*
+ * Link probe.
+ *
+ * Every direction of a logical topology is timed with a shift: each
+ * node sends to its neighbor in the direction and receives from the
+ * opposite one, first small messages for the latency and then large
+ * ones for the bandwidth.  The results of the node's outgoing links are
+ * kept in the topology.  Links much slower than the average of their
+ * direction are reported by the sending node, and the average inverse
+ * bandwidth per axis becomes the default layout weights.  Axes of
+ * length 1 have no links and get the mean weight of the others.
+ */
+
+#define PROBE_SMALL 8
+#define PROBE_LARGE (1<<20)
+#define PROBE_NSMALL 100
+#define PROBE_NLARGE 10
+/* a link is slow below this fraction of the average bandwidth, or
+   above the inverse of it times the average latency */
+#define SLOW_FRACTION 0.5
+
+int QMP_probe_pending = 0;
+
+/* seconds per shift of nbytes along axis mu towards isign */
+static double
+shift_time(QMP_comm_t comm, char *sbuf, char *rbuf, int nbytes, int niter,
+	   int mu, int isign)
+{
+  QMP_msgmem_t mm[2];
+  QMP_msghandle_t mh[2], mhm;
+  int i;
+  mm[0] = QMP_declare_msgmem(sbuf, nbytes);
+  mm[1] = QMP_declare_msgmem(rbuf, nbytes);
+  mh[0] = QMP_comm_declare_send_relative(comm, mm[0], mu, isign, 0);
+  mh[1] = QMP_comm_declare_receive_relative(comm, mm[1], mu, -isign, 0);
+  mhm = QMP_declare_multiple(mh, 2);
+  /* warm up the path */
+  QMP_start(mhm);
+  QMP_wait(mhm);
+  QMP_comm_barrier(comm);
+  double t = QMP_time();
+  for(i=0; i<niter; i++) {
+    QMP_start(mhm);
+    QMP_wait(mhm);
+  }
+  t = (QMP_time() - t)/niter;
+  QMP_free_msghandle(mhm);
+  QMP_free_msgmem(mm[0]);
+  QMP_free_msgmem(mm[1]);
+  return t;
+}
+
+/* average and max of v over comm */
+static void
+comm_avg_max(QMP_comm_t comm, double v, double *avg, double *max)
+{
+  *avg = v;
+  *max = v;
+  QMP_comm_sum_double(comm, avg);
+  QMP_comm_max_double(comm, max);
+  *avg /= comm->num_nodes;
+}
+
+/**
+ * Measure the latency and bandwidth of the links to the logical
+ * neighbors.
+ */
+QMP_status_t
+QMP_comm_probe_links (QMP_comm_t comm)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  QMP_logical_topology_t *topo = comm->topo;
+  char *sbuf = NULL, *rbuf = NULL;
+  double *weights = NULL, maxbw = 0, mean = 0;
+  int mu, s, nmeasured = 0;
+  ENTER;
+
+  if(topo==NULL) {
+    QMP_error("QMP_comm_probe_links: no logical topology declared");
+    status = QMP_ERROR;
+    goto leave;
+  }
+  int nd = topo->dimension;
+  if(topo->link_latency==NULL) {
+    QMP_alloc(topo->link_latency, double, 2*nd);
+    QMP_alloc(topo->link_bandwidth, double, 2*nd);
+  }
+  QMP_alloc(sbuf, char, PROBE_LARGE);
+  QMP_alloc(rbuf, char, PROBE_LARGE);
+  memset(sbuf, 0, PROBE_LARGE);
+
+  QMP_alloc(weights, double, nd);
+  for(mu=0; mu<nd; mu++) {
+    weights[mu] = 0;
+    for(s=0; s<2; s++) {
+      int k = 2*mu + s, isign = s ? 1 : -1;
+      if(topo->logical_size[mu]==1) {
+	/* the node is its own neighbor */
+	topo->link_latency[k] = 0;
+	topo->link_bandwidth[k] = 0;
+	continue;
+      }
+      double lat = shift_time(comm, sbuf, rbuf, PROBE_SMALL, PROBE_NSMALL,
+			      mu, isign);
+      double bw = PROBE_LARGE/shift_time(comm, sbuf, rbuf, PROBE_LARGE,
+					 PROBE_NLARGE, mu, isign);
+      topo->link_latency[k] = lat;
+      topo->link_bandwidth[k] = bw;
+
+      double lavg, lmax, bavg, bmin;
+      comm_avg_max(comm, lat, &lavg, &lmax);
+      comm_avg_max(comm, -bw, &bavg, &bmin);
+      bavg = -bavg;
+      bmin = -bmin;
+      if(comm->nodeid==0)
+	QMP_info("probe axis %d%c: latency avg %.2f max %.2f us, "
+		 "bandwidth avg %.1f min %.1f MB/s", mu, s ? '+' : '-',
+		 1e6*lavg, 1e6*lmax, 1e-6*bavg, 1e-6*bmin);
+      if(bw<SLOW_FRACTION*bavg || SLOW_FRACTION*lat>lavg)
+	QMP_info("probe: slow link from rank %d on %s along axis %d%c to "
+		 "rank %d: latency %.2f us, bandwidth %.1f MB/s",
+		 comm->nodeid, QMP_machine->host ? QMP_machine->host : "?",
+		 mu, s ? '+' : '-', topo->neigh[s][mu], 1e6*lat, 1e-6*bw);
+      weights[mu] += 0.5*bavg;
+    }
+    if(weights[mu]>maxbw) maxbw = weights[mu];
+  }
+  /* cost of an axis relative to the fastest one */
+  for(mu=0; mu<nd; mu++) {
+    if(weights[mu]>0) {
+      weights[mu] = maxbw/weights[mu];
+      mean += weights[mu];
+      nmeasured++;
+    }
+  }
+  if(nmeasured>0) {
+    mean /= nmeasured;
+    for(mu=0; mu<nd; mu++) if(topo->logical_size[mu]==1) weights[mu] = mean;
+    QMP_set_layout_probe_weights(topo, weights);
+  }
+
+ leave:
+  QMP_free(weights);
+  QMP_free(sbuf);
+  QMP_free(rbuf);
+  LEAVE;
+  return status;
+}
+
+QMP_status_t
+QMP_probe_links (void)
+{
+  QMP_status_t status;
+  ENTER;
+  status = QMP_comm_probe_links(QMP_comm_get_default());
+  LEAVE;
+  return status;
+}
+
+/**
+ * Get the probed latency and bandwidth of the link to a neighbor.
+ */
+QMP_status_t
+QMP_comm_get_link_probe (QMP_comm_t comm, int axis, int isign,
+			 double *latency, double *bandwidth)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  QMP_logical_topology_t *topo = comm->topo;
+  ENTER;
+  if(topo==NULL || topo->link_latency==NULL ||
+     axis<0 || axis>=topo->dimension) {
+    status = QMP_ERROR;
+  } else {
+    int k = 2*axis + (isign>0);
+    if(latency) *latency = topo->link_latency[k];
+    if(bandwidth) *bandwidth = topo->link_bandwidth[k];
+  }
+  LEAVE;
+  return status;
+}
+
+QMP_status_t
+QMP_get_link_probe (int axis, int isign, double *latency, double *bandwidth)
+{
+  QMP_status_t status;
+  ENTER;
+  status = QMP_comm_get_link_probe(QMP_comm_get_default(), axis, isign,
+				   latency, bandwidth);
+  LEAVE;
+  return status;
+}
@@ -0,0 +1,27 @@
+/*
+ * Weak QMP_ entry points of a profiling build (QMP_BUILD_PROFILING).
+ * The library itself is compiled with the names of QMP_profiling.h
+ * renamed to PQMP_, so a profiling library can replace any QMP_ entry
+ * point and call the PQMP_ version.
+ */
+#define QMP_PROFILING_WRAPPERS
+#include "QMP_P_COMMON.h"
+
+#ifdef QMP_BUILD_PROFILING
+
+#define DECLARE(ret, name, params, args) extern ret PQMP_##name params;
+#define DECLARE_VOID(name, params, args) extern void PQMP_##name params;
+QMP_PROFILED(DECLARE, DECLARE_VOID)
+
+#define WRAP(ret, name, params, args) \
+  __attribute__ ((weak)) ret QMP_##name params { return PQMP_##name args; }
+#define WRAP_VOID(name, params, args) \
+  __attribute__ ((weak)) void QMP_##name params { PQMP_##name args; }
+QMP_PROFILED(WRAP, WRAP_VOID)
+
+#else
+
+/* keep the translation unit non-empty */
+typedef int QMP_profiling_unused;
+
+#endif
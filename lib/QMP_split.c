@@ -4,6 +4,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_TOPOLOGY
 #include "QMP_P_COMMON.h"
 
 /**
@@ -42,6 +43,100 @@ QMP_comm_get_key (QMP_comm_t comm)
 }
 
 
+/* communicator of a cache entry for QMP_comm_split, the entry's own if
+   no one else uses it, else a copy */
+static QMP_comm_t
+comm_from_cache(struct QMP_split_cache *c, int share)
+{
+  QMP_comm_t comm = c->comm, newcomm;
+  QMP_alloc(newcomm, struct QMP_comm_struct, 1);
+  *newcomm = (struct QMP_comm_struct) {QMP_COMM_INIT};
+  newcomm->ncolors = comm->ncolors;
+  newcomm->color = comm->color;
+  newcomm->key = comm->key;
+  newcomm->topo = NULL;
+  newcomm->num_nodes = comm->num_nodes;
+  newcomm->nodeid = comm->nodeid;
+  if(share) {
+    c->refs++;
+    newcomm->split_entry = c;
+#ifdef QMP_COMM_SHARE
+    QMP_COMM_SHARE(comm, newcomm);
+#endif
+  } else {
+#ifdef QMP_COMM_DUP
+    QMP_COMM_DUP(comm, newcomm);
+#endif
+  }
+  return newcomm;
+}
+
+static void
+free_cached_split(struct QMP_split_cache *c)
+{
+  QMP_comm_free(c->comm);
+  QMP_free(c);
+}
+
+/* drop an entry from the cache, it stays until its last user is freed */
+static void
+drop_cached_split(struct QMP_split_cache *c)
+{
+  if(c->refs>0) c->dropped = 1;
+  else free_cached_split(c);
+}
+
+/*
+ * Position of this node's color and key in the split cache, if every
+ * node of comm finds the same entry in the same state, else -1.  The
+ * check needs only a two element sum: all n values are equal iff
+ * sum^2 == n*sum(squares).  Nothing is cached before the first split
+ * of comm, so that needs no check.
+ */
+static int
+find_cached_split(QMP_comm_t comm, int color, int key,
+		  struct QMP_split_cache **entry)
+{
+  struct QMP_split_cache *c;
+  int i = 0;
+  if(comm->nsplits==0) return -1;
+  for(c=comm->split_cache; c; c=c->next, i++)
+    if(c->color==color && c->key==key) break;
+  if(!c) i = -1;
+
+  double v = (i<0) ? -1 : 2*i + (c->refs>0);
+  double s[2] = { v, v*v };
+  QMP_comm_sum_double_array(comm, s, 2);
+  if(i<0 || s[0]*s[0]!=comm->num_nodes*s[1]) return -1;
+  *entry = c;
+  return i;
+}
+
+static struct QMP_split_cache *
+add_cached_split(QMP_comm_t comm, QMP_comm_t split)
+{
+  struct QMP_split_cache *c, **last = &comm->split_cache;
+  int n = 0;
+  while(*last) {
+    n++;
+    if(n==QMP_SPLIT_CACHE_MAX) {
+      drop_cached_split(*last);
+      *last = NULL;
+      break;
+    }
+    last = &(*last)->next;
+  }
+  QMP_alloc(c, struct QMP_split_cache, 1);
+  c->color = split->color;
+  c->key = split->key;
+  c->comm = split;
+  c->refs = 0;
+  c->dropped = 0;
+  c->next = comm->split_cache;
+  comm->split_cache = c;
+  return c;
+}
+
 /**
  * Split a communicator into one or more disjoint communicators.
  */
@@ -52,32 +147,39 @@ QMP_comm_split(QMP_comm_t comm, int color, int key,
   QMP_status_t status = QMP_SUCCESS;
   ENTER;
 
-  QMP_alloc(*newcomm, struct QMP_comm_struct, 1);
-  **newcomm = (struct QMP_comm_struct) {QMP_COMM_INIT};
-  (*newcomm)->color = color;
-  (*newcomm)->key = key;
-  (*newcomm)->topo = NULL;
-
-  double t = (double)color;
-  QMP_comm_max_double(comm, &t);
-  int cmax = 1 + (int)t;
-  QMP_assert(cmax>0);
-  double ca[cmax];
-  int i;
-  for(i=0; i<cmax; i++) ca[i] = 0;
-  if(color>=0) ca[color] = 1;
-  QMP_comm_sum_double_array(comm, ca, cmax);
-  int nc = 0;
-  for(i=0; i<cmax; i++) if(ca[i]) nc++;
-  (*newcomm)->ncolors = nc;
+  struct QMP_split_cache *c;
+  if(find_cached_split(comm, color, key, &c)>=0) {
+    *newcomm = comm_from_cache(c, c->refs==0);
+    goto leave;
+  }
+  comm->nsplits++;
+
+  QMP_comm_t split;
+  QMP_alloc(split, struct QMP_comm_struct, 1);
+  *split = (struct QMP_comm_struct) {QMP_COMM_INIT};
+  split->color = color;
+  split->key = key;
+  split->topo = NULL;
 
 #ifdef QMP_COMM_SPLIT
-  status = QMP_COMM_SPLIT(comm, *newcomm);
+  status = QMP_COMM_SPLIT(comm, split);
 #else
-  (*newcomm)->num_nodes = 1;
-  (*newcomm)->nodeid = 0;
+  split->num_nodes = 1;
+  split->nodeid = 0;
 #endif
 
+  /* count one node per new communicator */
+  double nc = (color>=0 && split->nodeid==0) ? 1 : 0;
+  QMP_comm_sum_double(comm, &nc);
+  split->ncolors = (int) nc;
+
+  /* the cache keeps the communicator, the caller uses it */
+  if(status==QMP_SUCCESS && color>=0)
+    *newcomm = comm_from_cache(add_cached_split(comm, split), 1);
+  else
+    *newcomm = split;
+
+ leave:
   LEAVE;
   return status;
 }
@@ -88,9 +190,21 @@ QMP_comm_free(QMP_comm_t comm)
   QMP_status_t status = QMP_SUCCESS;
   ENTER;
 
+  while(comm->split_cache) {
+    struct QMP_split_cache *c = comm->split_cache;
+    comm->split_cache = c->next;
+    drop_cached_split(c);
+  }
+  QMP_comm_traffic_free(comm);
+  if(comm->split_entry) {
+    /* the communicator belongs to the cache entry */
+    struct QMP_split_cache *c = comm->split_entry;
+    if(--c->refs==0 && c->dropped) free_cached_split(c);
+  } else {
 #ifdef QMP_COMM_FREE
-  status = QMP_COMM_FREE(comm);
+    status = QMP_COMM_FREE(comm);
 #endif
+  }
   QMP_free(comm);
 
   LEAVE;
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_COLLECTIVE
+#include "QMP_P_COMMON.h"
+
+/*
+ * Dynamic task farm over the job partitions.
+ *
+ * A single counter on node 0 of the allocated communicator hands out
+ * task numbers.  Node 0 of each job fetches and increments it with one
+ * atomic operation and broadcasts the task to the rest of its job, so
+ * jobs that finish early simply take more tasks.  Each job keeps a log
+ * of the tasks it completed, which QMP_taskfarm_collect combines into a
+ * separate log, so it can be called again as more tasks complete.
+ */
+
+/**
+ * Create a task farm handing out tasks 0 .. ntasks-1.
+ * Collective over the allocated communicator.
+ */
+QMP_taskfarm_t
+QMP_taskfarm_create (int ntasks)
+{
+  QMP_taskfarm_t tf;
+  ENTER;
+
+  QMP_assert(ntasks>=0);
+  QMP_alloc(tf, struct QMP_taskfarm_struct, 1);
+  if(tf) {
+    int i;
+    tf->ntasks = ntasks;
+    tf->counter = 0;
+    tf->current = -1;
+    tf->start = 0;
+    QMP_alloc(tf->job, double, 6*(ntasks>0 ? ntasks : 1));
+    tf->seconds = tf->job + ntasks;
+    tf->result = tf->seconds + ntasks;
+    tf->all = tf->result + ntasks;
+    for(i=0; i<6*ntasks; i++) tf->job[i] = 0;
+#ifdef QMP_TASKFARM_CREATE
+    QMP_TASKFARM_CREATE(tf);
+#endif
+  } else {
+    QMP_SET_STATUS_CODE(QMP_NOMEM_ERR);
+  }
+
+  LEAVE;
+  return tf;
+}
+
+/**
+ * Get the next task for this job, -1 when all tasks are taken.
+ * Collective over the job communicator.
+ */
+int
+QMP_taskfarm_next (QMP_taskfarm_t tf)
+{
+  int task = -1;
+  ENTER;
+
+  QMP_comm_t job = QMP_comm_get_job();
+  if(QMP_comm_get_node_number(job)==0) {
+#ifdef QMP_TASKFARM_FETCH
+    task = QMP_TASKFARM_FETCH(tf);
+#else
+    task = tf->counter++;
+#endif
+    if(task>=tf->ntasks) task = -1;
+  }
+  QMP_comm_broadcast(job, &task, sizeof(int));
+  tf->current = task;
+  tf->start = QMP_time();
+
+  LEAVE;
+  return task;
+}
+
+/**
+ * Log the completion of a task.  Called by all nodes of the job, the
+ * result given on node 0 of the job is kept.
+ */
+QMP_status_t
+QMP_taskfarm_complete (QMP_taskfarm_t tf, int task, double result)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER_CAT(QMP_TIMER_OTHER);
+
+  if(task<0 || task>=tf->ntasks) {
+    QMP_error("QMP_taskfarm_complete: invalid task %d", task);
+    status = QMP_INVALID_ARG;
+  } else if(QMP_comm_get_node_number(QMP_comm_get_job())==0) {
+    tf->job[task] = QMP_get_job_number() + 1;
+    tf->seconds[task] = (task==tf->current) ? QMP_time() - tf->start : 0;
+    tf->result[task] = result;
+  }
+
+  LEAVE;
+  return status;
+}
+
+/**
+ * Combine the completion logs of all jobs, and write them to a file
+ * from node 0 of the allocated communicator if logfile is not NULL.
+ * Collective over the allocated communicator.
+ */
+QMP_status_t
+QMP_taskfarm_collect (QMP_taskfarm_t tf, const char *logfile)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  double *job = tf->all, *seconds = job + tf->ntasks;
+  double *result = seconds + tf->ntasks;
+  ENTER;
+
+  /* only node 0 of the job that ran a task has nonzero entries, the
+     logs of the jobs are kept for the next collect */
+  memcpy(tf->all, tf->job, 3*tf->ntasks*sizeof(double));
+  if(tf->ntasks>0)
+    status = QMP_comm_sum_double_array(QMP_comm_get_allocated(), tf->all,
+				       3*tf->ntasks);
+
+  if(status==QMP_SUCCESS && logfile &&
+     QMP_comm_get_node_number(QMP_comm_get_allocated())==0) {
+    FILE *f = fopen(logfile, "w");
+    if(f) {
+      int i;
+      fprintf(f, "# task job seconds result\n");
+      for(i=0; i<tf->ntasks; i++) {
+	if(job[i]>0)
+	  fprintf(f, "%d %d %g %.17g\n", i, (int)job[i]-1, seconds[i],
+		  result[i]);
+	else
+	  fprintf(f, "%d - - -\n", i);
+      }
+      fclose(f);
+    } else {
+      QMP_error("QMP_taskfarm_collect: can't open %s", logfile);
+      status = QMP_ERROR;
+    }
+  }
+
+  LEAVE;
+  return status;
+}
+
+/**
+ * Get the log entry of a task after QMP_taskfarm_collect.
+ * Returns QMP_ERROR if the task was not completed.
+ */
+QMP_status_t
+QMP_taskfarm_get_record (QMP_taskfarm_t tf, int task, int *job,
+			 double *seconds, double *result)
+{
+  QMP_status_t status = QMP_SUCCESS;
+  const double *all = tf->all;
+  int n = tf->ntasks;
+  ENTER_CAT(QMP_TIMER_OTHER);
+
+  if(task<0 || task>=n || all[task]==0) {
+    status = QMP_ERROR;
+  } else {
+    if(job) *job = (int)all[task] - 1;
+    if(seconds) *seconds = all[n+task];
+    if(result) *result = all[2*n+task];
+  }
+
+  LEAVE;
+  return status;
+}
+
+/**
+ * Free a task farm.  Collective over the allocated communicator.
+ */
+void
+QMP_taskfarm_free (QMP_taskfarm_t tf)
+{
+  ENTER;
+  if(tf) {
+#ifdef QMP_TASKFARM_FREE
+    QMP_TASKFARM_FREE(tf);
+#endif
+    QMP_free(tf->job);
+    QMP_free(tf);
+  }
+  LEAVE;
+}
@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L /* needed to get sched_yield */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#define QMP_TIMER_CAT QMP_TIMER_TOPOLOGY
+#include "QMP_P_COMMON.h"
+
+/*
+ * Thread team reductions.
+ *
+ * The team is created once outside of the parallel region.  Inside the
+ * region every thread calls the team reduction with its partial result.
+ * The partial results are combined with a binary tree over the threads,
+ * thread 0 does the single global reduction over the communicator and
+ * all threads pick up the result before returning.  Thread 0 must be
+ * a thread that is allowed to call the underlying message passing
+ * (i.e. the master thread for QMP_THREAD_FUNNELED).
+ */
+
+enum team_op { TEAM_SUM, TEAM_MAX, TEAM_MIN };
+
+#define TEAM_SPINS 1000
+
+/* sense reversing barrier */
+static void
+team_barrier(QMP_team_t team, int tid)
+{
+  int s = !team->slot[tid].sense;
+  team->slot[tid].sense = s;
+  if(__atomic_add_fetch(&team->count, 1, __ATOMIC_ACQ_REL) == team->nthreads) {
+    __atomic_store_n(&team->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&team->sense, s, __ATOMIC_RELEASE);
+  } else {
+    int spins = 0;
+    while(__atomic_load_n(&team->sense, __ATOMIC_ACQUIRE) != s) {
+      if(++spins==TEAM_SPINS) {
+	spins = 0;
+	sched_yield();
+      }
+    }
+  }
+}
+
+static void
+combine_double(double *restrict a, const double *restrict b, int n, enum team_op op)
+{
+  int i;
+  switch(op) {
+  case TEAM_SUM:
+    for(i=0; i<n; i++) a[i] += b[i];
+    break;
+  case TEAM_MAX:
+    for(i=0; i<n; i++) a[i] = (b[i]>a[i]) ? b[i] : a[i];
+    break;
+  case TEAM_MIN:
+    for(i=0; i<n; i++) a[i] = (b[i]<a[i]) ? b[i] : a[i];
+    break;
+  }
+}
+
+static void
+combine_float(float *restrict a, const float *restrict b, int n)
+{
+  int i;
+  for(i=0; i<n; i++) a[i] += b[i];
+}
+
+static QMP_status_t
+global_reduce(QMP_team_t team, void *buf, int n, size_t size, enum team_op op)
+{
+  if(size==sizeof(float))
+    return QMP_comm_sum_float_array(team->comm, (float *)buf, n);
+  switch(op) {
+  case TEAM_MAX: return QMP_comm_max_double(team->comm, (double *)buf);
+  case TEAM_MIN: return QMP_comm_min_double(team->comm, (double *)buf);
+  default: break;
+  }
+  if(n==1) return QMP_comm_sum_double(team->comm, (double *)buf);
+  return QMP_comm_sum_double_array(team->comm, (double *)buf, n);
+}
+
+static QMP_status_t
+team_reduce(QMP_team_t team, int tid, void *buf, int n, size_t size, enum team_op op)
+{
+  int nt = team->nthreads;
+  int s;
+
+  team->slot[tid].buf = buf;
+  team_barrier(team, tid);
+
+  /* fixed pairing order, so the result does not depend on thread timing */
+  for(s=1; s<nt; s<<=1) {
+    if( ((tid&((s<<1)-1))==0) && (tid+s<nt) ) {
+      if(size==sizeof(float)) combine_float(buf, team->slot[tid+s].buf, n);
+      else combine_double(buf, team->slot[tid+s].buf, n, op);
+    }
+    team_barrier(team, tid);
+  }
+
+  if(tid==0) {
+    size_t nbytes = n*size;
+    team->status = global_reduce(team, buf, n, size, op);
+    if(nbytes>team->result_size) {
+      QMP_free(team->result);
+      QMP_alloc(team->result, char, nbytes);
+      team->result_size = nbytes;
+    }
+    memcpy(team->result, buf, nbytes);
+  }
+  team_barrier(team, tid);
+
+  /* the result buffer is only rewritten after the next tree phase,
+     which no thread can reach before everybody has copied it out */
+  if(tid!=0) memcpy(buf, team->result, n*size);
+  return team->status;
+}
+
+
+/**
+ * Create a thread team on a communicator.
+ */
+QMP_team_t
+QMP_comm_team_create(QMP_comm_t comm, int nthreads)
+{
+  QMP_team_t team;
+  ENTER;
+
+  QMP_assert(nthreads>0);
+  QMP_alloc(team, struct QMP_team_struct, 1);
+  if(team) {
+    int i;
+    team->count = 0;
+    team->sense = 0;
+    team->nthreads = nthreads;
+    team->comm = comm;
+    team->status = QMP_SUCCESS;
+    team->result_size = 16*sizeof(double);
+    QMP_alloc(team->result, char, team->result_size);
+    QMP_alloc(team->slot_allocated, char,
+	      (nthreads+1)*sizeof(struct QMP_team_slot));
+    team->slot = (struct QMP_team_slot *)
+      (((((size_t)(team->slot_allocated))+QMP_CACHE_LINE-1)/QMP_CACHE_LINE)*QMP_CACHE_LINE);
+    for(i=0; i<nthreads; i++) {
+      team->slot[i].buf = NULL;
+      team->slot[i].sense = 0;
+    }
+  } else {
+    QMP_SET_STATUS_CODE(QMP_NOMEM_ERR);
+  }
+
+  LEAVE;
+  return team;
+}
+
+QMP_team_t
+QMP_team_create(int nthreads)
+{
+  QMP_team_t team;
+  ENTER;
+  team = QMP_comm_team_create(QMP_comm_get_default(), nthreads);
+  LEAVE;
+  return team;
+}
+
+/**
+ * Free a thread team.
+ */
+void
+QMP_team_free(QMP_team_t team)
+{
+  ENTER;
+  if(team) {
+    QMP_free(team->result);
+    QMP_free(team->slot_allocated);
+    QMP_free(team);
+  }
+  LEAVE;
+}
+
+/* The team reductions are called concurrently by all threads of the
+   team, so they don't use ENTER/LEAVE. */
+QMP_status_t
+QMP_team_sum_double(QMP_team_t team, int tid, double *value)
+{
+  return team_reduce(team, tid, value, 1, sizeof(double), TEAM_SUM);
+}
+
+QMP_status_t
+QMP_team_sum_float_array(QMP_team_t team, int tid, float value[], int count)
+{
+  return team_reduce(team, tid, value, count, sizeof(float), TEAM_SUM);
+}
+
+QMP_status_t
+QMP_team_sum_double_array(QMP_team_t team, int tid, double value[], int count)
+{
+  return team_reduce(team, tid, value, count, sizeof(double), TEAM_SUM);
+}
+
+QMP_status_t
+QMP_team_max_double(QMP_team_t team, int tid, double *value)
+{
+  return team_reduce(team, tid, value, 1, sizeof(double), TEAM_MAX);
+}
+
+QMP_status_t
+QMP_team_min_double(QMP_team_t team, int tid, double *value)
+{
+  return team_reduce(team, tid, value, 1, sizeof(double), TEAM_MIN);
+}
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE /* needed to get CLOCK_MONOTONIC_RAW */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMER_TSC
+#endif
+
+#include "QMP_P_COMMON.h"
+
+/*
+ * Per thread timers of the QMP calls by category, built with
+ * QMP_BUILD_TIMING.
+ *
+ * Each thread keeps a stack of the categories of the active QMP calls
+ * and the time is charged to the innermost one, so the categories add
+ * up to the time spent in QMP.  The clock is only read when the
+ * category changes, nested calls of the same category cost a counter
+ * update.  On x86 the clock is the time stamp counter, calibrated
+ * against CLOCK_MONOTONIC_RAW over the time between the first call and
+ * the report.  The category of a function is QMP_TIMER_CAT of its file
+ * or the one given to ENTER_CAT.
+ */
+
+#define TIMER_DEPTH 32
+
+struct thread_timer {
+  uint64_t ticks[QMP_TIMER_N];
+  uint64_t calls[QMP_TIMER_N];
+  uint64_t t0;           /* start of the current category */
+  int depth;
+  unsigned char stack[TIMER_DEPTH];
+  struct thread_timer *next;
+};
+
+static struct thread_timer *threads = NULL;
+static int threads_lock = 0;
+static __thread struct thread_timer *tl_timer = NULL;
+
+static uint64_t calib_ticks, calib_ns;   /* at the first call */
+
+static uint64_t
+clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t
+now(void)
+{
+#ifdef TIMER_TSC
+  return __rdtsc();
+#else
+  return clock_ns();
+#endif
+}
+
+/* seconds per tick */
+static double
+tick_seconds(void)
+{
+#ifdef TIMER_TSC
+  uint64_t dt = now() - calib_ticks;
+  uint64_t dns = clock_ns() - calib_ns;
+  if(dt>0 && dns>0) return 1e-9*(double)dns/(double)dt;
+#endif
+  return 1e-9;
+}
+
+static struct thread_timer *
+thread_timer(void)
+{
+  struct thread_timer *t;
+  QMP_alloc(t, struct thread_timer, 1);
+  memset(t, 0, sizeof(struct thread_timer));
+  QMP_spin_lock(&threads_lock);
+  if(threads==NULL) {
+    calib_ns = clock_ns();
+    calib_ticks = now();
+  }
+  t->next = threads;
+  threads = t;
+  QMP_spin_unlock(&threads_lock);
+  tl_timer = t;
+  return t;
+}
+
+void
+QMP_timer_enter(int cat)
+{
+  struct thread_timer *t = tl_timer ? tl_timer : thread_timer();
+  int d = t->depth++;
+  if(d>=TIMER_DEPTH) return;
+  t->stack[d] = cat;
+  if(d>0 && t->stack[d-1]==cat) return;
+  uint64_t tn = now();
+  if(d>0) t->ticks[t->stack[d-1]] += tn - t->t0;
+  t->calls[cat]++;
+  t->t0 = tn;
+}
+
+void
+QMP_timer_leave(void)
+{
+  struct thread_timer *t = tl_timer;
+  if(t==NULL || t->depth==0) return;
+  int d = --t->depth;
+  if(d>=TIMER_DEPTH) return;
+  if(d>0 && t->stack[d-1]==t->stack[d]) return;
+  uint64_t tn = now();
+  t->ticks[t->stack[d]] += tn - t->t0;
+  t->t0 = tn;
+}
+
+/**
+ * Get the time spent in QMP calls by category, summed over threads.
+ */
+QMP_status_t
+QMP_get_timer_report(QMP_timer_report_t *report)
+{
+  struct thread_timer *t;
+  int i;
+  memset(report, 0, sizeof(QMP_timer_report_t));
+#ifndef QMP_BUILD_TIMING
+  if(threads==NULL) return QMP_ERROR;
+#endif
+  double tick = tick_seconds();
+  QMP_spin_lock(&threads_lock);
+  for(t=threads; t; t=t->next) {
+    for(i=0; i<QMP_TIMER_N; i++) {
+      report->seconds[i] += tick*t->ticks[i];
+      report->calls[i] += t->calls[i];
+    }
+    report->nthreads++;
+  }
+  QMP_spin_unlock(&threads_lock);
+  for(i=0; i<QMP_TIMER_N; i++) report->total += report->seconds[i];
+  return QMP_SUCCESS;
+}
+
+/* seconds in QMP calls of the calling thread, only it writes them */
+double
+QMP_timer_thread_total(void)
+{
+  struct thread_timer *t = tl_timer;
+  uint64_t ticks = 0;
+  int i;
+  if(t==NULL) return 0;
+  for(i=0; i<QMP_TIMER_N; i++) ticks += t->ticks[i];
+  return tick_seconds()*ticks;
+}
+
+/* zero the counters of all threads */
+void
+QMP_timer_reset(void)
+{
+  struct thread_timer *t;
+  QMP_spin_lock(&threads_lock);
+  for(t=threads; t; t=t->next) {
+    memset(t->ticks, 0, sizeof(t->ticks));
+    memset(t->calls, 0, sizeof(t->calls));
+  }
+  QMP_spin_unlock(&threads_lock);
+}
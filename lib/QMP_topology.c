@@ -5,8 +5,47 @@
 #include <ctype.h>
 #include <stdarg.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_TOPOLOGY
 #include "QMP_P_COMMON.h"
 
+/* shifts for power of two logical sizes */
+static void
+set_pow2(QMP_logical_topology_t *topo)
+{
+  int i, nd = topo->dimension;
+  for(i=0; i<nd; i++) {
+    int l = topo->logical_size[i];
+    if(l&(l-1)) return;
+  }
+  QMP_alloc(topo->log_size, int, nd);
+  for(i=0; i<nd; i++) {
+    int b = 0;
+    while((1<<b)<topo->logical_size[i]) b++;
+    topo->log_size[i] = b;
+  }
+}
+
+/* rank <-> coordinate tables, so later lookups are O(1) */
+static void
+set_tables(QMP_comm_t comm)
+{
+  QMP_logical_topology_t *topo = comm->topo;
+  int nd = topo->dimension, np = comm->num_nodes;
+  int r, i;
+  QMP_alloc(topo->rank_coords, int, np*nd);
+  QMP_alloc(topo->coord_rank, int, np);
+  for(r=0; r<np; r++) {
+    int *x = topo->rank_coords + r*nd, n = 0;
+#ifdef QMP_COMM_GET_LOGICAL_COORDINATES_FROM
+    QMP_COMM_GET_LOGICAL_COORDINATES_FROM(x, nd, comm, r);
+#else
+    for(i=0; i<nd; i++) x[i] = 0;
+#endif
+    for(i=nd-1; i>=0; i--) n = n*topo->logical_size[i] + x[i];
+    topo->coord_rank[n] = r;
+  }
+}
+
 static QMP_status_t
 QMP_set_topo(QMP_comm_t comm, const int* dims, int ndim, const int *map, int nmap)
 {
@@ -44,14 +83,27 @@ QMP_set_topo(QMP_comm_t comm, const int* dims, int ndim, const int *map, int nma
     QMP_alloc(topo->map, int, nmap);
     for(i=0; i<nmap; ++i) topo->map[i] = map[i];
   }
+  topo->log_size = NULL;
+  topo->rank_coords = NULL;
+  topo->coord_rank = NULL;
+  topo->neigh_size = 0;
+  topo->neigh_count = 0;
+  topo->neigh_key = NULL;
+  topo->neigh_rank = NULL;
+  topo->link_latency = NULL;
+  topo->link_bandwidth = NULL;
 
 #ifdef QMP_SET_TOPO
   status = QMP_SET_TOPO(comm);
 #endif
+  set_pow2(topo);
+  if(QMP_machine->topo_mapping!=QMP_MAP_LEX && map==NULL)
+    QMP_node_map_topology(comm);
+  if(topo->rank_coords==NULL && num_nodes*ndim<=QMP_TOPO_TABLE_MAX)
+    set_tables(comm);
 
-  QMP_barrier();
-
-  topo->logical_coord = QMP_comm_get_logical_coordinates_from(comm, comm->nodeid);
+  QMP_alloc(topo->logical_coord, int, ndim);
+  QMP_comm_get_logical_coordinates_from2(comm, topo->logical_coord, comm->nodeid);
 
   QMP_alloc(topo->neigh[0], int, 2*ndim);
   topo->neigh[1] = topo->neigh[0] + ndim;
@@ -69,8 +121,6 @@ QMP_set_topo(QMP_comm_t comm, const int* dims, int ndim, const int *map, int nma
   }
   QMP_free(coord);
 
-  QMP_barrier();
-
  leave:
   LEAVE;
   return status;
@@ -101,8 +151,6 @@ QMP_comm_declare_logical_topology_map (QMP_comm_t comm, const int* dims, int ndi
   QMP_status_t status = QMP_SUCCESS;
   ENTER;
 
-  QMP_barrier();
-
   QMP_assert(nmap>=0);
   QMP_assert((nmap==0&&map==NULL)||(nmap>0&&map!=NULL));
 
@@ -118,6 +166,12 @@ QMP_comm_declare_logical_topology_map (QMP_comm_t comm, const int* dims, int ndi
     }
   }
 
+  /* -qmp-probe measures the links of the first topology */
+  if(status==QMP_SUCCESS && comm->topo && QMP_probe_pending) {
+    QMP_probe_pending = 0;
+    status = QMP_comm_probe_links(comm);
+  }
+
   LEAVE;
   return status;
 }
@@ -252,14 +306,19 @@ QMP_comm_get_logical_coordinates_from (QMP_comm_t comm, int node)
   QMP_assert(QMP_comm_logical_topology_is_declared(comm));
 
   int nd = QMP_comm_get_logical_number_of_dimensions(comm);
-  QMP_alloc(c, int, nd);
+  c = (int *) malloc(nd*sizeof(int));   /* freed by the caller */
 
+  if(comm->topo->rank_coords) {
+    int i;
+    for(i=0; i<nd; i++) c[i] = comm->topo->rank_coords[node*nd+i];
+  } else {
 #ifdef QMP_COMM_GET_LOGICAL_COORDINATES_FROM
-  QMP_COMM_GET_LOGICAL_COORDINATES_FROM(c, nd, comm, node);
+    QMP_COMM_GET_LOGICAL_COORDINATES_FROM(c, nd, comm, node);
 #else
-  int i;
-  for(i=0; i<nd; i++) c[i] = 0;
+    int i;
+    for(i=0; i<nd; i++) c[i] = 0;
 #endif
+  }
 
   LEAVE;
   return c;
@@ -274,12 +333,17 @@ QMP_comm_get_logical_coordinates_from2 (QMP_comm_t comm, int coords[], int node)
 
   int nd = QMP_comm_get_logical_number_of_dimensions(comm);
 
+  if(comm->topo->rank_coords) {
+    int i;
+    for(i=0; i<nd; i++) coords[i] = comm->topo->rank_coords[node*nd+i];
+  } else {
 #ifdef QMP_COMM_GET_LOGICAL_COORDINATES_FROM
-  QMP_COMM_GET_LOGICAL_COORDINATES_FROM(coords, nd, comm, node);
+    QMP_COMM_GET_LOGICAL_COORDINATES_FROM(coords, nd, comm, node);
 #else
-  int i;
-  for(i=0; i<nd; i++) coords[i] = 0;
+    int i;
+    for(i=0; i<nd; i++) coords[i] = 0;
 #endif
+  }
 
   LEAVE;
 }
@@ -317,9 +381,17 @@ QMP_comm_get_node_number_from (QMP_comm_t comm, const int* coordinates)
   ENTER;
   QMP_assert(QMP_comm_logical_topology_is_declared(comm));
 
+  QMP_logical_topology_t *topo = comm->topo;
+  if(topo->coord_rank) {
+    int i, n = 0;
+    for(i=topo->dimension-1; i>=0; i--)
+      n = n*topo->logical_size[i] + coordinates[i];
+    world_node = topo->coord_rank[n];
+  } else {
 #ifdef QMP_COMM_GET_NODE_NUMBER_FROM
-  world_node = QMP_COMM_GET_NODE_NUMBER_FROM(comm, coordinates);
+    world_node = QMP_COMM_GET_NODE_NUMBER_FROM(comm, coordinates);
 #endif
+  }
 
   LEAVE;
   return world_node;
@@ -336,3 +408,87 @@ QMP_get_node_number_from (const int* coordinates)
   LEAVE;
   return world_node;
 }
+
+
+#define NEIGH_HASH(key,size) ((int)(((unsigned)(key)*2654435761u) & (unsigned)((size)-1)))
+
+static void
+neigh_cache_insert(QMP_logical_topology_t *topo, int key, int rank)
+{
+  int h = NEIGH_HASH(key, topo->neigh_size);
+  while(topo->neigh_key[h]>=0) h = (h+1) & (topo->neigh_size-1);
+  topo->neigh_key[h] = key;
+  topo->neigh_rank[h] = rank;
+  topo->neigh_count++;
+}
+
+static void
+neigh_cache_grow(QMP_logical_topology_t *topo)
+{
+  int i, oldsize = topo->neigh_size;
+  int *oldkey = topo->neigh_key, *oldrank = topo->neigh_rank;
+  topo->neigh_size = oldsize ? 2*oldsize : 64;
+  topo->neigh_count = 0;
+  QMP_alloc(topo->neigh_key, int, 2*topo->neigh_size);
+  topo->neigh_rank = topo->neigh_key + topo->neigh_size;
+  for(i=0; i<topo->neigh_size; i++) topo->neigh_key[i] = -1;
+  for(i=0; i<oldsize; i++)
+    if(oldkey[i]>=0) neigh_cache_insert(topo, oldkey[i], oldrank[i]);
+  QMP_free(oldkey);
+}
+
+/**
+ * Return the node number at a displacement from this node.
+ */
+int
+QMP_comm_get_neighbor (QMP_comm_t comm, const int disp[])
+{
+  int rank;
+  ENTER;
+  QMP_assert(QMP_comm_logical_topology_is_declared(comm));
+
+  QMP_logical_topology_t *topo = comm->topo;
+  int i, nd = topo->dimension, key = 0;
+  int d[nd];
+  for(i=nd-1; i>=0; i--) {
+    int l = topo->logical_size[i];
+    d[i] = ((disp[i] % l) + l) % l;
+    key = key*l + d[i];
+  }
+
+  rank = -1;
+  if(topo->neigh_size>0) {
+    int h = NEIGH_HASH(key, topo->neigh_size);
+    while(topo->neigh_key[h]>=0) {
+      if(topo->neigh_key[h]==key) {
+	rank = topo->neigh_rank[h];
+	break;
+      }
+      h = (h+1) & (topo->neigh_size-1);
+    }
+  }
+
+  if(rank<0) {
+    for(i=0; i<nd; i++)
+      d[i] = (topo->logical_coord[i] + d[i]) % topo->logical_size[i];
+    rank = QMP_comm_get_node_number_from(comm, d);
+
+    if(2*(topo->neigh_count+1)>topo->neigh_size) neigh_cache_grow(topo);
+    neigh_cache_insert(topo, key, rank);
+  }
+
+  LEAVE;
+  return rank;
+}
+
+int
+QMP_get_neighbor (const int disp[])
+{
+  int rank;
+  ENTER;
+
+  rank = QMP_comm_get_neighbor(QMP_comm_get_default(), disp);
+
+  LEAVE;
+  return rank;
+}
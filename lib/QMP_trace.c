@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "QMP_P_COMMON.h"
+
+/*
+ * Call tracer, enabled with -qmp-trace [N].
+ *
+ * The outermost QMP call of each thread is recorded (inner calls only
+ * add their bytes, peer and handle to it) into a ring buffer shared by
+ * the threads of the rank.  Writers take slots with an atomic counter,
+ * so the buffer keeps the most recent events.  With N>1 only every
+ * N-th call of a thread is recorded.  At finalize each rank writes its
+ * events as Chrome trace JSON (also read by Perfetto) to
+ * <prefix>.<rank>.json.
+ */
+
+struct trace_event {
+  const char *name;
+  double t0, t1;
+  long bytes;
+  int peer, axis, dir, handle, tid;
+};
+
+int QMP_trace_on = 0;
+
+static struct trace_event *ring = NULL;
+static unsigned long ring_size = 0, ring_next = 0;
+static int sample_every = 1;
+static int nthreads = 0;
+static double t_start;
+static const char *file_prefix = "qmp_trace";
+
+static __thread int tl_depth = 0;
+static __thread int tl_active = 0;
+static __thread int tl_tid = -1;
+static __thread unsigned long tl_calls = 0;
+static __thread struct trace_event tl_ev;
+
+/* size is rounded up to a power of two */
+void
+QMP_trace_init(int sample, unsigned long size, const char *prefix)
+{
+  ring_size = 1;
+  while(ring_size<size) ring_size <<= 1;
+  QMP_alloc(ring, struct trace_event, ring_size);
+  if(!ring) return;
+  ring_next = 0;
+  sample_every = (sample>1) ? sample : 1;
+  if(prefix) file_prefix = prefix;
+  t_start = QMP_time();
+  QMP_trace_on = 1;
+}
+
+void
+QMP_trace_enter(const char *name)
+{
+  if(tl_depth++>0) return;
+  tl_active = (tl_calls++ % sample_every)==0;
+  if(!tl_active) return;
+  if(tl_tid<0) tl_tid = __atomic_fetch_add(&nthreads, 1, __ATOMIC_RELAXED);
+  /* profiling builds define the library functions as PQMP_ */
+  tl_ev.name = (name[0]=='P') ? name+1 : name;
+  tl_ev.bytes = -1;
+  tl_ev.peer = -1;
+  tl_ev.axis = -1;
+  tl_ev.dir = 0;
+  tl_ev.handle = -1;
+  tl_ev.tid = tl_tid;
+  tl_ev.t0 = QMP_time();
+}
+
+void
+QMP_trace_leave(void)
+{
+  if(tl_depth==0 || --tl_depth>0 || !tl_active) return;
+  tl_ev.t1 = QMP_time();
+  unsigned long i = __atomic_fetch_add(&ring_next, 1, __ATOMIC_RELAXED);
+  ring[i&(ring_size-1)] = tl_ev;
+  tl_active = 0;
+}
+
+void
+QMP_trace_args(long bytes, int peer, int axis, int dir, int handle)
+{
+  if(!tl_active) return;
+  if(bytes>=0) tl_ev.bytes = bytes;
+  if(peer>=0) tl_ev.peer = peer;
+  if(axis>=0) {
+    tl_ev.axis = axis;
+    tl_ev.dir = dir;
+  }
+  if(handle>=0) tl_ev.handle = handle;
+}
+
+void
+QMP_trace_handle(QMP_msghandle_t mh)
+{
+  if(!tl_active) return;
+  if(mh->type==MH_multiple) {
+    long bytes = 0;
+    QMP_msghandle_t c;
+    for(c=mh->next; c; c=c->next) bytes += c->mm->nbytes;
+    QMP_trace_args(bytes, -1, -1, 0, mh->id);
+  } else {
+    int peer = (mh->type==MH_send) ? mh->dest_node : mh->srce_node;
+    QMP_trace_args(mh->mm->nbytes, peer, mh->axis, mh->dir, mh->id);
+  }
+}
+
+/* write the events in order of completion and free the buffer */
+void
+QMP_trace_finalize(void)
+{
+  if(!QMP_trace_on) return;
+  QMP_trace_on = 0;
+
+  int rank = QMP_machine->mnodeid;
+  char fn[1024];
+  snprintf(fn, sizeof(fn), "%s.%d.json", file_prefix, rank);
+  FILE *f = fopen(fn, "w");
+  if(f) {
+    unsigned long i, n = ring_next;
+    unsigned long first = (n>ring_size) ? n-ring_size : 0;
+    const char *sep = "";
+    fprintf(f, "{\"traceEvents\":[\n");
+    for(i=first; i<n; i++) {
+      struct trace_event *e = &ring[i&(ring_size-1)];
+      fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+	      "\"ts\":%.3f,\"dur\":%.3f,\"args\":{", sep, e->name, rank, e->tid,
+	      1e6*(e->t0-t_start), 1e6*(e->t1-e->t0));
+      const char *s = "";
+      if(e->bytes>=0) { fprintf(f, "\"bytes\":%ld", e->bytes); s = ","; }
+      if(e->peer>=0) { fprintf(f, "%s\"peer\":%d", s, e->peer); s = ","; }
+      if(e->axis>=0) {
+	fprintf(f, "%s\"axis\":%d,\"dir\":%d", s, e->axis, e->dir);
+	s = ",";
+      }
+      if(e->handle>=0) fprintf(f, "%s\"handle\":%d", s, e->handle);
+      fprintf(f, "}}");
+      sep = ",\n";
+    }
+    fprintf(f, "\n],\"otherData\":{\"rank\":%d,\"dropped\":%lu}}\n",
+	    rank, first);
+    fclose(f);
+  } else {
+    QMP_error("cannot write trace file %s", fn);
+  }
+  QMP_free(ring);
+  ring = NULL;
+}
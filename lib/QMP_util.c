@@ -46,12 +46,17 @@ void
 QMP_reset_total_qmp_time(void)
 {
   QMP_machine->total_qmp_time = 0.0;
+  QMP_timer_reset();
 }
 
 double 
 QMP_get_total_qmp_time(void)
 {
+#ifdef QMP_BUILD_TIMING
+  return QMP_timer_thread_total();
+#else
   return QMP_machine->total_qmp_time;
+#endif
 }
 
 /**
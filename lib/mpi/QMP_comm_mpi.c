@@ -4,6 +4,7 @@
 #include <sys/time.h>
 #include <assert.h>
 
+#define QMP_TIMER_CAT QMP_TIMER_COLLECTIVE
 #include "QMP_P_COMMON.h"
 
 
@@ -58,16 +59,22 @@ QMP_wait_mpi(QMP_msghandle_t mh)
 {
   QMP_status_t status = QMP_SUCCESS;
 
-  int flag;
+  int flag = MPI_SUCCESS;
   if(mh->type==MH_multiple) {
-    /* MPI_Status status[mh->num]; */
-    MPI_Status *status;  QMP_alloc(status, MPI_Status, mh->num);
-    flag = MPI_Waitall(mh->num, mh->request_array, status);
-    if (flag != MPI_SUCCESS) {
-      QMP_fprintf (stderr, "Wait all Flag is %d\n", flag);
-      QMP_FATAL("test unexpectedly failed");
+    /* complete the messages one by one to time each of them */
+    int n = mh->num, ndone = 0, nout, i, index[n];
+    while(ndone<n) {
+      flag = MPI_Waitsome(n, mh->request_array, &nout, index,
+			  MPI_STATUSES_IGNORE);
+      if (flag != MPI_SUCCESS) {
+	QMP_fprintf (stderr, "Wait some Flag is %d\n", flag);
+	QMP_FATAL("test unexpectedly failed");
+      }
+      if (nout == MPI_UNDEFINED) break;
+      double t = MPI_Wtime();
+      for(i=0; i<nout; i++) mh->child_array[index[i]]->t_done = t;
+      ndone += nout;
     }
-    QMP_free(status);
   } else {
     MPI_Status status;
     flag = MPI_Wait(&mh->request, &status);
@@ -200,7 +207,7 @@ QMP_comm_sum_long_double_array_mpi(QMP_comm_t comm, long double value[], int cou
   long double *dest;
   QMP_alloc(dest, long double, count);
   int err = MPI_Allreduce((void *)value, (void *)dest, count,
-			  MPI_DOUBLE, MPI_SUM, comm->mpicomm);
+			  MPI_LONG_DOUBLE, MPI_SUM, comm->mpicomm);
   if(err != MPI_SUCCESS) status = (QMP_status_t)err;
   else {
     int i;
@@ -264,6 +271,28 @@ QMP_comm_xor_ulong_mpi(QMP_comm_t comm, unsigned long *value)
   return status;
 }
 
+QMP_status_t
+QMP_comm_allreduce_mpi(QMP_comm_t comm, void *value, int count,
+		       QMP_datatype_t type, QMP_op_t op)
+{
+  static MPI_Datatype const types[QMP_TYPE_N] = {
+    MPI_INT, MPI_UNSIGNED, MPI_LONG, MPI_UNSIGNED_LONG,
+    MPI_INT64_T, MPI_UINT64_T, MPI_FLOAT, MPI_DOUBLE, MPI_LONG_DOUBLE
+  };
+  static MPI_Op const ops[QMP_OP_N] = {
+    MPI_SUM, MPI_PROD, MPI_MAX, MPI_MIN, MPI_BAND, MPI_BOR, MPI_BXOR
+  };
+  QMP_status_t status = QMP_SUCCESS;
+  ENTER;
+
+  int err = MPI_Allreduce(MPI_IN_PLACE, value, count, types[type], ops[op],
+			  comm->mpicomm);
+  if(err != MPI_SUCCESS) status = (QMP_status_t)err;
+
+  LEAVE;
+  return status;
+}
+
 //does global transposition from sendbuffer to recvbuffer of count data (in BYTE). be careful with 2GB limits
 QMP_status_t
 QMP_comm_alltoall_mpi(QMP_comm_t comm, char* recvbuffer, char* sendbuffer, int count)
@@ -316,6 +345,7 @@ QMP_comm_binary_reduction_mpi(QMP_comm_t comm, void *lbuffer, size_t count, QMP_
     err = MPI_Op_create(qmp_bfunc_mpi, 1, &bop);
     if (err != MPI_SUCCESS) {
       QMP_error ("Cannot create MPI operator for binary reduction.\n");
+      status = (QMP_status_t)err;
       goto leave;
     }
     op_inited = 1;
@@ -324,19 +354,22 @@ QMP_comm_binary_reduction_mpi(QMP_comm_t comm, void *lbuffer, size_t count, QMP_
   char *rbuffer;
   QMP_alloc(rbuffer, char, count);
 
-  err = MPI_Allreduce(lbuffer,rbuffer,count, MPI_BYTE, bop, comm->mpicomm);
+  /* the user function has no length, so the buffer is one element
+     that MPI cannot split between the steps of the reduction */
+  MPI_Datatype type;
+  MPI_Type_contiguous((int)count, MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+  err = MPI_Allreduce(lbuffer,rbuffer,1, type, bop, comm->mpicomm);
+  MPI_Type_free(&type);
 
   if(err != MPI_SUCCESS) status = (QMP_status_t)err;
-  else {
-    memcpy (lbuffer, rbuffer, count);
-    QMP_free(rbuffer);
-  }
+  else memcpy (lbuffer, rbuffer, count);
+  QMP_free(rbuffer);
 
+ leave:
   /* signal end of the binary reduction session */
   qmp_user_bfunc = NULL;
 
-  return status;
- leave:
   LEAVE;
-  return QMP_SUCCESS;
+  return status;
 }
@@ -6,6 +6,8 @@
 
 #include "QMP_P_COMMON.h"
 
+/* ranks sharing this rank's physical node */
+MPI_Comm QMP_node_mpicomm = MPI_COMM_NULL;
 
 QMP_status_t
 QMP_init_machine_mpi (int* argc, char*** argv, QMP_thread_level_t required,
@@ -86,6 +88,42 @@ QMP_init_machine_mpi (int* argc, char*** argv, QMP_thread_level_t required,
   QMP_alloc(QMP_machine->host, char, MPI_MAX_PROCESSOR_NAME);
   MPI_Get_processor_name(QMP_machine->host, &QMP_machine->hostlen);
 
+  /* ranks per physical node, used when laying out the grid */
+  QMP_node_map_t *nm = &QMP_machine->nodemap;
+  if (MPI_Comm_split_type(*mcomm, MPI_COMM_TYPE_SHARED, PAR_node_rank,
+			  MPI_INFO_NULL, &QMP_node_mpicomm) == MPI_SUCCESS) {
+    int ppn[2];
+    MPI_Comm_size(QMP_node_mpicomm, &nm->local_size);
+    MPI_Comm_rank(QMP_node_mpicomm, &nm->local_rank);
+    ppn[0] = nm->local_size;
+    ppn[1] = -ppn[0];
+    MPI_Allreduce(MPI_IN_PLACE, ppn, 2, MPI_INT, MPI_MIN, *mcomm);
+    if (ppn[0] == -ppn[1]) QMP_machine->ranks_per_node = ppn[0];
+
+    /* number the nodes by their first rank */
+    MPI_Comm leaders;
+    int host[2] = { 0, 1 };
+    MPI_Comm_split(*mcomm, (nm->local_rank==0) ? 0 : MPI_UNDEFINED,
+		   PAR_node_rank, &leaders);
+    if (leaders != MPI_COMM_NULL) {
+      MPI_Comm_rank(leaders, &host[0]);
+      MPI_Comm_size(leaders, &host[1]);
+      MPI_Comm_free(&leaders);
+    }
+    MPI_Bcast(host, 2, MPI_INT, 0, QMP_node_mpicomm);
+    nm->host_id = host[0];
+    nm->num_hosts = host[1];
+
+    nm->socket_id = QMP_get_socket_id();
+    MPI_Allreduce(&nm->socket_id, &nm->num_sockets, 1, MPI_INT, MPI_MAX,
+		  QMP_node_mpicomm);
+    nm->num_sockets++;
+    if (nm->num_sockets < 1) nm->num_sockets = 1;
+  } else {
+    nm->num_hosts = PAR_num_nodes;
+    nm->host_id = PAR_node_rank;
+  }
+
   return QMP_SUCCESS;
 }
 
@@ -97,6 +135,7 @@ QMP_finalize_msg_passing_mpi (void)
   MPI_Finalized(&flag);
 
   if (!flag) {
+    if (QMP_node_mpicomm != MPI_COMM_NULL) MPI_Comm_free(&QMP_node_mpicomm);
     MPI_Finalize();
   }
 }
@@ -5,6 +5,49 @@
 #include "QMP_P_COMMON.h"
 
 
+QMP_status_t
+QMP_alloc_comms_mpi(QMP_mem_t *mem)
+{
+  int err = MPI_Alloc_mem((MPI_Aint)mem->nbytes, MPI_INFO_NULL,
+			  &mem->allocated_ptr);
+  return (err==MPI_SUCCESS) ? QMP_SUCCESS : QMP_NOMEM_ERR;
+}
+
+void
+QMP_free_comms_mpi(QMP_mem_t *mem)
+{
+  MPI_Free_mem(mem->allocated_ptr);
+}
+
+/* collective over the ranks of the physical node */
+QMP_status_t
+QMP_alloc_shared_mpi(QMP_mem_t *mem)
+{
+  if(QMP_node_mpicomm==MPI_COMM_NULL) return QMP_NOMEM_ERR;
+  int err = MPI_Win_allocate_shared((MPI_Aint)mem->nbytes, 1, MPI_INFO_NULL,
+				    QMP_node_mpicomm, &mem->allocated_ptr,
+				    &mem->win);
+  return (err==MPI_SUCCESS) ? QMP_SUCCESS : QMP_NOMEM_ERR;
+}
+
+void
+QMP_free_shared_mpi(QMP_mem_t *mem)
+{
+  MPI_Win_free(&mem->win);
+}
+
+void *
+QMP_shared_query_mpi(QMP_mem_t *mem, int local_rank)
+{
+  MPI_Aint size;
+  int disp_unit;
+  void *base = NULL;
+  if(MPI_Win_shared_query(mem->win, local_rank, &size, &disp_unit, &base)
+     != MPI_SUCCESS) base = NULL;
+  return base;
+}
+
+
 void
 QMP_declare_msgmem_mpi(QMP_msgmem_t mem)
 {
@@ -73,6 +116,7 @@ QMP_declare_msgmem_mpi(QMP_msgmem_t mem)
   } break;
 
   }
+  if(mem->type!=MM_user_buf) QMP_mem_account(QMP_MEMCAT_DATATYPE, 0, 0, 1);
 }
 
 
@@ -84,6 +128,7 @@ QMP_free_msgmem_mpi(QMP_msgmem_t mm)
        (mm->type == MM_indexed_buf) ) {
     int err = MPI_Type_free(&(mm->mpi_type));
     QMP_assert(err==MPI_SUCCESS);
+    QMP_mem_account(QMP_MEMCAT_DATATYPE, 0, 0, -1);
   }
 }
 
@@ -100,6 +145,7 @@ QMP_free_msghandle_mpi(QMP_msghandle_t mh)
 {
   if(mh->type==MH_multiple) {
     QMP_free(mh->request_array);
+    QMP_free(mh->child_array);
   } else {
     int err = MPI_Request_free(&mh->request);
     QMP_assert(err==MPI_SUCCESS);
@@ -107,6 +153,16 @@ QMP_free_msghandle_mpi(QMP_msghandle_t mh)
 }
 
 
+/* unique tag for each displacement, QMP_MAX_DISPLACED_CODE keeps it
+   below any MPI_TAG_UB */
+static int
+displaced_tag(QMP_msghandle_t mh)
+{
+  QMP_assert(mh->disp <= QMP_MAX_DISPLACED_CODE);
+  return TAG_DISPLACED + mh->disp;
+}
+
+
 void
 QMP_declare_receive_mpi(QMP_msghandle_t mh)
 {
@@ -116,6 +172,7 @@ QMP_declare_receive_mpi(QMP_msghandle_t mh)
     if (mh->dir >0) tag ++;
     else        tag --;
   }
+  if (mh->disp >= 0) tag = displaced_tag(mh);
   QMP_assert (tag>=0);
   if(mh->mm->type==MM_user_buf) {
     MPI_Recv_init(mh->base, mh->mm->nbytes,
@@ -139,6 +196,7 @@ QMP_declare_send_mpi(QMP_msghandle_t mh)
     if (mh->dir >0) tag --; /* should be reversed from receive tag */
     else        tag ++;
   }
+  if (mh->disp >= 0) tag = displaced_tag(mh);
   QMP_assert (tag>=0);
   if(mh->mm->type==MM_user_buf) {
     MPI_Send_init(mh->base, mh->mm->nbytes,
@@ -158,12 +216,14 @@ QMP_declare_send_mpi(QMP_msghandle_t mh)
 void
 QMP_declare_multiple_mpi(QMP_msghandle_t mh)
 {
-  QMP_alloc(mh->request_array, MPI_Request, mh->num);
+  QMP_alloc_cat(mh->request_array, MPI_Request, mh->num, QMP_MEMCAT_MSGHANDLE);
+  QMP_alloc_cat(mh->child_array, QMP_msghandle_t, mh->num, QMP_MEMCAT_MSGHANDLE);
 
   QMP_msghandle_t mhc = mh->next;
   int i=0;
   while(mhc) {
     mh->request_array[i] = mhc->request;
+    mh->child_array[i] = mhc;
     i++;
     mhc = mhc->next;
   }
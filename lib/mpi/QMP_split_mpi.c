@@ -21,11 +21,79 @@ QMP_comm_split_mpi(QMP_comm_t comm, QMP_comm_t newcomm)
   return status;
 }
 
+QMP_status_t
+QMP_comm_dup_mpi(QMP_comm_t comm, QMP_comm_t newcomm)
+{
+  QMP_status_t status = QMP_SUCCESS;
+
+  int err = MPI_Comm_dup(comm->mpicomm, &newcomm->mpicomm);
+  if(err!=MPI_SUCCESS) status = (QMP_status_t)err;
+  newcomm->num_nodes = comm->num_nodes;
+  newcomm->nodeid = comm->nodeid;
+
+  return status;
+}
+
+/* newcomm uses the MPI communicator of comm, which still owns it */
+QMP_status_t
+QMP_comm_share_mpi(QMP_comm_t comm, QMP_comm_t newcomm)
+{
+  QMP_comm_complete_mpi(comm);
+  newcomm->mpicomm = comm->mpicomm;
+  newcomm->num_nodes = comm->num_nodes;
+  newcomm->nodeid = comm->nodeid;
+
+  return QMP_SUCCESS;
+}
+
+/* start duplicating a communicator, completed by QMP_comm_complete_mpi */
+QMP_status_t
+QMP_comm_idup_mpi(QMP_comm_t comm, QMP_comm_t newcomm)
+{
+  QMP_status_t status = QMP_SUCCESS;
+
+#if MPI_VERSION >= 3
+  int err = MPI_Comm_idup(comm->mpicomm, &newcomm->mpicomm, &newcomm->pending);
+#else
+  int err = MPI_Comm_dup(comm->mpicomm, &newcomm->mpicomm);
+#endif
+  if(err!=MPI_SUCCESS) status = (QMP_status_t)err;
+  newcomm->num_nodes = comm->num_nodes;
+  newcomm->nodeid = comm->nodeid;
+
+  return status;
+}
+
+void
+QMP_comm_complete_mpi(QMP_comm_t comm)
+{
+  if(comm->pending!=MPI_REQUEST_NULL)
+    MPI_Wait(&comm->pending, MPI_STATUS_IGNORE);
+}
+
+/* rank in the allocated communicator of node of comm */
+int
+QMP_comm_allocated_rank_mpi(QMP_comm_t comm, int node)
+{
+  MPI_Group group, allocated;
+  int rank;
+
+  QMP_comm_complete_mpi(comm);
+  MPI_Comm_group(comm->mpicomm, &group);
+  MPI_Comm_group(QMP_allocated_comm->mpicomm, &allocated);
+  MPI_Group_translate_ranks(group, 1, &node, allocated, &rank);
+  MPI_Group_free(&group);
+  MPI_Group_free(&allocated);
+
+  return rank;
+}
+
 QMP_status_t
 QMP_comm_free_mpi(QMP_comm_t comm)
 {
   QMP_status_t status = QMP_SUCCESS;
 
+  QMP_comm_complete_mpi(comm);
   int err = MPI_Comm_free(&comm->mpicomm);
   if(err!=MPI_SUCCESS) status = (QMP_status_t)err;
 
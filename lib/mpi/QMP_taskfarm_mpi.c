@@ -0,0 +1,34 @@
+#include "QMP_P_COMMON.h"
+
+/* the task counter lives in a window on node 0 of the allocated comm */
+void
+QMP_taskfarm_create_mpi(QMP_taskfarm_t tf)
+{
+  MPI_Comm comm = QMP_allocated_comm->mpicomm;
+  MPI_Aint size = (QMP_allocated_comm->nodeid==0) ? sizeof(int) : 0;
+  int err = MPI_Win_allocate(size, sizeof(int), MPI_INFO_NULL, comm,
+			     &tf->win_base, &tf->win);
+  QMP_assert(err==MPI_SUCCESS);
+  if(QMP_allocated_comm->nodeid==0) {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, tf->win);
+    *tf->win_base = 0;
+    MPI_Win_unlock(0, tf->win);
+  }
+  MPI_Barrier(comm);
+}
+
+int
+QMP_taskfarm_fetch_mpi(QMP_taskfarm_t tf)
+{
+  int one = 1, task;
+  MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, tf->win);
+  MPI_Fetch_and_op(&one, &task, MPI_INT, 0, 0, MPI_SUM, tf->win);
+  MPI_Win_unlock(0, tf->win);
+  return task;
+}
+
+void
+QMP_taskfarm_free_mpi(QMP_taskfarm_t tf)
+{
+  MPI_Win_free(&tf->win);
+}
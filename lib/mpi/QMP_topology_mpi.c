@@ -61,6 +61,32 @@ get_rank(const int *x, int *l, int *p, int nd)
   return n;
 }
 
+/* same for power of two extents, b = log2 of the extents */
+static void
+get_coord_pow2(int *x, int n, int *b, int *p, int nd)
+{
+  int i;
+  for(i=0; i<nd; i++) {
+    int k;
+    if(p) k = p[i]; else k = i;
+    x[k] = n & ((1<<b[k])-1);
+    n >>= b[k];
+  }
+}
+
+static int
+get_rank_pow2(const int *x, int *b, int *p, int nd)
+{
+  int i, n;
+  n = 0;
+  for(i=nd-1; i>=0; i--) {
+    int k;
+    if(p) k = p[i]; else k = i;
+    n = (n<<b[k]) | x[k];
+  }
+  return n;
+}
+
 QMP_status_t
 QMP_set_topo_mpi(QMP_comm_t comm)
 {
@@ -74,7 +100,9 @@ QMP_comm_get_logical_coordinates_from_mpi(int *c, int nd, QMP_comm_t comm, int n
 {
   //int cart_node = w2c[node];
   //MPI_Cart_coords(comm_cart, cart_node, nd, nc);
-  get_coord(c, node, comm->topo->logical_size, comm->topo->map, nd);
+  QMP_logical_topology_t *topo = comm->topo;
+  if(topo->log_size) get_coord_pow2(c, node, topo->log_size, topo->map, nd);
+  else get_coord(c, node, topo->logical_size, topo->map, nd);
 }
 
 int 
@@ -84,6 +112,15 @@ QMP_comm_get_node_number_from_mpi(QMP_comm_t comm, const int* coords)
   //MPI_Cart_rank(comm_cart, (int *)coordinates, &cart_node);
   //world_node = c2w[cart_node];
   int n;
-  n = get_rank(coords, comm->topo->logical_size, comm->topo->map, comm->topo->dimension);
+  QMP_logical_topology_t *topo = comm->topo;
+  if(topo->log_size) n = get_rank_pow2(coords, topo->log_size, topo->map, topo->dimension);
+  else n = get_rank(coords, topo->logical_size, topo->map, topo->dimension);
   return n;
 }
+
+void
+QMP_comm_get_host_ids_mpi(QMP_comm_t comm, int *ids)
+{
+  MPI_Allgather(&QMP_machine->nodemap.host_id, 1, MPI_INT, ids, 1, MPI_INT,
+		comm->mpicomm);
+}